@@ -0,0 +1,462 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Audio Mixer
+//
+// AudioMixer.cpp: implementation of the AudioMixer class.
+// See AudioMixer.h for how it works.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "AudioMixer.h"
+#include "AudioStream.h"
+
+#include <chrono>
+#include <emmintrin.h>	// SSE2
+#include <string.h>
+
+static const unsigned long long ONE = 1ULL << 32;	// A frame, in 32.32 fixed point
+
+//////////////////////////////////////////////////////////////////////
+// Adding a voice into the bus
+//////////////////////////////////////////////////////////////////////
+
+// Frame for frame, a mono clip into both sides
+static void AddMono(const float *src, float gain, float *dst, int frames)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	int i = 0;
+	for (; i + 4 <= frames; i += 4)
+	{
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+		_mm_storeu_ps(dst + i * 2, _mm_add_ps(_mm_loadu_ps(dst + i * 2), _mm_unpacklo_ps(v, v)));
+		_mm_storeu_ps(dst + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(dst + i * 2 + 4), _mm_unpackhi_ps(v, v)));
+	}
+	for (; i < frames; i++)
+	{
+		dst[i * 2] += src[i] * gain;
+		dst[i * 2 + 1] += src[i] * gain;
+	}
+}
+
+// Frame for frame, a stereo clip
+static void AddStereo(const float *src, float gain, float *dst, int frames)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	int count = frames * 2;
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+	for (; i < count; i++)
+		dst[i] += src[i] * gain;
+}
+
+// The top 24 bits of four positions' fractions, as 0 to 1
+static inline __m128 Fractions(unsigned long long p0, unsigned long long p1, unsigned long long p2, unsigned long long p3)
+{
+	__m128i bits = _mm_setr_epi32((int)((unsigned int)p0 >> 8), (int)((unsigned int)p1 >> 8), (int)((unsigned int)p2 >> 8), (int)((unsigned int)p3 >> 8));
+	return _mm_mul_ps(_mm_cvtepi32_ps(bits), _mm_set1_ps(1.0f / 16777216.0f));
+}
+
+// A mono clip at another rate, every frame blended from the two samples around it (which must both be in the clip)
+static void AddMonoResampled(const float *src, unsigned long long position, unsigned long long step, float gain, float *dst, int frames)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	int i = 0;
+	for (; i + 4 <= frames; i += 4)
+	{
+		unsigned long long p0 = position;
+		unsigned long long p1 = p0 + step;
+		unsigned long long p2 = p1 + step;
+		unsigned long long p3 = p2 + step;
+		position = p3 + step;
+
+		const float *a0 = src + (p0 >> 32);
+		const float *a1 = src + (p1 >> 32);
+		const float *a2 = src + (p2 >> 32);
+		const float *a3 = src + (p3 >> 32);
+		__m128 s0 = _mm_setr_ps(a0[0], a1[0], a2[0], a3[0]);
+		__m128 s1 = _mm_setr_ps(a0[1], a1[1], a2[1], a3[1]);
+		__m128 t = Fractions(p0, p1, p2, p3);
+		__m128 v = _mm_mul_ps(_mm_add_ps(s0, _mm_mul_ps(_mm_sub_ps(s1, s0), t)), g);
+
+		_mm_storeu_ps(dst + i * 2, _mm_add_ps(_mm_loadu_ps(dst + i * 2), _mm_unpacklo_ps(v, v)));
+		_mm_storeu_ps(dst + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(dst + i * 2 + 4), _mm_unpackhi_ps(v, v)));
+	}
+	for (; i < frames; i++)
+	{
+		const float *a = src + (position >> 32);
+		float t = (float)((unsigned int)position >> 8) * (1.0f / 16777216.0f);
+		float v = (a[0] + (a[1] - a[0]) * t) * gain;
+		dst[i * 2] += v;
+		dst[i * 2 + 1] += v;
+		position += step;
+	}
+}
+
+// A stereo clip at another rate
+static void AddStereoResampled(const float *src, unsigned long long position, unsigned long long step, float gain, float *dst, int frames)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	int i = 0;
+	for (; i + 4 <= frames; i += 4)
+	{
+		unsigned long long p0 = position;
+		unsigned long long p1 = p0 + step;
+		unsigned long long p2 = p1 + step;
+		unsigned long long p3 = p2 + step;
+		position = p3 + step;
+
+		const float *a0 = src + (p0 >> 32) * 2;
+		const float *a1 = src + (p1 >> 32) * 2;
+		const float *a2 = src + (p2 >> 32) * 2;
+		const float *a3 = src + (p3 >> 32) * 2;
+		__m128 left0 = _mm_setr_ps(a0[0], a1[0], a2[0], a3[0]);
+		__m128 right0 = _mm_setr_ps(a0[1], a1[1], a2[1], a3[1]);
+		__m128 left1 = _mm_setr_ps(a0[2], a1[2], a2[2], a3[2]);
+		__m128 right1 = _mm_setr_ps(a0[3], a1[3], a2[3], a3[3]);
+		__m128 t = Fractions(p0, p1, p2, p3);
+		__m128 left = _mm_mul_ps(_mm_add_ps(left0, _mm_mul_ps(_mm_sub_ps(left1, left0), t)), g);
+		__m128 right = _mm_mul_ps(_mm_add_ps(right0, _mm_mul_ps(_mm_sub_ps(right1, right0), t)), g);
+
+		_mm_storeu_ps(dst + i * 2, _mm_add_ps(_mm_loadu_ps(dst + i * 2), _mm_unpacklo_ps(left, right)));
+		_mm_storeu_ps(dst + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(dst + i * 2 + 4), _mm_unpackhi_ps(left, right)));
+	}
+	for (; i < frames; i++)
+	{
+		const float *a = src + (position >> 32) * 2;
+		float t = (float)((unsigned int)position >> 8) * (1.0f / 16777216.0f);
+		dst[i * 2] += (a[0] + (a[2] - a[0]) * t) * gain;
+		dst[i * 2 + 1] += (a[1] + (a[3] - a[1]) * t) * gain;
+		position += step;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+AudioMixer::AudioMixer(int rate)
+{
+	this->rate = rate;
+	plays = 0;
+	gain = 1;
+	memset(&stats, 0, sizeof(stats));
+	memset(voices, 0, sizeof(voices));
+	bus.resize(BLOCK_FRAMES * 2);
+}
+
+AudioMixer::~AudioMixer()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+// Voices
+//////////////////////////////////////////////////////////////////////
+
+int AudioMixer::Rate() const
+{
+	return rate;
+}
+
+int AudioMixer::TakeVoice()
+{
+	// A free voice, or else the one that started longest ago
+	int chosen = -1;
+	for (int i = 0; i < MAX_VOICES && chosen < 0; i++)
+	{
+		if (!voices[i].clip && !voices[i].stream)
+			chosen = i;
+	}
+	if (chosen < 0)
+	{
+		for (int i = 0; i < MAX_VOICES; i++)
+		{
+			if (!voices[i].loop && (chosen < 0 || voices[i].started < voices[chosen].started))
+				chosen = i;
+		}
+		if (chosen < 0)
+			return -1;
+		stats.stolen++;
+	}
+	return chosen;
+}
+
+int AudioMixer::Play(const Clip *clip, float volume, bool loop)
+{
+	if (!clip || clip->frames <= 0 || clip->rate <= 0 || (clip->channels != 1 && clip->channels != 2))
+		return -1;
+
+	int chosen = TakeVoice();
+	if (chosen < 0)
+		return -1;
+
+	Voice &voice = voices[chosen];
+	voice.clip = clip;
+	voice.stream = 0;
+	voice.position = 0;
+	voice.step = ((unsigned long long)clip->rate << 32) / rate;
+	voice.volume = volume;
+	voice.loop = loop;
+	voice.started = ++plays;
+	return chosen;
+}
+
+int AudioMixer::Play(AudioStream *stream, float volume)
+{
+	// The voice reads at most a block's worth of frames at a time from it
+	const AudioStream::Format &format = stream->GetFormat();
+	unsigned long long step = format.rate > 0 ? ((unsigned long long)format.rate << 32) / rate : 0;
+	if (step == 0 || step * BLOCK_FRAMES >= (unsigned long long)(AudioStream::WINDOW - 2) << 32)
+		return -1;
+
+	int chosen = TakeVoice();
+	if (chosen < 0)
+		return -1;
+
+	Voice &voice = voices[chosen];
+	voice.clip = 0;
+	voice.stream = stream;
+	voice.position = 0;
+	voice.step = step;
+	voice.volume = volume;
+	voice.loop = stream->Looping();
+	voice.started = ++plays;
+	return chosen;
+}
+
+bool AudioMixer::IsPlaying(const AudioStream *stream) const
+{
+	for (int i = 0; i < MAX_VOICES; i++)
+	{
+		if (voices[i].stream == stream)
+			return true;
+	}
+	return false;
+}
+
+void AudioMixer::Stop(int voice)
+{
+	if (voice >= 0 && voice < MAX_VOICES)
+	{
+		voices[voice].clip = 0;
+		voices[voice].stream = 0;
+	}
+}
+
+void AudioMixer::StopAll()
+{
+	for (int i = 0; i < MAX_VOICES; i++)
+		Stop(i);
+}
+
+int AudioMixer::Playing() const
+{
+	int playing = 0;
+	for (int i = 0; i < MAX_VOICES; i++)
+	{
+		if (voices[i].clip || voices[i].stream)
+			playing++;
+	}
+	return playing;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Mixing
+//////////////////////////////////////////////////////////////////////
+
+void AudioMixer::MixVoice(Voice &voice, float *bus, int frames)
+{
+	const Clip &clip = *voice.clip;
+	const float *src = &clip.samples[0];
+	unsigned long long end = (unsigned long long)clip.frames << 32;
+	unsigned long long last = end - ONE;	// The last frame, which has no sample after it to blend with
+	int done = 0;
+
+	while (done < frames)
+	{
+		if (voice.position >= end)
+		{
+			if (!voice.loop)
+			{
+				voice.clip = 0;
+				return;
+			}
+			voice.position %= end;
+			continue;
+		}
+
+		float *dst = bus + done * 2;
+		int n = frames - done;
+		if (voice.step == ONE && (voice.position & (ONE - 1)) == 0)
+		{
+			// At the output rate: nothing to blend, up to the end of the clip
+			int index = (int)(voice.position >> 32);
+			if (n > clip.frames - index)
+				n = clip.frames - index;
+			if (clip.channels == 1)
+				AddMono(src + index, voice.volume, dst, n);
+			else
+				AddStereo(src + index * 2, voice.volume, dst, n);
+			voice.position += (unsigned long long)n << 32;
+		}
+		else if (voice.position < last)
+		{
+			// Up to the last frame
+			unsigned long long fit = (last - voice.position + voice.step - 1) / voice.step;
+			if ((unsigned long long)n > fit)
+				n = (int)fit;
+			if (clip.channels == 1)
+				AddMonoResampled(src, voice.position, voice.step, voice.volume, dst, n);
+			else
+				AddStereoResampled(src, voice.position, voice.step, voice.volume, dst, n);
+			voice.position += voice.step * n;
+		}
+		else
+		{
+			// Past the last frame it blends into the first one again, or into silence
+			const float *a = src + (clip.frames - 1) * clip.channels;
+			float t = (float)((unsigned int)voice.position >> 8) * (1.0f / 16777216.0f);
+			for (int c = 0; c < 2; c++)
+			{
+				int channel = clip.channels == 1 ? 0 : c;
+				float next = voice.loop ? src[channel] : 0;
+				dst[c] += (a[channel] + (next - a[channel]) * t) * voice.volume;
+			}
+			voice.position += voice.step;
+			n = 1;
+		}
+		done += n;
+	}
+}
+
+void AudioMixer::MixStream(Voice &voice, float *bus, int frames)
+{
+	AudioStream &stream = *voice.stream;
+	int channels = stream.GetFormat().channels;
+
+	// The frames the block blends from: up to the one after the last output frame's (Play() made sure they fit the window)
+	bool ended = stream.Ended();
+	int needed = (int)((voice.position + voice.step * (frames - 1)) >> 32) + 2;
+	int available;
+	const float *src = stream.Peek(needed, available);
+
+	// Short of them: as many output frames as there are frames for, the rest is silent
+	if (available < needed)
+	{
+		unsigned long long last = available > 1 ? (unsigned long long)(available - 1) << 32 : 0;
+		frames = last > voice.position ? (int)((last - voice.position + voice.step - 1) / voice.step) : 0;
+		if (frames == 0)
+		{
+			// All that's left of a finished stream is the silent frame after the end
+			if (ended)
+				voice.stream = 0;
+			return;
+		}
+	}
+
+	if (voice.step == ONE && voice.position == 0)
+	{
+		if (channels == 1)
+			AddMono(src, voice.volume, bus, frames);
+		else
+			AddStereo(src, voice.volume, bus, frames);
+	}
+	else if (channels == 1)
+		AddMonoResampled(src, voice.position, voice.step, voice.volume, bus, frames);
+	else
+		AddStereoResampled(src, voice.position, voice.step, voice.volume, bus, frames);
+
+	// The frames behind the next position go back to the stream
+	unsigned long long end = voice.position + voice.step * frames;
+	stream.Advance((int)(end >> 32));
+	voice.position = end & (ONE - 1);
+}
+
+void AudioMixer::Output(const float *bus, short *out, int frames)
+{
+	int count = frames * 2;
+
+	// The loudest sample in the block
+	const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peaks = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+		peaks = _mm_max_ps(peaks, _mm_and_ps(_mm_loadu_ps(bus + i), magnitude));
+	float lanes[4];
+	_mm_storeu_ps(lanes, peaks);
+	float peak = lanes[0];
+	for (int lane = 1; lane < 4; lane++)
+		peak = lanes[lane] > peak ? lanes[lane] : peak;
+	for (; i < count; i++)
+	{
+		float sample = bus[i] < 0 ? -bus[i] : bus[i];
+		peak = sample > peak ? sample : peak;
+	}
+
+	// Down at once if it would go over, back up over a tenth of a second otherwise
+	float target = peak > 1 ? 1 / peak : 1;
+	float from = gain;
+	if (target < gain)
+	{
+		from = target;
+		gain = target;
+	}
+	else
+	{
+		float release = (float)frames / (rate * 0.1f);
+		gain += (target - gain) * (release < 1 ? release : 1);
+	}
+	if (from < 1)
+		stats.limited++;
+
+	// Two frames per vector, the gain going from one to the other across the block
+	float slope = (gain - from) / frames;
+	__m128 scale = _mm_mul_ps(_mm_setr_ps(from, from, from + slope, from + slope), _mm_set1_ps(32767.0f));
+	const __m128 slope2 = _mm_set1_ps(slope * 2 * 32767.0f);
+	i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(bus + i), scale));
+		scale = _mm_add_ps(scale, slope2);
+		__m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(bus + i + 4), scale));
+		scale = _mm_add_ps(scale, slope2);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+	}
+	for (; i < count; i++)
+	{
+		float sample = bus[i] * (from + slope * (i / 2)) * 32767.0f;
+		out[i] = (short)(sample > 32767 ? 32767 : (sample < -32768 ? -32768 : (sample < 0 ? sample - 0.5f : sample + 0.5f)));
+	}
+}
+
+void AudioMixer::Mix(short *out, int frames)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	while (frames > 0)
+	{
+		int n = frames < BLOCK_FRAMES ? frames : BLOCK_FRAMES;
+		memset(&bus[0], 0, n * 2 * sizeof(float));
+
+		int playing = 0;
+		for (int i = 0; i < MAX_VOICES; i++)
+		{
+			if (voices[i].stream)
+				MixStream(voices[i], &bus[0], n);
+			else if (voices[i].clip)
+				MixVoice(voices[i], &bus[0], n);
+			else
+				continue;
+			playing++;
+		}
+
+		Output(&bus[0], out, n);
+		stats.voices = playing;
+		stats.frames += n;
+		stats.voiceFrames += (long long)playing * n;
+		out += n * 2;
+		frames -= n;
+	}
+
+	stats.mixMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
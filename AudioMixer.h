@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Audio Mixer
+//
+// AudioMixer.h: interface for the AudioMixer class.
+// Every sound used to get an XAudio2 source voice of its own, so the
+// sound only worked on Windows and nothing about it could be run or
+// timed anywhere else. This class does the mixing itself, with no
+// API under it, and hands the result to an AudioSink (XAudio2, a
+// .wav file or nowhere):
+//
+// - A clip is a sound in memory, as floats (-1 to 1), mono or
+//   stereo, at whatever rate it was recorded at.
+// - Each playing voice reads its clip at a step of the clip's rate
+//   over the output rate, in 32.32 fixed point, and adds it into a
+//   stereo float bus, scaled by its volume. Four output frames are
+//   worked on at a time with SSE: the two samples around each one
+//   are picked out and blended linearly. A voice at the output rate
+//   skips the blending and just scales and adds.
+// - The bus is turned into 16 bit samples. A limiter turns the
+//   whole bus down at once when a block would go past full scale,
+//   and back up over about a tenth of a second, so loud moments
+//   get quieter instead of crackling. Anything still over is
+//   clamped by the saturating pack.
+// - A voice can play an AudioStream instead of a clip (the music,
+//   read from the file as it plays). It takes the frames the block
+//   needs from the stream's ring, blends them the same way and hands
+//   back the ones it's done with. If the stream hasn't read them yet
+//   the voice is silent for the rest of the block.
+//
+// Voices are a fixed pool. Play() takes a free one, or cuts short
+// the one that started longest ago (never a looping one), so it
+// allocates nothing, and Mix() doesn't either.
+//
+// Usage:
+// AudioMixer mixer(44100);
+//
+// AudioMixer::Clip clip;
+// clip.rate = 22050;
+// clip.channels = 1;
+// clip.frames = n;
+// clip.samples.assign(samples, samples + n);
+//
+// mixer.Play(&clip, 0.5f, false);			// The clip has to outlive the voice
+// mixer.Play(&stream, 0.3f);					// So does the stream
+// short out[512 * 2];
+// mixer.Mix(out, 512);						// 512 stereo frames
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+#include <vector>
+
+class AudioStream;
+
+class AudioMixer
+{
+public:
+	enum {
+		MAX_VOICES = 16,	// Voices in the pool
+		BLOCK_FRAMES = 512	// Frames mixed into the bus at a time
+	};
+
+	// A sound in memory
+	struct Clip {
+		int rate;			// Frames a second
+		int channels;		// 1 or 2
+		int frames;
+		std::vector<float> samples;	// frames * channels, interleaved
+	};
+
+	// What Mix() did since the mixer was made (voices: in the last call)
+	struct Stats {
+		int voices;			// Voices playing
+		int stolen;			// Voices cut short by Play()
+		int limited;		// Blocks the limiter turned down
+		long long frames;	// Frames mixed
+		long long voiceFrames;	// Frames mixed, times the voices playing in them
+		double mixMs;		// Time spent in Mix()
+	};
+
+	Stats stats;
+
+	int Rate() const;		// The output rate
+	int Play(const Clip *clip, float volume, bool loop);	// Starts a voice, which one (-1: the clip is empty or every voice is looping)
+	int Play(AudioStream *stream, float volume);	// Starts a voice on an open stream (which loops or not), which one (-1: none)
+	bool IsPlaying(const AudioStream *stream) const;	// True: a voice is still playing it
+	void Stop(int voice);
+	void StopAll();
+	int Playing() const;	// Voices playing
+	void Mix(short *out, int frames);	// The next frames of every voice, as interleaved stereo 16 bit samples
+
+	AudioMixer(int rate = 44100);	// Constructor
+	virtual ~AudioMixer();	// Destructor
+
+private:
+	struct Voice {
+		const Clip *clip;	// 0: free, unless it plays a stream
+		AudioStream *stream;
+		unsigned long long position;	// In the clip (or past the stream's next frame), in frames, 32.32 fixed point
+		unsigned long long step;		// Added a frame: the clip's rate over the output rate
+		float volume;
+		bool loop;
+		unsigned int started;	// Play() count when it started
+	};
+
+	int TakeVoice();		// A free voice, or the oldest one not looping, -1 if there's none
+	void MixVoice(Voice &voice, float *bus, int frames);	// Adds the voice into the bus, freeing it if it reaches the end
+	void MixStream(Voice &voice, float *bus, int frames);	// The same for a stream
+	void Output(const float *bus, short *out, int frames);	// The bus into 16 bit samples, through the limiter
+
+	int rate;
+	Voice voices[MAX_VOICES];
+	unsigned int plays;
+	float gain;				// The limiter's, 1 when it isn't turning anything down
+	std::vector<float> bus;	// BLOCK_FRAMES stereo frames
+
+	AudioMixer(const AudioMixer &);	// Not copyable
+	AudioMixer &operator=(const AudioMixer &);
+};
+
+#endif // AUDIOMIXER_H
@@ -0,0 +1,272 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Audio Sinks
+//
+// AudioSink.cpp: implementation of the AudioSink class and the sinks.
+// See AudioSink.h for what they do.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "AudioSink.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <xaudio2.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// AudioSink
+//////////////////////////////////////////////////////////////////////
+
+AudioSink::AudioSink()
+{
+	rate = 0;
+	taken = 0;
+	started = false;
+}
+
+AudioSink::~AudioSink()
+{
+}
+
+AudioSink *AudioSink::OpenDefault(int rate)
+{
+#ifdef _WIN32
+	AudioSink *sink = new XAudio2Sink();
+	if (sink->Open(rate))
+		return sink;
+	delete sink;
+#endif
+
+	AudioSink *none = new NullSink();
+	none->Open(rate);
+	return none;
+}
+
+int AudioSink::Writable()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (!started)
+	{
+		start = now;
+		started = true;
+	}
+
+	// What would have played by now, but not more than a tenth of a second of it after a long stall
+	long long played = (long long)(std::chrono::duration<double>(now - start).count() * rate);
+	long long due = played - taken;
+	if (due > rate / 10)
+	{
+		taken += due - rate / 10;
+		due = rate / 10;
+	}
+	taken += due;
+	return (int)due;
+}
+
+//////////////////////////////////////////////////////////////////////
+// NullSink
+//////////////////////////////////////////////////////////////////////
+
+NullSink::NullSink()
+{
+	frames = 0;
+}
+
+bool NullSink::Open(int rate)
+{
+	this->rate = rate;
+	return true;
+}
+
+void NullSink::Write(const short *samples, int frames)
+{
+	this->frames += frames;
+}
+
+//////////////////////////////////////////////////////////////////////
+// WavFileSink
+//////////////////////////////////////////////////////////////////////
+
+// The canonical 44 byte header of a PCM .wav file
+#pragma pack(push, 1)
+struct WavHeader {
+	char riff[4];			// "RIFF"
+	unsigned int riffSize;	// The rest of the file
+	char wave[4];			// "WAVE"
+	char fmt[4];			// "fmt "
+	unsigned int fmtSize;	// 16
+	unsigned short format;	// 1: PCM
+	unsigned short channels;
+	unsigned int rate;
+	unsigned int bytesPerSecond;
+	unsigned short blockAlign;
+	unsigned short bits;
+	char data[4];			// "data"
+	unsigned int dataSize;
+};
+#pragma pack(pop)
+
+WavFileSink::WavFileSink(const char *path)
+{
+	this->path = path;
+	file = 0;
+	frames = 0;
+}
+
+WavFileSink::~WavFileSink()
+{
+	Close();
+}
+
+static void WriteHeader(FILE *file, int rate, long long frames)
+{
+	WavHeader header;
+	memcpy(header.riff, "RIFF", 4);
+	memcpy(header.wave, "WAVE", 4);
+	memcpy(header.fmt, "fmt ", 4);
+	memcpy(header.data, "data", 4);
+	header.fmtSize = 16;
+	header.format = 1;
+	header.channels = 2;
+	header.rate = rate;
+	header.blockAlign = 2 * sizeof(short);
+	header.bytesPerSecond = rate * header.blockAlign;
+	header.bits = 16;
+	header.dataSize = (unsigned int)(frames * header.blockAlign);
+	header.riffSize = header.dataSize + sizeof(header) - 8;
+	fwrite(&header, sizeof(header), 1, file);
+}
+
+bool WavFileSink::Open(int rate)
+{
+	Close();
+	this->rate = rate;
+	frames = 0;
+
+	file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	// The sizes are filled in by Close()
+	WriteHeader(file, rate, 0);
+	return true;
+}
+
+void WavFileSink::Write(const short *samples, int frames)
+{
+	if (!file)
+		return;
+	fwrite(samples, sizeof(short) * 2, frames, file);
+	this->frames += frames;
+}
+
+void WavFileSink::Close()
+{
+	if (!file)
+		return;
+	fseek(file, 0, SEEK_SET);
+	WriteHeader(file, rate, frames);
+	fclose(file);
+	file = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// XAudio2Sink
+//////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+
+XAudio2Sink::XAudio2Sink()
+{
+	xaudio = 0;
+	master = 0;
+	source = 0;
+	bufferFrames = 0;
+	current = 0;
+	filled = 0;
+}
+
+XAudio2Sink::~XAudio2Sink()
+{
+	// The source voice reads from the buffers, so it goes first
+	if (source)
+		source->DestroyVoice();
+	if (master)
+		master->DestroyVoice();
+	if (xaudio)
+		xaudio->Release();
+}
+
+bool XAudio2Sink::Open(int rate)
+{
+	this->rate = rate;
+
+	HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	if (FAILED(hr))
+		return false;
+	if (FAILED(hr = XAudio2Create(&xaudio, 0, XAUDIO2_DEFAULT_PROCESSOR)))
+		return false;
+	if (FAILED(hr = xaudio->CreateMasteringVoice(&master)))
+		return false;
+
+	WAVEFORMATEX format;
+	memset(&format, 0, sizeof(format));
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = 2;
+	format.nSamplesPerSec = rate;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = format.nChannels * format.wBitsPerSample / 8;
+	format.nAvgBytesPerSec = rate * format.nBlockAlign;
+	if (FAILED(hr = xaudio->CreateSourceVoice(&source, &format)))
+		return false;
+
+	bufferFrames = rate / 100;
+	buffers.resize(BUFFERS * bufferFrames * 2);
+	current = 0;
+	filled = 0;
+	return SUCCEEDED(source->Start(0));
+}
+
+int XAudio2Sink::Writable()
+{
+	if (!source)
+		return 0;
+
+	// Every buffer not queued, less what's in the one being filled
+	XAUDIO2_VOICE_STATE state;
+	source->GetState(&state);
+	return (BUFFERS - (int)state.BuffersQueued) * bufferFrames - filled;
+}
+
+void XAudio2Sink::Write(const short *samples, int frames)
+{
+	if (!source)
+		return;
+
+	while (frames > 0)
+	{
+		int n = bufferFrames - filled;
+		if (n > frames)
+			n = frames;
+		short *buffer = &buffers[current * bufferFrames * 2];
+		memcpy(buffer + filled * 2, samples, n * 2 * sizeof(short));
+		filled += n;
+		samples += n * 2;
+		frames -= n;
+
+		// A full buffer is queued behind the others
+		if (filled == bufferFrames)
+		{
+			XAUDIO2_BUFFER submit = { 0 };
+			submit.AudioBytes = bufferFrames * 2 * sizeof(short);
+			submit.pAudioData = (const BYTE *)buffer;
+			source->SubmitSourceBuffer(&submit);
+			current = (current + 1) % BUFFERS;
+			filled = 0;
+		}
+	}
+}
+
+#endif
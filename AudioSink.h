@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Audio Sinks
+//
+// AudioSink.h: interface for the AudioSink class and the sinks.
+// Where what the AudioMixer mixes goes: interleaved stereo 16 bit
+// samples, at the rate the sink was opened with.
+//
+// - XAudio2Sink (Windows only) plays them through one XAudio2 source
+//   voice, from a ring of 10 ms buffers.
+// - NullSink throws them away, for running the game (or timing the
+//   mixer) where there's nothing to play them on.
+// - WavFileSink writes them to a .wav file, so what the game would
+//   have played can be listened to or compared.
+//
+// Writable() says how many frames the sink can take now. XAudio2
+// counts its free buffers; the others go by the clock, so they take
+// sound as fast as it would have been played.
+//
+// Writable() and Write() are called from one thread at a time (the
+// Audio's mixing thread, every few milliseconds).
+//
+// Usage:
+// AudioSink *sink = AudioSink::OpenDefault(44100);	// XAudio2, or a NullSink if it can't be opened
+//
+// int frames = sink->Writable();				// Every few milliseconds
+// mixer.Mix(samples, frames);
+// sink->Write(samples, frames);
+//
+// WavFileSink wav("out.wav");
+// if (wav.Open(44100))
+//		wav.Write(samples, frames);				// The file is finished when it's destroyed
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef AUDIOSINK_H
+#define AUDIOSINK_H
+
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class AudioSink
+{
+public:
+	static AudioSink *OpenDefault(int rate);	// The platform's sink, or a NullSink if it has none (delete it when done)
+
+	virtual bool Open(int rate) = 0;			// Stereo 16 bit at the rate, false if it can't be opened
+	virtual int Writable();						// Frames it can take now (by default the ones that would have played since the last call)
+	virtual void Write(const short *samples, int frames) = 0;	// Interleaved stereo
+
+	AudioSink();			// Constructor
+	virtual ~AudioSink();	// Destructor
+
+protected:
+	int rate;
+
+private:
+	std::chrono::steady_clock::time_point start;	// The first Writable()
+	long long taken;		// Frames handed out by Writable() since then
+	bool started;
+};
+
+// Throws the sound away
+class NullSink : public AudioSink
+{
+public:
+	long long frames;		// Frames written
+
+	virtual bool Open(int rate);
+	virtual void Write(const short *samples, int frames);
+
+	NullSink();				// Constructor
+};
+
+// Writes the sound to a .wav file
+class WavFileSink : public AudioSink
+{
+public:
+	long long frames;		// Frames written
+
+	virtual bool Open(int rate);	// Creates the file, false if it can't be
+	virtual void Write(const short *samples, int frames);
+	void Close();			// Fills in the sizes in the header and closes the file
+
+	WavFileSink(const char *path);	// Constructor (nothing is written until Open())
+	virtual ~WavFileSink();	// Destructor, closes the file
+
+private:
+	std::string path;
+	FILE *file;
+};
+
+#ifdef _WIN32
+struct IXAudio2;
+struct IXAudio2MasteringVoice;
+struct IXAudio2SourceVoice;
+
+// Plays the sound through XAudio2
+class XAudio2Sink : public AudioSink
+{
+public:
+	enum {
+		BUFFERS = 6			// 10 ms each, so at most 60 ms is queued ahead of what's playing
+	};
+
+	virtual bool Open(int rate);
+	virtual int Writable();	// The room left in the free buffers
+	virtual void Write(const short *samples, int frames);
+
+	XAudio2Sink();			// Constructor
+	virtual ~XAudio2Sink();	// Destructor
+
+private:
+	IXAudio2 *xaudio;
+	IXAudio2MasteringVoice *master;
+	IXAudio2SourceVoice *source;
+	std::vector<short> buffers;	// BUFFERS of bufferFrames stereo frames, played in turn
+	int bufferFrames;
+	int current;			// The buffer being filled
+	int filled;				// Frames in it
+};
+#endif
+
+#endif // AUDIOSINK_H
@@ -0,0 +1,281 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Audio Stream
+//
+// AudioStream.cpp: implementation of the AudioStream class.
+// See AudioStream.h for how it works.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "AudioStream.h"
+
+#include <chrono>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////
+// Wave format
+//////////////////////////////////////////////////////////////////////
+
+bool AudioStream::ParseFormat(const unsigned char *chunk, unsigned int size, Format &format)
+{
+	if (size < 16)
+		return false;
+
+	unsigned short tag = chunk[0] | chunk[1] << 8;
+	format.channels = chunk[2] | chunk[3] << 8;
+	format.rate = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | chunk[7] << 24;
+	format.bits = chunk[14] | chunk[15] << 8;
+
+	// WAVE_FORMAT_EXTENSIBLE: the real tag starts the sub format
+	if (tag == 0xFFFE && size >= 26)
+		tag = chunk[24] | chunk[25] << 8;
+
+	format.isFloat = tag == 3 && format.bits == 32;
+	if (tag != 1 && !format.isFloat)
+		return false;
+	if (format.channels != 1 && format.channels != 2)
+		return false;
+	return format.rate > 0 && (format.bits == 8 || format.bits == 16 || format.bits == 24 || format.bits == 32);
+}
+
+void AudioStream::Decode(const unsigned char *data, int count, const Format &format, float *samples)
+{
+	int bytes = format.bits / 8;
+	for (int i = 0; i < count; i++, data += bytes)
+	{
+		if (format.isFloat)
+			memcpy(&samples[i], data, 4);
+		else if (format.bits == 8)
+			samples[i] = (data[0] - 128) / 128.0f;
+		else if (format.bits == 16)
+			samples[i] = (short)(data[0] | data[1] << 8) / 32768.0f;
+		else if (format.bits == 24)
+			samples[i] = (int)((unsigned int)(data[0] << 8 | data[1] << 16 | data[2] << 24)) / 2147483648.0f;
+		else
+			samples[i] = (int)((unsigned int)(data[0] | data[1] << 8 | data[2] << 16 | data[3] << 24)) / 2147483648.0f;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+AudioStream::AudioStream()
+	: written(0), read(0), ended(false), underruns(0)
+{
+	file = 0;
+	memset(&format, 0, sizeof(format));
+	frameBytes = 0;
+	dataStart = 0;
+	dataBytes = 0;
+	dataRead = 0;
+	loop = false;
+	stop = false;
+}
+
+AudioStream::~AudioStream()
+{
+	if (thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		wake.notify_one();
+		thread.join();
+	}
+	if (file)
+		fclose(file);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Opening
+//////////////////////////////////////////////////////////////////////
+
+bool AudioStream::Open(const char *path, bool loop)
+{
+	if (file)
+		return false;
+
+	file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	// "RIFF", the size, "WAVE", then the chunks up to the samples
+	unsigned char header[12];
+	if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+		return false;
+
+	bool haveFormat = false;
+	for (;;)
+	{
+		unsigned char chunk[8];
+		if (fread(chunk, 1, 8, file) != 8)
+			return false;
+		unsigned int size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (unsigned int)chunk[7] << 24;
+		unsigned int pad = size & 1;
+
+		if (memcmp(chunk, "fmt ", 4) == 0)
+		{
+			unsigned char fmt[40];
+			unsigned int keep = size < sizeof(fmt) ? size : sizeof(fmt);
+			if (fread(fmt, 1, keep, file) != keep || !ParseFormat(fmt, keep, format))
+				return false;
+			haveFormat = true;
+			size -= keep;
+		}
+		else if (memcmp(chunk, "data", 4) == 0)
+		{
+			if (!haveFormat)
+				return false;
+			dataStart = ftell(file);
+			dataBytes = size;
+			break;
+		}
+
+		// Chunks start on even bytes
+		if (fseek(file, size + pad, SEEK_CUR) != 0)
+			return false;
+	}
+
+	frameBytes = format.channels * format.bits / 8;
+	dataBytes -= dataBytes % frameBytes;
+	if (dataBytes == 0)
+		return false;
+	this->loop = loop;
+
+	block.resize(BLOCK_FRAMES * frameBytes);
+	decoded.resize(BLOCK_FRAMES * format.channels);
+	ring.resize((RING_FRAMES + WINDOW) * format.channels);
+
+	thread = std::thread(&AudioStream::ReadLoop, this);
+	return true;
+}
+
+const AudioStream::Format &AudioStream::GetFormat() const
+{
+	return format;
+}
+
+bool AudioStream::Looping() const
+{
+	return loop;
+}
+
+//////////////////////////////////////////////////////////////////////
+// The reading thread
+//////////////////////////////////////////////////////////////////////
+
+void AudioStream::ReadLoop()
+{
+	for (;;)
+	{
+		// A block whenever there's room for one
+		while (RING_FRAMES - (written.load() - read.load()) >= BLOCK_FRAMES)
+		{
+			if (!ReadBlock())
+			{
+				// The last frame blends into this one
+				float silence[2] = { 0, 0 };
+				Put(silence, 1);
+				ended = true;
+				return;
+			}
+		}
+
+		// The mixer plays a block in about a tenth of a second, so looking a few times as often keeps up
+		std::unique_lock<std::mutex> guard(lock);
+		if (stop)
+			return;
+		wake.wait_for(guard, std::chrono::milliseconds(10));
+		if (stop)
+			return;
+	}
+}
+
+bool AudioStream::ReadBlock()
+{
+	int frames = 0;
+	while (frames < BLOCK_FRAMES)
+	{
+		// From the start again when a looping one runs out
+		if (dataRead == dataBytes)
+		{
+			if (!loop || fseek(file, dataStart, SEEK_SET) != 0)
+				break;
+			dataRead = 0;
+		}
+
+		unsigned int want = (BLOCK_FRAMES - frames) * frameBytes;
+		if (want > dataBytes - dataRead)
+			want = dataBytes - dataRead;
+		size_t got = fread(&block[frames * frameBytes], 1, want, file);
+		got -= got % frameBytes;
+		if (got == 0)
+			break;
+		dataRead += (unsigned int)got;
+		frames += (int)(got / frameBytes);
+	}
+
+	if (frames == 0)
+		return false;
+	Decode(&block[0], frames * format.channels, format, &decoded[0]);
+	Put(&decoded[0], frames);
+	return true;
+}
+
+void AudioStream::Put(const float *samples, int frames)
+{
+	int channels = format.channels;
+	int at = (int)(written.load() % RING_FRAMES);
+
+	// Up to the end of the ring, then the rest from its start
+	int first = RING_FRAMES - at < frames ? RING_FRAMES - at : frames;
+	memcpy(&ring[at * channels], samples, first * channels * sizeof(float));
+	memcpy(&ring[0], samples + first * channels, (frames - first) * channels * sizeof(float));
+
+	// What went in the first WINDOW frames goes after the end too
+	int pieces[2][2] = { { at, at + first }, { 0, frames - first } };
+	for (int i = 0; i < 2; i++)
+	{
+		int begin = pieces[i][0];
+		int end = pieces[i][1] < WINDOW ? pieces[i][1] : WINDOW;
+		if (begin < end)
+			memcpy(&ring[(RING_FRAMES + begin) * channels], &ring[begin * channels], (end - begin) * channels * sizeof(float));
+	}
+
+	// Only now can the mixer see them
+	written.store(written.load() + frames);
+}
+
+//////////////////////////////////////////////////////////////////////
+// The mixer's side
+//////////////////////////////////////////////////////////////////////
+
+const float *AudioStream::Peek(int frames, int &available)
+{
+	bool last = ended.load();
+	long long position = read.load();
+	long long buffered = written.load() - position;
+	if (frames > WINDOW)
+		frames = WINDOW;
+	available = buffered < frames ? (int)buffered : frames;
+	if (available < frames && !last)
+		underruns++;
+	return &ring[(position % RING_FRAMES) * format.channels];
+}
+
+void AudioStream::Advance(int frames)
+{
+	read.store(read.load() + frames);
+}
+
+bool AudioStream::Ended() const
+{
+	return ended;
+}
+
+int AudioStream::Underruns() const
+{
+	return underruns;
+}
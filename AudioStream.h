@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Audio Stream
+//
+// AudioStream.h: interface for the AudioStream class.
+// A long sound (the music) used to be read whole into memory before
+// it could start, a stall of a few megabytes at startup, and it
+// stayed there the whole game. A stream plays it from the file
+// instead:
+//
+// - Open() reads only the header, then starts a thread of its own
+//   which reads the samples a block (4096 frames) at a time, turns
+//   them into floats and puts them in a ring of 16384 frames.
+// - The AudioMixer takes them out of the ring as it plays them. The
+//   ring is single producer, single consumer: the thread only moves
+//   the write count and the mixer the read count, so neither waits
+//   for the other. The first WINDOW frames of the ring are copied
+//   after its end too, so the mixer always sees the frames it needs
+//   in one piece, even where the ring wraps around.
+// - A looping stream goes back to the start of the samples when the
+//   file runs out. That's done on the thread, so to the mixer it's
+//   just more frames and there's no gap. A stream that doesn't loop
+//   gets one silent frame after the last, which the last blends into.
+//
+// So a stream holds about 200 KB whatever the file's length, and
+// starts as soon as the header is read. If the thread falls behind
+// (a slow disk) the mixer plays silence until it catches up and
+// counts it in underruns.
+//
+// ParseFormat() and Decode() are how the samples of any wave file are
+// understood, Audio::Load() uses them too.
+//
+// Usage:
+// AudioStream *music = new AudioStream();
+// if (music->Open("sound/music.wav", true))		// Looping
+//		mixer.Play(music, 0.3f);
+// ...
+// delete music;									// After the mixer is done with it, joins the thread
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef AUDIOSTREAM_H
+#define AUDIOSTREAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+class AudioStream
+{
+public:
+	enum {
+		BLOCK_FRAMES = 4096,	// Read from the file at a time
+		RING_FRAMES = 16384,	// Decoded and waiting to be played
+		WINDOW = 4096			// Most frames Peek() gives at once
+	};
+
+	// How a wave file's samples are stored
+	struct Format {
+		int rate;
+		int channels;		// 1 or 2
+		int bits;			// 8, 16, 24 or 32
+		bool isFloat;		// 32 bit floats instead of integers
+	};
+
+	// The format from a "fmt " chunk (PCM or float, mono or stereo), false if it's one that can't be played
+	static bool ParseFormat(const unsigned char *chunk, unsigned int size, Format &format);
+	// count samples in the format to floats from -1 to 1
+	static void Decode(const unsigned char *data, int count, const Format &format, float *samples);
+
+	bool Open(const char *path, bool loop);	// Reads the header and starts reading the samples, false if it's not a wave file that can be played
+	const Format &GetFormat() const;
+	bool Looping() const;
+
+	// Mixer side
+	const float *Peek(int frames, int &available);	// The next frames (interleaved), available: how many are there (at most WINDOW)
+	void Advance(int frames);	// They've been played
+	bool Ended() const;			// True: the file has been read to the end and it doesn't loop, so a Peek() after this shows all there is
+	int Underruns() const;		// Times Peek() came up short before the end
+
+	AudioStream();			// Constructor
+	virtual ~AudioStream();	// Destructor, stops the thread and closes the file
+
+private:
+	void ReadLoop();		// The thread: fills the ring until stopped or done
+	bool ReadBlock();		// The next block from the file into the ring, false at the end
+	void Put(const float *samples, int frames);	// Into the ring, and the copy after it
+
+	FILE *file;
+	Format format;
+	int frameBytes;
+	long dataStart;			// Where the samples are in the file
+	unsigned int dataBytes;
+	unsigned int dataRead;	// How many of them have been read, since the last time round
+	bool loop;
+
+	std::vector<unsigned char> block;	// BLOCK_FRAMES frames, as they are in the file
+	std::vector<float> decoded;			// The same, as floats
+	std::vector<float> ring;			// RING_FRAMES frames, then a copy of the first WINDOW
+	std::atomic<long long> written;		// Frames put in the ring, ever
+	std::atomic<long long> read;		// Frames played, ever
+	std::atomic<bool> ended;
+	std::atomic<int> underruns;
+
+	std::thread thread;
+	std::mutex lock;		// Only for waking the thread
+	std::condition_variable wake;
+	bool stop;
+
+	AudioStream(const AudioStream &);	// Not copyable, the thread points at it
+	AudioStream &operator=(const AudioStream &);
+};
+
+#endif // AUDIOSTREAM_H
@@ -0,0 +1,2160 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Benchmarks
+//
+// Benchmark.cpp: the benchmarks run by "-bench <name>".
+// Every benchmark prints a small table to the console.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "Benchmark.h"
+#include "AudioMixer.h"
+#include "ClusteredLighting.h"
+#include "CollisionMesh.h"
+#include "EntityStore.h"
+#include "FlowField.h"
+#include "GLTexture.h"
+#include "ImageDecoder.h"
+#include "JobSystem.h"
+#include "Matrix4.h"
+#include "MipmapBuilder.h"
+#include "ParticleSystem.h"
+#include "RenderQueue.h"
+#include "SpatialGrid.h"
+#include "SpawnPlacer.h"
+#include "TextureCache.h"
+#include "TextureCompressor.h"
+#include "TextureManager.h"
+#include "TextureStreamer.h"
+#include "TriggerSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <glut.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+// Milliseconds since start
+static double ElapsedMs(BenchClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+//=======================================================================
+// Render Queue
+//=======================================================================
+
+// Builds the queue for a field of snakes with 1..N threads
+static void BenchRenderQueue()
+{
+	// A stand in for snake.3ds, only its bounds matter to the queue
+	Model_3DS model;
+	model.boundsMin.x = -20.0f; model.boundsMin.y = 0.0f; model.boundsMin.z = -20.0f;
+	model.boundsMax.x = 20.0f; model.boundsMax.y = 40.0f; model.boundsMax.z = 20.0f;
+
+	// The same projection and camera height the game uses
+	float proj[16];
+	float view[16];
+	float aspect = 1280.0f / 720.0f;
+	float f = 1.0f / tanf(45.0f * 0.5f * 0.0174532925f);
+	float zn = 0.1f, zf = 100000.0f;
+
+	memset(proj, 0, sizeof(proj));
+	proj[0] = f / aspect;
+	proj[5] = f;
+	proj[10] = (zf + zn) / (zn - zf);
+	proj[11] = -1.0f;
+	proj[14] = 2.0f * zf * zn / (zn - zf);
+
+	Mat4Identity(view);
+	Mat4Translate(view, 0.0f, -10.0f, -17.0f);
+
+	int counts[] = { 1000, 5000, 20000, 50000 };
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	printf("renderqueue: ms per Build() (average of 50)\n");
+	printf("%8s", "items");
+	for (int t = 1; t <= maxThreads; t *= 2)
+		printf("  %6d thr", t);
+	printf("\n");
+
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> spread(-500.0f, 500.0f);
+
+	for (int c = 0; c < 4; c++)
+	{
+		std::vector<RenderItem> items(counts[c]);
+		for (int i = 0; i < counts[c]; i++)
+		{
+			RenderItem &item = items[i];
+			item.model = &model;
+			item.x = spread(gen);
+			item.y = 0.0f;
+			item.z = spread(gen);
+			item.yaw = spread(gen);
+			item.scale = 0.03f;
+			item.tiltX = 90.0f;
+			item.pivot = 0;
+			item.occluder = false;
+		}
+
+		printf("%8d", counts[c]);
+
+		for (int t = 1; t <= maxThreads; t *= 2)
+		{
+			JobSystem jobs;
+			jobs.Start(t);
+
+			RenderQueue queue;
+			queue.Build(items, view, proj, 720, jobs, 0);	// Warm up the lists
+
+			BenchClock::time_point start = BenchClock::now();
+			for (int i = 0; i < 50; i++)
+				queue.Build(items, view, proj, 720, jobs, 0);
+
+			printf("  %10.3f", ElapsedMs(start) / 50.0);
+		}
+
+		printf("\n");
+	}
+}
+
+//=======================================================================
+// Clustered Lighting
+//=======================================================================
+
+// Draws a lit 100x100 field of quads the size of the level
+static void DrawLightingField()
+{
+	glBegin(GL_QUADS);
+	glNormal3f(0.0f, 1.0f, 0.0f);
+	for (int z = 0; z < 100; z++)
+	{
+		for (int x = 0; x < 100; x++)
+		{
+			float x0 = -50.0f + x, z0 = -50.0f + z;
+			glTexCoord2f(0.0f, 0.0f); glVertex3f(x0, 0.0f, z0);
+			glTexCoord2f(0.0f, 1.0f); glVertex3f(x0, 0.0f, z0 + 1.0f);
+			glTexCoord2f(1.0f, 1.0f); glVertex3f(x0 + 1.0f, 0.0f, z0 + 1.0f);
+			glTexCoord2f(1.0f, 0.0f); glVertex3f(x0 + 1.0f, 0.0f, z0);
+		}
+	}
+	glEnd();
+}
+
+// Frame time of the lit field against the number of lights
+static void BenchLighting()
+{
+	ClusteredLighting lighting;
+	if (!lighting.Init())
+	{
+		printf("lighting: skipped, OpenGL 3.0 isn't available\n");
+		return;
+	}
+
+	int width = 1280, height = 720;
+	glutReshapeWindow(width, height);
+	glViewport(0, 0, width, height);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_2D);
+
+	GLTexture white;
+	white.BuildColorTexture(255, 255, 255);
+
+	// The game's projection looking down over the field
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluPerspective(45.0, (double)width / height, 0.1, 100000.0);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	gluLookAt(0.0, 25.0, 60.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+
+	float view[16];
+	float proj[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, view);
+	glGetFloatv(GL_PROJECTION_MATRIX, proj);
+
+	float sunDirection[] = { 15.0f, 9.0f, 0.0f };
+	float sunColor[] = { 0.5f, 0.5f, 0.5f };
+	float ambient[] = { 0.3f, 0.3f, 0.3f };
+
+	int counts[] = { 0, 16, 64, 256, 1024 };
+
+	printf("lighting: ms per frame (average of 50, %dx%d)\n", width, height);
+	printf("%8s  %10s  %10s  %10s  %10s\n", "lights", "frame", "binning", "entries", "busiest");
+
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> spread(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> tint(0.2f, 1.0f);
+
+	for (int c = 0; c < 5; c++)
+	{
+		lighting.BeginFrame();
+		for (int i = 0; i < counts[c]; i++)
+			lighting.AddLight(spread(gen), 1.5f, spread(gen), 6.0f, tint(gen), tint(gen), tint(gen));
+
+		// One frame to warm up, then the timed ones
+		double binMs = 0.0;
+		BenchClock::time_point start;
+		for (int i = -1; i < 50; i++)
+		{
+			if (i == 0)
+			{
+				glFinish();
+				start = BenchClock::now();
+				binMs = 0.0;
+			}
+
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			lighting.Update(view, proj, width, height);
+			binMs += lighting.stats.binMs;
+			lighting.Bind(sunDirection, sunColor, ambient);
+			white.Use();
+			DrawLightingField();
+			lighting.Unbind();
+			glutSwapBuffers();
+		}
+		glFinish();
+
+		printf("%8d  %10.3f  %10.3f  %10d  %10d\n", counts[c], ElapsedMs(start) / 50.0, binMs / 50.0,
+			lighting.stats.indices, lighting.stats.busiest);
+	}
+}
+
+//=======================================================================
+// Spatial Grid
+//=======================================================================
+
+// Collision queries against the grid and against a plain loop as the entity count grows
+static void BenchSpatialGrid()
+{
+	int counts[] = { 100, 1000, 10000, 100000 };
+	int numQueries = 10000;
+
+	printf("spatialgrid: ms for %d queries (radius 0.5, same crowding as the level at every size)\n", numQueries);
+	printf("%8s  %10s  %10s  %10s  %10s  %10s\n", "entities", "insert", "move", "grid", "linear", "hits");
+
+	std::mt19937 gen(1234);
+
+	for (int c = 0; c < 4; c++)
+	{
+		int n = counts[c];
+
+		// Grow the area with the count so every cell stays about as full
+		float half = sqrtf((float)n) * 2.5f;
+		std::uniform_real_distribution<float> spread(-half, half);
+
+		std::vector<float> xs(n), zs(n);
+		for (int i = 0; i < n; i++)
+		{
+			xs[i] = spread(gen);
+			zs[i] = spread(gen);
+		}
+
+		std::vector<float> qx(numQueries), qz(numQueries);
+		for (int i = 0; i < numQueries; i++)
+		{
+			qx[i] = spread(gen);
+			qz[i] = spread(gen);
+		}
+
+		SpatialGrid grid(5.0f);
+
+		BenchClock::time_point start = BenchClock::now();
+		for (int i = 0; i < n; i++)
+			grid.Insert(i, xs[i], zs[i], 0.5f);
+		double insertMs = ElapsedMs(start);
+
+		// Nudge everything a little, like the snakes walking about
+		start = BenchClock::now();
+		for (int i = 0; i < n; i++)
+			grid.Move(i, xs[i] + 1.0f, zs[i] + 1.0f);
+		for (int i = 0; i < n; i++)
+			grid.Move(i, xs[i], zs[i]);
+		double moveMs = ElapsedMs(start) / 2.0;
+
+		std::vector<int> found;
+		int gridHits = 0;
+		start = BenchClock::now();
+		for (int q = 0; q < numQueries; q++)
+		{
+			found.clear();
+			grid.QueryRadius(qx[q], qz[q], 0.5f, found);
+			gridHits += (int)found.size();
+		}
+		double gridMs = ElapsedMs(start);
+
+		// What checkCollitionObstacles() used to do
+		int linearHits = 0;
+		start = BenchClock::now();
+		for (int q = 0; q < numQueries; q++)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				float dx = xs[i] - qx[q];
+				float dz = zs[i] - qz[q];
+				if (sqrtf(dx * dx + dz * dz) <= 1.0f)
+					linearHits++;
+			}
+		}
+		double linearMs = ElapsedMs(start);
+
+		printf("%8d  %10.3f  %10.3f  %10.3f  %10.3f  %5d/%-5d\n", n, insertMs, moveMs, gridMs, linearMs, gridHits, linearHits);
+	}
+}
+
+//=======================================================================
+// Trigger Volumes
+//=======================================================================
+
+// Point queries against the volume tree and against a plain loop as the level fills up
+static void BenchTriggers()
+{
+	int counts[] = { 16, 128, 1024, 8192 };
+	int numQueries = 100000;
+
+	printf("triggers: ms for %d point queries\n", numQueries);
+	printf("%8s  %10s  %10s  %10s  %10s\n", "volumes", "build", "tree", "linear", "hits");
+
+	std::mt19937 gen(1234);
+
+	for (int c = 0; c < 4; c++)
+	{
+		int n = counts[c];
+
+		// Scatter 2x2 to 10x10 boxes over an area that grows with the count
+		float half = sqrtf((float)n) * 10.0f;
+		std::uniform_real_distribution<float> spread(-half, half);
+		std::uniform_real_distribution<float> size(2.0f, 10.0f);
+
+		TriggerSystem triggers;
+		std::vector<TriggerVolume> volumes(n);
+		for (int i = 0; i < n; i++)
+		{
+			TriggerVolume &v = volumes[i];
+			v.kind = VOLUME_OBSTACLE;
+			v.level = 1;
+			v.min[0] = spread(gen); v.min[1] = 0.0f; v.min[2] = spread(gen);
+			v.max[0] = v.min[0] + size(gen); v.max[1] = 5.0f; v.max[2] = v.min[2] + size(gen);
+			triggers.Add(v);
+		}
+
+		BenchClock::time_point start = BenchClock::now();
+		triggers.Build();
+		double buildMs = ElapsedMs(start);
+
+		std::vector<float> qx(numQueries), qz(numQueries);
+		for (int i = 0; i < numQueries; i++)
+		{
+			qx[i] = spread(gen);
+			qz[i] = spread(gen);
+		}
+
+		std::vector<int> found;
+		int treeHits = 0;
+		start = BenchClock::now();
+		for (int q = 0; q < numQueries; q++)
+		{
+			found.clear();
+			triggers.Query(qx[q], 1.0f, qz[q], 1, found);
+			treeHits += (int)found.size();
+		}
+		double treeMs = ElapsedMs(start);
+
+		// What the chains of ifs in Main.cpp amounted to
+		int linearHits = 0;
+		start = BenchClock::now();
+		for (int q = 0; q < numQueries; q++)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				const TriggerVolume &v = volumes[i];
+				if (qx[q] >= v.min[0] && qx[q] <= v.max[0] && qz[q] >= v.min[2] && qz[q] <= v.max[2])
+					linearHits++;
+			}
+		}
+		double linearMs = ElapsedMs(start);
+
+		printf("%8d  %10.3f  %10.3f  %10.3f  %5d/%-5d\n", n, buildMs, treeMs, linearMs, treeHits, linearHits);
+	}
+}
+
+//=======================================================================
+// Spawn Placement
+//=======================================================================
+
+// Fills a 100x100 map (1 unit apart) with the Poisson placer and with plain rejection sampling
+static void BenchPlacement()
+{
+	printf("placement: filling a 100x100 area with points 1 apart, per band of 500 placements\n");
+	printf("%10s  %12s  %10s  %12s  %10s\n", "calls", "poisson us", "max tries", "darts us", "max tries");
+
+	SpawnPlacer poisson;
+	poisson.Reset(0.0f, 0.0f, 100.0f, 100.0f, 1.0f, 1234);
+
+	// What myTimer used to do: throw darts until one lands (capped so it ends)
+	SpawnPlacer darts;
+	darts.Reset(0.0f, 0.0f, 100.0f, 100.0f, 1.0f, 1234);
+	darts.dartTries = 100000;
+	darts.maxTries = 100000;
+
+	bool poissonFull = false, dartsFull = false;
+	for (int band = 0; !poissonFull || !dartsFull; band++)
+	{
+		double poissonMs = 0.0, dartsMs = 0.0;
+		int poissonMax = 0, dartsMax = 0, poissonPlaced = 0, dartsPlaced = 0;
+		float x, z;
+
+		for (int i = 0; i < 500; i++)
+		{
+			if (!poissonFull)
+			{
+				// A miss isn't the end, the next call picks up where it stopped
+				BenchClock::time_point start = BenchClock::now();
+				if (poisson.Place(x, z))
+					poissonPlaced++;
+				poissonMs += ElapsedMs(start);
+				if (poisson.LastTries() > poissonMax)
+					poissonMax = poisson.LastTries();
+				poissonFull = poisson.Full();
+			}
+
+			if (!dartsFull)
+			{
+				BenchClock::time_point start = BenchClock::now();
+				dartsFull = !darts.Place(x, z);
+				dartsMs += ElapsedMs(start);
+				if (darts.LastTries() > dartsMax)
+					dartsMax = darts.LastTries();
+				if (!dartsFull)
+					dartsPlaced++;
+			}
+		}
+
+		printf("%10d  %12.2f  %10d  %12.2f  %10d\n", (band + 1) * 500,
+			poissonMs * 1000.0 / 500, poissonMax,
+			dartsPlaced ? dartsMs * 1000.0 / dartsPlaced : 0.0, dartsMax);
+	}
+
+	printf("poisson fit %d points, darts fit %d\n", poisson.NumPoints(), darts.NumPoints());
+}
+
+//=======================================================================
+// Entity Store
+//=======================================================================
+
+// What a snake used to be: everything in one struct, the model included
+struct LegacyObject {
+	float position[3];
+	float velocity[3];
+	float rotation;
+	float scale;
+	float collisionRadius;
+	float drawLift;
+	bool displayed;
+	bool effect;
+	bool needsRotation;
+	bool isOccluder;
+	char model[sizeof(Model_3DS)];	// Stands in for the Model_3DS GameObject holds by value
+};
+
+// Movement, collision and render extraction over 10000 entities, one struct each against EntityStore
+static void BenchEntityStore()
+{
+	int n = 10000;
+	int frames = 100;
+	int queriesPerFrame = 100;
+	float half = sqrtf((float)n) * 2.5f;
+	float dt = 1.0f / 60.0f;
+
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> spread(-half, half);
+	std::uniform_real_distribution<float> speed(-1.0f, 1.0f);
+
+	printf("ecs: ms per frame over %d frames, %d entities (a third moving), %d collision queries a frame\n", frames, n, queriesPerFrame);
+	printf("%-12s  %10s  %10s  %10s  %10s  %10s\n", "layout", "move", "collide", "extract", "total", "bytes/ent");
+
+	std::vector<LegacyObject> legacy(n);
+	EntityStore store;
+	store.Reserve(n);
+	Model_3DS *sharedModel = 0;	// Never drawn, only the pointer is copied
+
+	for (int i = 0; i < n; i++)
+	{
+		LegacyObject &o = legacy[i];
+		memset(&o, 0, sizeof(o));
+		o.position[0] = spread(gen);
+		o.position[2] = spread(gen);
+		o.rotation = 0.0f;
+		o.scale = 0.03f;
+		o.collisionRadius = 0.4f;
+		o.displayed = true;
+		o.effect = true;
+		o.needsRotation = true;
+
+		int e = store.Index(store.Create((EntityKind)(i % ENTITY_KIND_COUNT), o.position[0], 0.0f, o.position[2], 0.0f, 0.03f, 0.4f, sharedModel));
+
+		if (i % 3 == 0)
+		{
+			o.velocity[0] = speed(gen);
+			o.velocity[2] = speed(gen);
+			store.velocities[e].x = o.velocity[0];
+			store.velocities[e].z = o.velocity[2];
+			store.flags[e] |= ENTITY_MOVING;
+		}
+	}
+
+	std::vector<float> qx(queriesPerFrame), qz(queriesPerFrame);
+	for (int q = 0; q < queriesPerFrame; q++)
+	{
+		qx[q] = spread(gen);
+		qz[q] = spread(gen);
+	}
+
+	std::vector<RenderItem> items;
+	items.reserve(n);
+	std::vector<int> found, hits;
+	int legacyHits = 0, storeHits = 0;
+
+	// One struct per entity, the way the vectors of GameObjects were walked
+	{
+		SpatialGrid grid(5.0f);
+		for (int i = 0; i < n; i++)
+			grid.Insert(i, legacy[i].position[0], legacy[i].position[2], legacy[i].collisionRadius);
+
+		double moveMs = 0.0, collideMs = 0.0, extractMs = 0.0;
+		for (int f = 0; f < frames; f++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			for (int i = 0; i < n; i++)
+			{
+				LegacyObject &o = legacy[i];
+				if (o.velocity[0] == 0.0f && o.velocity[2] == 0.0f)
+					continue;
+				o.position[0] += o.velocity[0] * dt;
+				o.position[1] += o.velocity[1] * dt;
+				o.position[2] += o.velocity[2] * dt;
+				grid.Move(i, o.position[0], o.position[2]);
+			}
+			moveMs += ElapsedMs(start);
+
+			start = BenchClock::now();
+			for (int q = 0; q < queriesPerFrame; q++)
+			{
+				found.clear();
+				grid.QueryRadius(qx[q], qz[q], 0.5f, found);
+				for (size_t c = 0; c < found.size(); c++)
+				{
+					const LegacyObject &o = legacy[found[c]];
+					float dx = o.position[0] - qx[q];
+					float dy = o.position[1];
+					float dz = o.position[2] - qz[q];
+					if (o.effect && sqrtf(dx * dx + dy * dy + dz * dz) < 0.5f + o.collisionRadius)
+						legacyHits++;
+				}
+			}
+			collideMs += ElapsedMs(start);
+
+			start = BenchClock::now();
+			items.clear();
+			for (int i = 0; i < n; i++)
+			{
+				const LegacyObject &o = legacy[i];
+				if (!o.displayed)
+					continue;
+
+				RenderItem item;
+				item.model = (Model_3DS *)o.model;
+				item.x = o.position[0];
+				item.y = o.position[1] + o.drawLift;
+				item.z = o.position[2];
+				item.yaw = o.rotation;
+				item.scale = o.scale;
+				item.tiltX = o.needsRotation ? 90.0f : 0.0f;
+				item.pivot = 0;
+				item.occluder = o.isOccluder;
+				items.push_back(item);
+			}
+			extractMs += ElapsedMs(start);
+		}
+
+		printf("%-12s  %10.3f  %10.3f  %10.3f  %10.3f  %10d\n", "one struct", moveMs / frames, collideMs / frames, extractMs / frames,
+			(moveMs + collideMs + extractMs) / frames, (int)sizeof(LegacyObject));
+	}
+
+	// The same work through the store's arrays
+	{
+		SpatialGrid grid(5.0f);
+		for (int i = 0; i < n; i++)
+			grid.Insert(store.HandleOf(i).slot, store.transforms[i].x, store.transforms[i].z, store.colliders[i].radius);
+
+		unsigned int allKinds = ENTITY_MASK(ENTITY_SNAKE) | ENTITY_MASK(ENTITY_ROCK) | ENTITY_MASK(ENTITY_WATER);
+		double moveMs = 0.0, collideMs = 0.0, extractMs = 0.0;
+		for (int f = 0; f < frames; f++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			store.UpdateMovement(dt, &grid);
+			moveMs += ElapsedMs(start);
+
+			start = BenchClock::now();
+			for (int q = 0; q < queriesPerFrame; q++)
+			{
+				hits.clear();
+				store.FindCollisions(grid, qx[q], 0.0f, qz[q], 0.5f, allKinds, hits);
+				storeHits += (int)hits.size();
+			}
+			collideMs += ElapsedMs(start);
+
+			start = BenchClock::now();
+			items.clear();
+			store.ExtractRenderItems(items);
+			extractMs += ElapsedMs(start);
+		}
+
+		int bytes = (int)(sizeof(Transform) + sizeof(Velocity) + sizeof(Collider) + sizeof(RenderHandle) + sizeof(unsigned char) + sizeof(unsigned int));
+		printf("%-12s  %10.3f  %10.3f  %10.3f  %10.3f  %10d\n", "entitystore", moveMs / frames, collideMs / frames, extractMs / frames,
+			(moveMs + collideMs + extractMs) / frames, bytes);
+	}
+
+	printf("hits: one struct %d, entitystore %d\n", legacyHits, storeHits);
+}
+
+// Spawning and despawning a tenth of 10000 entities every frame: a vector of structs against EntityStore
+static void BenchEntityPool()
+{
+	int n = 10000;
+	int churn = 1000;
+	int frames = 200;
+	float half = sqrtf((float)n) * 2.5f;
+
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> spread(-half, half);
+
+	printf("pool: %d entities, %d despawned and %d spawned a frame for %d frames\n", n, churn, churn, frames);
+	printf("%-12s  %12s  %12s  %14s\n", "layout", "despawn us", "spawn us", "reallocations");
+
+	// What the vectors of GameObjects would need: erase the dead one, push_back the new one
+	{
+		std::vector<LegacyObject> objects;
+		LegacyObject fresh;
+		memset(&fresh, 0, sizeof(fresh));
+		fresh.displayed = true;
+		for (int i = 0; i < n; i++)
+			objects.push_back(fresh);
+
+		double despawnMs = 0.0, spawnMs = 0.0;
+		int reallocations = 0;
+		for (int f = 0; f < frames; f++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			for (int k = 0; k < churn; k++)
+				objects.erase(objects.begin() + gen() % objects.size());
+			despawnMs += ElapsedMs(start);
+
+			start = BenchClock::now();
+			for (int k = 0; k < churn; k++)
+			{
+				const LegacyObject *before = objects.data();
+				fresh.position[0] = spread(gen);
+				fresh.position[2] = spread(gen);
+				objects.push_back(fresh);
+				if (objects.data() != before)
+					reallocations++;
+			}
+			spawnMs += ElapsedMs(start);
+		}
+
+		printf("%-12s  %12.3f  %12.3f  %14d\n", "vector", despawnMs * 1000.0 / (frames * churn), spawnMs * 1000.0 / (frames * churn), reallocations);
+	}
+
+	// Handles, free lists and a compaction every 60 frames
+	{
+		EntityStore store;
+		store.Reserve(n);
+		SpatialGrid grid(5.0f);
+
+		std::vector<EntityHandle> handles;
+		handles.reserve(n);
+		for (int i = 0; i < n; i++)
+		{
+			float x = spread(gen), z = spread(gen);
+			EntityHandle h = store.Create(ENTITY_SNAKE, x, 0.0f, z, 0.0f, 0.03f, 0.4f, 0);
+			grid.Insert(h.slot, x, z, 0.4f);
+			handles.push_back(h);
+		}
+
+		const Transform *rowsBefore = store.transforms.data();
+		double despawnMs = 0.0, spawnMs = 0.0, compactMs = 0.0;
+		int staleAlive = 0;
+		for (int f = 0; f < frames; f++)
+		{
+			// Destroyed handles stay in the list for a moment to check they are dead
+			BenchClock::time_point start = BenchClock::now();
+			for (int k = 0; k < churn; k++)
+				store.Destroy(handles[k], &grid);
+			despawnMs += ElapsedMs(start);
+
+			for (int k = 0; k < churn; k++)
+				if (store.IsAlive(handles[k]))
+					staleAlive++;
+
+			start = BenchClock::now();
+			for (int k = 0; k < churn; k++)
+			{
+				float x = spread(gen), z = spread(gen);
+				EntityHandle h = store.Create(ENTITY_SNAKE, x, 0.0f, z, 0.0f, 0.03f, 0.4f, 0);
+				grid.Insert(h.slot, x, z, 0.4f);
+				handles[k] = h;
+			}
+			spawnMs += ElapsedMs(start);
+
+			// Move the new ones to the back of the list so every entity takes its turn
+			std::rotate(handles.begin(), handles.begin() + churn, handles.end());
+
+			if (f % 60 == 59)
+			{
+				start = BenchClock::now();
+				store.Compact();
+				compactMs += ElapsedMs(start);
+			}
+		}
+
+		printf("%-12s  %12.3f  %12.3f  %14d\n", "entitystore", despawnMs * 1000.0 / (frames * churn), spawnMs * 1000.0 / (frames * churn),
+			store.transforms.data() != rowsBefore ? 1 : 0);
+		printf("entitystore: %d live, %d rows, %.3f ms per compaction, %d stale handles still alive\n",
+			store.Count(), store.Size(), compactMs / (frames / 60), staleAlive);
+	}
+}
+
+//=======================================================================
+// Collision Mesh
+//=======================================================================
+
+// Closest point on a triangle to p, the plain one at a time version (Ericson 5.1.5)
+static void ClosestOnTriangle(const float *p, const float *a, const float *b, const float *c, float *out)
+{
+	float ab[3], ac[3], ap[3], bp[3], cp[3];
+	for (int k = 0; k < 3; k++)
+	{
+		ab[k] = b[k] - a[k];
+		ac[k] = c[k] - a[k];
+		ap[k] = p[k] - a[k];
+		bp[k] = p[k] - b[k];
+		cp[k] = p[k] - c[k];
+	}
+
+	float d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+	float d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+	float d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+	float d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+	float d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+	float d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+	float va = d3 * d6 - d5 * d4, vb = d5 * d2 - d1 * d6, vc = d1 * d4 - d3 * d2;
+
+	float s, t;
+	if (d1 <= 0 && d2 <= 0) { s = 0; t = 0; }
+	else if (d3 >= 0 && d4 <= d3) { s = 1; t = 0; }
+	else if (vc <= 0 && d1 >= 0 && d3 <= 0) { s = d1 / (d1 - d3); t = 0; }
+	else if (d6 >= 0 && d5 <= d6) { s = 0; t = 1; }
+	else if (vb <= 0 && d2 >= 0 && d6 <= 0) { s = 0; t = d2 / (d2 - d6); }
+	else if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) { t = (d4 - d3) / ((d4 - d3) + (d5 - d6)); s = 1 - t; }
+	else { s = vb / (va + vb + vc); t = vc / (va + vb + vc); }
+
+	for (int k = 0; k < 3; k++)
+		out[k] = a[k] + ab[k] * s + ac[k] * t;
+}
+
+// Building the cave's tree, then sphere and ray queries through it against testing every triangle
+static void BenchCollisionMesh()
+{
+	Model_3DS cave;
+	char name[] = "models/cave/cave.3ds";
+	cave.Load(name);
+
+	int builds = 50;
+	BenchClock::time_point start = BenchClock::now();
+	CollisionMesh mesh;
+	for (int i = 0; i < builds; i++)
+		mesh.Build(cave);
+	double buildMs = ElapsedMs(start) / builds;
+
+	printf("bvh: cave.3ds, %d triangles, %d nodes, built in %.3f ms\n", mesh.NumTriangles(), mesh.NumNodes(), buildMs);
+
+	// Every triangle as three corners, for the brute force runs
+	std::vector<float> corners;
+	for (int i = 0; i < cave.numObjects; i++)
+	{
+		const Model_3DS::Object &object = cave.Objects[i];
+		for (int f = 0; f < object.numFaces; f++)
+		{
+			const float *v = &object.Vertexes[object.Faces[f] * 3];
+			corners.push_back(v[0] + object.pos.x);
+			corners.push_back(v[1] + object.pos.y);
+			corners.push_back(v[2] + object.pos.z);
+		}
+	}
+
+	// Queries spread through the cave's box, spheres about the player's size next to it
+	int numQueries = 20000;
+	const float *lo = mesh.Min(), *hi = mesh.Max();
+	float radius = (hi[0] - lo[0]) * 0.01f;
+
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<float> points(numQueries * 3), dirs(numQueries * 3);
+	for (int q = 0; q < numQueries; q++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			points[q * 3 + k] = lo[k] + (hi[k] - lo[k]) * unit(gen);
+			dirs[q * 3 + k] = unit(gen) * 2.0f - 1.0f;
+		}
+	}
+
+	printf("%-8s  %14s  %14s  %8s\n", "query", "bvh queries/s", "all tris q/s", "hits");
+
+	int bvhHits = 0, bruteHits = 0;
+	start = BenchClock::now();
+	for (int q = 0; q < numQueries; q++)
+		if (mesh.OverlapsSphere(&points[q * 3], radius))
+			bvhHits++;
+	double bvhMs = ElapsedMs(start);
+
+	start = BenchClock::now();
+	for (int q = 0; q < numQueries; q++)
+	{
+		const float *p = &points[q * 3];
+		for (size_t c = 0; c < corners.size(); c += 9)
+		{
+			float closest[3];
+			ClosestOnTriangle(p, &corners[c], &corners[c + 3], &corners[c + 6], closest);
+			float dx = closest[0] - p[0], dy = closest[1] - p[1], dz = closest[2] - p[2];
+			if (dx * dx + dy * dy + dz * dz <= radius * radius)
+			{
+				bruteHits++;
+				break;
+			}
+		}
+	}
+	double bruteMs = ElapsedMs(start);
+
+	printf("%-8s  %14.0f  %14.0f  %4d/%-4d\n", "sphere", numQueries / bvhMs * 1000.0, numQueries / bruteMs * 1000.0, bvhHits, bruteHits);
+
+	bvhHits = 0;
+	bruteHits = 0;
+	start = BenchClock::now();
+	for (int q = 0; q < numQueries; q++)
+	{
+		float t;
+		if (mesh.Raycast(&points[q * 3], &dirs[q * 3], 1e30f, t))
+			bvhHits++;
+	}
+	bvhMs = ElapsedMs(start);
+
+	start = BenchClock::now();
+	for (int q = 0; q < numQueries; q++)
+	{
+		const float *o = &points[q * 3], *d = &dirs[q * 3];
+		float best = 1e30f;
+		bool hit = false;
+		for (size_t c = 0; c < corners.size(); c += 9)
+		{
+			const float *a = &corners[c];
+			float e1[3], e2[3], tv[3];
+			for (int k = 0; k < 3; k++)
+			{
+				e1[k] = corners[c + 3 + k] - a[k];
+				e2[k] = corners[c + 6 + k] - a[k];
+				tv[k] = o[k] - a[k];
+			}
+			float pv[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+			float det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+			if (det == 0.0f)
+				continue;
+			float inv = 1.0f / det;
+			float u = (tv[0] * pv[0] + tv[1] * pv[1] + tv[2] * pv[2]) * inv;
+			if (u < 0.0f || u > 1.0f)
+				continue;
+			float qv[3] = { tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2], tv[0] * e1[1] - tv[1] * e1[0] };
+			float v = (d[0] * qv[0] + d[1] * qv[1] + d[2] * qv[2]) * inv;
+			if (v < 0.0f || u + v > 1.0f)
+				continue;
+			float t = (e2[0] * qv[0] + e2[1] * qv[1] + e2[2] * qv[2]) * inv;
+			if (t >= 0.0f && t < best)
+			{
+				best = t;
+				hit = true;
+			}
+		}
+		if (hit)
+			bruteHits++;
+	}
+	bruteMs = ElapsedMs(start);
+
+	printf("%-8s  %14.0f  %14.0f  %4d/%-4d\n", "ray", numQueries / bvhMs * 1000.0, numQueries / bruteMs * 1000.0, bvhHits, bruteHits);
+}
+
+//=======================================================================
+// Flow Field
+//=======================================================================
+
+// Field rebuilds on a 256x256 grid and steering 1k to 50k agents along it
+static void BenchFlowField()
+{
+	int size = 256;
+	FlowField field;
+	field.Reset(0.0f, 0.0f, (float)size, (float)size, 1.0f);
+
+	// Scatter rock sized obstacles over about a fifth of the map
+	std::mt19937 gen(1234);
+	std::uniform_int_distribution<int> cell(0, size - 1);
+	for (int i = 0; i < size * size / 5 / 9; i++)
+	{
+		int cx = cell(gen), cz = cell(gen);
+		for (int dz = -1; dz <= 1; dz++)
+			for (int dx = -1; dx <= 1; dx++)
+				field.SetBlocked(cx + dx, cz + dz, true);
+	}
+
+	// The player walking across the map, a new cell every time
+	int rebuilds = 50;
+	BenchClock::time_point start = BenchClock::now();
+	int visited = 0;
+	for (int i = 0; i < rebuilds; i++)
+	{
+		field.Update(10.5f + i * 4.0f, 128.5f);
+		visited += field.LastVisited();
+	}
+	double rebuildMs = ElapsedMs(start) / rebuilds;
+
+	// Standing still
+	int idle = 10000;
+	start = BenchClock::now();
+	for (int i = 0; i < idle; i++)
+		field.Update(10.5f + (rebuilds - 1) * 4.0f, 128.5f);
+	double idleUs = ElapsedMs(start) * 1000.0 / idle;
+
+	printf("flowfield: %dx%d cells, rebuild %.3f ms (%d cells settled), same cell %.3f us\n", size, size, rebuildMs, visited / rebuilds, idleUs);
+	printf("%8s  %12s  %14s  %14s\n", "agents", "steer ms", "+rebuild ms", "ns per agent");
+
+	int counts[] = { 1000, 5000, 10000, 50000 };
+	std::uniform_real_distribution<float> spread(0.0f, (float)size);
+
+	for (int c = 0; c < 4; c++)
+	{
+		int n = counts[c];
+		std::vector<float> xs(n), zs(n), vx(n), vz(n);
+		for (int i = 0; i < n; i++)
+		{
+			xs[i] = spread(gen);
+			zs[i] = spread(gen);
+		}
+
+		int frames = 100;
+		start = BenchClock::now();
+		for (int f = 0; f < frames; f++)
+		{
+			field.Steer(&xs[0], &zs[0], &vx[0], &vz[0], n, 2.0f);
+
+			// Walk them so the next frame's cells differ
+			for (int i = 0; i < n; i++)
+			{
+				xs[i] += vx[i] * (1.0f / 60.0f);
+				zs[i] += vz[i] * (1.0f / 60.0f);
+			}
+		}
+		double steerMs = ElapsedMs(start) / frames;
+
+		// A tick where the player also stepped into a new cell
+		printf("%8d  %12.3f  %14.3f  %14.2f\n", n, steerMs, rebuildMs + steerMs, steerMs * 1e6 / n);
+	}
+}
+
+//=======================================================================
+// Job System
+//=======================================================================
+
+// A bit of arithmetic that can't be optimized away, a few ns per iteration
+static float JobWork(int seed, int iterations)
+{
+	float x = (float)(seed & 1023) * 0.001f;
+	for (int i = 0; i < iterations; i++)
+		x = x * 0.9999f + 0.5f / (1.0f + x * x);
+	return x;
+}
+
+// Every thread's counts added up
+static JobStats JobTotals(const JobSystem &jobs)
+{
+	JobStats total;
+	memset(&total, 0, sizeof(total));
+	for (int t = 0; t < jobs.NumThreads(); t++)
+	{
+		JobStats stats = jobs.GetStats(t);
+		total.jobs += stats.jobs;
+		total.steals += stats.steals;
+		total.failedSteals += stats.failedSteals;
+		total.inlined += stats.inlined;
+	}
+	return total;
+}
+
+// A binary tree of jobs, every job starts its two children on the same counter as itself
+static void JobTree(JobSystem &jobs, JobCounter &counter, int depth, float *sums)
+{
+	if (depth == 0)
+	{
+		sums[jobs.ThreadIndex() * 16] += JobWork(depth, 200);
+		return;
+	}
+
+	for (int child = 0; child < 2; child++)
+		jobs.Run(counter, [&jobs, &counter, depth, sums](int thread) { JobTree(jobs, counter, depth - 1, sums); });
+}
+
+// Scheduling overhead, how often the threads have to steal, and scaling from 1 to 64 threads
+static void BenchJobs()
+{
+	int cores = (int)std::thread::hardware_concurrency();
+	if (cores < 1)
+		cores = 1;
+
+	// Padded so the threads don't share cache lines (room for 64 threads)
+	std::vector<float> sums(64 * 16, 0.0f);
+
+	// The cost of a job that does nothing, alone and with every core competing for them
+	printf("jobs: overhead of empty jobs (%d cores)\n", cores);
+	printf("%8s  %16s  %20s\n", "threads", "run+wait ns/job", "parallelfor ns/piece");
+
+	int threadCounts[] = { 1, cores };
+	for (int c = 0; c < (cores > 1 ? 2 : 1); c++)
+	{
+		JobSystem jobs;
+		jobs.Start(threadCounts[c]);
+
+		int numJobs = 100000;
+		JobCounter counter;
+		BenchClock::time_point start = BenchClock::now();
+		for (int i = 0; i < numJobs; i++)
+		{
+			jobs.Run(counter, [](int thread) {});
+
+			// Waiting every so often keeps the deque from filling up and running them inline
+			if ((i & 1023) == 1023)
+				jobs.Wait(counter);
+		}
+		jobs.Wait(counter);
+		double runNs = ElapsedMs(start) * 1e6 / numJobs;
+
+		int items = 1 << 20;
+		int grain = 64;
+		int repeats = 10;
+		start = BenchClock::now();
+		for (int r = 0; r < repeats; r++)
+			jobs.ParallelFor(items, grain, [](int begin, int end, int thread) {});
+		double forNs = ElapsedMs(start) * 1e6 / (repeats * (items / grain));
+
+		// One thread runs the whole range in one call, there are no pieces to time
+		if (threadCounts[c] > 1)
+			printf("%8d  %16.1f  %20.1f\n", threadCounts[c], runNs, forNs);
+		else
+			printf("%8d  %16.1f  %20s\n", threadCounts[c], runNs, "not split");
+	}
+
+	// Where the jobs came from: everything queued by thread 0, a tree of jobs queuing their children, and a ParallelFor
+	// At least a few threads, a single one has nobody to steal from
+	int stealThreads = std::max(cores, 4);
+	printf("\njobs: steals with %d threads\n", stealThreads);
+	printf("%-12s  %8s  %8s  %10s  %12s  %8s\n", "pattern", "jobs", "ms", "stolen %", "failed/job", "inlined");
+
+	for (int pattern = 0; pattern < 3; pattern++)
+	{
+		JobSystem jobs;
+		jobs.Start(stealThreads);
+		jobs.ResetStats();
+
+		const char *name = "";
+		BenchClock::time_point start = BenchClock::now();
+		if (pattern == 0)
+		{
+			name = "flat";
+			JobCounter counter;
+			for (int i = 0; i < 4000; i++)
+				jobs.Run(counter, [&sums, i](int thread) { sums[thread * 16] += JobWork(i, 500); });
+			jobs.Wait(counter);
+		}
+		else if (pattern == 1)
+		{
+			name = "tree";
+			JobCounter counter;
+			JobTree(jobs, counter, 14, &sums[0]);
+			jobs.Wait(counter);
+		}
+		else
+		{
+			name = "parallelfor";
+			jobs.ParallelFor(1 << 16, 16, [&sums](int begin, int end, int thread) {
+				for (int i = begin; i < end; i++)
+					sums[thread * 16] += JobWork(i, 25);
+			});
+		}
+		double ms = ElapsedMs(start);
+
+		JobStats total = JobTotals(jobs);
+		printf("%-12s  %8lld  %8.2f  %10.1f  %12.2f  %8lld\n", name, total.jobs, ms,
+			total.jobs ? 100.0 * total.steals / total.jobs : 0.0,
+			total.jobs ? (double)total.failedSteals / total.jobs : 0.0, total.inlined);
+	}
+
+	// The same work on more and more threads, past the number of cores the threads just take turns
+	printf("\njobs: scaling, 4096 equal pieces\n");
+	printf("%8s  %10s  %8s  %10s  %10s\n", "threads", "ms", "speedup", "efficiency", "stolen %");
+
+	double baseMs = 0.0;
+	for (int t = 1; t <= 64; t *= 2)
+	{
+		JobSystem jobs;
+		jobs.Start(t);
+
+		int repeats = 5;
+		double bestMs = 1e30;
+		for (int r = 0; r < repeats; r++)
+		{
+			jobs.ResetStats();
+			BenchClock::time_point start = BenchClock::now();
+			jobs.ParallelFor(4096, 1, [&sums](int begin, int end, int thread) {
+				for (int i = begin; i < end; i++)
+					sums[thread * 16] += JobWork(i, 10000);
+			});
+			bestMs = std::min(bestMs, ElapsedMs(start));
+		}
+
+		if (t == 1)
+			baseMs = bestMs;
+
+		JobStats total = JobTotals(jobs);
+		printf("%8d  %10.2f  %8.2f  %9.0f%%  %10.1f%s\n", t, bestMs, baseMs / bestMs, 100.0 * baseMs / bestMs / t,
+			total.jobs ? 100.0 * total.steals / total.jobs : 0.0, t > cores ? "  (more threads than cores)" : "");
+	}
+
+	printf("(a piece takes %.1f us on one thread)\n", baseMs * 1000.0 / 4096);
+
+	// So the work isn't optimized out
+	float sum = 0.0f;
+	for (size_t i = 0; i < sums.size(); i++)
+		sum += sums[i];
+	printf("(checksum %g)\n", sum);
+}
+
+//=======================================================================
+// Particles
+//=======================================================================
+
+// What the particles used to look like in most engines: one struct each, removed by swapping in the last
+struct LegacyParticle {
+	float x, y, z;
+	float vx, vy, vz;
+	float life;
+};
+
+// Holding 25k to 400k live particles steady, with some dying and as many emitted every tick
+static void BenchParticles()
+{
+	printf("particles: ms per tick, SSE pools vs one struct per particle\n");
+	printf("%8s  %10s  %10s  %10s  %12s\n", "live", "update", "+pack", "structs", "died/tick");
+
+	int counts[] = { 25000, 100000, 200000, 400000 };
+	for (int c = 0; c < 4; c++)
+	{
+		int live = counts[c];
+		int perType = live / PARTICLE_TYPE_COUNT + 1000;
+
+		ParticleSystem particles;
+		particles.Reserve(perType);
+
+		// Fill every pool, then let it settle into dying and being topped up
+		for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+			particles.Emit((ParticleType)t, 0.0f, 5.0f, 0.0f, live / PARTICLE_TYPE_COUNT);
+
+		int ticks = 120;
+		long long died = 0;
+		double updateMs = 0.0, packMs = 0.0;
+		for (int tick = 0; tick < ticks; tick++)
+		{
+			int before = particles.Count();
+
+			BenchClock::time_point start = BenchClock::now();
+			particles.Update(1.0f / 60.0f);
+			updateMs += ElapsedMs(start);
+
+			start = BenchClock::now();
+			for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+				particles.PackVertices((ParticleType)t);
+			packMs += ElapsedMs(start);
+
+			// Top every pool back up (not timed, it's the same either way)
+			died += before - particles.Count();
+			for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+			{
+				int missing = live / PARTICLE_TYPE_COUNT - particles.Count((ParticleType)t);
+				if (missing > 0)
+					particles.Emit((ParticleType)t, 0.0f, 5.0f, 0.0f, missing);
+			}
+		}
+
+		// The same work on an array of structs, taking the lives of the first run's particles
+		std::vector<LegacyParticle> legacy(live);
+		std::mt19937 gen(1234);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		for (int i = 0; i < live; i++)
+		{
+			LegacyParticle &p = legacy[i];
+			p.x = 0.0f; p.y = 5.0f; p.z = 0.0f;
+			p.vx = unit(gen) - 0.5f; p.vy = unit(gen) * 3.0f; p.vz = unit(gen) - 0.5f;
+			p.life = 0.4f + unit(gen);
+		}
+
+		double legacyMs = 0.0;
+		for (int tick = 0; tick < ticks; tick++)
+		{
+			float dt = 1.0f / 60.0f;
+			BenchClock::time_point start = BenchClock::now();
+			for (size_t i = 0; i < legacy.size();)
+			{
+				LegacyParticle &p = legacy[i];
+				p.life -= dt;
+				if (p.life <= 0.0f)
+				{
+					p = legacy.back();
+					legacy.pop_back();
+					continue;
+				}
+
+				p.vx *= 0.98f; p.vy = p.vy * 0.98f - 9.8f * dt; p.vz *= 0.98f;
+				p.x += p.vx * dt; p.y += p.vy * dt; p.z += p.vz * dt;
+				if (p.y < 0.0f)
+				{
+					p.y = 0.0f;
+					p.vx = p.vy = p.vz = 0.0f;
+				}
+				i++;
+			}
+			legacyMs += ElapsedMs(start);
+
+			// Top back up
+			while ((int)legacy.size() < live)
+			{
+				LegacyParticle p = { 0.0f, 5.0f, 0.0f, unit(gen) - 0.5f, unit(gen) * 3.0f, unit(gen) - 0.5f, 0.4f + unit(gen) };
+				legacy.push_back(p);
+			}
+		}
+
+		printf("%8d  %10.3f  %10.3f  %10.3f  %12lld\n", live, updateMs / ticks, (updateMs + packMs) / ticks,
+			legacyMs / ticks, died / ticks);
+	}
+}
+
+//=======================================================================
+// Image Decoding
+//=======================================================================
+
+// A whole file, empty if it isn't there
+static std::vector<unsigned char> ReadWholeFile(const char *path)
+{
+	std::vector<unsigned char> data;
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return data;
+
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (length > 0)
+	{
+		data.resize(length);
+		data.resize(fread(&data[0], 1, length, f));
+	}
+	fclose(f);
+	return data;
+}
+
+// Writes decoded RGB pixels back out as a targa: 24 or 32 bits (alpha made up from green), raw or RLE
+static std::vector<unsigned char> MakeTarga(const unsigned char *rgb, int width, int height, bool alpha, bool rle)
+{
+	int bytes = alpha ? 4 : 3;
+	std::vector<unsigned char> pixels((size_t)width * height * bytes);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+	{
+		unsigned char *p = &pixels[i * bytes];
+		p[0] = rgb[i * 3 + 2];
+		p[1] = rgb[i * 3 + 1];
+		p[2] = rgb[i * 3];
+		if (alpha)
+			p[3] = rgb[i * 3 + 1];
+	}
+
+	unsigned char header[18] = { 0 };
+	header[2] = rle ? 10 : 2;
+	header[12] = (unsigned char)width; header[13] = (unsigned char)(width >> 8);
+	header[14] = (unsigned char)height; header[15] = (unsigned char)(height >> 8);
+	header[16] = (unsigned char)(bytes * 8);
+	header[17] = alpha ? 8 : 0;
+
+	std::vector<unsigned char> tga(header, header + 18);
+	if (!rle)
+	{
+		tga.insert(tga.end(), pixels.begin(), pixels.end());
+		return tga;
+	}
+
+	// Runs of the same pixel as one packet, everything else in raw packets
+	size_t count = (size_t)width * height;
+	for (size_t i = 0; i < count;)
+	{
+		size_t run = 1;
+		while (i + run < count && run < 128 && memcmp(&pixels[(i + run) * bytes], &pixels[i * bytes], bytes) == 0)
+			run++;
+
+		if (run > 1)
+		{
+			tga.push_back((unsigned char)(0x80 | (run - 1)));
+			tga.insert(tga.end(), &pixels[i * bytes], &pixels[i * bytes] + bytes);
+			i += run;
+			continue;
+		}
+
+		size_t raw = 1;
+		while (i + raw < count && raw < 128 && memcmp(&pixels[(i + raw) * bytes], &pixels[(i + raw - 1) * bytes], bytes) != 0)
+			raw++;
+		tga.push_back((unsigned char)(raw - 1));
+		tga.insert(tga.end(), &pixels[i * bytes], &pixels[(i + raw) * bytes]);
+		i += raw;
+	}
+	return tga;
+}
+
+// The same pixels as a 32 bit bitmap
+static std::vector<unsigned char> MakeBitmap32(const unsigned char *rgb, int width, int height)
+{
+	unsigned char header[54] = { 0 };
+	unsigned int size = 54 + width * height * 4;
+	header[0] = 'B'; header[1] = 'M';
+	memcpy(header + 2, &size, 4);
+	header[10] = 54;
+	header[14] = 40;
+	memcpy(header + 18, &width, 4);
+	memcpy(header + 22, &height, 4);
+	header[26] = 1;
+	header[28] = 32;
+
+	std::vector<unsigned char> bmp(header, header + 54);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+	{
+		bmp.push_back(rgb[i * 3 + 2]);
+		bmp.push_back(rgb[i * 3 + 1]);
+		bmp.push_back(rgb[i * 3]);
+		bmp.push_back(0);
+	}
+	return bmp;
+}
+
+// Decoding the game's own bitmaps and pngs (and targas made from the bitmaps), MB/s in and out
+static void BenchImages()
+{
+	ImageDecoder decoder;
+	ImageInfo info;
+
+	// The cave's and the treasure's textures, the biggest the game loads
+	std::vector<std::vector<unsigned char> > formats[6];
+	const char *formatNames[6] = { "bmp 24", "bmp 32", "tga 24", "tga 32", "tga rle", "png" };
+	char path[64];
+	for (int i = 0; i < 19; i++)
+	{
+		if (i < 16)
+			sprintf(path, "models/cave/c%d.bmp", i);
+		else
+			sprintf(path, "models/treasure/t%d.bmp", i - 15);
+
+		std::vector<unsigned char> bmp = ReadWholeFile(path);
+		unsigned char *rgb = bmp.empty() ? 0 : decoder.Decode(&bmp[0], bmp.size(), info);
+		if (!rgb || info.channels != 3)
+			continue;
+
+		// Decode() reuses its buffer, so copy before making the others
+		std::vector<unsigned char> pixels(rgb, rgb + (size_t)info.width * info.height * 3);
+		formats[0].push_back(bmp);
+		formats[1].push_back(MakeBitmap32(&pixels[0], info.width, info.height));
+		formats[2].push_back(MakeTarga(&pixels[0], info.width, info.height, false, false));
+		formats[3].push_back(MakeTarga(&pixels[0], info.width, info.height, true, false));
+		formats[4].push_back(MakeTarga(&pixels[0], info.width, info.height, false, true));
+	}
+	for (int i = 0; i < 26; i++)
+	{
+		if (i < 16)
+			sprintf(path, "models/cave/texture%03d.png", i);
+		else if (i < 25)
+			sprintf(path, "models/treasure/%d.png", i - 16);
+		else
+			sprintf(path, "models/snake/TopiaryLion_SM.png");
+
+		std::vector<unsigned char> png = ReadWholeFile(path);
+		if (!png.empty())
+			formats[5].push_back(png);
+	}
+
+	printf("images: decoding into a reused buffer\n");
+	printf("%-8s  %6s  %10s  %10s  %10s  %10s\n", "format", "files", "MB in", "MB out", "MB/s in", "MB/s out");
+
+	for (int f = 0; f < 6; f++)
+	{
+		std::vector<std::vector<unsigned char> > &files = formats[f];
+		if (files.empty())
+		{
+			printf("%-8s  (no files, run from the game's folder)\n", formatNames[f]);
+			continue;
+		}
+
+		// Passes over every file until a quarter second has gone by
+		double in = 0.0, out = 0.0, ms = 0.0;
+		int passes = 0;
+		bool failed = false;
+		while (ms < 250.0 && !failed)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			for (size_t i = 0; i < files.size(); i++)
+			{
+				if (!decoder.Decode(&files[i][0], files[i].size(), info))
+				{
+					printf("%-8s  failed: %s\n", formatNames[f], decoder.Error());
+					failed = true;
+					break;
+				}
+				if (passes == 0)
+				{
+					in += files[i].size() / 1048576.0;
+					out += (double)info.width * info.height * info.channels / 1048576.0;
+				}
+			}
+			ms += ElapsedMs(start);
+			passes++;
+		}
+		if (failed)
+			continue;
+
+		double seconds = ms / 1000.0 / passes;
+		printf("%-8s  %6d  %10.2f  %10.2f  %10.1f  %10.1f\n", formatNames[f], (int)files.size(), in, out, in / seconds, out / seconds);
+	}
+
+	// Red and blue swapped over a 1024 x 1024 image, SSE2 against a byte at a time
+	int pixels = 1024 * 1024;
+	std::vector<unsigned char> src(pixels * 4), dst(pixels * 4);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = (unsigned char)(i * 7);
+
+	printf("%-8s  %10s  %10s\n", "swizzle", "SSE2 MB/s", "bytes MB/s");
+	for (int bytes = 3; bytes <= 4; bytes++)
+	{
+		int reps = 50;
+		BenchClock::time_point start = BenchClock::now();
+		for (int r = 0; r < reps; r++)
+		{
+			if (bytes == 3)
+				ImageDecoder::SwizzleBGR(&src[0], &dst[0], pixels);
+			else
+				ImageDecoder::SwizzleBGRA(&src[0], &dst[0], pixels, false);
+		}
+		double simdMs = ElapsedMs(start) / reps;
+
+		// The loop the targa loader used to run
+		start = BenchClock::now();
+		for (int r = 0; r < reps; r++)
+		{
+			memcpy(&dst[0], &src[0], (size_t)pixels * bytes);
+			for (int i = 0; i < pixels * bytes; i += bytes)
+			{
+				unsigned char temp = dst[i];
+				dst[i] = dst[i + 2];
+				dst[i + 2] = temp;
+			}
+		}
+		double scalarMs = ElapsedMs(start) / reps;
+
+		double mb = (double)pixels * bytes / 1048576.0;
+		printf("%-8s  %10.1f  %10.1f\n", bytes == 3 ? "BGR" : "BGRA", mb / (simdMs / 1000.0), mb / (scalarMs / 1000.0));
+	}
+}
+
+//=======================================================================
+// Block Compression
+//=======================================================================
+
+// A BC1 color block back into 16 RGB pixels, the way the card reads it
+static void DecodeBC1(const unsigned char *block, unsigned char *rgb)
+{
+	int colors[4][3];
+	unsigned short c0 = block[0] | (block[1] << 8);
+	unsigned short c1 = block[2] | (block[3] << 8);
+	unsigned short ends[2] = { c0, c1 };
+	for (int e = 0; e < 2; e++)
+	{
+		int r = (ends[e] >> 11) & 31, g = (ends[e] >> 5) & 63, b = ends[e] & 31;
+		colors[e][0] = (r << 3) | (r >> 2);
+		colors[e][1] = (g << 2) | (g >> 4);
+		colors[e][2] = (b << 3) | (b >> 2);
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		colors[2][k] = c0 > c1 ? (2 * colors[0][k] + colors[1][k]) / 3 : (colors[0][k] + colors[1][k]) / 2;
+		colors[3][k] = c0 > c1 ? (colors[0][k] + 2 * colors[1][k]) / 3 : 0;
+	}
+
+	unsigned int indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+	for (int i = 0; i < 16; i++)
+	{
+		int *color = colors[(indices >> (2 * i)) & 3];
+		rgb[i * 3 + 0] = (unsigned char)color[0];
+		rgb[i * 3 + 1] = (unsigned char)color[1];
+		rgb[i * 3 + 2] = (unsigned char)color[2];
+	}
+}
+
+static void BenchDds()
+{
+	ImageDecoder decoder;
+	ImageInfo info;
+
+	// The cave's and the treasure's textures, made RGBA
+	std::vector<std::vector<unsigned char> > images;
+	std::vector<ImageInfo> infos;
+	char path[64];
+	for (int i = 0; i < 19; i++)
+	{
+		if (i < 16)
+			sprintf(path, "models/cave/c%d.bmp", i);
+		else
+			sprintf(path, "models/treasure/t%d.bmp", i - 15);
+
+		unsigned char *pixels = decoder.DecodeFile(path, info);
+		if (!pixels)
+			continue;
+
+		int count = info.width * info.height;
+		std::vector<unsigned char> rgba((size_t)count * 4);
+		for (int p = 0; p < count; p++)
+		{
+			for (int k = 0; k < 3; k++)
+				rgba[p * 4 + k] = pixels[p * info.channels + k];
+			rgba[p * 4 + 3] = info.channels == 4 ? pixels[p * 4 + 3] : 255;
+		}
+		images.push_back(rgba);
+		infos.push_back(info);
+	}
+	if (images.empty())
+	{
+		printf("dds: no textures, run from the game's folder\n");
+		return;
+	}
+
+	printf("dds: compressing %d textures with their mipmaps\n", (int)images.size());
+
+	// Passes until a second has gone by
+	std::vector<unsigned char> dds;
+	double pixelsMB = 0.0, rawBytes = 0.0, ddsBytes = 0.0, ms = 0.0;
+	int passes = 0;
+	while (ms < 1000.0)
+	{
+		BenchClock::time_point start = BenchClock::now();
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			TextureCompressor::Compress(&images[i][0], infos[i].width, infos[i].height, dds);
+			if (passes == 0)
+			{
+				pixelsMB += images[i].size() / 1048576.0;
+				rawBytes += infos[i].width * infos[i].height * 3 * 4.0 / 3.0;
+				ddsBytes += dds.size() - 128;
+			}
+		}
+		ms += ElapsedMs(start);
+		passes++;
+	}
+
+	// How far the top level is from the original, over every texture
+	double squares = 0.0, samples = 0.0;
+	unsigned char decoded[16 * 3];
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		TextureCompressor::Compress(&images[i][0], infos[i].width, infos[i].height, dds);
+		bool bc3 = dds[87] == '5';
+		const unsigned char *block = &dds[128] + (bc3 ? 8 : 0);
+		int width = infos[i].width, height = infos[i].height;
+		for (int by = 0; by < height; by += 4)
+		{
+			for (int bx = 0; bx < width; bx += 4, block += bc3 ? 16 : 8)
+			{
+				DecodeBC1(block, decoded);
+				for (int p = 0; p < 16; p++)
+				{
+					int x = bx + (p & 3), y = by + (p >> 2);
+					if (x >= width || y >= height)
+						continue;
+					const unsigned char *original = &images[i][((size_t)y * width + x) * 4];
+					for (int k = 0; k < 3; k++)
+					{
+						double error = (double)decoded[p * 3 + k] - original[k];
+						squares += error * error;
+					}
+					samples += 3;
+				}
+			}
+		}
+	}
+	double mse = squares / samples;
+	double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+
+	double seconds = ms / 1000.0 / passes;
+	printf("%-22s  %10.1f\n", "encode MB/s (RGBA in)", pixelsMB / seconds);
+	printf("%-22s  %10.1f\n", "RGB + mips (MB)", rawBytes / 1048576.0);
+	printf("%-22s  %10.1f\n", "DDS (MB)", ddsBytes / 1048576.0);
+	printf("%-22s  %9.1fx\n", "smaller by", rawBytes / ddsBytes);
+	printf("%-22s  %10.2f\n", "PSNR (dB)", psnr);
+}
+
+//=======================================================================
+// Mipmaps
+//=======================================================================
+
+// The next level down a byte at a time, what the builder's SSE2 has to match
+static void HalveScalar(const unsigned char *src, int width, int height, int channels, unsigned char *dst)
+{
+	int w = width > 1 ? width / 2 : 1;
+	int h = height > 1 ? height / 2 : 1;
+	for (int y = 0; y < h; y++)
+	{
+		const unsigned char *row0 = src + (size_t)(height > 1 ? y * 2 : y) * width * channels;
+		const unsigned char *row1 = height > 1 ? row0 + (size_t)width * channels : row0;
+		for (int x = 0; x < w; x++)
+		{
+			int x0 = (width > 1 ? x * 2 : x) * channels, x1 = (width > 1 ? x * 2 + 1 : x) * channels;
+			for (int c = 0; c < channels; c++)
+				dst[((size_t)y * w + x) * channels + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+		}
+	}
+}
+
+static void BenchMipmaps()
+{
+	ImageDecoder decoder;
+	ImageInfo info;
+
+	// The cave's and the treasure's textures, as RGB and made RGBA
+	std::vector<std::vector<unsigned char> > images[2];
+	std::vector<ImageInfo> infos;
+	char path[64];
+	for (int i = 0; i < 19; i++)
+	{
+		if (i < 16)
+			sprintf(path, "models/cave/c%d.bmp", i);
+		else
+			sprintf(path, "models/treasure/t%d.bmp", i - 15);
+
+		unsigned char *pixels = decoder.DecodeFile(path, info);
+		if (!pixels || info.channels != 3)
+			continue;
+
+		int count = info.width * info.height;
+		std::vector<unsigned char> rgba((size_t)count * 4);
+		for (int p = 0; p < count; p++)
+		{
+			memcpy(&rgba[p * 4], pixels + p * 3, 3);
+			rgba[p * 4 + 3] = 255;
+		}
+		images[0].push_back(std::vector<unsigned char>(pixels, pixels + (size_t)count * 3));
+		images[1].push_back(rgba);
+		infos.push_back(info);
+	}
+	if (infos.empty())
+	{
+		printf("mipmaps: no textures, run from the game's folder\n");
+		return;
+	}
+
+	JobSystem jobs;
+	jobs.Start(0);
+	MipmapBuilder builder;
+
+	printf("mipmaps: every level below %d textures, ms a pass (%d threads)\n", (int)infos.size(), jobs.NumThreads());
+	printf("%-8s  %10s  %10s  %10s  %10s  %10s\n", "format", "scalar", "SSE2", "SSE2 jobs", "sRGB", "same");
+
+	for (int f = 0; f < 2; f++)
+	{
+		int channels = f == 0 ? 3 : 4;
+		std::vector<std::vector<unsigned char> > &files = images[f];
+
+		// Byte at a time, the way every level used to be built
+		std::vector<unsigned char> level, next;
+		double times[4] = { 0.0, 0.0, 0.0, 0.0 };
+		int reps = 5;
+		for (int r = 0; r < reps; r++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			for (size_t i = 0; i < files.size(); i++)
+			{
+				int w = infos[i].width, h = infos[i].height;
+				level = files[i];
+				while (w > 1 || h > 1)
+				{
+					next.resize((size_t)(w > 1 ? w / 2 : 1) * (h > 1 ? h / 2 : 1) * channels);
+					HalveScalar(&level[0], w, h, channels, &next[0]);
+					level.swap(next);
+					w = w > 1 ? w / 2 : 1;
+					h = h > 1 ? h / 2 : 1;
+				}
+			}
+			times[0] += ElapsedMs(start);
+
+			for (int mode = 1; mode < 4; mode++)
+			{
+				start = BenchClock::now();
+				for (size_t i = 0; i < files.size(); i++)
+					builder.Build(&files[i][0], infos[i].width, infos[i].height, channels, mode == 3, mode >= 2 ? &jobs : 0);
+				times[mode] += ElapsedMs(start);
+			}
+		}
+
+		// Every level has to come out the same as the byte at a time ones
+		bool same = true;
+		for (size_t i = 0; i < files.size() && same; i++)
+		{
+			int count = builder.Build(&files[i][0], infos[i].width, infos[i].height, channels, false, &jobs);
+			level = files[i];
+			int w = infos[i].width, h = infos[i].height;
+			for (int l = 1; l < count && same; l++)
+			{
+				next.resize((size_t)(w > 1 ? w / 2 : 1) * (h > 1 ? h / 2 : 1) * channels);
+				HalveScalar(&level[0], w, h, channels, &next[0]);
+				level.swap(next);
+				const unsigned char *built = builder.Level(l, w, h);
+				same = memcmp(built, &level[0], level.size()) == 0;
+			}
+		}
+
+		printf("%-8s  %10.2f  %10.2f  %10.2f  %10.2f  %10s\n", f == 0 ? "RGB" : "RGBA",
+			times[0] / reps, times[1] / reps, times[2] / reps, times[3] / reps, same ? "yes" : "NO");
+	}
+
+	// The whole upload, against gluBuild2DMipmaps (needs the window's GL context)
+	if (!glGetString(GL_VERSION))
+		return;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	MipmapBuilder::SetJobSystem(&jobs);
+
+	double gluMs = 0.0, uploadMs = 0.0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		glFinish();
+		BenchClock::time_point start = BenchClock::now();
+		for (size_t i = 0; i < images[0].size(); i++)
+		{
+			if (pass == 0)
+				gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGB, infos[i].width, infos[i].height, GL_RGB, GL_UNSIGNED_BYTE, &images[0][i][0]);
+			else
+				MipmapBuilder::Upload(&images[0][i][0], infos[i].width, infos[i].height, 3);
+		}
+		glFinish();
+		(pass == 0 ? gluMs : uploadMs) = ElapsedMs(start);
+	}
+	printf("%-22s  %10.2f\n", "gluBuild2DMipmaps (ms)", gluMs);
+	printf("%-22s  %10.2f  (%s)\n", "Upload (ms)", uploadMs,
+		GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object || GLEW_EXT_framebuffer_object ? "glGenerateMipmap" : "built here");
+
+	MipmapBuilder::SetJobSystem(0);
+	glDeleteTextures(1, &texture);
+}
+
+//=======================================================================
+// Texture Streaming
+//=======================================================================
+
+static void BenchStreaming()
+{
+	// Uploads need the window's GL context
+	if (!glGetString(GL_VERSION))
+	{
+		printf("streaming: needs a GL context\n");
+		return;
+	}
+
+	// The cave's and the treasure's textures and the ground and sky, what the cave loads mid-frame and more
+	std::vector<std::string> paths;
+	char path[64];
+	for (int i = 0; i < 19; i++)
+	{
+		if (i < 16)
+			sprintf(path, "models/cave/c%d.bmp", i);
+		else
+			sprintf(path, "models/treasure/t%d.bmp", i - 15);
+		paths.push_back(path);
+	}
+	paths.push_back("textures/sand.bmp");
+	paths.push_back("textures/blu-sky-3.bmp");
+	paths.push_back("textures/caveLand.bmp");
+	paths.push_back("textures/ground.bmp");
+
+	JobSystem jobs;
+	jobs.Start(0);
+	MipmapBuilder::SetJobSystem(&jobs);
+	TextureManager &textures = TextureManager::Shared();
+	std::vector<TextureHandle> handles;
+
+	// All at once, the way a frame that loads them stalls
+	glFinish();
+	BenchClock::time_point start = BenchClock::now();
+	for (size_t i = 0; i < paths.size(); i++)
+		handles.push_back(textures.Load(paths[i].c_str()));
+	glFinish();
+	double atOnceMs = ElapsedMs(start);
+	size_t bytes = textures.LiveBytes();
+	handles.clear();
+
+	printf("streaming: %d textures, %.2f MB with their mipmaps\n", (int)paths.size(), bytes / (1024.0 * 1024.0));
+	printf("%-12s  %10s  %10s  %10s  %10s  %10s\n", "budget KB", "Load() ms", "frames", "worst ms", "mean ms", "total ms");
+	printf("%-12s  %10.2f  %10d  %10.2f  %10.2f  %10.2f\n", "at once", atOnceMs, 1, atOnceMs, atOnceMs, atOnceMs);
+
+	// Streamed: what each frame pays (taking the decoded files and uploading its share) until all are in
+	size_t budgets[] = { 128, 512, 2048 };
+	for (int b = 0; b < 3; b++)
+	{
+		TextureStreamer streamer;
+		streamer.Init(&jobs);
+		streamer.budget = budgets[b] * 1024;
+		textures.SetStreamer(&streamer);
+
+		glFinish();
+		start = BenchClock::now();
+		for (size_t i = 0; i < paths.size(); i++)
+			handles.push_back(textures.Load(paths[i].c_str()));
+		double loadMs = ElapsedMs(start);
+
+		int frames = 0;
+		double worstMs = 0.0, sumMs = 0.0;
+		bool resident = false;
+		while (!resident)
+		{
+			BenchClock::time_point frame = BenchClock::now();
+			jobs.RunMainJobs();
+			streamer.Update();
+			double ms = ElapsedMs(frame);
+			worstMs = ms > worstMs ? ms : worstMs;
+			sumMs += ms;
+			frames++;
+
+			resident = true;
+			for (size_t i = 0; i < handles.size(); i++)
+				resident = resident && handles[i].Resident();
+
+			// The rest of the frame, while the workers decode
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+		glFinish();
+		double totalMs = ElapsedMs(start);
+
+		printf("%-12d  %10.2f  %10d  %10.2f  %10.2f  %10.2f\n", (int)budgets[b], loadMs, frames, worstMs, sumMs / frames, totalMs);
+
+		handles.clear();
+		textures.SetStreamer(0);
+	}
+
+	MipmapBuilder::SetJobSystem(0);
+}
+
+//=======================================================================
+// Texture Cache
+//=======================================================================
+
+static void BenchTextureCache()
+{
+	// Every texture the game decodes (the .3ds models' bitmaps and pngs, the ground and the sky)
+	std::vector<std::string> paths;
+	char path[64];
+	for (int i = 0; i < 16; i++)
+	{
+		sprintf(path, "models/cave/c%d.bmp", i);
+		paths.push_back(path);
+		sprintf(path, "models/cave/texture%03d.png", i);
+		paths.push_back(path);
+	}
+	for (int i = 1; i <= 3; i++)
+	{
+		sprintf(path, "models/treasure/t%d.bmp", i);
+		paths.push_back(path);
+	}
+	paths.push_back("textures/sand.bmp");
+	paths.push_back("textures/blu-sky-3.bmp");
+	paths.push_back("textures/caveLand.bmp");
+	paths.push_back("textures/ground.bmp");
+
+	JobSystem jobs;
+	jobs.Start(0);
+
+	// A folder of its own, emptied first so the first pass is a cold start
+	TextureCache cache;
+	if (!cache.Open("texcache-bench", &jobs))
+		return;
+	cache.Clear();
+
+	bool gl = glGetString(GL_VERSION) != 0;
+	GLuint texture = 0;
+	if (gl)
+		glGenTextures(1, &texture);
+
+	printf("texture cache: %d files%s\n", (int)paths.size(), gl ? ", uploaded too" : " (no GL context, not uploaded)");
+	printf("%-10s  %10s  %10s  %10s  %10s\n", "start", "ms", "hits", "misses", "MB");
+
+	const char *passes[] = { "cold", "warm" };
+	for (int pass = 0; pass < 2; pass++)
+	{
+		TextureCache::Stats before = cache.stats;
+		size_t bytes = 0;
+
+		BenchClock::time_point start = BenchClock::now();
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			TextureCache::Chain chain;
+			if (!cache.Get(paths[i].c_str(), chain))
+				continue;
+			bytes += chain.Bytes();
+
+			if (gl)
+			{
+				glBindTexture(GL_TEXTURE_2D, texture);
+				chain.Upload();
+			}
+		}
+		if (gl)
+			glFinish();
+		double ms = ElapsedMs(start);
+
+		printf("%-10s  %10.2f  %10d  %10d  %10.2f\n", passes[pass], ms, cache.stats.hits - before.hits,
+			cache.stats.misses - before.misses, bytes / (1024.0 * 1024.0));
+	}
+
+	if (gl)
+		glDeleteTextures(1, &texture);
+	cache.Clear();
+}
+
+//=======================================================================
+// Audio Mixer
+//=======================================================================
+
+// Two seconds of a tone, a different one on each side if it's stereo
+static void MakeTone(AudioMixer::Clip &clip, int rate, int channels, float hz)
+{
+	clip.rate = rate;
+	clip.channels = channels;
+	clip.frames = rate * 2;
+	clip.samples.resize(clip.frames * channels);
+	for (int i = 0; i < clip.frames; i++)
+	{
+		for (int c = 0; c < channels; c++)
+			clip.samples[i * channels + c] = 0.8f * sinf(6.2831853f * hz * (c + 1) * i / rate);
+	}
+}
+
+static void BenchMixer()
+{
+	const int rate = 44100;
+	const int seconds = 10;
+
+	AudioMixer::Clip clips[4];
+	MakeTone(clips[0], 44100, 1, 440);
+	MakeTone(clips[1], 44100, 2, 330);
+	MakeTone(clips[2], 22050, 1, 550);
+	MakeTone(clips[3], 48000, 2, 220);
+	const char *names[] = { "44.1k mono", "44.1k stereo", "22k mono", "48k stereo" };
+
+	// One voice against the same blend done a frame at a time in doubles, in 16 bit steps
+	int worst = 0;
+	for (int c = 0; c < 4; c++)
+	{
+		AudioMixer mixer(rate);
+		mixer.Play(&clips[c], 0.5f, false);
+		std::vector<short> out(rate * 2);
+		mixer.Mix(&out[0], rate);
+
+		const AudioMixer::Clip &clip = clips[c];
+		double step = (double)clip.rate / rate;
+		for (int i = 0; i < rate; i++)
+		{
+			double position = i * step;
+			int index = (int)position;
+			double t = position - index;
+			for (int side = 0; side < 2; side++)
+			{
+				int channel = clip.channels == 1 ? 0 : side;
+				double a = clip.samples[index * clip.channels + channel];
+				double b = index + 1 < clip.frames ? clip.samples[(index + 1) * clip.channels + channel] : 0;
+				int expected = (int)floor((a + (b - a) * t) * 0.5 * 32767 + 0.5);
+				int error = abs(out[i * 2 + side] - expected);
+				worst = error > worst ? error : worst;
+			}
+		}
+	}
+
+	printf("audio mixer: 1 s of stereo 16 bit at %d, largest error against doubles: %d\n", rate, worst);
+
+	// The timing mixes seconds of sound, the column says how many
+	char msHeader[16];
+	sprintf_s(msHeader, sizeof(msHeader), "ms for %d s", seconds);
+	printf("%-14s  %8s  %10s  %16s\n", "clips", "voices", msHeader, "us/voice/ms");
+
+	std::vector<short> out(AudioMixer::BLOCK_FRAMES * 2);
+	const int voiceCounts[] = { 1, 4, 16 };
+	for (int c = 0; c < 4; c++)
+	{
+		for (int v = 0; v < 3; v++)
+		{
+			// Looping, so every voice plays the whole time, quiet enough that the limiter stays out of it
+			AudioMixer mixer(rate);
+			for (int i = 0; i < voiceCounts[v]; i++)
+				mixer.Play(&clips[c], 1.0f / voiceCounts[v], true);
+
+			BenchClock::time_point start = BenchClock::now();
+			for (int frames = 0; frames < rate * seconds; frames += AudioMixer::BLOCK_FRAMES)
+				mixer.Mix(&out[0], AudioMixer::BLOCK_FRAMES);
+			double ms = ElapsedMs(start);
+
+			printf("%-14s  %8d  %10.2f  %16.4f\n", names[c], voiceCounts[v], ms, ms * 1000 / (voiceCounts[v] * seconds * 1000.0));
+		}
+	}
+}
+
+//=======================================================================
+// Entry Point
+//=======================================================================
+
+bool RunBenchmark(const char *name)
+{
+	bool all = strcmp(name, "all") == 0;
+	bool found = false;
+
+	if (all || strcmp(name, "renderqueue") == 0)
+	{
+		BenchRenderQueue();
+		found = true;
+	}
+
+	if (all || strcmp(name, "lighting") == 0)
+	{
+		BenchLighting();
+		found = true;
+	}
+
+	if (all || strcmp(name, "spatialgrid") == 0)
+	{
+		BenchSpatialGrid();
+		found = true;
+	}
+
+	if (all || strcmp(name, "triggers") == 0)
+	{
+		BenchTriggers();
+		found = true;
+	}
+
+	if (all || strcmp(name, "placement") == 0)
+	{
+		BenchPlacement();
+		found = true;
+	}
+
+	if (all || strcmp(name, "ecs") == 0)
+	{
+		BenchEntityStore();
+		found = true;
+	}
+
+	if (all || strcmp(name, "pool") == 0)
+	{
+		BenchEntityPool();
+		found = true;
+	}
+
+	if (all || strcmp(name, "bvh") == 0)
+	{
+		BenchCollisionMesh();
+		found = true;
+	}
+
+	if (all || strcmp(name, "flowfield") == 0)
+	{
+		BenchFlowField();
+		found = true;
+	}
+
+	if (all || strcmp(name, "jobs") == 0)
+	{
+		BenchJobs();
+		found = true;
+	}
+
+	if (all || strcmp(name, "particles") == 0)
+	{
+		BenchParticles();
+		found = true;
+	}
+
+	if (all || strcmp(name, "images") == 0)
+	{
+		BenchImages();
+		found = true;
+	}
+
+	if (all || strcmp(name, "dds") == 0)
+	{
+		BenchDds();
+		found = true;
+	}
+
+	if (all || strcmp(name, "mipmaps") == 0)
+	{
+		BenchMipmaps();
+		found = true;
+	}
+
+	if (all || strcmp(name, "streaming") == 0)
+	{
+		BenchStreaming();
+		found = true;
+	}
+
+	if (all || strcmp(name, "texcache") == 0)
+	{
+		BenchTextureCache();
+		found = true;
+	}
+
+	if (all || strcmp(name, "mixer") == 0)
+	{
+		BenchMixer();
+		found = true;
+	}
+
+	if (!found)
+		printf("Unknown benchmark \"%s\"\n", name);
+
+	return found;
+}
@@ -0,0 +1,22 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Benchmarks
+//
+// Benchmark.h: timing runs for the engine's hot paths.
+// They are run from the command line instead of the game:
+//
+// OpenGLMeshLoader19.exe -bench renderqueue
+//
+// The window is created before the benchmark starts so the
+// ones that need a GL context have one. Results are printed
+// to the console.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Runs the named benchmark ("all" runs every one), returns false if there is no such benchmark
+bool RunBenchmark(const char *name);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,523 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Clustered Forward Lighting
+//
+// ClusteredLighting.cpp: implementation of the ClusteredLighting class.
+// See ClusteredLighting.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "ClusteredLighting.h"
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CLUSTERS_PER_SLICE	(CLUSTER_TILES_X * CLUSTER_TILES_Y)
+
+// A macro's value as a string, for handing the cluster sizes to the shader
+#define STRINGIZE(x)		#x
+#define MACRO_STRING(x)		STRINGIZE(x)
+
+// Passes the view space position and normal on to the fragment shader
+static const char *vertexSource =
+	"#version 130\n"
+	"out vec3 viewPos;\n"
+	"out vec3 viewNormal;\n"
+	"out vec2 uv;\n"
+	"out vec4 color;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 p = gl_ModelViewMatrix * gl_Vertex;\n"
+	"	viewPos = p.xyz;\n"
+	"	viewNormal = gl_NormalMatrix * gl_Normal;\n"
+	"	uv = gl_MultiTexCoord0.xy;\n"
+	"	color = gl_Color;\n"
+	"	gl_Position = gl_ProjectionMatrix * p;\n"
+	"}\n";
+
+// Finds the fragment's cluster and adds up the sun and the lights in it
+// (no #version, it goes after the one of the shader that uses it)
+static const char *shadingSource =
+	"#define CLUSTER_TILES_X " MACRO_STRING(CLUSTER_TILES_X) "\n"
+	"#define CLUSTER_TILES_Y " MACRO_STRING(CLUSTER_TILES_Y) "\n"
+	"#define CLUSTER_SLICES " MACRO_STRING(CLUSTER_SLICES) "\n"
+	"#define CLUSTER_INDEX_WIDTH " MACRO_STRING(CLUSTER_INDEX_WIDTH) "u\n"
+	"uniform sampler2D lightTex;\n"
+	"uniform usampler2D clusterTex;\n"
+	"uniform usampler2D indexTex;\n"
+	"uniform vec4 clusterScale;\n"	// x, y: pixels to tiles, z, w: depth to slice
+	"uniform vec3 sunDir;\n"
+	"uniform vec3 sunColor;\n"
+	"uniform vec3 ambient;\n"
+	"vec3 clusterLight(vec3 viewPos, vec3 n)\n"
+	"{\n"
+	"	vec3 light = ambient + sunColor * max(dot(n, sunDir), 0.0);\n"
+	"	int cx = clamp(int(gl_FragCoord.x * clusterScale.x), 0, CLUSTER_TILES_X - 1);\n"
+	"	int cy = clamp(int(gl_FragCoord.y * clusterScale.y), 0, CLUSTER_TILES_Y - 1);\n"
+	"	int cz = clamp(int(log(max(-viewPos.z, 0.0001)) * clusterScale.z - clusterScale.w), 0, CLUSTER_SLICES - 1);\n"
+	"	uvec2 cluster = texelFetch(clusterTex, ivec2(cx + cy * CLUSTER_TILES_X, cz), 0).xy;\n"
+	"	for (uint i = 0u; i < cluster.y; i++)\n"
+	"	{\n"
+	"		uint index = cluster.x + i;\n"
+	"		int l = int(texelFetch(indexTex, ivec2(int(index % CLUSTER_INDEX_WIDTH), int(index / CLUSTER_INDEX_WIDTH)), 0).r);\n"
+	"		vec4 posRadius = texelFetch(lightTex, ivec2(l, 0), 0);\n"
+	"		vec4 colorIntensity = texelFetch(lightTex, ivec2(l, 1), 0);\n"
+	"		vec3 d = posRadius.xyz - viewPos;\n"
+	"		float dist = length(d);\n"
+	"		float fade = clamp(1.0 - dist / posRadius.w, 0.0, 1.0);\n"
+	"		light += colorIntensity.rgb * colorIntensity.a * fade * fade * max(dot(n, d / max(dist, 0.0001)), 0.0);\n"
+	"	}\n"
+	"	return light;\n"
+	"}\n";
+
+// The model's texture and color, lit
+static const char *fragmentSource =
+	"uniform sampler2D diffuseMap;\n"
+	"in vec3 viewPos;\n"
+	"in vec3 viewNormal;\n"
+	"in vec2 uv;\n"
+	"in vec4 color;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 base = texture(diffuseMap, uv) * color;\n"
+	"	vec3 light = clusterLight(viewPos, normalize(viewNormal));\n"
+	"	gl_FragColor = vec4(base.rgb * light, base.a);\n"
+	"}\n";
+
+// Compiles one stage of the shader from its pieces, returns 0 if it didn't compile
+static GLuint CompileShader(GLenum type, const char **sources, int count)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, count, sources, 0);
+	glCompileShader(shader);
+
+	GLint ok = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), 0, log);
+		printf("ClusteredLighting: shader didn't compile:\n%s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+ClusteredLighting::ClusteredLighting()
+{
+	supported = false;
+	nearSlice = 0.5f;
+	farSlice = 200.0f;
+
+	program = 0;
+	lightTex = 0;
+	clusterTex = 0;
+	indexTex = 0;
+
+	boundsProj[0] = boundsProj[1] = 0.0f;
+	tileScale[0] = tileScale[1] = 0.0f;
+	sliceScale = 0.0f;
+	sliceBias = 0.0f;
+	memset(sunView, 0, sizeof(sunView));
+	memset(sunColor, 0, sizeof(sunColor));
+	memset(ambient, 0, sizeof(ambient));
+
+	memset(&stats, 0, sizeof(stats));
+	memset(viewMatrix, 0, sizeof(viewMatrix));
+}
+
+ClusteredLighting::~ClusteredLighting()
+{
+
+}
+
+bool ClusteredLighting::Init()
+{
+	// Integer textures and texelFetch need OpenGL 3.0
+	if (!GLEW_VERSION_3_0)
+		return false;
+
+	const char *fragmentSources[] = { "#version 130\n", shadingSource, fragmentSource };
+	GLuint vs = CompileShader(GL_VERTEX_SHADER, &vertexSource, 1);
+	GLuint fs = CompileShader(GL_FRAGMENT_SHADER, fragmentSources, 3);
+	if (!vs || !fs)
+		return false;
+
+	program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	glLinkProgram(program);
+
+	GLint ok = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok)
+	{
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), 0, log);
+		printf("ClusteredLighting: shader didn't link:\n%s\n", log);
+		return false;
+	}
+
+	// The samplers never move so set them once
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "diffuseMap"), 0);
+	glUseProgram(0);
+
+	// Make the textures the lights are handed over in
+	glGenTextures(1, &lightTex);
+	glBindTexture(GL_TEXTURE_2D, lightTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, MAX_CLUSTER_LIGHTS, 2, 0, GL_RGBA, GL_FLOAT, 0);
+
+	glGenTextures(1, &clusterTex);
+	glBindTexture(GL_TEXTURE_2D, clusterTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, CLUSTERS_PER_SLICE, CLUSTER_SLICES, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, 0);
+
+	glGenTextures(1, &indexTex);
+	glBindTexture(GL_TEXTURE_2D, indexTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, CLUSTER_INDEX_WIDTH, MAX_CLUSTER_INDICES / CLUSTER_INDEX_WIDTH, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Reserve everything up front so binning never allocates
+	lights.reserve(MAX_CLUSTER_LIGHTS);
+	lightData.resize(MAX_CLUSTER_LIGHTS * 8);
+	clusterCounts.resize(CLUSTER_COUNT);
+	clusterData.resize(CLUSTER_COUNT * 2);
+	indices.resize(MAX_CLUSTER_INDICES);
+	clusterBounds.resize(CLUSTER_COUNT * 6);
+
+	supported = true;
+	return true;
+}
+
+void ClusteredLighting::BeginFrame()
+{
+	lights.clear();
+}
+
+void ClusteredLighting::AddLight(float x, float y, float z, float radius, float r, float g, float b, float intensity)
+{
+	if (lights.size() >= MAX_CLUSTER_LIGHTS)
+		return;
+
+	Light light = { x, y, z, radius, r, g, b, intensity };
+	lights.push_back(light);
+}
+
+int ClusteredLighting::NumLights() const
+{
+	return (int)lights.size();
+}
+
+int ClusteredLighting::SliceOf(float depth) const
+{
+	if (depth <= nearSlice)
+		return 0;
+
+	int slice = (int)(logf(depth) * sliceScale - sliceBias);
+	if (slice < 0)
+		slice = 0;
+	if (slice >= CLUSTER_SLICES)
+		slice = CLUSTER_SLICES - 1;
+
+	return slice;
+}
+
+void ClusteredLighting::BuildClusterBounds(const float *proj)
+{
+	boundsProj[0] = proj[0];
+	boundsProj[1] = proj[5];
+
+	for (int s = 0; s < CLUSTER_SLICES; s++)
+	{
+		// The depths the slice starts and ends at
+		float zNear = nearSlice * powf(farSlice / nearSlice, (float)s / CLUSTER_SLICES);
+		float zFar = nearSlice * powf(farSlice / nearSlice, (float)(s + 1) / CLUSTER_SLICES);
+
+		// Everything past the far slice falls into the last one
+		if (s == CLUSTER_SLICES - 1)
+			zFar = 1e30f;
+
+		for (int ty = 0; ty < CLUSTER_TILES_Y; ty++)
+		{
+			for (int tx = 0; tx < CLUSTER_TILES_X; tx++)
+			{
+				// The tile's corners in normalized device coordinates
+				float nx0 = -1.0f + 2.0f * tx / CLUSTER_TILES_X;
+				float nx1 = -1.0f + 2.0f * (tx + 1) / CLUSTER_TILES_X;
+				float ny0 = -1.0f + 2.0f * ty / CLUSTER_TILES_Y;
+				float ny1 = -1.0f + 2.0f * (ty + 1) / CLUSTER_TILES_Y;
+
+				// At a depth d a point at ndc n sits at n * d / proj (for a centered perspective)
+				float *b = &clusterBounds[(s * CLUSTERS_PER_SLICE + ty * CLUSTER_TILES_X + tx) * 6];
+				float xs[4] = { nx0 * zNear / proj[0], nx1 * zNear / proj[0], nx0 * zFar / proj[0], nx1 * zFar / proj[0] };
+				float ys[4] = { ny0 * zNear / proj[5], ny1 * zNear / proj[5], ny0 * zFar / proj[5], ny1 * zFar / proj[5] };
+
+				b[0] = b[3] = xs[0];
+				b[1] = b[4] = ys[0];
+				for (int i = 1; i < 4; i++)
+				{
+					if (xs[i] < b[0]) b[0] = xs[i];
+					if (xs[i] > b[3]) b[3] = xs[i];
+					if (ys[i] < b[1]) b[1] = ys[i];
+					if (ys[i] > b[4]) b[4] = ys[i];
+				}
+
+				// The camera looks down -z
+				b[2] = -zFar;
+				b[5] = -zNear;
+			}
+		}
+	}
+}
+
+void ClusteredLighting::Update(const float *view, const float *proj, int width, int height)
+{
+	if (!supported)
+		return;
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	memcpy(viewMatrix, view, sizeof(viewMatrix));
+
+	if (proj[0] != boundsProj[0] || proj[5] != boundsProj[1])
+		BuildClusterBounds(proj);
+
+	tileScale[0] = (float)CLUSTER_TILES_X / (width > 0 ? width : 1);
+	tileScale[1] = (float)CLUSTER_TILES_Y / (height > 0 ? height : 1);
+	sliceScale = CLUSTER_SLICES / logf(farSlice / nearSlice);
+	sliceBias = CLUSTER_SLICES * logf(nearSlice) / logf(farSlice / nearSlice);
+
+	memset(&clusterCounts[0], 0, clusterCounts.size() * sizeof(unsigned int));
+
+	int numPairs = 0;
+	int visible = 0;
+
+	// Two passes over the lights: the first counts the lights per cluster,
+	// the second (once the offsets are known) writes the indices
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			// Turn the counts into offsets
+			unsigned int offset = 0;
+			for (int c = 0; c < CLUSTER_COUNT; c++)
+			{
+				clusterData[c * 2] = offset;
+				clusterData[c * 2 + 1] = 0;
+				offset += clusterCounts[c];
+			}
+		}
+
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			const Light &light = lights[i];
+
+			// Take the light to view space
+			float vx = view[0] * light.x + view[4] * light.y + view[8] * light.z + view[12];
+			float vy = view[1] * light.x + view[5] * light.y + view[9] * light.z + view[13];
+			float vz = view[2] * light.x + view[6] * light.y + view[10] * light.z + view[14];
+			float r = light.radius;
+			float depth = -vz;
+
+			// Behind the camera
+			if (depth + r < nearSlice)
+				continue;
+
+			if (pass == 0)
+			{
+				float *out = &lightData[i * 4];
+				out[0] = vx; out[1] = vy; out[2] = vz; out[3] = r;
+				float *color = &lightData[(MAX_CLUSTER_LIGHTS + i) * 4];
+				color[0] = light.r; color[1] = light.g; color[2] = light.b; color[3] = light.intensity;
+			}
+
+			// The slices the sphere spans
+			int s0 = SliceOf(depth - r);
+			int s1 = SliceOf(depth + r);
+
+			// The tiles it spans: project its box, or take the whole screen if it reaches the camera
+			int tx0 = 0, tx1 = CLUSTER_TILES_X - 1;
+			int ty0 = 0, ty1 = CLUSTER_TILES_Y - 1;
+			if (depth - r > nearSlice)
+			{
+				float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+				for (int k = 0; k < 8; k++)
+				{
+					float cx = vx + ((k & 1) ? r : -r);
+					float cy = vy + ((k & 2) ? r : -r);
+					float cd = depth + ((k & 4) ? r : -r);
+					float nx = proj[0] * cx / cd;
+					float ny = proj[5] * cy / cd;
+					if (nx < minX) minX = nx;
+					if (nx > maxX) maxX = nx;
+					if (ny < minY) minY = ny;
+					if (ny > maxY) maxY = ny;
+				}
+
+				// Off the screen
+				if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+					continue;
+
+				tx0 = (int)((minX + 1.0f) * 0.5f * CLUSTER_TILES_X);
+				tx1 = (int)((maxX + 1.0f) * 0.5f * CLUSTER_TILES_X);
+				ty0 = (int)((minY + 1.0f) * 0.5f * CLUSTER_TILES_Y);
+				ty1 = (int)((maxY + 1.0f) * 0.5f * CLUSTER_TILES_Y);
+				if (tx0 < 0) tx0 = 0;
+				if (ty0 < 0) ty0 = 0;
+				if (tx1 >= CLUSTER_TILES_X) tx1 = CLUSTER_TILES_X - 1;
+				if (ty1 >= CLUSTER_TILES_Y) ty1 = CLUSTER_TILES_Y - 1;
+			}
+
+			bool touched = false;
+
+			// Test the sphere against every cluster in that range
+			for (int s = s0; s <= s1; s++)
+			{
+				for (int ty = ty0; ty <= ty1; ty++)
+				{
+					for (int tx = tx0; tx <= tx1; tx++)
+					{
+						int c = s * CLUSTERS_PER_SLICE + ty * CLUSTER_TILES_X + tx;
+						const float *b = &clusterBounds[c * 6];
+
+						// Distance from the sphere's center to the box
+						float dx = vx < b[0] ? b[0] - vx : (vx > b[3] ? vx - b[3] : 0.0f);
+						float dy = vy < b[1] ? b[1] - vy : (vy > b[4] ? vy - b[4] : 0.0f);
+						float dz = vz < b[2] ? b[2] - vz : (vz > b[5] ? vz - b[5] : 0.0f);
+						if (dx * dx + dy * dy + dz * dz > r * r)
+							continue;
+
+						touched = true;
+
+						if (pass == 0)
+						{
+							// Leave out what doesn't fit in the index texture
+							if (numPairs >= MAX_CLUSTER_INDICES)
+								continue;
+
+							clusterCounts[c]++;
+							numPairs++;
+						}
+						else if (clusterData[c * 2 + 1] < clusterCounts[c])
+						{
+							indices[clusterData[c * 2] + clusterData[c * 2 + 1]] = (unsigned int)i;
+							clusterData[c * 2 + 1]++;
+						}
+					}
+				}
+			}
+
+			if (pass == 0 && touched)
+				visible++;
+		}
+	}
+
+	unsigned int busiest = 0;
+	for (int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		if (clusterCounts[c] > busiest)
+			busiest = clusterCounts[c];
+	}
+
+	// Upload what changed, only as many index rows as are used
+	int numLights = (int)lights.size();
+	int indexRows = (numPairs + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH;
+
+	if (numLights > 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, lightTex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, numLights, 1, GL_RGBA, GL_FLOAT, &lightData[0]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 1, numLights, 1, GL_RGBA, GL_FLOAT, &lightData[MAX_CLUSTER_LIGHTS * 4]);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, clusterTex);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTERS_PER_SLICE, CLUSTER_SLICES, GL_RG_INTEGER, GL_UNSIGNED_INT, &clusterData[0]);
+
+	if (indexRows > 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, indexTex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_INDEX_WIDTH, indexRows, GL_RED_INTEGER, GL_UNSIGNED_INT, &indices[0]);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	stats.lights = numLights;
+	stats.visible = visible;
+	stats.indices = numPairs;
+	stats.busiest = (int)busiest;
+	stats.binMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void ClusteredLighting::Bind(const float *sunDirection, const float *sunColor, const float *ambient)
+{
+	if (!supported)
+		return;
+
+	// Take the sun to view space (it's a direction so only the rotation matters)
+	float sx = viewMatrix[0] * sunDirection[0] + viewMatrix[4] * sunDirection[1] + viewMatrix[8] * sunDirection[2];
+	float sy = viewMatrix[1] * sunDirection[0] + viewMatrix[5] * sunDirection[1] + viewMatrix[9] * sunDirection[2];
+	float sz = viewMatrix[2] * sunDirection[0] + viewMatrix[6] * sunDirection[1] + viewMatrix[10] * sunDirection[2];
+	float len = sqrtf(sx * sx + sy * sy + sz * sz);
+	if (len > 0.0f)
+	{
+		sx /= len;
+		sy /= len;
+		sz /= len;
+	}
+
+	sunView[0] = sx;
+	sunView[1] = sy;
+	sunView[2] = sz;
+	memcpy(this->sunColor, sunColor, sizeof(this->sunColor));
+	memcpy(this->ambient, ambient, sizeof(this->ambient));
+
+	glUseProgram(program);
+	SetUniforms(program);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, lightTex);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, clusterTex);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, indexTex);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void ClusteredLighting::SetUniforms(GLuint other) const
+{
+	glUniform1i(glGetUniformLocation(other, "lightTex"), 1);
+	glUniform1i(glGetUniformLocation(other, "clusterTex"), 2);
+	glUniform1i(glGetUniformLocation(other, "indexTex"), 3);
+	glUniform4f(glGetUniformLocation(other, "clusterScale"), tileScale[0], tileScale[1], sliceScale, sliceBias);
+	glUniform3fv(glGetUniformLocation(other, "sunDir"), 1, sunView);
+	glUniform3fv(glGetUniformLocation(other, "sunColor"), 1, sunColor);
+	glUniform3fv(glGetUniformLocation(other, "ambient"), 1, ambient);
+}
+
+const char *ClusteredLighting::ShadingSource()
+{
+	return shadingSource;
+}
+
+void ClusteredLighting::Unbind()
+{
+	if (!supported)
+		return;
+
+	glUseProgram(0);
+}
@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Clustered Forward Lighting
+//
+// ClusteredLighting.h: interface for the ClusteredLighting class.
+// The fixed function pipeline only gives us 8 lights and we were
+// using 2 of them. This class lets anything in the game put out
+// light (collectibles, the torches in the cave, pickup flashes)
+// without every pixel having to look at every light.
+//
+// The view is cut into a grid of clusters: 16x9 tiles on screen
+// and 24 slices in depth (the slices get thicker further away).
+// Every frame the lights are binned into the clusters they touch
+// on the CPU, and the result is uploaded into three small integer
+// and float textures. The fragment shader works out which cluster
+// it is in and only loops over the lights in that cluster.
+//
+// The shader is GLSL 1.30 and reads the fixed function matrices,
+// vertex arrays and glColor, so Model_3DS::Draw() doesn't need to
+// change at all. If the card can't do OpenGL 3.0 Init() returns
+// false and the game keeps using GL_LIGHT0/GL_LIGHT1.
+//
+// Usage:
+// ClusteredLighting lighting;
+//
+// lighting.Init();						// Once, after glewInit()
+//
+// lighting.BeginFrame();					// Every frame
+// lighting.AddLight(x, y, z, radius, r, g, b);	// In world space
+// lighting.Update(view, proj, WIDTH, HEIGHT);	// Bins and uploads the lights
+// lighting.Bind(sunDir, sunColor, ambient);
+// model.Draw();
+// lighting.Unbind();
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef CLUSTEREDLIGHTING_H
+#define CLUSTEREDLIGHTING_H
+
+#include "glew.h"
+
+#include <vector>
+
+#define CLUSTER_TILES_X		16		// Clusters across the screen
+#define CLUSTER_TILES_Y		9		// Clusters down the screen
+#define CLUSTER_SLICES		24		// Clusters in depth
+#define CLUSTER_COUNT		(CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+#define MAX_CLUSTER_LIGHTS	1024	// Most lights in a frame
+#define CLUSTER_INDEX_WIDTH	1024	// Width of the light index texture
+#define MAX_CLUSTER_INDICES	(CLUSTER_INDEX_WIDTH * 64)	// Most (cluster, light) pairs in a frame
+
+class ClusteredLighting
+{
+public:
+	// A point light
+	struct Light {
+		float x;		// Position (world space until Update(), view space after)
+		float y;
+		float z;
+		float radius;	// The light fades to nothing at this distance
+		float r;		// Color
+		float g;
+		float b;
+		float intensity;
+	};
+
+	// Counters for the last Update()
+	struct Stats {
+		int lights;			// Lights added this frame
+		int visible;		// Lights that touched at least one cluster
+		int indices;		// (cluster, light) pairs
+		int busiest;		// Most lights in one cluster
+		double binMs;		// CPU time spent binning and uploading
+	};
+
+	bool supported;			// True: Init() worked and the shader path can be used
+	float nearSlice;		// Where the first depth slice starts
+	float farSlice;			// Where the last depth slice ends (anything further is in the last slice)
+	Stats stats;
+
+	bool Init();			// Compiles the shader and makes the textures (needs a GL context)
+	void BeginFrame();		// Forgets last frame's lights
+	void AddLight(float x, float y, float z, float radius, float r, float g, float b, float intensity = 1.0f);
+	int NumLights() const;	// Lights added this frame
+	// Bins the lights (view and proj are column major like glGetFloatv returns)
+	void Update(const float *view, const float *proj, int width, int height);
+	// Turns the shader on, the sun's direction is in world space
+	void Bind(const float *sunDirection, const float *sunColor, const float *ambient);
+	void Unbind();			// Goes back to the fixed function pipeline
+	// For other shaders that light the same way (see SceneBatcher): the GLSL with
+	// clusterLight(viewPos, normal), which goes after their #version, and its
+	// uniforms as of the last Bind(), set on the other program (while it's in use)
+	static const char *ShadingSource();
+	void SetUniforms(GLuint other) const;
+	ClusteredLighting();	// Constructor
+	virtual ~ClusteredLighting();	// Destructor
+
+private:
+	void BuildClusterBounds(const float *proj);	// Works out the view space box of every cluster
+	int SliceOf(float depth) const;				// The slice a positive view depth falls in
+
+	std::vector<Light> lights;					// This frame's lights
+	std::vector<unsigned int> clusterCounts;	// Lights per cluster
+	std::vector<unsigned int> clusterData;		// (offset, count) per cluster, what gets uploaded
+	std::vector<unsigned int> indices;			// Light indices of every cluster, back to back
+	std::vector<float> lightData;				// The lights as they get uploaded
+	std::vector<float> clusterBounds;			// min xyz, max xyz per cluster in view space
+
+	float boundsProj[2];	// The projection the cluster bounds were built for
+	float viewMatrix[16];	// This frame's camera
+	float tileScale[2];		// Turns window pixels into tiles
+	float sliceScale;		// slice = log(depth) * sliceScale - sliceBias
+	float sliceBias;
+	float sunView[3];		// The sun's direction in view space, as of the last Bind()
+	float sunColor[3];
+	float ambient[3];
+
+	GLuint program;			// The lighting shader
+	GLuint lightTex;		// RGBA32F: position and radius on row 0, color and intensity on row 1
+	GLuint clusterTex;		// RG32UI: first index and count for every cluster
+	GLuint indexTex;		// R32UI: the light indices
+};
+
+#endif // CLUSTEREDLIGHTING_H
@@ -0,0 +1,468 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Triangle Collision Mesh
+//
+// CollisionMesh.cpp: implementation of the CollisionMesh class.
+// See CollisionMesh.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "CollisionMesh.h"
+#include "Matrix4.h"
+
+#include <algorithm>
+#include <emmintrin.h>	// SSE2
+#include <math.h>
+
+#define LEAF_SIZE	4	// Triangles in a leaf, one TriangleBlock
+
+// a.x * b.x + a.y * b.y + a.z * b.z for four pairs at once
+static inline __m128 Dot4(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+// mask ? a : b, lane by lane
+static inline __m128 Select4(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+CollisionMesh::CollisionMesh()
+{
+	Clear();
+}
+
+CollisionMesh::~CollisionMesh()
+{
+
+}
+
+void CollisionMesh::Clear()
+{
+	triangles.clear();
+	order.clear();
+	nodes.clear();
+	blocks.clear();
+	numTriangles = 0;
+	radius = 0.0f;
+
+	for (int k = 0; k < 3; k++)
+	{
+		bounds[0][k] = 0.0f;
+		bounds[1][k] = 0.0f;
+	}
+}
+
+void CollisionMesh::Build(const Model_3DS &model)
+{
+	Clear();
+
+	float radius2 = 0.0f;
+
+	for (int i = 0; i < model.numObjects; i++)
+	{
+		const Model_3DS::Object &object = model.Objects[i];
+		const float offset[3] = { object.pos.x, object.pos.y, object.pos.z };
+
+		// numFaces counts indices, three to a triangle
+		for (int f = 0; f + 2 < object.numFaces; f += 3)
+		{
+			float corner[3][3];
+			for (int c = 0; c < 3; c++)
+			{
+				const float *v = &object.Vertexes[object.Faces[f + c] * 3];
+				for (int k = 0; k < 3; k++)
+					corner[c][k] = v[k] + offset[k];
+			}
+
+			Triangle tri;
+			for (int k = 0; k < 3; k++)
+			{
+				tri.a[k] = corner[0][k];
+				tri.ab[k] = corner[1][k] - corner[0][k];
+				tri.ac[k] = corner[2][k] - corner[0][k];
+				tri.min[k] = std::min(corner[0][k], std::min(corner[1][k], corner[2][k]));
+				tri.max[k] = std::max(corner[0][k], std::max(corner[1][k], corner[2][k]));
+			}
+
+			// Slivers with no area can't be hit and upset the closest point maths
+			float nx = tri.ab[1] * tri.ac[2] - tri.ab[2] * tri.ac[1];
+			float ny = tri.ab[2] * tri.ac[0] - tri.ab[0] * tri.ac[2];
+			float nz = tri.ab[0] * tri.ac[1] - tri.ab[1] * tri.ac[0];
+			if (nx * nx + ny * ny + nz * nz <= 0.0f)
+				continue;
+
+			for (int c = 0; c < 3; c++)
+			{
+				float d2 = corner[c][0] * corner[c][0] + corner[c][1] * corner[c][1] + corner[c][2] * corner[c][2];
+				if (d2 > radius2)
+					radius2 = d2;
+			}
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (triangles.empty() || tri.min[k] < bounds[0][k]) bounds[0][k] = tri.min[k];
+				if (triangles.empty() || tri.max[k] > bounds[1][k]) bounds[1][k] = tri.max[k];
+			}
+
+			triangles.push_back(tri);
+		}
+	}
+
+	numTriangles = (int)triangles.size();
+	radius = sqrtf(radius2);
+
+	if (triangles.empty())
+		return;
+
+	order.resize(triangles.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = (int)i;
+
+	nodes.reserve(triangles.size() / LEAF_SIZE * 2 + 1);
+	blocks.reserve(triangles.size() / LEAF_SIZE + 1);
+	BuildNode(0, (int)triangles.size());
+
+	// The blocks have everything the queries need
+	std::vector<Triangle>().swap(triangles);
+	std::vector<int>().swap(order);
+}
+
+int CollisionMesh::BuildNode(int first, int count)
+{
+	int index = (int)nodes.size();
+	nodes.push_back(Node());
+
+	// The box around every triangle in the range
+	Node node;
+	for (int k = 0; k < 3; k++)
+	{
+		node.min[k] = triangles[order[first]].min[k];
+		node.max[k] = triangles[order[first]].max[k];
+	}
+	for (int i = first + 1; i < first + count; i++)
+	{
+		const Triangle &tri = triangles[order[i]];
+		for (int k = 0; k < 3; k++)
+		{
+			if (tri.min[k] < node.min[k]) node.min[k] = tri.min[k];
+			if (tri.max[k] > node.max[k]) node.max[k] = tri.max[k];
+		}
+	}
+
+	node.left = -1;
+	node.right = -1;
+	node.block = -1;
+
+	if (count > LEAF_SIZE)
+	{
+		// Split at the median center along the longest side
+		int axis = 0;
+		for (int k = 1; k < 3; k++)
+		{
+			if (node.max[k] - node.min[k] > node.max[axis] - node.min[axis])
+				axis = k;
+		}
+
+		int half = count / 2;
+		std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+			[&](int a, int b) {
+				return triangles[a].min[axis] + triangles[a].max[axis] < triangles[b].min[axis] + triangles[b].max[axis];
+			});
+
+		node.left = BuildNode(first, half);
+		node.right = BuildNode(first + half, count - half);
+	}
+	else
+	{
+		// Lay the triangles out across the block, padding with the last one
+		TriangleBlock block;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			const Triangle &tri = triangles[order[first + std::min(lane, count - 1)]];
+			block.ax[lane] = tri.a[0];
+			block.ay[lane] = tri.a[1];
+			block.az[lane] = tri.a[2];
+			block.abx[lane] = tri.ab[0];
+			block.aby[lane] = tri.ab[1];
+			block.abz[lane] = tri.ab[2];
+			block.acx[lane] = tri.ac[0];
+			block.acy[lane] = tri.ac[1];
+			block.acz[lane] = tri.ac[2];
+		}
+
+		node.block = (int)blocks.size();
+		blocks.push_back(block);
+	}
+
+	nodes[index] = node;
+	return index;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queries
+//////////////////////////////////////////////////////////////////////
+
+bool CollisionMesh::SphereBlock(const TriangleBlock &block, const float *center, float radius2) const
+{
+	__m128 ax = _mm_loadu_ps(block.ax), ay = _mm_loadu_ps(block.ay), az = _mm_loadu_ps(block.az);
+	__m128 bx = _mm_loadu_ps(block.abx), by = _mm_loadu_ps(block.aby), bz = _mm_loadu_ps(block.abz);
+	__m128 cx = _mm_loadu_ps(block.acx), cy = _mm_loadu_ps(block.acy), cz = _mm_loadu_ps(block.acz);
+
+	// The center relative to each first corner
+	__m128 px = _mm_sub_ps(_mm_set1_ps(center[0]), ax);
+	__m128 py = _mm_sub_ps(_mm_set1_ps(center[1]), ay);
+	__m128 pz = _mm_sub_ps(_mm_set1_ps(center[2]), az);
+
+	// The dot products the closest point test works from (Ericson, Real-Time Collision Detection 5.1.5)
+	__m128 abab = Dot4(bx, by, bz, bx, by, bz);
+	__m128 acac = Dot4(cx, cy, cz, cx, cy, cz);
+	__m128 abac = Dot4(bx, by, bz, cx, cy, cz);
+	__m128 d1 = Dot4(bx, by, bz, px, py, pz);
+	__m128 d2 = Dot4(cx, cy, cz, px, py, pz);
+	__m128 d3 = _mm_sub_ps(d1, abab);
+	__m128 d4 = _mm_sub_ps(d2, abac);
+	__m128 d5 = _mm_sub_ps(d1, abac);
+	__m128 d6 = _mm_sub_ps(d2, acac);
+
+	__m128 va = _mm_sub_ps(_mm_mul_ps(d3, d6), _mm_mul_ps(d5, d4));
+	__m128 vb = _mm_sub_ps(_mm_mul_ps(d5, d2), _mm_mul_ps(d1, d6));
+	__m128 vc = _mm_sub_ps(_mm_mul_ps(d1, d4), _mm_mul_ps(d3, d2));
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+
+	// Where the closest point is as a + s * ab + t * ac, starting with inside the face
+	// and letting each region the scalar version would have returned early for win
+	__m128 denom = _mm_add_ps(_mm_add_ps(va, vb), vc);
+	__m128 s = _mm_div_ps(vb, denom);
+	__m128 t = _mm_div_ps(vc, denom);
+
+	// On edge bc
+	__m128 d43 = _mm_sub_ps(d4, d3);
+	__m128 d56 = _mm_sub_ps(d5, d6);
+	__m128 mask = _mm_and_ps(_mm_cmple_ps(va, zero), _mm_and_ps(_mm_cmpge_ps(d43, zero), _mm_cmpge_ps(d56, zero)));
+	__m128 w = _mm_div_ps(d43, _mm_add_ps(d43, d56));
+	s = Select4(mask, _mm_sub_ps(one, w), s);
+	t = Select4(mask, w, t);
+
+	// On edge ac
+	mask = _mm_and_ps(_mm_cmple_ps(vb, zero), _mm_and_ps(_mm_cmpge_ps(d2, zero), _mm_cmple_ps(d6, zero)));
+	s = Select4(mask, zero, s);
+	t = Select4(mask, _mm_div_ps(d2, _mm_sub_ps(d2, d6)), t);
+
+	// Corner c
+	mask = _mm_and_ps(_mm_cmpge_ps(d6, zero), _mm_cmple_ps(d5, d6));
+	s = Select4(mask, zero, s);
+	t = Select4(mask, one, t);
+
+	// On edge ab
+	mask = _mm_and_ps(_mm_cmple_ps(vc, zero), _mm_and_ps(_mm_cmpge_ps(d1, zero), _mm_cmple_ps(d3, zero)));
+	s = Select4(mask, _mm_div_ps(d1, _mm_sub_ps(d1, d3)), s);
+	t = Select4(mask, zero, t);
+
+	// Corner b
+	mask = _mm_and_ps(_mm_cmpge_ps(d3, zero), _mm_cmple_ps(d4, d3));
+	s = Select4(mask, one, s);
+	t = Select4(mask, zero, t);
+
+	// Corner a
+	mask = _mm_and_ps(_mm_cmple_ps(d1, zero), _mm_cmple_ps(d2, zero));
+	s = Select4(mask, zero, s);
+	t = Select4(mask, zero, t);
+
+	// From the closest point to the center
+	__m128 dx = _mm_sub_ps(px, _mm_add_ps(_mm_mul_ps(bx, s), _mm_mul_ps(cx, t)));
+	__m128 dy = _mm_sub_ps(py, _mm_add_ps(_mm_mul_ps(by, s), _mm_mul_ps(cy, t)));
+	__m128 dz = _mm_sub_ps(pz, _mm_add_ps(_mm_mul_ps(bz, s), _mm_mul_ps(cz, t)));
+
+	__m128 hit = _mm_cmple_ps(Dot4(dx, dy, dz, dx, dy, dz), _mm_set1_ps(radius2));
+	return _mm_movemask_ps(hit) != 0;
+}
+
+bool CollisionMesh::RayBlock(const TriangleBlock &block, const float *origin, const float *dir, float &t) const
+{
+	__m128 bx = _mm_loadu_ps(block.abx), by = _mm_loadu_ps(block.aby), bz = _mm_loadu_ps(block.abz);
+	__m128 cx = _mm_loadu_ps(block.acx), cy = _mm_loadu_ps(block.acy), cz = _mm_loadu_ps(block.acz);
+	__m128 dx = _mm_set1_ps(dir[0]), dy = _mm_set1_ps(dir[1]), dz = _mm_set1_ps(dir[2]);
+
+	// Moller-Trumbore, both sides of the triangle count
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, cz), _mm_mul_ps(dz, cy));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, cx), _mm_mul_ps(dx, cz));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, cy), _mm_mul_ps(dy, cx));
+	__m128 det = Dot4(bx, by, bz, px, py, pz);
+	__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	__m128 tx = _mm_sub_ps(_mm_set1_ps(origin[0]), _mm_loadu_ps(block.ax));
+	__m128 ty = _mm_sub_ps(_mm_set1_ps(origin[1]), _mm_loadu_ps(block.ay));
+	__m128 tz = _mm_sub_ps(_mm_set1_ps(origin[2]), _mm_loadu_ps(block.az));
+	__m128 u = _mm_mul_ps(Dot4(tx, ty, tz, px, py, pz), inv);
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, bz), _mm_mul_ps(tz, by));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, bx), _mm_mul_ps(tx, bz));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, by), _mm_mul_ps(ty, bx));
+	__m128 v = _mm_mul_ps(Dot4(dx, dy, dz, qx, qy, qz), inv);
+	__m128 dist = _mm_mul_ps(Dot4(cx, cy, cz, qx, qy, qz), inv);
+
+	// A ray along the triangle gives a det of 0 and an inf or nan that fails every compare below
+	__m128 zero = _mm_setzero_ps();
+	__m128 hit = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(dist, zero), _mm_cmplt_ps(dist, _mm_set1_ps(t))));
+
+	int lanes = _mm_movemask_ps(hit);
+	if (!lanes)
+		return false;
+
+	float d[4];
+	_mm_storeu_ps(d, dist);
+	for (int lane = 0; lane < 4; lane++)
+	{
+		if ((lanes & (1 << lane)) && d[lane] < t)
+			t = d[lane];
+	}
+
+	return true;
+}
+
+bool CollisionMesh::OverlapsSphere(const float *center, float radius) const
+{
+	if (nodes.empty())
+		return false;
+
+	float radius2 = radius * radius;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node &node = nodes[stack[--top]];
+
+		// How far the center is outside the box
+		float d2 = 0.0f;
+		for (int k = 0; k < 3; k++)
+		{
+			float d = 0.0f;
+			if (center[k] < node.min[k])
+				d = node.min[k] - center[k];
+			else if (center[k] > node.max[k])
+				d = center[k] - node.max[k];
+			d2 += d * d;
+		}
+		if (d2 > radius2)
+			continue;
+
+		if (node.block >= 0)
+		{
+			if (SphereBlock(blocks[node.block], center, radius2))
+				return true;
+		}
+		else
+		{
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+
+	return false;
+}
+
+bool CollisionMesh::OverlapsSphere(const float *inverse, float x, float y, float z, float radius) const
+{
+	float center[3];
+	Mat4TransformPoint(inverse, x, y, z, center);
+	return OverlapsSphere(center, radius * Mat4MaxScale(inverse));
+}
+
+bool CollisionMesh::Raycast(const float *origin, const float *dir, float maxT, float &t) const
+{
+	if (nodes.empty())
+		return false;
+
+	// Slab test against the boxes, a 0 direction gives +-inf which still works
+	float invDir[3];
+	for (int k = 0; k < 3; k++)
+		invDir[k] = 1.0f / dir[k];
+
+	float best = maxT;
+	bool hit = false;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node &node = nodes[stack[--top]];
+
+		float tMin = 0.0f, tMax = best;
+		for (int k = 0; k < 3; k++)
+		{
+			float t0 = (node.min[k] - origin[k]) * invDir[k];
+			float t1 = (node.max[k] - origin[k]) * invDir[k];
+			if (t0 > t1)
+				std::swap(t0, t1);
+			if (t0 > tMin) tMin = t0;
+			if (t1 < tMax) tMax = t1;
+		}
+		if (tMin > tMax)
+			continue;
+
+		if (node.block >= 0)
+		{
+			if (RayBlock(blocks[node.block], origin, dir, best))
+				hit = true;
+		}
+		else
+		{
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+
+	if (hit)
+		t = best;
+
+	return hit;
+}
+
+bool CollisionMesh::Raycast(const float *inverse, const float *origin, const float *dir, float maxT, float &t) const
+{
+	// The same t works on both sides since the matrix is affine
+	float o[3], d[3];
+	Mat4TransformPoint(inverse, origin[0], origin[1], origin[2], o);
+	Mat4TransformVector(inverse, dir[0], dir[1], dir[2], d);
+	return Raycast(o, d, maxT, t);
+}
+
+int CollisionMesh::NumTriangles() const
+{
+	return numTriangles;
+}
+
+int CollisionMesh::NumNodes() const
+{
+	return (int)nodes.size();
+}
+
+const float *CollisionMesh::Min() const
+{
+	return bounds[0];
+}
+
+const float *CollisionMesh::Max() const
+{
+	return bounds[1];
+}
+
+float CollisionMesh::Radius() const
+{
+	return radius;
+}
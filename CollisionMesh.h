@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Triangle Collision Mesh
+//
+// CollisionMesh.h: interface for the CollisionMesh class.
+// A sphere with a hand picked radius is a poor fit for a snake
+// lying on the ground or the walls of the cave. This class keeps
+// the model's real triangles (as loaded into Model_3DS) in a
+// bounding volume tree so a sphere or a ray can be tested against
+// the actual shape without looking at every triangle.
+//
+// The tree is split at the median along the longest side, like the
+// one in TriggerSystem. A leaf holds up to 4 triangles stored
+// "across" (all 4 first corners' x together, then their y...), so
+// one leaf is tested with a single pass of SSE instructions.
+//
+// Everything is in the model's own space (the vertices plus each
+// object's pos, the same space as Model_3DS::boundsMin/Max). To test
+// something placed in the world, hand in the inverse of its world
+// matrix (see Mat4InvertUniform) and the test moves the sphere or
+// ray into model space first.
+//
+// Usage:
+// CollisionMesh mesh;
+// mesh.Build(model);
+//
+// float radius = mesh.Radius() * scale;	// For the broad phase
+//
+// float inverse[16];
+// Mat4InvertUniform(inverse, world);
+// if (mesh.OverlapsSphere(inverse, x, y, z, r)) ...
+// if (mesh.Raycast(inverse, origin, dir, maxT, t)) ...
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef COLLISIONMESH_H
+#define COLLISIONMESH_H
+
+#include "Model_3DS.h"
+
+#include <vector>
+
+class CollisionMesh
+{
+public:
+	// Copies the triangles out of a loaded model and builds the tree over them
+	void Build(const Model_3DS &model);
+	void Clear();								// Drops the triangles and the tree
+
+	// True if the sphere touches a triangle (everything in model space)
+	bool OverlapsSphere(const float *center, float radius) const;
+	// The same for a sphere in the world, inverse takes the world to model space
+	bool OverlapsSphere(const float *inverse, float x, float y, float z, float radius) const;
+	// The nearest hit along the ray (dir doesn't have to be unit length, t is in lengths of dir)
+	bool Raycast(const float *origin, const float *dir, float maxT, float &t) const;
+	// The same for a ray in the world
+	bool Raycast(const float *inverse, const float *origin, const float *dir, float maxT, float &t) const;
+
+	int NumTriangles() const;
+	int NumNodes() const;
+	const float *Min() const;					// The box around every triangle
+	const float *Max() const;
+	float Radius() const;						// The furthest a vertex is from the model's origin
+
+	CollisionMesh();							// Constructor
+	virtual ~CollisionMesh();					// Destructor
+
+private:
+	// A corner and two edges of one triangle
+	struct Triangle {
+		float a[3];
+		float ab[3];
+		float ac[3];
+		float min[3];
+		float max[3];
+	};
+
+	// Four triangles, component by component (a leaf with fewer repeats its last one)
+	struct TriangleBlock {
+		float ax[4], ay[4], az[4];
+		float abx[4], aby[4], abz[4];
+		float acx[4], acy[4], acz[4];
+	};
+
+	// A node of the tree
+	struct Node {
+		float min[3];
+		float max[3];
+		int left;		// Child nodes, -1 for a leaf
+		int right;
+		int block;		// The leaf's triangles
+	};
+
+	int BuildNode(int first, int count);		// Builds the tree over triangles[order[first..first+count)]
+	bool SphereBlock(const TriangleBlock &block, const float *center, float radius2) const;
+	bool RayBlock(const TriangleBlock &block, const float *origin, const float *dir, float &t) const;
+
+	std::vector<Triangle> triangles;	// Only used while building
+	std::vector<int> order;
+	std::vector<Node> nodes;
+	std::vector<TriangleBlock> blocks;
+	int numTriangles;
+	float bounds[2][3];
+	float radius;
+};
+
+#endif // COLLISIONMESH_H
@@ -0,0 +1,325 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Entity Store
+//
+// EntityStore.cpp: implementation of the EntityStore class.
+// See EntityStore.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "EntityStore.h"
+#include "Matrix4.h"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+EntityStore::EntityStore()
+{
+	memset(kindCounts, 0, sizeof(kindCounts));
+}
+
+EntityStore::~EntityStore()
+{
+
+}
+
+EntityHandle EntityStore::Create(EntityKind kind, float x, float y, float z, float yaw, float scale, float radius, Model_3DS *model)
+{
+	Transform transform = { x, y, z, yaw, scale };
+	Velocity velocity = { 0.0f, 0.0f, 0.0f };
+	Collider collider = { radius, 0 };
+	RenderHandle render = { model, 0.0f, 90.0f, 0 };
+
+	// Take a free slot if there is one
+	int slot;
+	if (!freeSlots.empty())
+	{
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		Slot fresh = { -1, 0 };
+		slots.push_back(fresh);
+		slot = (int)slots.size() - 1;
+	}
+
+	// And a dead row, or a new one on the end
+	int index;
+	if (!deadRows.empty())
+	{
+		index = deadRows.back();
+		deadRows.pop_back();
+
+		transforms[index] = transform;
+		velocities[index] = velocity;
+		colliders[index] = collider;
+		renders[index] = render;
+		kinds[index] = (unsigned char)kind;
+		flags[index] = ENTITY_VISIBLE | ENTITY_ACTIVE;
+		owners[index] = slot;
+	}
+	else
+	{
+		transforms.push_back(transform);
+		velocities.push_back(velocity);
+		colliders.push_back(collider);
+		renders.push_back(render);
+		kinds.push_back((unsigned char)kind);
+		flags.push_back(ENTITY_VISIBLE | ENTITY_ACTIVE);
+		owners.push_back(slot);
+		index = (int)transforms.size() - 1;
+	}
+
+	slots[slot].index = index;
+	kindCounts[kind]++;
+
+	EntityHandle handle = { slot, slots[slot].generation };
+	return handle;
+}
+
+void EntityStore::Destroy(EntityHandle handle, SpatialGrid *grid)
+{
+	int index = Index(handle);
+	if (index < 0)
+		return;
+
+	if (grid)
+		grid->Remove(handle.slot);
+
+	kindCounts[kinds[index]]--;
+	flags[index] = 0;
+	owners[index] = -1;
+	deadRows.push_back(index);
+
+	// Any handle still out there now points at an older generation
+	slots[handle.slot].index = -1;
+	slots[handle.slot].generation++;
+	freeSlots.push_back(handle.slot);
+}
+
+bool EntityStore::IsAlive(EntityHandle handle) const
+{
+	return Index(handle) >= 0;
+}
+
+int EntityStore::Index(EntityHandle handle) const
+{
+	if (handle.slot < 0 || handle.slot >= (int)slots.size())
+		return -1;
+
+	const Slot &slot = slots[handle.slot];
+	if (slot.generation != handle.generation)
+		return -1;
+
+	return slot.index;
+}
+
+EntityHandle EntityStore::HandleOf(int index) const
+{
+	EntityHandle handle = { -1, 0 };
+	if (index < 0 || index >= (int)owners.size() || owners[index] < 0)
+		return handle;
+
+	handle.slot = owners[index];
+	handle.generation = slots[handle.slot].generation;
+	return handle;
+}
+
+int EntityStore::Count() const
+{
+	return (int)(transforms.size() - deadRows.size());
+}
+
+int EntityStore::CountKind(EntityKind kind) const
+{
+	return kindCounts[kind];
+}
+
+int EntityStore::Size() const
+{
+	return (int)transforms.size();
+}
+
+void EntityStore::Reserve(int count)
+{
+	transforms.reserve(count);
+	velocities.reserve(count);
+	colliders.reserve(count);
+	renders.reserve(count);
+	kinds.reserve(count);
+	flags.reserve(count);
+	owners.reserve(count);
+	slots.reserve(count);
+	freeSlots.reserve(count);
+	deadRows.reserve(count);
+}
+
+void EntityStore::Compact()
+{
+	if (deadRows.empty())
+		return;
+
+	// Slide every live row down into the first free row, keeping their order
+	int size = (int)transforms.size();
+	int write = 0;
+	for (int read = 0; read < size; read++)
+	{
+		if (owners[read] < 0)
+			continue;
+
+		if (write != read)
+		{
+			transforms[write] = transforms[read];
+			velocities[write] = velocities[read];
+			colliders[write] = colliders[read];
+			renders[write] = renders[read];
+			kinds[write] = kinds[read];
+			flags[write] = flags[read];
+			owners[write] = owners[read];
+			slots[owners[write]].index = write;
+		}
+		write++;
+	}
+
+	// Shrinking keeps the capacity, so growing back later doesn't allocate
+	transforms.resize(write);
+	velocities.resize(write);
+	colliders.resize(write);
+	renders.resize(write);
+	kinds.resize(write);
+	flags.resize(write);
+	owners.resize(write);
+	deadRows.clear();
+}
+
+void EntityStore::Clear()
+{
+	transforms.clear();
+	velocities.clear();
+	colliders.clear();
+	renders.clear();
+	kinds.clear();
+	flags.clear();
+	owners.clear();
+	deadRows.clear();
+
+	// Every slot is free again, on a new generation so old handles stay dead
+	freeSlots.clear();
+	for (int i = (int)slots.size() - 1; i >= 0; i--)
+	{
+		if (slots[i].index >= 0)
+		{
+			slots[i].index = -1;
+			slots[i].generation++;
+		}
+		freeSlots.push_back(i);
+	}
+
+	memset(kindCounts, 0, sizeof(kindCounts));
+}
+
+void EntityStore::UpdateMovement(float dt, SpatialGrid *grid)
+{
+	int count = (int)transforms.size();
+
+	for (int i = 0; i < count; i++)
+	{
+		if (!(flags[i] & ENTITY_MOVING))
+			continue;
+
+		Transform &t = transforms[i];
+		const Velocity &v = velocities[i];
+		t.x += v.x * dt;
+		t.y += v.y * dt;
+		t.z += v.z * dt;
+
+		if (grid)
+			grid->Move(owners[i], t.x, t.z);
+	}
+}
+
+void EntityStore::FindCollisions(const SpatialGrid &grid, float x, float y, float z, float radius, unsigned int kindMask, std::vector<int> &hits) const
+{
+	// The grid only knows the ground plane (and slots), do the exact test on what it finds. The
+	// candidates go straight onto the end of hits and are weeded out in place, so no scratch is
+	// shared and several threads can ask at once.
+	size_t first = hits.size();
+	grid.QueryRadius(x, z, radius, hits);
+
+	size_t kept = first;
+	for (size_t c = first; c < hits.size(); c++)
+	{
+		int i = slots[hits[c]].index;
+		if (i < 0)
+			continue;
+
+		if (!(kindMask & ENTITY_MASK(kinds[i])) || !(flags[i] & ENTITY_ACTIVE))
+			continue;
+
+		const Transform &t = transforms[i];
+		float dx = t.x - x;
+		float dy = t.y + renders[i].lift - y;
+		float dz = t.z - z;
+		float r = radius + colliders[i].radius;
+		if (dx * dx + dy * dy + dz * dz >= r * r)
+			continue;
+
+		// Close enough, now the real shape
+		if (colliders[i].mesh)
+		{
+			float world[16], inverse[16];
+			WorldMatrix(i, world);
+			Mat4InvertUniform(inverse, world);
+			if (!colliders[i].mesh->OverlapsSphere(inverse, x, y, z, radius))
+				continue;
+		}
+
+		hits[kept++] = i;
+	}
+
+	hits.resize(kept);
+}
+
+void EntityStore::ExtractRenderItems(std::vector<RenderItem> &items) const
+{
+	int count = (int)transforms.size();
+
+	for (int i = 0; i < count; i++)
+	{
+		if (!(flags[i] & ENTITY_VISIBLE))
+			continue;
+
+		RenderItem item;
+		MakeItem(i, item);
+		items.push_back(item);
+	}
+}
+
+void EntityStore::WorldMatrix(int index, float *world) const
+{
+	RenderItem item;
+	MakeItem(index, item);
+
+	float matrix[16];
+	RenderQueue::ItemMatrix(item, matrix, world);
+}
+
+void EntityStore::MakeItem(int index, RenderItem &item) const
+{
+	const Transform &t = transforms[index];
+	const RenderHandle &r = renders[index];
+
+	item.model = r.model;
+	item.x = t.x;
+	item.y = t.y + r.lift;
+	item.z = t.z;
+	item.yaw = t.yaw;
+	item.scale = t.scale;
+	item.tiltX = r.tiltX;
+	item.pivot = r.pivot;
+	item.occluder = (flags[index] & ENTITY_OCCLUDER) != 0;
+}
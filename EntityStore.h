@@ -0,0 +1,172 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Entity Store
+//
+// EntityStore.h: interface for the EntityStore class.
+// GameObject keeps everything about an object in one big struct,
+// a whole Model_3DS included, so a loop that only wants the
+// positions still drags every model header through the cache.
+//
+// This class keeps the snakes, rocks and water bottles the other
+// way around: an entity is just an index, and each part of it
+// (where it is, how it moves, how big it is to collide with, what
+// it draws with, its flags) lives in its own dense array. A system
+// only walks the arrays it needs:
+//
+// UpdateMovement()		transforms, velocities, flags
+// FindCollisions()		transforms, colliders, kinds, flags
+// ExtractRenderItems()	transforms, renders, flags
+//
+// The models themselves are shared (see ModelCache), an entity
+// only holds a pointer.
+//
+// An entity is handed out as an EntityHandle: a slot number and the
+// generation the slot was on when the entity was made. Destroying
+// the entity bumps the generation, so an old handle to it no longer
+// matches and can't reach whatever takes the slot next. The slot
+// table maps a handle to the entity's row in the arrays.
+//
+// Destroy() only marks the row dead (it stops being drawn or hit)
+// and puts the row and the slot on free lists that Create() takes
+// from first, so both are O(1) and rows don't move under a loop
+// that is walking them. Compact() slides the live rows down over
+// the dead ones now and then. Once Reserve() has made room, making
+// and destroying entities never allocates.
+//
+// The grid is told about entities by slot, not by row, so
+// Compact() never has to touch it.
+//
+// A collider is a sphere for the broad phase. If it also has a
+// CollisionMesh the sphere only gets an entity onto the short list
+// and FindCollisions() tests the model's triangles.
+//
+// Usage:
+// EntityStore entities;
+//
+// EntityHandle snake = entities.Create(ENTITY_SNAKE, x, y, z, yaw, scale, radius, model);
+// grid.Insert(snake.slot, x, z, radius);
+// entities.flags[entities.Index(snake)] &= ~ENTITY_VISIBLE;	// Parts are plain arrays
+//
+// entities.UpdateMovement(dt, &grid);			// Once a tick
+// entities.FindCollisions(grid, x, y, z, r, ENTITY_MASK(ENTITY_SNAKE), hits);
+// entities.Destroy(entities.HandleOf(hits[0]), &grid);
+// entities.ExtractRenderItems(renderItems);	// Once a frame
+// entities.Compact();							// Every so often
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef ENTITYSTORE_H
+#define ENTITYSTORE_H
+
+#include "CollisionMesh.h"
+#include "RenderQueue.h"
+#include "SpatialGrid.h"
+
+#include <vector>
+
+// What an entity is
+enum EntityKind {
+	ENTITY_SNAKE,
+	ENTITY_ROCK,
+	ENTITY_WATER,
+	ENTITY_KIND_COUNT
+};
+
+#define ENTITY_MASK(kind)	(1u << (kind))	// For picking kinds in FindCollisions()
+
+// Entity flags
+#define ENTITY_VISIBLE		1	// Drawn
+#define ENTITY_ACTIVE		2	// Can be collided with (cleared when a bottle is picked up)
+#define ENTITY_MOVING		4	// UpdateMovement() moves it by its velocity
+#define ENTITY_OCCLUDER		8	// Big enough to hide things behind it
+
+// Where an entity is
+struct Transform {
+	float x;
+	float y;
+	float z;
+	float yaw;		// Rotation about the y axis in degrees
+	float scale;
+};
+
+// How fast it moves in units per second
+struct Velocity {
+	float x;
+	float y;
+	float z;
+};
+
+// What it collides as: a sphere around its position, then the mesh's triangles if it has one
+struct Collider {
+	float radius;
+	const CollisionMesh *mesh;	// Shared, owned by the ModelCache, can be 0
+};
+
+// Names an entity for as long as it lives
+struct EntityHandle {
+	int slot;					// -1 for no entity
+	unsigned int generation;	// Must match the slot's for the handle to be good
+};
+
+// What it draws with
+struct RenderHandle {
+	Model_3DS *model;	// Shared, owned by the ModelCache
+	float lift;			// Extra height it is drawn at
+	float tiltX;		// Rotation about the x axis after the scale (90 for the upright models)
+	const float *pivot;	// An extra matrix applied last, can be 0
+};
+
+class EntityStore
+{
+public:
+	// The parts, all indexed by row (dead rows have no flags set)
+	std::vector<Transform> transforms;
+	std::vector<Velocity> velocities;
+	std::vector<Collider> colliders;
+	std::vector<RenderHandle> renders;
+	std::vector<unsigned char> kinds;
+	std::vector<unsigned int> flags;
+
+	// Makes a visible, active, upright entity that doesn't move
+	EntityHandle Create(EntityKind kind, float x, float y, float z, float yaw, float scale, float radius, Model_3DS *model);
+	// Kills an entity and takes it out of the grid (if not 0), old handles to it stop working
+	void Destroy(EntityHandle handle, SpatialGrid *grid);
+	bool IsAlive(EntityHandle handle) const;	// True if the entity hasn't been destroyed
+	int Index(EntityHandle handle) const;		// The entity's row, -1 if it is dead
+	EntityHandle HandleOf(int index) const;		// The handle of the entity in a row
+	int Count() const;						// Live entities
+	int CountKind(EntityKind kind) const;	// Live entities of one kind
+	int Size() const;						// Rows, dead ones included (what to loop to)
+	void Reserve(int count);				// Makes room so Create() doesn't allocate
+	void Compact();							// Moves the live rows over the dead ones, handles stay good
+	void Clear();							// Removes every entity
+
+	// Moves every moving entity by velocity * dt and keeps the grid (if not 0) up to date
+	void UpdateMovement(float dt, SpatialGrid *grid);
+	// Adds the row of every active entity of the kinds in kindMask that the sphere touches to hits (any thread)
+	void FindCollisions(const SpatialGrid &grid, float x, float y, float z, float radius, unsigned int kindMask, std::vector<int> &hits) const;
+	// Adds a RenderItem for every visible entity
+	void ExtractRenderItems(std::vector<RenderItem> &items) const;
+	// The matrix that takes the entity's model (and its collision mesh) into the world
+	void WorldMatrix(int index, float *world) const;
+
+	EntityStore();							// Constructor
+	virtual ~EntityStore();					// Destructor
+
+private:
+	// Where a handle points
+	struct Slot {
+		int index;					// The entity's row, -1 while the slot is free
+		unsigned int generation;	// Bumped every time the entity in it is destroyed
+	};
+
+	std::vector<int> owners;		// The slot of the entity in each row, -1 for a dead row
+	std::vector<Slot> slots;
+	std::vector<int> freeSlots;		// Slots nobody is using
+	std::vector<int> deadRows;		// Rows Create() can reuse
+	void MakeItem(int index, RenderItem &item) const;	// What the entity in a row draws as
+
+	int kindCounts[ENTITY_KIND_COUNT];
+};
+
+#endif // ENTITYSTORE_H
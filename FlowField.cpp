@@ -0,0 +1,309 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Flow Field Navigation
+//
+// FlowField.cpp: implementation of the FlowField class.
+// See FlowField.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "FlowField.h"
+
+#include <algorithm>
+#include <emmintrin.h>	// SSE2
+#include <math.h>
+
+#define UNREACHED	1e30f		// The cost of a cell the target can't be reached from
+#define DIAGONAL	1.41421356f	// The cost of a diagonal step (a straight one costs 1)
+
+// The eight neighbours, straight ones first
+static const int stepX[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+static const int stepZ[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+FlowField::FlowField()
+{
+	minX = 0.0f;
+	minZ = 0.0f;
+	cellSize = 1.0f;
+	invCellSize = 1.0f;
+	width = 0;
+	height = 0;
+	target = -1;
+	dirty = false;
+	visited = 0;
+}
+
+FlowField::~FlowField()
+{
+
+}
+
+void FlowField::Reset(float minX, float minZ, float maxX, float maxZ, float cellSize)
+{
+	this->minX = minX;
+	this->minZ = minZ;
+	this->cellSize = cellSize;
+	invCellSize = 1.0f / cellSize;
+	width = std::max(1, (int)ceilf((maxX - minX) * invCellSize));
+	height = std::max(1, (int)ceilf((maxZ - minZ) * invCellSize));
+
+	int cells = width * height;
+	blocked.assign(cells, 0);
+	cost.assign(cells, UNREACHED);
+	dirX.assign(cells, 0.0f);
+	dirZ.assign(cells, 0.0f);
+	heap.clear();
+	heap.reserve(cells);
+
+	target = -1;
+	dirty = true;
+	visited = 0;
+}
+
+void FlowField::SetBlocked(int cx, int cz, bool blocked)
+{
+	if (cx < 0 || cz < 0 || cx >= width || cz >= height)
+		return;
+
+	unsigned char value = blocked ? 1 : 0;
+	if (this->blocked[cz * width + cx] != value)
+	{
+		this->blocked[cz * width + cx] = value;
+		dirty = true;
+	}
+}
+
+bool FlowField::IsBlocked(int cx, int cz) const
+{
+	if (cx < 0 || cz < 0 || cx >= width || cz >= height)
+		return true;
+
+	return blocked[cz * width + cx] != 0;
+}
+
+void FlowField::ClearBlocked()
+{
+	std::fill(blocked.begin(), blocked.end(), (unsigned char)0);
+	dirty = true;
+}
+
+bool FlowField::CellOf(float x, float z, int &cx, int &cz) const
+{
+	cx = (int)floorf((x - minX) * invCellSize);
+	cz = (int)floorf((z - minZ) * invCellSize);
+	return cx >= 0 && cz >= 0 && cx < width && cz < height;
+}
+
+void FlowField::CellCenter(int cx, int cz, float &x, float &z) const
+{
+	x = minX + (cx + 0.5f) * cellSize;
+	z = minZ + (cz + 0.5f) * cellSize;
+}
+
+int FlowField::Width() const
+{
+	return width;
+}
+
+int FlowField::Height() const
+{
+	return height;
+}
+
+int FlowField::LastVisited() const
+{
+	return visited;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Building the field
+//////////////////////////////////////////////////////////////////////
+
+bool FlowField::Update(float targetX, float targetZ)
+{
+	if (width == 0)
+		return false;
+
+	// A target off the area chases the nearest edge cell
+	int cx, cz;
+	CellOf(targetX, targetZ, cx, cz);
+	cx = std::min(std::max(cx, 0), width - 1);
+	cz = std::min(std::max(cz, 0), height - 1);
+
+	int cell = cz * width + cx;
+	if (cell == target && !dirty)
+		return false;
+
+	Build(cell);
+	return true;
+}
+
+void FlowField::Build(int target)
+{
+	this->target = target;
+	dirty = false;
+	visited = 0;
+
+	std::fill(cost.begin(), cost.end(), UNREACHED);
+
+	// The standard heap keeps the largest on top, so "less" is "costs more"
+	auto cheaper = [](const Open &a, const Open &b) { return a.cost > b.cost; };
+
+	// Dijkstra out from the target (a cell can be queued more than once, the stale copies are skipped)
+	heap.clear();
+	Open start = { 0.0f, target };
+	cost[target] = 0.0f;
+	heap.push_back(start);
+
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), cheaper);
+		Open open = heap.back();
+		heap.pop_back();
+
+		if (open.cost > cost[open.cell])
+			continue;
+		visited++;
+
+		int x = open.cell % width;
+		int z = open.cell / width;
+
+		for (int n = 0; n < 8; n++)
+		{
+			int nx = x + stepX[n];
+			int nz = z + stepZ[n];
+			if (IsBlocked(nx, nz))
+				continue;
+
+			// No cutting the corner of a blocked cell
+			float step = 1.0f;
+			if (n >= 4)
+			{
+				if (IsBlocked(x + stepX[n], z) || IsBlocked(x, z + stepZ[n]))
+					continue;
+				step = DIAGONAL;
+			}
+
+			int next = nz * width + nx;
+			float c = open.cost + step;
+			if (c < cost[next])
+			{
+				cost[next] = c;
+				Open queued = { c, next };
+				heap.push_back(queued);
+				std::push_heap(heap.begin(), heap.end(), cheaper);
+			}
+		}
+	}
+
+	// Point every cell down the hill
+	int cells = width * height;
+	for (int cell = 0; cell < cells; cell++)
+		PointCell(cell);
+}
+
+void FlowField::PointCell(int cell)
+{
+	dirX[cell] = 0.0f;
+	dirZ[cell] = 0.0f;
+
+	if (cell == target)
+		return;
+
+	int x = cell % width;
+	int z = cell / width;
+	bool inside = blocked[cell] != 0;
+
+	// A blocked cell (something got pushed into it) points at its cheapest open neighbour
+	float best = inside ? UNREACHED : cost[cell];
+	int bestStep = -1;
+
+	for (int n = 0; n < 8; n++)
+	{
+		int nx = x + stepX[n];
+		int nz = z + stepZ[n];
+		if (IsBlocked(nx, nz))
+			continue;
+		if (n >= 4 && !inside && (IsBlocked(x + stepX[n], z) || IsBlocked(x, z + stepZ[n])))
+			continue;
+
+		float c = cost[nz * width + nx];
+		if (c < best || (inside && bestStep < 0))
+		{
+			best = c;
+			bestStep = n;
+		}
+	}
+
+	if (bestStep < 0)
+		return;
+
+	float length = bestStep >= 4 ? DIAGONAL : 1.0f;
+	dirX[cell] = stepX[bestStep] / length;
+	dirZ[cell] = stepZ[bestStep] / length;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Using the field
+//////////////////////////////////////////////////////////////////////
+
+void FlowField::Steer(const float *x, const float *z, float *vx, float *vz, int count, float speed) const
+{
+	if (width == 0)
+		return;
+
+	__m128 originX = _mm_set1_ps(minX);
+	__m128 originZ = _mm_set1_ps(minZ);
+	__m128 scale = _mm_set1_ps(invCellSize);
+	__m128 lastX = _mm_set1_ps((float)(width - 1));
+	__m128 lastZ = _mm_set1_ps((float)(height - 1));
+	__m128 rowLength = _mm_set1_ps((float)width);
+	__m128 zero = _mm_setzero_ps();
+	__m128 speed4 = _mm_set1_ps(speed);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// The cells of four agents (clamped onto the area, so truncating is the same as floor)
+		__m128 fx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), originX), scale);
+		__m128 fz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(z + i), originZ), scale);
+		fx = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fx, zero), lastX)));
+		fz = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fz, zero), lastZ)));
+
+		// SSE2 has no 32 bit multiply, the cell numbers are small enough to work out in floats
+		int cells[4];
+		_mm_storeu_si128((__m128i *)cells, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(fz, rowLength), fx)));
+
+		__m128 dx = _mm_set_ps(dirX[cells[3]], dirX[cells[2]], dirX[cells[1]], dirX[cells[0]]);
+		__m128 dz = _mm_set_ps(dirZ[cells[3]], dirZ[cells[2]], dirZ[cells[1]], dirZ[cells[0]]);
+
+		_mm_storeu_ps(vx + i, _mm_mul_ps(dx, speed4));
+		_mm_storeu_ps(vz + i, _mm_mul_ps(dz, speed4));
+	}
+
+	// The ones left over
+	for (; i < count; i++)
+	{
+		int cx, cz;
+		CellOf(x[i], z[i], cx, cz);
+		cx = std::min(std::max(cx, 0), width - 1);
+		cz = std::min(std::max(cz, 0), height - 1);
+
+		vx[i] = dirX[cz * width + cx] * speed;
+		vz[i] = dirZ[cz * width + cx] * speed;
+	}
+}
+
+float FlowField::Distance(float x, float z) const
+{
+	int cx, cz;
+	if (target < 0 || !CellOf(x, z, cx, cz))
+		return -1.0f;
+
+	float c = cost[cz * width + cx];
+	return c >= UNREACHED ? -1.0f : c * cellSize;
+}
@@ -0,0 +1,90 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Flow Field Navigation
+//
+// FlowField.h: interface for the FlowField class.
+// Finding a path for every enemy that chases the player costs more
+// with every enemy added. A flow field turns that around: the level
+// is cut into square cells and, once per target position, every
+// cell works out which way to go to reach the target. An enemy then
+// just looks up the cell it is in and walks that way, so a thousand
+// enemies cost little more than one.
+//
+// The field is worked out with Dijkstra from the target cell out
+// over the open cells (diagonal steps cost more and may not cut the
+// corner of a blocked cell). Each cell then points at its cheapest
+// neighbour. Update() only does this when the target moves into a
+// different cell or the obstacles have changed; the rest of the time
+// it returns straight away.
+//
+// The directions are kept as two plain arrays (x and z) and Steer()
+// works on the agents' positions in arrays as well, four at a time
+// with SSE.
+//
+// Usage:
+// FlowField field;
+// field.Reset(minX, minZ, maxX, maxZ, 1.0f);
+// field.SetBlocked(cx, cz, true);				// For every cell an obstacle covers
+//
+// field.Update(player.x, player.z);			// Every tick, cheap unless the player changed cell
+// field.Steer(xs, zs, vxs, vzs, count, speed);	// A velocity for every agent
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FLOWFIELD_H
+#define FLOWFIELD_H
+
+#include <vector>
+
+class FlowField
+{
+public:
+	// Cuts the area into cells (every cell open), the field is empty until the next Update()
+	void Reset(float minX, float minZ, float maxX, float maxZ, float cellSize);
+	void SetBlocked(int cx, int cz, bool blocked);	// Marks a cell an agent can't walk through
+	bool IsBlocked(int cx, int cz) const;
+	void ClearBlocked();						// Opens every cell
+	// The cell a point is in, false if it is outside the area
+	bool CellOf(float x, float z, int &cx, int &cz) const;
+	void CellCenter(int cx, int cz, float &x, float &z) const;
+	int Width() const;							// Cells along x
+	int Height() const;							// Cells along z
+
+	// Rebuilds the field toward the target if it changed cell or a cell was (un)blocked, true if it did
+	bool Update(float targetX, float targetZ);
+	// The velocity (speed along the field) for count agents at (x[i], z[i]), agents in the target cell stop
+	void Steer(const float *x, const float *z, float *vx, float *vz, int count, float speed) const;
+	// The path length from the point to the target, -1 if it can't get there
+	float Distance(float x, float z) const;
+	int LastVisited() const;					// Cells the last rebuild settled
+
+	FlowField();								// Constructor
+	virtual ~FlowField();						// Destructor
+
+private:
+	// A cell waiting in Dijkstra's queue
+	struct Open {
+		float cost;
+		int cell;
+	};
+
+	void Build(int target);						// Dijkstra from the target, then the directions
+	void PointCell(int cell);					// Points a cell at its cheapest neighbour
+
+	std::vector<unsigned char> blocked;
+	std::vector<float> cost;					// Path length to the target, a big number if it can't get there
+	std::vector<float> dirX;					// Which way to walk from each cell (unit length or 0)
+	std::vector<float> dirZ;
+	std::vector<Open> heap;						// Kept between rebuilds so they don't allocate
+	float minX;
+	float minZ;
+	float cellSize;
+	float invCellSize;
+	int width;
+	int height;
+	int target;									// The target's cell, -1 before the first Update()
+	bool dirty;									// The obstacles changed since the last rebuild
+	int visited;
+};
+
+#endif // FLOWFIELD_H
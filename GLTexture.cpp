@@ -5,8 +5,8 @@
 //
 // GLTexture.cpp: implementation of the GLTexture class.
 // This class loads a texture file and prepares it
-// to be used in OpenGL. It can open a bitmap or a
-// targa file. The min filter is set to mipmap b/c
+// to be used in OpenGL. It can open a bitmap, a
+// targa or a png file. The min filter is set to mipmap b/c
 // they look better and the performance cost on
 // modern video cards in negligible. I leave all of
 // the texture management to the application. I have
@@ -35,10 +35,14 @@
 //////////////////////////////////////////////////////////////////////
 
 #include "GLTexture.h"
+#include "ImageDecoder.h"
+#include "MipmapBuilder.h"
+#include "TextureCache.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <vector>
 
 
 //////////////////////////////////////////////////////////////////////
@@ -47,7 +51,9 @@
 
 GLTexture::GLTexture()
 {
-
+	texture[0] = 0;
+	width = 0;
+	height = 0;
 }
 
 GLTexture::~GLTexture()
@@ -64,11 +70,37 @@ void GLTexture::Load(char *name)
 	if (strstr(texturename, "\""))
 		texturename = strtok(texturename, "\"");
 
+	// a .dds made from the file ahead of time takes its place
+	char *ext = strrchr(texturename, '.');
+	if (ext && strcmp(ext, ".dds") != 0 && strcmp(ext, ".ktx") != 0 && ext - texturename < MAX_PATH - 5)
+	{
+		char compressed[MAX_PATH];
+		memcpy(compressed, texturename, ext - texturename);
+		strcpy(compressed + (ext - texturename), ".dds");
+
+		FILE *file = fopen(compressed, "rb");
+		if (file)
+		{
+			fclose(file);
+			LoadDDS(compressed);
+
+			// unless the card can't take it
+			if (texture[0])
+				return;
+		}
+	}
+
 	// check the file extension to see what type of texture
 	if(strstr(texturename, ".bmp"))	
 		LoadBMP(texturename);
 	if(strstr(texturename, ".tga"))	
 		LoadTGA(texturename);
+	if(strstr(texturename, ".png"))
+		LoadPNG(texturename);
+	if(strstr(texturename, ".dds"))
+		LoadDDS(texturename);
+	if(strstr(texturename, ".ktx"))
+		LoadKTX(texturename);
 }
 
 void GLTexture::LoadFromResource(char *name)
@@ -91,22 +123,53 @@ void GLTexture::Use()
 
 void GLTexture::LoadBMP(char *name)
 {
-	// Create a place to store the texture
-	AUX_RGBImageRec *TextureImage[1];
+	// The decoder tells the formats apart by their headers
+	LoadDecoded(name);
+}
+
+void GLTexture::LoadTGA(char *name)
+{
+	LoadDecoded(name);
+}
+
+void GLTexture::LoadPNG(char *name)
+{
+	LoadDecoded(name);
+}
+
+void GLTexture::LoadDecoded(char *name)
+{
+	// With the texture cache open the mip chain comes from it (built and stored the first time) and goes up as it is (scaled up if the card needs it)
+	TextureCache &cache = TextureCache::Shared();
+	if (cache.IsOpen())
+	{
+		TextureCache::Chain chain;
+		if (!cache.Get(name, chain))
+			return;
+
+		width = chain.width;
+		height = chain.height;
 
-	// Set the pointer to NULL
-	memset(TextureImage,0,sizeof(void *)*1);
+		glGenTextures(1, &texture[0]);
+		glBindTexture(GL_TEXTURE_2D, texture[0]);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+		chain.Upload();
+		return;
+	}
 
-	// Load the bitmap and assign our pointer to it
-	TextureImage[0] = auxDIBImageLoad(name);
+	// Textures are only made on the GL thread, so one decoder (and the buffers it keeps) does for all of them
+	static ImageDecoder decoder;
+	ImageInfo info;
 
-	// If the texture file was not found, return from the function
-	if(!TextureImage[0]) 
+	// Decode the file, if it isn't there or can't be read return from the function
+	unsigned char *pixels = decoder.DecodeFile(name, info);
+	if (!pixels)
 		return;
 
 	// Just in case we want to use the width and height later
-	width = TextureImage[0]->sizeX;
-	height = TextureImage[0]->sizeY;
+	width = info.width;
+	height = info.height;
 
 	// Generate the OpenGL texture id
 	glGenTextures(1, &texture[0]);
@@ -119,108 +182,135 @@ void GLTexture::LoadBMP(char *name)
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
 
 	// Generate the mipmaps
-	gluBuild2DMipmaps(GL_TEXTURE_2D, 3, TextureImage[0]->sizeX, TextureImage[0]->sizeY, GL_RGB, GL_UNSIGNED_BYTE, TextureImage[0]->data);
+	MipmapBuilder::Upload(pixels, width, height, info.channels);
+}
 
-	// Cleanup
-	if (TextureImage[0])
-	{
-		if (TextureImage[0]->data)
-			free(TextureImage[0]->data);
 
-		free(TextureImage[0]);
+// The whole file, empty if it can't be read
+static std::vector<unsigned char> ReadWholeFile(const char *name)
+{
+	std::vector<unsigned char> data;
+	FILE *file = fopen(name, "rb");
+	if (!file)
+		return data;
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (length > 0)
+	{
+		data.resize(length);
+		data.resize(fread(&data[0], 1, length, file));
 	}
+	fclose(file);
+	return data;
 }
 
-void GLTexture::LoadTGA(char *name)
+static unsigned int Read32(const unsigned char *p)
 {
-	GLubyte		TGAheader[12]	= {0,0,2,0,0,0,0,0,0,0,0,0};// Uncompressed TGA header
-	GLubyte		TGAcompare[12];								// Used to compare TGA header
-	GLubyte		header[6];									// First 6 useful bytes of the header
-	GLuint		bytesPerPixel;								// Holds the number of bytes per pixel used
-	GLuint		imageSize;									// Used to store the image size
-	GLuint		temp;										// Temporary variable
-	GLuint		type			= GL_RGBA;					// Set the default type to RBGA (32 BPP)
-	GLubyte		*imageData;									// Image data (up to 32 Bits)
-	GLuint		bpp;										// Image color depth in bits per pixel.
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
 
-	FILE *file = fopen(name, "rb");							// Open the TGA file
+void GLTexture::LoadDDS(char *name)
+{
+	std::vector<unsigned char> file = ReadWholeFile(name);
 
-	// Load the file and perform checks
-	if(file == NULL ||														// Does file exist?
-	   fread(TGAcompare,1,sizeof(TGAcompare),file) != sizeof(TGAcompare) ||	// Are there 12 bytes to read?
-	   memcmp(TGAheader,TGAcompare,sizeof(TGAheader)) != 0				 ||	// Is it the right format?
-	   fread(header,1,sizeof(header),file) != sizeof(header))				// If so then read the next 6 header bytes
-	{
-		if (file == NULL)									// If the file didn't exist then return
-			return;
-		else
-		{
-			fclose(file);									// If something broke then close the file and return
-			return;
-		}
-	}
+	// "DDS ", a 124 byte header and the blocks
+	if (file.size() < 128 || memcmp(&file[0], "DDS ", 4) != 0 || Read32(&file[4]) != 124)
+		return;
 
-	// Determine the TGA width and height (highbyte*256+lowbyte)
-	width  = header[1] * 256 + header[0];
-	height = header[3] * 256 + header[2];
-    
-	// Check to make sure the targa is valid and is 24 bit or 32 bit
-	if(width	<=0	||										// Is the width less than or equal to zero
-	   height	<=0	||										// Is the height less than or equal to zero
-	   (header[4] != 24 && header[4] != 32))				// Is it 24 or 32 bit?
-	{
-		fclose(file);										// If anything didn't check out then close the file and return
+	const unsigned char *header = &file[0];
+	int levels = (Read32(header + 8) & 0x20000) ? Read32(header + 28) : 1;
+	GLenum format;
+	if (memcmp(header + 84, "DXT1", 4) == 0)
+		format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	else if (memcmp(header + 84, "DXT3", 4) == 0)
+		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+	else if (memcmp(header + 84, "DXT5", 4) == 0)
+		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	else
 		return;
-	}
 
-	bpp				= header[4];							// Grab the bits per pixel
-	bytesPerPixel	= bpp / 8;								// Divide by 8 to get the bytes per pixel
-	imageSize		= width * height * bytesPerPixel;		// Calculate the memory required for the data
+	UploadCompressed(format, Read32(header + 16), Read32(header + 12), levels > 0 ? levels : 1,
+		header + 128, header + file.size(), false);
+}
 
-	// Allocate the memory for the image data
-	imageData		= new GLubyte[imageSize];
+void GLTexture::LoadKTX(char *name)
+{
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	std::vector<unsigned char> file = ReadWholeFile(name);
 
-	// Make sure the data is allocated write and load it
-	if(imageData == NULL ||									// Does the memory storage exist?
-	   fread(imageData, 1, imageSize, file) != imageSize)	// Does the image size match the memory reserved?
-	{
-		if(imageData != NULL)								// Was the image data loaded
-			free(imageData);								// If so, then release the image data
+	// A 64 byte header (little endian only), key/value data, then each level's size and blocks
+	if (file.size() < 64 || memcmp(&file[0], identifier, 12) != 0 || Read32(&file[12]) != 0x04030201)
+		return;
+
+	const unsigned char *header = &file[0];
+	GLenum format = Read32(header + 28);
+	size_t keyValueBytes = Read32(header + 60);
+	int levels = Read32(header + 56);
 
-		fclose(file);										// Close the file
+	// Only S3TC blocks (glType 0 is compressed), one 2D face
+	bool s3tc = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ||
+		format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	if (Read32(header + 16) != 0 || !s3tc || Read32(header + 48) > 1 || Read32(header + 52) > 1 || 64 + keyValueBytes > file.size())
 		return;
-	}
 
-	// Loop through the image data and swap the 1st and 3rd bytes (red and blue)
-	for(GLuint i = 0; i < int(imageSize); i += bytesPerPixel)
-	{
-		temp = imageData[i];
-		imageData[i] = imageData[i + 2];
-		imageData[i + 2] = temp;
-	}
+	UploadCompressed(format, Read32(header + 36), Read32(header + 40), levels > 0 ? levels : 1,
+		header + 64 + keyValueBytes, header + file.size(), true);
+}
 
-	// We are done with the file so close it
-	fclose(file);
+void GLTexture::UploadCompressed(GLenum format, int w, int h, int levels, const unsigned char *data, const unsigned char *end, bool sized)
+{
+	// Without S3TC the caller falls back to the uncompressed file
+	if (!GLEW_EXT_texture_compression_s3tc || w <= 0 || h <= 0)
+		return;
+
+	int blockBytes = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+
+	// Just in case we want to use the width and height later
+	width = w;
+	height = h;
 
-	// Set the type
-	if (bpp == 24)
-		type = GL_RGB;
-	
 	// Generate the OpenGL texture id
 	glGenTextures(1, &texture[0]);
 
 	// Bind this texture to its id
 	glBindTexture(GL_TEXTURE_2D, texture[0]);
 
-	// Use mipmapping filter
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	// Upload every level the file has, the blocks go to the card as they are
+	int uploaded = 0;
+	for (int level = 0; level < levels; level++)
+	{
+		int size = ((w + 3) / 4) * ((h + 3) / 4) * blockBytes;
+		if (sized)
+		{
+			// KTX puts each level's size in front of it
+			if (end - data < 4)
+				break;
+			data += 4;
+		}
+		if (end - data < size)
+			break;
 
-	// Generate the mipmaps
-	gluBuild2DMipmaps(GL_TEXTURE_2D, type, width, height, type, GL_UNSIGNED_BYTE, imageData);
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, size, data);
+		data += size;
+		uploaded++;
 
-	// Cleanup
-	free(imageData);
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+
+	// Only mipmap as far as the file went
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, uploaded > 0 ? uploaded - 1 : 0);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER, uploaded > 1 ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+
+	// Nothing usable: no texture, so the caller can fall back
+	if (uploaded == 0)
+	{
+		glDeleteTextures(1, &texture[0]);
+		texture[0] = 0;
+	}
 }
 
 
@@ -272,8 +362,7 @@ void GLTexture::LoadBMPResource(char *name)
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
 
 	// Generate the mipmaps
-	gluBuild2DMipmaps(GL_TEXTURE_2D, 3, width, height, GL_RGB, GL_UNSIGNED_BYTE, (unsigned char *)buffer+sizeof(BITMAPINFO)+2);
-	//gluBuild2DMipmaps(GL_TEXTURE_2D, 3, width, height, GL_RGB, GL_UNSIGNED_BYTE, bmp->bmBits);
+	MipmapBuilder::Upload(ptr, width, height, 3);
 
 	// Cleanup
 	free(buffer);
@@ -366,7 +455,7 @@ void GLTexture::LoadTGAResource(char *name)
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
 
 	// Generate the mipmaps
-	gluBuild2DMipmaps(GL_TEXTURE_2D, type, width, height, type, GL_UNSIGNED_BYTE, imageData);
+	MipmapBuilder::Upload(imageData, width, height, type == GL_RGBA ? 4 : 3);
 
 	// Cleanup
 	free(imageData);
@@ -398,6 +487,7 @@ void GLTexture::BuildColorTexture(unsigned char r, unsigned char g, unsigned cha
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
 
-	// Generate the texture
-	gluBuild2DMipmaps(GL_TEXTURE_2D, 3, 2, 2, GL_RGB, GL_UNSIGNED_BYTE, data);
+	// Both levels are the same color, nothing to filter
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2, 2, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+	glTexImage2D(GL_TEXTURE_2D, 1, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
 }
@@ -5,8 +5,11 @@
 //
 // GLTexture.h: interface for the GLTexture class.
 // This class loads a texture file and prepares it
-// to be used in OpenGL. It can open a bitmap or a
-// targa file. The min filter is set to mipmap b/c
+// to be used in OpenGL. It can open a bitmap, a
+// targa or a png file, or blocks compressed ahead of
+// time in a dds or ktx file (a .dds beside a bitmap,
+// targa or png is used instead of it when there is
+// one, see TextureCompressor). The min filter is set to mipmap b/c
 // they look better and the performance cost on
 // modern video cards in negligible. I leave all of
 // the texture management to the application. I have
@@ -38,11 +41,8 @@
 #define GLTEXTURE_H
 
 #include <windows.h>		// Header File For Windows
-#include <gl\gl.h>			// Header File For The OpenGL32 Library
+#include "glew.h"			// Header File For OpenGL (and the compressed texture calls)
 #include <gl\glu.h>			// Header File For The GLu32 Library
-#include "GLAUX.H"		// Header File For The Glaux Library
-
-#pragma comment(lib, "glaux")
 
 class GLTexture  
 {
@@ -58,10 +58,18 @@ public:
 	void LoadFromResource(char *name);				// Load the texture from a resource
 	void LoadTGA(char *name);						// Loads a targa file
 	void LoadBMP(char *name);						// Loads a bitmap file
+	void LoadPNG(char *name);						// Loads a png file
+	void LoadDDS(char *name);						// Loads a DXT1/3/5 dds file (see TextureCompressor)
+	void LoadKTX(char *name);						// Loads a ktx file of S3TC blocks
 	void Load(char *name);							// Load the texture
 	GLTexture();									// Constructor
 	virtual ~GLTexture();							// Destructor
 
+private:
+	void LoadDecoded(char *name);					// Loads any of the three through ImageDecoder
+	// Uploads levels of S3TC blocks (sized: each starts with its byte count, like in a ktx)
+	void UploadCompressed(GLenum format, int w, int h, int levels, const unsigned char *data, const unsigned char *end, bool sized);
+
 };
 
 #endif GLTEXTURE_H
\ No newline at end of file
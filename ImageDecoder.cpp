@@ -0,0 +1,1279 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Image Decoder
+//
+// ImageDecoder.cpp: implementation of the ImageDecoder class.
+// See ImageDecoder.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "ImageDecoder.h"
+
+#include <emmintrin.h>
+#include <stdio.h>
+#include <string.h>
+
+// Little and big endian fields
+static unsigned int Read16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int Read32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int Read32BE(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Images bigger than this on a side are taken to be corrupt headers
+static const int MAX_SIDE = 16384;
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+ImageDecoder::ImageDecoder()
+{
+	error = "";
+}
+
+ImageDecoder::~ImageDecoder()
+{
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decoding
+//////////////////////////////////////////////////////////////////////
+
+ImageDecoder::Format ImageDecoder::Detect(const unsigned char *data, size_t size)
+{
+	static const unsigned char pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	if (size >= 8 && memcmp(data, pngSignature, 8) == 0)
+		return FORMAT_PNG;
+	if (size >= 2 && data[0] == 'B' && data[1] == 'M')
+		return FORMAT_BMP;
+
+	// A targa's color map type is 0 or 1 and its image type one of six
+	if (size >= 18 && data[1] <= 1)
+	{
+		int type = data[2];
+		if (type == 1 || type == 2 || type == 3 || type == 9 || type == 10 || type == 11)
+			return FORMAT_TGA;
+	}
+
+	return FORMAT_UNKNOWN;
+}
+
+bool ImageDecoder::ReadInfo(const unsigned char *data, size_t size, ImageInfo &info)
+{
+	return DecodeInto(data, size, 0, 0, info);
+}
+
+unsigned char *ImageDecoder::Decode(const unsigned char *data, size_t size, ImageInfo &info)
+{
+	if (!ReadInfo(data, size, info))
+		return 0;
+
+	size_t bytes = (size_t)info.width * info.height * info.channels;
+	if (pixels.size() < bytes)
+		pixels.resize(bytes);
+
+	if (!DecodeInto(data, size, &pixels[0], bytes, info))
+		return 0;
+
+	return &pixels[0];
+}
+
+bool ImageDecoder::DecodeInto(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info)
+{
+	error = "";
+
+	switch (Detect(data, size))
+	{
+	case FORMAT_BMP:
+		return DecodeBMP(data, size, pixels, capacity, info);
+	case FORMAT_TGA:
+		return DecodeTGA(data, size, pixels, capacity, info);
+	case FORMAT_PNG:
+		return DecodePNG(data, size, pixels, capacity, info);
+	default:
+		return Fail("not a bitmap, targa or png");
+	}
+}
+
+unsigned char *ImageDecoder::DecodeFile(const char *path, ImageInfo &info)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+	{
+		Fail("can't open the file");
+		return 0;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	if (length <= 0)
+	{
+		fclose(f);
+		Fail("the file is empty");
+		return 0;
+	}
+
+	if (file.size() < (size_t)length)
+		file.resize(length);
+	size_t read = fread(&file[0], 1, length, f);
+	fclose(f);
+
+	return Decode(&file[0], read, info);
+}
+
+const char *ImageDecoder::Error() const
+{
+	return error;
+}
+
+bool ImageDecoder::Fail(const char *why)
+{
+	error = why;
+	return false;
+}
+
+// Checks a header's size and the room it needs, true if there's enough
+static bool CheckRoom(const ImageInfo &info, size_t capacity)
+{
+	return (size_t)info.width * info.height * info.channels <= capacity;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Swizzling
+//////////////////////////////////////////////////////////////////////
+
+void ImageDecoder::SwizzleBGRA(const unsigned char *src, unsigned char *dst, int pixels, bool opaque)
+{
+	int i = 0;
+
+	// Red and blue sit 16 bits apart in every 32 bit pixel: mask them out and shift them past each other
+	const __m128i redBlue = _mm_set1_epi32(0x00FF00FF);
+	const __m128i greenAlpha = _mm_set1_epi32((int)0xFF00FF00);
+	const __m128i alpha = _mm_set1_epi32(opaque ? (int)0xFF000000 : 0);
+	for (; i + 4 <= pixels; i += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + i * 4));
+		__m128i rb = _mm_and_si128(p, redBlue);
+		__m128i swapped = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		__m128i out = _mm_or_si128(_mm_or_si128(_mm_and_si128(p, greenAlpha), swapped), alpha);
+		_mm_storeu_si128((__m128i *)(dst + i * 4), out);
+	}
+
+	for (; i < pixels; i++)
+	{
+		dst[i * 4] = src[i * 4 + 2];
+		dst[i * 4 + 1] = src[i * 4 + 1];
+		dst[i * 4 + 2] = src[i * 4];
+		dst[i * 4 + 3] = opaque ? 255 : src[i * 4 + 3];
+	}
+}
+
+// Which bytes of a 16 byte block take the input byte two on, the one in the same place
+// and the one two back, for blocks starting 0, 1 or 2 bytes into a pixel
+struct SwizzleMasks {
+	__m128i select[3][3];
+
+	SwizzleMasks()
+	{
+		for (int phase = 0; phase < 3; phase++)
+		{
+			unsigned char bytes[3][16];
+			for (int j = 0; j < 16; j++)
+			{
+				int channel = (phase + j) % 3;		// 0: red's slot (blue is two on), 2: blue's (red is two back)
+				for (int m = 0; m < 3; m++)
+					bytes[m][j] = channel == m ? 0xFF : 0;
+			}
+			for (int m = 0; m < 3; m++)
+				select[phase][m] = _mm_loadu_si128((const __m128i *)bytes[m]);
+		}
+	}
+};
+
+void ImageDecoder::SwizzleBGR(const unsigned char *src, unsigned char *dst, int pixels)
+{
+	// Red and blue are two bytes apart, so every output byte is the input byte
+	// two on, the one in the same place or the one two back, depending on
+	// where it falls in its pixel. Three 16 byte blocks cover 16 pixels and
+	// bring the pattern back to where it started. The first pixel is done on
+	// its own so the block two bytes back never starts before src.
+	int bytes = pixels * 3;
+	int k = 3;
+
+	if (pixels > 0)
+	{
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+
+	static const SwizzleMasks masks;
+
+	for (; k + 48 + 2 <= bytes; k += 48)
+	{
+		for (int block = 0; block < 3; block++)
+		{
+			const unsigned char *s = src + k + block * 16;
+			__m128i ahead = _mm_loadu_si128((const __m128i *)(s + 2));
+			__m128i here = _mm_loadu_si128((const __m128i *)s);
+			__m128i behind = _mm_loadu_si128((const __m128i *)(s - 2));
+			__m128i out = _mm_or_si128(_mm_and_si128(ahead, masks.select[block][0]),
+				_mm_or_si128(_mm_and_si128(here, masks.select[block][1]), _mm_and_si128(behind, masks.select[block][2])));
+			_mm_storeu_si128((__m128i *)(dst + k + block * 16), out);
+		}
+	}
+
+	for (; k < bytes; k += 3)
+	{
+		dst[k] = src[k + 2];
+		dst[k + 1] = src[k + 1];
+		dst[k + 2] = src[k];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// BMP
+//////////////////////////////////////////////////////////////////////
+
+// Unpacks RLE8 or RLE4 into one palette index per pixel, bottom row first
+static bool UnpackBitmapRLE(const unsigned char *p, const unsigned char *end, unsigned char *indices, int width, int height, bool rle4)
+{
+	memset(indices, 0, (size_t)width * height);
+
+	int x = 0, y = 0;
+	while (p + 2 <= end)
+	{
+		int count = p[0];
+		int value = p[1];
+		p += 2;
+
+		if (count > 0)
+		{
+			// A run of one index (RLE4: two, taking turns)
+			if (y >= height)
+				return false;
+			unsigned char *row = indices + (size_t)y * width;
+			for (int i = 0; i < count && x < width; i++, x++)
+				row[x] = rle4 ? ((i & 1) ? value & 15 : value >> 4) : value;
+			continue;
+		}
+
+		if (value == 0)			// End of the row
+		{
+			x = 0;
+			y++;
+		}
+		else if (value == 1)	// End of the bitmap
+		{
+			return true;
+		}
+		else if (value == 2)	// Skip ahead
+		{
+			if (p + 2 > end)
+				return false;
+			x += p[0];
+			y += p[1];
+			p += 2;
+		}
+		else					// That many indices, stored as they are and padded to 16 bits
+		{
+			int bytes = rle4 ? (value + 1) / 2 : value;
+			if (p + bytes > end || y >= height)
+				return false;
+
+			unsigned char *row = indices + (size_t)y * width;
+			for (int i = 0; i < value && x < width; i++, x++)
+				row[x] = rle4 ? ((i & 1) ? p[i / 2] & 15 : p[i / 2] >> 4) : p[i];
+			p += (bytes + 1) & ~1;
+		}
+	}
+
+	// Ran off the end without an end of bitmap, keep what there is
+	return true;
+}
+
+bool ImageDecoder::DecodeBMP(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info)
+{
+	if (size < 26)
+		return Fail("bitmap header cut short");
+
+	unsigned int offset = Read32(data + 10);
+	unsigned int headerSize = Read32(data + 14);
+	int width, height, bpp, compression = 0, paletteEntry = 4;
+	unsigned int colorsUsed = 0;
+
+	if (headerSize == 12)
+	{
+		// The old OS/2 header
+		width = Read16(data + 18);
+		height = (short)Read16(data + 20);
+		bpp = Read16(data + 24);
+		paletteEntry = 3;
+	}
+	else
+	{
+		if (headerSize < 40 || size < 54)
+			return Fail("bitmap header cut short");
+		width = (int)Read32(data + 18);
+		height = (int)Read32(data + 22);
+		bpp = Read16(data + 28);
+		compression = Read32(data + 30);
+		colorsUsed = Read32(data + 46);
+	}
+
+	// A negative height is stored top row first
+	bool topDown = height < 0;
+	if (topDown)
+		height = -height;
+
+	if (width <= 0 || height <= 0 || width > MAX_SIDE || height > MAX_SIDE)
+		return Fail("bad bitmap size");
+
+	// Bit fields are fine as long as they are the usual BGRA order
+	bool hasAlpha = false;
+	if (compression == 3 || compression == 6)
+	{
+		if (bpp != 32 || size < 66 || Read32(data + 54) != 0x00FF0000 || Read32(data + 58) != 0x0000FF00 || Read32(data + 62) != 0x000000FF)
+			return Fail("bitmap bit fields aren't supported");
+		hasAlpha = (headerSize >= 56 || compression == 6) && size >= 70 && Read32(data + 66) == 0xFF000000;
+	}
+	else if (compression == 1 && bpp != 8)
+		return Fail("bad RLE8 bitmap");
+	else if (compression == 2 && bpp != 4)
+		return Fail("bad RLE4 bitmap");
+	else if (compression > 2)
+		return Fail("compressed bitmaps aren't supported");
+
+	if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32)
+		return Fail("bitmap bit depth isn't supported");
+
+	// Rows are padded to 32 bits (RLE rows are packets instead)
+	bool rle = compression == 1 || compression == 2;
+	size_t stride = (((size_t)width * bpp + 31) / 32) * 4;
+	if (offset >= size || (!rle && offset + stride * (height - 1) + ((size_t)width * bpp + 7) / 8 > size))
+		return Fail("bitmap cut short");
+
+	info.width = width;
+	info.height = height;
+	info.channels = bpp == 32 ? 4 : 3;
+	if (!pixels)
+		return true;
+	if (!CheckRoom(info, capacity))
+		return Fail("not enough room for the pixels");
+
+	int outStride = width * info.channels;
+
+	// Palettes are BGR(X), turned into RGB once here
+	unsigned char palette[256][3];
+	if (bpp <= 8)
+	{
+		memset(palette, 0, sizeof(palette));
+		unsigned int colors = colorsUsed ? colorsUsed : 1u << bpp;
+		if (colors > 256)
+			colors = 256;
+
+		const unsigned char *entry = data + 14 + headerSize;
+		for (unsigned int i = 0; i < colors && entry + 3 <= data + size; i++, entry += paletteEntry)
+		{
+			palette[i][0] = entry[2];
+			palette[i][1] = entry[1];
+			palette[i][2] = entry[0];
+		}
+	}
+
+	if (rle)
+	{
+		// RLE bitmaps are always bottom row first, like the output
+		if (unpacked.size() < (size_t)width * height)
+			unpacked.resize((size_t)width * height);
+		if (!UnpackBitmapRLE(data + offset, data + size, &unpacked[0], width, height, compression == 2))
+			return Fail("bad RLE bitmap data");
+
+		const unsigned char *index = &unpacked[0];
+		unsigned char *out = pixels;
+		for (size_t i = 0; i < (size_t)width * height; i++, out += 3)
+		{
+			const unsigned char *color = palette[index[i]];
+			out[0] = color[0];
+			out[1] = color[1];
+			out[2] = color[2];
+		}
+		return true;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char *src = data + offset + stride * y;
+		unsigned char *dst = pixels + (size_t)outStride * (topDown ? height - 1 - y : y);
+
+		if (bpp == 24)
+			SwizzleBGR(src, dst, width);
+		else if (bpp == 32)
+			SwizzleBGRA(src, dst, width, !hasAlpha);
+		else
+		{
+			// 1, 4 and 8 bits, high bits first
+			int perByte = 8 / bpp;
+			int mask = (1 << bpp) - 1;
+			for (int x = 0; x < width; x++, dst += 3)
+			{
+				int shift = 8 - bpp * (x % perByte + 1);
+				const unsigned char *color = palette[(src[x / perByte] >> shift) & mask];
+				dst[0] = color[0];
+				dst[1] = color[1];
+				dst[2] = color[2];
+			}
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// TGA
+//////////////////////////////////////////////////////////////////////
+
+bool ImageDecoder::DecodeTGA(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info)
+{
+	int idLength = data[0];
+	int mapType = data[1];
+	int type = data[2];
+	int mapFirst = Read16(data + 3);
+	int mapLength = Read16(data + 5);
+	int mapBits = data[7];
+	int width = Read16(data + 12);
+	int height = Read16(data + 14);
+	int bpp = data[16];
+	bool topDown = (data[17] & 0x20) != 0;
+	bool rle = type >= 9;
+	int baseType = rle ? type - 8 : type;
+
+	if (width <= 0 || height <= 0 || width > MAX_SIDE || height > MAX_SIDE)
+		return Fail("bad targa size");
+
+	if (baseType == 2 && bpp != 24 && bpp != 32)
+		return Fail("targa bit depth isn't supported");
+	if ((baseType == 1 || baseType == 3) && bpp != 8)
+		return Fail("targa bit depth isn't supported");
+	if (baseType == 1 && (mapType != 1 || (mapBits != 24 && mapBits != 32)))
+		return Fail("targa color map isn't supported");
+
+	// The pixels follow the id and the color map
+	size_t mapBytes = mapType == 1 ? (size_t)mapLength * ((mapBits + 7) / 8) : 0;
+	size_t start = 18 + idLength + mapBytes;
+	int bytesPerPixel = bpp / 8;
+	size_t rawBytes = (size_t)width * height * bytesPerPixel;
+	if (start > size || (!rle && start + rawBytes > size))
+		return Fail("targa cut short");
+
+	info.width = width;
+	info.height = height;
+	info.channels = (baseType == 2 && bpp == 32) || (baseType == 1 && mapBits == 32) ? 4 : 3;
+	if (!pixels)
+		return true;
+	if (!CheckRoom(info, capacity))
+		return Fail("not enough room for the pixels");
+
+	const unsigned char *map = data + 18 + idLength;
+	const unsigned char *src = data + start;
+	const unsigned char *end = data + size;
+
+	if (rle)
+	{
+		// Packets of one pixel repeated or of pixels as they are, running across rows
+		if (unpacked.size() < rawBytes)
+			unpacked.resize(rawBytes);
+
+		unsigned char *out = &unpacked[0];
+		unsigned char *outEnd = out + rawBytes;
+		while (out < outEnd)
+		{
+			if (src >= end)
+				return Fail("targa cut short");
+
+			int header = *src++;
+			size_t count = (header & 0x7F) + 1;
+			size_t bytes = count * bytesPerPixel;
+			if (out + bytes > outEnd)
+				bytes = outEnd - out;
+
+			if (header & 0x80)
+			{
+				if (src + bytesPerPixel > end)
+					return Fail("targa cut short");
+				if (bytesPerPixel == 4)
+				{
+					unsigned int pixel;
+					memcpy(&pixel, src, 4);
+					for (size_t i = 0; i < bytes; i += 4)
+						memcpy(out + i, &pixel, 4);
+				}
+				else
+				{
+					for (size_t i = 0; i < bytes; i += bytesPerPixel)
+						for (int c = 0; c < bytesPerPixel; c++)
+							out[i + c] = src[c];
+				}
+				src += bytesPerPixel;
+			}
+			else
+			{
+				if (src + bytes > end)
+					return Fail("targa cut short");
+				memcpy(out, src, bytes);
+				src += bytes;
+			}
+			out += bytes;
+		}
+
+		src = &unpacked[0];
+	}
+
+	// Color maps are BGR(A) too
+	unsigned char palette[256][4];
+	if (baseType == 1)
+	{
+		memset(palette, 0, sizeof(palette));
+		int entryBytes = mapBits / 8;
+		for (int i = 0; i < mapLength && mapFirst + i < 256; i++)
+		{
+			const unsigned char *entry = map + i * entryBytes;
+			unsigned char *color = palette[mapFirst + i];
+			color[0] = entry[2];
+			color[1] = entry[1];
+			color[2] = entry[0];
+			color[3] = entryBytes == 4 ? entry[3] : 255;
+		}
+	}
+
+	int outStride = width * info.channels;
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char *row = src + (size_t)width * bytesPerPixel * y;
+		unsigned char *dst = pixels + (size_t)outStride * (topDown ? height - 1 - y : y);
+
+		if (baseType == 2)
+		{
+			if (bpp == 24)
+				SwizzleBGR(row, dst, width);
+			else
+				SwizzleBGRA(row, dst, width, false);
+		}
+		else if (baseType == 3)
+		{
+			for (int x = 0; x < width; x++, dst += 3)
+				dst[0] = dst[1] = dst[2] = row[x];
+		}
+		else
+		{
+			for (int x = 0; x < width; x++, dst += info.channels)
+				memcpy(dst, palette[row[x]], info.channels);
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Inflate
+//////////////////////////////////////////////////////////////////////
+
+// Codes up to this long are decoded with one table lookup, longer ones bit by bit
+static const int FAST_BITS = 10;
+
+// A canonical Huffman code
+struct HuffmanTable {
+	unsigned short fast[1 << FAST_BITS];	// The next FAST_BITS bits (reversed) to symbol << 4 | length, 0: longer code
+	unsigned short count[16];				// Codes of each length
+	unsigned short symbols[288];			// Symbols in code order
+};
+
+// Builds the table for a set of code lengths, false if they over-subscribe the code
+static bool BuildHuffman(HuffmanTable &table, const unsigned char *lengths, int numSymbols)
+{
+	memset(table.count, 0, sizeof(table.count));
+	memset(table.fast, 0, sizeof(table.fast));
+
+	for (int i = 0; i < numSymbols; i++)
+		table.count[lengths[i]]++;
+	table.count[0] = 0;
+
+	// The first code and symbol slot of each length
+	int code = 0, left = 1;
+	unsigned short next[16];
+	int firstCode[16];
+	next[1] = 0;
+	for (int len = 1; len < 16; len++)
+	{
+		left = (left << 1) - table.count[len];
+		if (left < 0)
+			return false;
+		firstCode[len] = code;
+		code = (code + table.count[len]) << 1;
+		if (len < 15)
+			next[len + 1] = next[len] + table.count[len];
+	}
+
+	for (int i = 0; i < numSymbols; i++)
+	{
+		int len = lengths[i];
+		if (!len)
+			continue;
+
+		int slot = next[len]++;
+		table.symbols[slot] = (unsigned short)i;
+
+		if (len <= FAST_BITS)
+		{
+			// The code's bits come out of the stream lowest first, so the table is indexed reversed
+			int c = firstCode[len]++;
+			int reversed = 0;
+			for (int b = 0; b < len; b++)
+				reversed |= ((c >> b) & 1) << (len - 1 - b);
+			for (int j = reversed; j < (1 << FAST_BITS); j += 1 << len)
+				table.fast[j] = (unsigned short)((i << 4) | len);
+		}
+	}
+
+	return true;
+}
+
+// Reads a deflate stream's bits, lowest first
+struct BitReader {
+	const unsigned char *p;
+	const unsigned char *end;
+	unsigned long long bits;
+	int count;
+	int padding;			// Zero bytes fed in past the end
+
+	void Refill()
+	{
+		// Eight bytes at once while there are eight left, keeping as many whole bytes as fit
+		if (end - p >= 8)
+		{
+			unsigned long long next;
+			memcpy(&next, p, 8);
+			bits |= next << count;
+			p += (63 - count) >> 3;
+			count |= 56;
+			return;
+		}
+
+		while (count <= 56)
+		{
+			if (p < end)
+				bits |= (unsigned long long)*p++ << count;
+			else
+				padding++;
+			count += 8;
+		}
+	}
+
+	unsigned int Take(int n)
+	{
+		if (count < n)
+			Refill();
+		unsigned int v = (unsigned int)(bits & ((1ull << n) - 1));
+		bits >>= n;
+		count -= n;
+		return v;
+	}
+
+	// True once any of the zeros fed in past the end have been used
+	bool Overrun() const
+	{
+		return padding * 8 > count;
+	}
+};
+
+// The next symbol, -1 if the bits aren't a code
+static inline int DecodeSymbol(BitReader &in, const HuffmanTable &table)
+{
+	if (in.count < 16)
+		in.Refill();
+
+	int entry = table.fast[in.bits & ((1 << FAST_BITS) - 1)];
+	if (entry)
+	{
+		int len = entry & 15;
+		in.bits >>= len;
+		in.count -= len;
+		return entry >> 4;
+	}
+
+	// A long code: walk the lengths, one bit at a time
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len < 16; len++)
+	{
+		code |= (int)(in.bits & 1);
+		in.bits >>= 1;
+		in.count--;
+
+		int count = table.count[len];
+		if (code - first < count)
+			return table.symbols[index + code - first];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static const unsigned short LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// The fixed codes of block type 1, built once
+struct FixedTables {
+	HuffmanTable literals;
+	HuffmanTable distances;
+
+	FixedTables()
+	{
+		unsigned char lengths[288];
+		for (int i = 0; i < 288; i++)
+			lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+		BuildHuffman(literals, lengths, 288);
+
+		for (int i = 0; i < 30; i++)
+			lengths[i] = 5;
+		BuildHuffman(distances, lengths, 30);
+	}
+};
+
+// Reads a dynamic block's code lengths and builds its two tables
+static bool ReadDynamicTables(BitReader &in, HuffmanTable &literals, HuffmanTable &distances)
+{
+	static const unsigned char ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	int numLiterals = in.Take(5) + 257;
+	int numDistances = in.Take(5) + 1;
+	int numCodeLengths = in.Take(4) + 4;
+	if (numLiterals > 286 || numDistances > 30)
+		return false;
+
+	unsigned char lengths[288 + 32];
+	memset(lengths, 0, 19);
+	for (int i = 0; i < numCodeLengths; i++)
+		lengths[ORDER[i]] = (unsigned char)in.Take(3);
+
+	HuffmanTable codeLengths;
+	if (!BuildHuffman(codeLengths, lengths, 19))
+		return false;
+
+	int total = numLiterals + numDistances;
+	for (int i = 0; i < total;)
+	{
+		int symbol = DecodeSymbol(in, codeLengths);
+		if (symbol < 0)
+			return false;
+
+		if (symbol < 16)
+		{
+			lengths[i++] = (unsigned char)symbol;
+			continue;
+		}
+
+		int repeat;
+		unsigned char value = 0;
+		if (symbol == 16)
+		{
+			if (i == 0)
+				return false;
+			value = lengths[i - 1];
+			repeat = 3 + in.Take(2);
+		}
+		else if (symbol == 17)
+			repeat = 3 + in.Take(3);
+		else
+			repeat = 11 + in.Take(7);
+
+		if (i + repeat > total)
+			return false;
+		memset(lengths + i, value, repeat);
+		i += repeat;
+	}
+
+	if (lengths[256] == 0)
+		return false;
+
+	return BuildHuffman(literals, lengths, numLiterals) && BuildHuffman(distances, lengths + numLiterals, numDistances);
+}
+
+bool ImageDecoder::Inflate(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity, size_t &written)
+{
+	static const FixedTables fixed;
+
+	written = 0;
+
+	// The zlib header: deflate, no preset dictionary
+	if (size < 2 || (src[0] & 15) != 8 || ((src[0] << 8) | src[1]) % 31 != 0 || (src[1] & 0x20))
+		return false;
+
+	BitReader in;
+	in.p = src + 2;
+	in.end = src + size;
+	in.bits = 0;
+	in.count = 0;
+	in.padding = 0;
+
+	unsigned char *out = dst;
+	unsigned char *outEnd = dst + capacity;
+	HuffmanTable literals, distances;
+
+	bool last = false;
+	while (!last)
+	{
+		last = in.Take(1) != 0;
+		int type = in.Take(2);
+
+		if (type == 0)
+		{
+			// Stored: back up to the byte boundary and copy
+			int unread = in.count / 8;
+			in.p -= unread - in.padding > 0 ? unread - in.padding : 0;
+			in.bits = 0;
+			in.count = 0;
+			in.padding = 0;
+
+			if (in.p + 4 > in.end)
+				return false;
+			unsigned int length = Read16(in.p);
+			if ((length ^ Read16(in.p + 2)) != 0xFFFF)
+				return false;
+			in.p += 4;
+
+			if (in.p + length > in.end || out + length > outEnd)
+				return false;
+			memcpy(out, in.p, length);
+			out += length;
+			in.p += length;
+			continue;
+		}
+
+		const HuffmanTable *lit, *dist;
+		if (type == 1)
+		{
+			lit = &fixed.literals;
+			dist = &fixed.distances;
+		}
+		else if (type == 2)
+		{
+			if (!ReadDynamicTables(in, literals, distances))
+				return false;
+			lit = &literals;
+			dist = &distances;
+		}
+		else
+			return false;
+
+		for (;;)
+		{
+			int symbol = DecodeSymbol(in, *lit);
+			if (symbol < 256)
+			{
+				if (symbol < 0 || out >= outEnd)
+					return false;
+				*out++ = (unsigned char)symbol;
+				continue;
+			}
+			if (symbol == 256)
+				break;
+
+			symbol -= 257;
+			if (symbol >= 29)
+				return false;
+			int length = LENGTH_BASE[symbol] + in.Take(LENGTH_EXTRA[symbol]);
+
+			int d = DecodeSymbol(in, *dist);
+			if (d < 0 || d >= 30)
+				return false;
+			size_t distance = DIST_BASE[d] + in.Take(DIST_EXTRA[d]);
+
+			if (distance > (size_t)(out - dst) || out + length > outEnd)
+				return false;
+
+			// Eight bytes at a time when there's room to write past the end (the
+			// next symbols overwrite it), byte by byte when the copy overlaps itself
+			const unsigned char *from = out - distance;
+			if (distance >= 8 && outEnd - out >= length + 8)
+			{
+				for (int i = 0; i < length; i += 8)
+					memcpy(out + i, from + i, 8);
+			}
+			else
+			{
+				for (int i = 0; i < length; i++)
+					out[i] = from[i];
+			}
+			out += length;
+		}
+
+		if (in.Overrun())
+			return false;
+	}
+
+	written = out - dst;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// PNG
+//////////////////////////////////////////////////////////////////////
+
+// The neighbour most like the gradient of the three
+static inline int Paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = p > a ? p - a : a - p;
+	int pb = p > b ? p - b : b - p;
+	int pc = p > c ? p - c : c - p;
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+// One 3 or 4 byte pixel into the low lanes of a register and back
+template <int BPP> static inline __m128i LoadPixel(const unsigned char *p)
+{
+	int v = 0;
+	memcpy(&v, p, BPP);
+	return _mm_cvtsi32_si128(v);
+}
+
+template <int BPP> static inline void StorePixel(unsigned char *p, __m128i v)
+{
+	int out = _mm_cvtsi128_si32(v);
+	memcpy(p, &out, BPP);
+}
+
+// Sub, Average and Paeth for RGB and RGBA rows a whole pixel at a time (after libpng's SSE2
+// filters). Each pixel still waits for the one to its left, but its channels go together.
+template <int BPP> static void UnfilterPixels(int filter, unsigned char *row, const unsigned char *prior, size_t bytes)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;				// The pixel to the left
+	__m128i c = zero;				// The one above that (16 bit lanes for Paeth)
+
+	if (filter == 1)
+	{
+		for (size_t i = 0; i < bytes; i += BPP)
+		{
+			a = _mm_add_epi8(LoadPixel<BPP>(row + i), a);
+			StorePixel<BPP>(row + i, a);
+		}
+	}
+	else if (filter == 3)
+	{
+		// avg_epu8 rounds up, take the odd bit back off
+		const __m128i one = _mm_set1_epi8(1);
+		for (size_t i = 0; i < bytes; i += BPP)
+		{
+			__m128i b = LoadPixel<BPP>(prior + i);
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+			a = _mm_add_epi8(LoadPixel<BPP>(row + i), average);
+			StorePixel<BPP>(row + i, a);
+		}
+	}
+	else
+	{
+		// Paeth in 16 bit lanes: p - a = b - c, p - b = a - c, p - c = both added
+		for (size_t i = 0; i < bytes; i += BPP)
+		{
+			__m128i b = _mm_unpacklo_epi8(LoadPixel<BPP>(prior + i), zero);
+			__m128i left = _mm_unpacklo_epi8(a, zero);
+
+			__m128i pa = _mm_sub_epi16(b, c);
+			__m128i pb = _mm_sub_epi16(left, c);
+			__m128i pc = _mm_add_epi16(pa, pb);
+			pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+			pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+			pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i useA = _mm_cmpeq_epi16(smallest, pa);
+			__m128i useB = _mm_cmpeq_epi16(smallest, pb);
+			__m128i bOrC = _mm_or_si128(_mm_and_si128(useB, b), _mm_andnot_si128(useB, c));
+			__m128i nearest = _mm_or_si128(_mm_and_si128(useA, left), _mm_andnot_si128(useA, bOrC));
+
+			a = _mm_add_epi8(LoadPixel<BPP>(row + i), _mm_packus_epi16(nearest, nearest));
+			StorePixel<BPP>(row + i, a);
+			c = b;
+		}
+	}
+}
+
+// Undoes one row's filter in place, prior is the row above (already unfiltered) or 0 for the first
+static bool Unfilter(int filter, unsigned char *row, const unsigned char *prior, size_t bytes, int bpp)
+{
+	size_t i;
+
+	// Above the first row is all zeros: Up does nothing and Paeth always picks the left byte
+	if (!prior)
+	{
+		if (filter == 2)
+			filter = 0;
+		else if (filter == 4)
+			filter = 1;
+	}
+
+	// Whole pixels with SSE2 (Up needs no help, the compiler vectorizes it)
+	if ((bpp == 3 || bpp == 4) && (filter == 1 || (prior && (filter == 3 || filter == 4))))
+	{
+		if (bpp == 3)
+			UnfilterPixels<3>(filter, row, prior, bytes);
+		else
+			UnfilterPixels<4>(filter, row, prior, bytes);
+		return true;
+	}
+
+	switch (filter)
+	{
+	case 0:
+		break;
+	case 1:		// Sub
+		for (i = bpp; i < bytes; i++)
+			row[i] = (unsigned char)(row[i] + row[i - bpp]);
+		break;
+	case 2:		// Up
+		for (i = 0; i < bytes; i++)
+			row[i] = (unsigned char)(row[i] + prior[i]);
+		break;
+	case 3:		// Average
+		if (!prior)
+		{
+			for (i = bpp; i < bytes; i++)
+				row[i] = (unsigned char)(row[i] + (row[i - bpp] >> 1));
+			break;
+		}
+		for (i = 0; i < (size_t)bpp; i++)
+			row[i] = (unsigned char)(row[i] + (prior[i] >> 1));
+		for (; i < bytes; i++)
+			row[i] = (unsigned char)(row[i] + ((row[i - bpp] + prior[i]) >> 1));
+		break;
+	case 4:		// Paeth
+		for (i = 0; i < (size_t)bpp; i++)
+			row[i] = (unsigned char)(row[i] + prior[i]);
+		for (; i < bytes; i++)
+			row[i] = (unsigned char)(row[i] + Paeth(row[i - bpp], prior[i], prior[i - bpp]));
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+bool ImageDecoder::DecodePNG(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info)
+{
+	const unsigned char *p = data + 8;
+	const unsigned char *end = data + size;
+
+	int width = 0, height = 0, depth = 0, colorType = -1;
+	unsigned char palette[256][4];
+	int paletteSize = 0;
+	memset(palette, 0, sizeof(palette));
+	bool transparent = false;
+	const unsigned char *idat = 0;
+	size_t idatSize = 0;
+	int idatChunks = 0;
+
+	// Walk the chunks, only the header, palette, transparency and data matter
+	while (p + 12 <= end)
+	{
+		size_t length = Read32BE(p);
+		const unsigned char *type = p + 4;
+		const unsigned char *body = p + 8;
+		if (length > (size_t)(end - body) - 4)
+			return Fail("png cut short");
+
+		if (memcmp(type, "IHDR", 4) == 0)
+		{
+			if (length < 13)
+				return Fail("bad png header");
+			width = (int)Read32BE(body);
+			height = (int)Read32BE(body + 4);
+			depth = body[8];
+			colorType = body[9];
+			if (body[10] != 0 || body[11] != 0)
+				return Fail("png compression or filter method isn't supported");
+			if (body[12] != 0)
+				return Fail("interlaced pngs aren't supported");
+		}
+		else if (memcmp(type, "PLTE", 4) == 0)
+		{
+			paletteSize = (int)(length / 3) > 256 ? 256 : (int)(length / 3);
+			for (int i = 0; i < paletteSize; i++)
+			{
+				palette[i][0] = body[i * 3];
+				palette[i][1] = body[i * 3 + 1];
+				palette[i][2] = body[i * 3 + 2];
+				palette[i][3] = 255;
+			}
+		}
+		else if (memcmp(type, "tRNS", 4) == 0 && colorType == 3)
+		{
+			transparent = true;
+			for (size_t i = 0; i < length && i < (size_t)paletteSize; i++)
+				palette[i][3] = body[i];
+		}
+		else if (memcmp(type, "IDAT", 4) == 0)
+		{
+			// The header is all ReadInfo() needs
+			if (!pixels)
+				break;
+
+			// Usually one chunk, used where it is; more get joined
+			if (idatChunks == 0)
+			{
+				idat = body;
+				idatSize = length;
+			}
+			else
+			{
+				if (idatChunks == 1)
+					compressed.assign(idat, idat + idatSize);
+				compressed.insert(compressed.end(), body, body + length);
+				idat = &compressed[0];
+				idatSize = compressed.size();
+			}
+			idatChunks++;
+		}
+		else if (memcmp(type, "IEND", 4) == 0)
+			break;
+
+		p = body + length + 4;
+	}
+
+	int samples;
+	switch (colorType)
+	{
+	case 0: samples = 1; break;
+	case 2: samples = 3; break;
+	case 3: samples = 1; break;
+	case 4: samples = 2; break;
+	case 6: samples = 4; break;
+	default: return Fail("bad png header");
+	}
+
+	bool depthOk = depth == 8 || (depth == 16 && colorType != 3) || ((depth == 1 || depth == 2 || depth == 4) && (colorType == 0 || colorType == 3));
+	if (!depthOk)
+		return Fail("png bit depth isn't supported");
+	if (width <= 0 || height <= 0 || width > MAX_SIDE || height > MAX_SIDE)
+		return Fail("bad png size");
+
+	info.width = width;
+	info.height = height;
+	info.channels = colorType == 4 || colorType == 6 || (colorType == 3 && transparent) ? 4 : 3;
+	if (!pixels)
+		return true;
+	if (!CheckRoom(info, capacity))
+		return Fail("not enough room for the pixels");
+	if (!idat)
+		return Fail("png has no image data");
+	if (colorType == 3 && paletteSize == 0)
+		return Fail("png has no palette");
+
+	// Every row is a filter byte and the packed samples
+	int bitsPerPixel = samples * depth;
+	size_t rowBytes = ((size_t)width * bitsPerPixel + 7) / 8;
+	int filterBpp = bitsPerPixel >= 8 ? bitsPerPixel / 8 : 1;
+	size_t filteredSize = (rowBytes + 1) * height;
+
+	if (unpacked.size() < filteredSize)
+		unpacked.resize(filteredSize);
+
+	size_t written;
+	if (!Inflate(idat, idatSize, &unpacked[0], filteredSize, written) || written != filteredSize)
+	{
+		compressed.clear();
+		return Fail("bad png image data");
+	}
+	compressed.clear();
+
+	int outStride = width * info.channels;
+	const unsigned char *prior = 0;
+	for (int y = 0; y < height; y++)
+	{
+		unsigned char *row = &unpacked[(rowBytes + 1) * y];
+		if (!Unfilter(row[0], row + 1, prior, rowBytes, filterBpp))
+			return Fail("bad png filter");
+		row++;
+		prior = row;
+
+		// PNGs are stored top row first
+		unsigned char *dst = pixels + (size_t)outStride * (height - 1 - y);
+
+		if (depth == 8 && (colorType == 2 || colorType == 6))
+		{
+			memcpy(dst, row, outStride);
+		}
+		else if (colorType == 3)
+		{
+			int perByte = 8 / depth;
+			int mask = (1 << depth) - 1;
+			for (int x = 0; x < width; x++, dst += info.channels)
+			{
+				int index = depth == 8 ? row[x] : (row[x / perByte] >> (8 - depth * (x % perByte + 1))) & mask;
+				memcpy(dst, palette[index], info.channels);
+			}
+		}
+		else if (depth == 16)
+		{
+			// Keep the high byte of each sample
+			for (int x = 0; x < width; x++, dst += info.channels)
+			{
+				const unsigned char *s = row + x * samples * 2;
+				if (colorType == 0 || colorType == 4)
+				{
+					dst[0] = dst[1] = dst[2] = s[0];
+					if (colorType == 4)
+						dst[3] = s[2];
+				}
+				else
+				{
+					for (int c = 0; c < samples; c++)
+						dst[c] = s[c * 2];
+				}
+			}
+		}
+		else
+		{
+			// Grey (1 to 8 bits, spread over 0..255) and grey with alpha
+			int perByte = 8 / depth;
+			int mask = (1 << depth) - 1;
+			int scale = 255 / mask;
+			for (int x = 0; x < width; x++, dst += info.channels)
+			{
+				if (colorType == 4)
+				{
+					dst[0] = dst[1] = dst[2] = row[x * 2];
+					dst[3] = row[x * 2 + 1];
+				}
+				else
+				{
+					int grey = depth == 8 ? row[x] : ((row[x / perByte] >> (8 - depth * (x % perByte + 1))) & mask) * scale;
+					dst[0] = dst[1] = dst[2] = (unsigned char)grey;
+				}
+			}
+		}
+	}
+
+	return true;
+}
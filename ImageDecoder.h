@@ -0,0 +1,101 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Image Decoder
+//
+// ImageDecoder.h: interface for the ImageDecoder class.
+// Bitmaps used to be read by glaux's auxDIBImageLoad, which only
+// exists on Windows and only reads plain bitmaps, and targas by a
+// loop that swapped red and blue one byte at a time. This class
+// reads all three formats the game ships in itself:
+//
+// BMP: 1, 4, 8 (with RLE4 and RLE8), 24 and 32 bits
+// TGA: true color (24 and 32 bits), grey and color mapped, raw or RLE
+// PNG: every color type at 8 bits (16 bit channels are cut to 8,
+//		palettes and grey may be 1, 2 or 4 bits), not interlaced.
+//		The inflate is built in, CRCs and Adler sums aren't checked.
+//
+// The format is told from the data, not the file name. Pixels come
+// out as RGB or RGBA, tightly packed, with the bottom row first the
+// way glTexImage2D wants them. Red and blue are swapped with SSE2,
+// four pixels or 16 bytes at a time, and PNG's filters are undone a
+// whole RGB or RGBA pixel at a time.
+//
+// A decoder keeps its buffers (the file, the unpacked rows, the
+// pixels) and reuses them, so once it has read the biggest texture
+// it doesn't allocate again. Decode() hands back its own pixel
+// buffer, good until the next call; DecodeInto() writes straight
+// into one the caller owns instead. A decoder may be used by one
+// thread at a time.
+//
+// Usage:
+// ImageDecoder decoder;
+// ImageInfo info;
+//
+// unsigned char *pixels = decoder.DecodeFile("models/snake/snake.bmp", info);
+// if (pixels)
+//		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, info.width, info.height, 0,
+//			info.channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, pixels);
+// else
+//		printf("%s\n", decoder.Error());
+//
+// decoder.ReadInfo(data, size, info);		// Just the size, to make room
+// decoder.DecodeInto(data, size, mine, info.width * info.height * info.channels, info);
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef IMAGEDECODER_H
+#define IMAGEDECODER_H
+
+#include <stddef.h>
+#include <vector>
+
+// What a decoded image looks like
+struct ImageInfo {
+	int width;
+	int height;
+	int channels;		// 3: RGB, 4: RGBA
+};
+
+class ImageDecoder
+{
+public:
+	enum Format {
+		FORMAT_UNKNOWN,
+		FORMAT_BMP,
+		FORMAT_TGA,
+		FORMAT_PNG
+	};
+
+	static Format Detect(const unsigned char *data, size_t size);	// From the header (targas have no signature, so they're last)
+
+	bool ReadInfo(const unsigned char *data, size_t size, ImageInfo &info);	// Only reads the header, false if it can't be decoded
+	unsigned char *Decode(const unsigned char *data, size_t size, ImageInfo &info);	// Into the decoder's buffer, 0 on failure
+	// Into the caller's buffer, false on failure or if it holds fewer than width * height * channels bytes
+	bool DecodeInto(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info);
+	unsigned char *DecodeFile(const char *path, ImageInfo &info);	// Reads the file and decodes it, 0 on failure
+	const char *Error() const;										// Why the last call failed
+
+	// A zlib stream into dst, false if it's corrupt or doesn't fit
+	static bool Inflate(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity, size_t &written);
+	// BGR to RGB and BGRA to RGBA (opaque: alpha set to 255), src and dst must not overlap
+	static void SwizzleBGR(const unsigned char *src, unsigned char *dst, int pixels);
+	static void SwizzleBGRA(const unsigned char *src, unsigned char *dst, int pixels, bool opaque);
+
+	ImageDecoder();									// Constructor
+	virtual ~ImageDecoder();						// Destructor
+
+private:
+	// Each reads the header into info, then (unless pixels is 0) the pixels
+	bool DecodeBMP(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info);
+	bool DecodeTGA(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info);
+	bool DecodePNG(const unsigned char *data, size_t size, unsigned char *pixels, size_t capacity, ImageInfo &info);
+	bool Fail(const char *why);
+
+	std::vector<unsigned char> file;				// DecodeFile()'s data
+	std::vector<unsigned char> pixels;				// Decode()'s output
+	std::vector<unsigned char> unpacked;			// RLE packets unpacked, PNG rows inflated
+	std::vector<unsigned char> compressed;			// PNG data split over several IDAT chunks, joined
+	const char *error;
+};
+
+#endif // IMAGEDECODER_H
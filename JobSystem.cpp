@@ -0,0 +1,425 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Work Stealing Job System
+//
+// JobSystem.cpp: implementation of the JobSystem class.
+// See JobSystem.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "JobSystem.h"
+
+#include <string.h>
+
+#define DEQUE_SIZE	4096	// Jobs a thread can have queued (a power of two)
+#define SPIN_TRIES	64		// Times an idle worker looks for a job before it sleeps
+
+// Which system and thread the current thread is a worker of
+static thread_local const JobSystem *currentSystem = 0;
+static thread_local int currentThread = -1;
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+JobSystem::JobSystem()
+{
+	queued = 0;
+	sleeping = 0;
+	quit = false;
+}
+
+JobSystem::~JobSystem()
+{
+	Stop();
+}
+
+void JobSystem::Start(int numThreads)
+{
+	// Don't start twice
+	if (!deques.empty())
+		return;
+
+	// One thread per core, the calling thread counts as one of them
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	quit = false;
+	queued = 0;
+	sleeping = 0;
+	mainThread = std::this_thread::get_id();
+
+	for (int i = 0; i < numThreads; i++)
+	{
+		Deque *deque = new Deque();
+		deque->busy.clear();
+		deque->ring.resize(DEQUE_SIZE);
+		deque->head = 0;
+		deque->tail = 0;
+		deque->random = 0x9E3779B9u * (i + 1);
+		memset(&deque->stats, 0, sizeof(deque->stats));
+		deques.push_back(deque);
+	}
+
+	for (int i = 1; i < numThreads; i++)
+		workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+}
+
+void JobSystem::Stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	workers.clear();
+
+	for (size_t i = 0; i < deques.size(); i++)
+		delete deques[i];
+
+	deques.clear();
+}
+
+int JobSystem::NumThreads() const
+{
+	return deques.empty() ? 1 : (int)deques.size();
+}
+
+int JobSystem::ThreadIndex() const
+{
+	if (std::this_thread::get_id() == mainThread)
+		return 0;
+
+	return currentSystem == this ? currentThread : -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Jobs
+//////////////////////////////////////////////////////////////////////
+
+void JobSystem::Run(JobCounter &counter, const JobFunc &func)
+{
+	int thread = ThreadIndex();
+
+	// Not started (or called from a stranger), there is no deque to put it on
+	if (deques.empty() || thread < 0)
+	{
+		func(thread < 0 ? 0 : thread);
+		return;
+	}
+
+	counter.pending.fetch_add(1);
+
+	Job job;
+	job.func = func;
+	job.range = 0;
+	job.counter = &counter;
+	Push(thread, job);
+}
+
+void JobSystem::Wait(JobCounter &counter)
+{
+	int thread = ThreadIndex();
+	Job job;
+
+	while (counter.pending.load(std::memory_order_acquire) > 0)
+	{
+		// Help out instead of just waiting
+		if (thread >= 0 && FindJob(thread, job))
+			Execute(thread, job);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::ParallelFor(int count, int grain, const RangeFunc &func)
+{
+	if (count <= 0)
+		return;
+
+	if (grain < 1)
+		grain = 1;
+
+	int thread = ThreadIndex();
+
+	// Not worth splitting up a single piece
+	if (deques.size() < 2 || thread < 0 || count <= grain)
+	{
+		func(0, count, thread < 0 ? 0 : thread);
+		return;
+	}
+
+	JobCounter counter;
+	SplitRange(thread, counter, func, 0, count, grain);
+	Wait(counter);
+}
+
+void JobSystem::SplitRange(int thread, JobCounter &counter, const RangeFunc &func, int begin, int end, int grain)
+{
+	// Give away the back half until what is left is one piece
+	while (end - begin > grain)
+	{
+		int middle = begin + (end - begin) / 2;
+
+		counter.pending.fetch_add(1);
+
+		Job job;
+		job.range = &func;
+		job.begin = middle;
+		job.end = end;
+		job.grain = grain;
+		job.counter = &counter;
+		Push(thread, job);
+
+		end = middle;
+	}
+
+	func(begin, end, thread);
+}
+
+void JobSystem::Execute(int thread, Job &job)
+{
+	deques[thread]->stats.jobs++;
+
+	if (job.range)
+		SplitRange(thread, *job.counter, *job.range, job.begin, job.end, job.grain);
+	else
+	{
+		job.func(thread);
+		job.func = nullptr;		// Drop what it captured now rather than whenever the slot is reused
+	}
+
+	// Last, so a waiter doesn't see zero while this job's children are still being queued
+	job.counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////
+// The deques
+//////////////////////////////////////////////////////////////////////
+
+void JobSystem::Push(int thread, Job &job)
+{
+	Deque &deque = *deques[thread];
+
+	while (deque.busy.test_and_set(std::memory_order_acquire))
+		;
+
+	unsigned int tail = deque.tail.load(std::memory_order_relaxed);
+	if (tail - deque.head.load(std::memory_order_relaxed) >= DEQUE_SIZE)
+	{
+		// Full, it can't wait for room (only its owner empties it fast enough) so run it now
+		deque.busy.clear(std::memory_order_release);
+		deque.stats.inlined++;
+		Execute(thread, job);
+		return;
+	}
+
+	Job &slot = deque.ring[tail & (DEQUE_SIZE - 1)];
+	slot.func.swap(job.func);
+	slot.range = job.range;
+	slot.begin = job.begin;
+	slot.end = job.end;
+	slot.grain = job.grain;
+	slot.counter = job.counter;
+	deque.tail.store(tail + 1, std::memory_order_relaxed);
+
+	deque.busy.clear(std::memory_order_release);
+
+	// Only take the lock if someone could be asleep (see WorkerLoop for why this can't miss one)
+	queued.fetch_add(1);
+	if (sleeping.load() > 0)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		wake.notify_one();
+	}
+}
+
+bool JobSystem::Pop(int thread, Job &job)
+{
+	Deque &deque = *deques[thread];
+
+	while (deque.busy.test_and_set(std::memory_order_acquire))
+		;
+
+	unsigned int tail = deque.tail.load(std::memory_order_relaxed);
+	if (tail == deque.head.load(std::memory_order_relaxed))
+	{
+		deque.busy.clear(std::memory_order_release);
+		return false;
+	}
+
+	tail--;
+	deque.tail.store(tail, std::memory_order_relaxed);
+	Job &slot = deque.ring[tail & (DEQUE_SIZE - 1)];
+	job.func.swap(slot.func);
+	job.range = slot.range;
+	job.begin = slot.begin;
+	job.end = slot.end;
+	job.grain = slot.grain;
+	job.counter = slot.counter;
+
+	deque.busy.clear(std::memory_order_release);
+
+	queued.fetch_sub(1);
+	return true;
+}
+
+bool JobSystem::Steal(int thread, Job &job)
+{
+	Deque &self = *deques[thread];
+	int count = (int)deques.size();
+
+	// Start somewhere random so the thieves don't all pile onto the same deque
+	self.random ^= self.random << 13;
+	self.random ^= self.random >> 17;
+	self.random ^= self.random << 5;
+	int first = (int)(self.random % (unsigned int)count);
+
+	for (int n = 0; n < count; n++)
+	{
+		int victim = (first + n) % count;
+		if (victim == thread)
+			continue;
+
+		Deque &deque = *deques[victim];
+
+		// An empty deque is passed over without touching its lock, a busy one rather than waited on
+		if (deque.tail.load(std::memory_order_relaxed) == deque.head.load(std::memory_order_relaxed) ||
+			deque.busy.test_and_set(std::memory_order_acquire))
+		{
+			self.stats.failedSteals++;
+			continue;
+		}
+
+		unsigned int head = deque.head.load(std::memory_order_relaxed);
+		if (deque.tail.load(std::memory_order_relaxed) == head)
+		{
+			deque.busy.clear(std::memory_order_release);
+			self.stats.failedSteals++;
+			continue;
+		}
+
+		Job &slot = deque.ring[head & (DEQUE_SIZE - 1)];
+		job.func.swap(slot.func);
+		job.range = slot.range;
+		job.begin = slot.begin;
+		job.end = slot.end;
+		job.grain = slot.grain;
+		job.counter = slot.counter;
+		deque.head.store(head + 1, std::memory_order_relaxed);
+
+		deque.busy.clear(std::memory_order_release);
+
+		queued.fetch_sub(1);
+		self.stats.steals++;
+		return true;
+	}
+
+	return false;
+}
+
+bool JobSystem::FindJob(int thread, Job &job)
+{
+	if (Pop(thread, job))
+		return true;
+
+	return deques.size() > 1 && Steal(thread, job);
+}
+
+void JobSystem::WorkerLoop(int thread)
+{
+	currentSystem = this;
+	currentThread = thread;
+
+	Job job;
+	int idle = 0;
+
+	while (true)
+	{
+		if (FindJob(thread, job))
+		{
+			Execute(thread, job);
+			idle = 0;
+			continue;
+		}
+
+		// Jobs tend to come in bursts, look a few more times before going to sleep
+		if (++idle < SPIN_TRIES)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		idle = 0;
+
+		// Push() adds to queued before it reads sleeping, this adds to sleeping before it reads
+		// queued, so either Push() sees a sleeper and notifies or this sees the job and stays up
+		std::unique_lock<std::mutex> guard(lock);
+		sleeping.fetch_add(1);
+		wake.wait(guard, [this] { return quit || queued.load() > 0; });
+		sleeping.fetch_sub(1);
+
+		if (quit)
+			break;
+	}
+
+	currentSystem = 0;
+	currentThread = -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// The GL thread's queue
+//////////////////////////////////////////////////////////////////////
+
+void JobSystem::RunOnMain(const MainFunc &func)
+{
+	std::lock_guard<std::mutex> guard(mainLock);
+	mainJobs.push_back(func);
+}
+
+int JobSystem::RunMainJobs()
+{
+	if (ThreadIndex() != 0)
+		return 0;
+
+	// Take the whole batch so the work can queue more without holding the lock
+	{
+		std::lock_guard<std::mutex> guard(mainLock);
+		if (mainJobs.empty())
+			return 0;
+		mainRunning.swap(mainJobs);
+	}
+
+	int count = (int)mainRunning.size();
+	for (int i = 0; i < count; i++)
+		mainRunning[i]();
+
+	mainRunning.clear();
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Statistics
+//////////////////////////////////////////////////////////////////////
+
+JobStats JobSystem::GetStats(int thread) const
+{
+	JobStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	if (thread >= 0 && thread < (int)deques.size())
+		stats = deques[thread]->stats;
+
+	return stats;
+}
+
+void JobSystem::ResetStats()
+{
+	for (size_t i = 0; i < deques.size(); i++)
+		memset(&deques[i]->stats, 0, sizeof(deques[i]->stats));
+}
@@ -0,0 +1,156 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Work Stealing Job System
+//
+// JobSystem.h: interface for the JobSystem class.
+// This class keeps one worker thread per core and hands them small
+// jobs from anywhere in the game: loading models, testing the level
+// for the nav grid, building the render queue. Every thread (the
+// calling thread is thread 0, the workers are 1..NumThreads()-1)
+// owns a deque of jobs. A thread pushes the jobs it makes onto the
+// back of its own deque and takes them off the back again, so the
+// job it runs next is the one whose data is still in its cache. A
+// thread that runs out steals from the front of someone else's
+// deque, which is where the oldest and usually biggest jobs are.
+//
+// Jobs are counted in a JobCounter. Run() adds one to it and the
+// count drops when the job returns, so Wait() on the counter waits
+// for everything started with it. A job that starts more jobs on the
+// same counter (its children) keeps the counter up until they are
+// done as well, so waiting on a parent waits for the whole tree. A
+// thread that waits doesn't sleep, it runs jobs until the count
+// reaches zero.
+//
+// ParallelFor() is built on the same deques: the range is split in
+// half again and again, one half pushed as a job and the other kept,
+// so idle threads steal big pieces and busy ones keep small ones.
+//
+// Only thread 0 may touch OpenGL. A job that needs to (making the
+// textures of a model it loaded, for example) hands that part to
+// RunOnMain() and the main thread runs it the next time it calls
+// RunMainJobs().
+//
+// Run(), Wait() and ParallelFor() have to be called from thread 0
+// or from inside a job. Every thread counts the jobs it ran and how
+// its steals went; read the counts with nothing running.
+//
+// Usage:
+// JobSystem jobs;
+//
+// jobs.Start(0);	// One thread per core (0 = let it decide)
+//
+// JobCounter loaded;
+// jobs.Run(loaded, [&](int thread) { model.Load(name); });
+// jobs.Wait(loaded);
+//
+// jobs.ParallelFor(count, 64, [&](int begin, int end, int thread) {
+//		for (int i = begin; i < end; i++)
+//			results[thread] += work(i);
+// });
+//
+// jobs.RunOnMain([&] { model.LoadTextures(); });	// From any thread
+// jobs.RunMainJobs();								// Once a frame on the GL thread
+//
+// jobs.Stop();		// Joins the workers (the destructor does this too)
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The number of jobs started with it that haven't finished yet
+struct JobCounter {
+	std::atomic<int> pending;
+	JobCounter() : pending(0) {}
+};
+
+// What one thread did (see JobSystem::GetStats())
+struct JobStats {
+	long long jobs;				// Jobs run
+	long long steals;			// Jobs taken from another thread's deque
+	long long failedSteals;		// Deques looked at that had nothing to take (or were busy)
+	long long inlined;			// Jobs run straight away because the deque was full
+};
+
+class JobSystem
+{
+public:
+	// A job, handed the index of the thread running it
+	typedef std::function<void(int thread)> JobFunc;
+	// The work a piece of a ParallelFor() runs: [begin, end) and the thread index
+	typedef std::function<void(int begin, int end, int thread)> RangeFunc;
+	// Work for the GL thread
+	typedef std::function<void()> MainFunc;
+
+	void Start(int numThreads);						// Spawns the workers (0 = one per core)
+	void Stop();									// Wakes and joins the workers
+	int NumThreads() const;							// Workers plus the calling thread
+	int ThreadIndex() const;						// The calling thread's index, -1 if it isn't one of ours
+
+	void Run(JobCounter &counter, const JobFunc &func);	// Queues a job on the calling thread's deque
+	void Wait(JobCounter &counter);					// Runs jobs until the counter is zero
+	void ParallelFor(int count, int grain, const RangeFunc &func);	// Runs func over [0, count) and waits
+
+	void RunOnMain(const MainFunc &func);			// Queues GL work for thread 0 (any thread may call it)
+	int RunMainJobs();								// Runs the queued GL work (thread 0 only), how many ran
+
+	JobStats GetStats(int thread) const;			// What a thread did since the last ResetStats()
+	void ResetStats();
+
+	JobSystem();									// Constructor
+	virtual ~JobSystem();							// Destructor
+
+private:
+	// A job waiting in a deque, either a plain function or a piece of a ParallelFor()
+	struct Job {
+		JobFunc func;
+		const RangeFunc *range;
+		int begin;
+		int end;
+		int grain;
+		JobCounter *counter;
+	};
+
+	// One thread's jobs. A ring buffer behind a spin lock: the owner
+	// works the back, thieves the front, and both only hold the lock
+	// for a few instructions.
+	struct Deque {
+		std::atomic_flag busy;
+		std::vector<Job> ring;
+		std::atomic<unsigned int> head;				// The front (oldest job), only changed with busy held
+		std::atomic<unsigned int> tail;				// One past the back (newest job)
+		JobStats stats;
+		unsigned int random;						// Picks who to steal from
+		char pad[64];								// Keeps the next deque's lock off this cache line
+	};
+
+	void WorkerLoop(int thread);					// What every worker runs until Stop()
+	void Push(int thread, Job &job);				// Onto the back of a thread's deque (runs it if full)
+	bool Pop(int thread, Job &job);					// Off the back of a thread's own deque
+	bool Steal(int thread, Job &job);				// Off the front of someone else's
+	bool FindJob(int thread, Job &job);				// Its own first, then a steal
+	void Execute(int thread, Job &job);
+	void SplitRange(int thread, JobCounter &counter, const RangeFunc &func, int begin, int end, int grain);
+
+	std::vector<std::thread> workers;				// The worker threads
+	std::vector<Deque *> deques;					// One per thread, 0 is the calling thread's
+	std::thread::id mainThread;						// The thread that called Start()
+	std::atomic<int> queued;						// Jobs sitting in the deques
+	std::atomic<int> sleeping;						// Workers waiting on wake
+	std::mutex lock;								// Guards sleeping workers and quit
+	std::condition_variable wake;					// Signaled when a job is queued
+	bool quit;										// True: the workers should exit
+
+	std::mutex mainLock;							// Guards mainJobs
+	std::vector<MainFunc> mainJobs;					// GL work waiting for thread 0
+	std::vector<MainFunc> mainRunning;				// The batch RunMainJobs() is working through
+};
+
+#endif // JOBSYSTEM_H
@@ -4,9 +4,28 @@
 
 #include "TextureBuilder.h"
 #include "Model_3DS.h"
-#include "GLTexture.h"
+#include "TextureManager.h"
+#include "TextureCompressor.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
 #include <glut.h>
 #include "audio.h"
+#include "JobSystem.h"
+#include "MipmapBuilder.h"
+#include "RenderQueue.h"
+#include "OcclusionCuller.h"
+#include "ClusteredLighting.h"
+#include "SceneBatcher.h"
+#include "SpatialGrid.h"
+#include "TriggerSystem.h"
+#include "SpawnPlacer.h"
+#include "Replay.h"
+#include "ModelCache.h"
+#include "EntityStore.h"
+#include "FlowField.h"
+#include "ParticleSystem.h"
+#include "Matrix4.h"
+#include "Benchmark.h"
 
 #include <time.h>
 
@@ -15,6 +34,7 @@
 #include <vector>
 #include <chrono>
 #include <random>
+#include <string.h>
 constexpr char* audioPath = "C:\\sound";
 
 
@@ -101,17 +121,20 @@ public:
 	float rotation;
 	float scale;
 	float collisionRadius;
-	Model_3DS gameObjectModel;
+	Model_3DS* gameObjectModel = 0;	// Shared, owned by the ModelCache
 	bool displayed = true;
 	bool needsRotation;
 	Direction direction;
 	bool isCave = false;
 	bool effect = true;
+	float drawLift = 0;	// Extra height the object is drawn at
+	bool isOccluder = false;	// Big enough to hide what's behind it
+	const CollisionMesh* collisionMesh = 0;	// Its real shape to collide with (shared, owned by the ModelCache), can be 0
 	GameObject() {
 	}
 
 
-	GameObject(Vector position, float rotation, float scale, float collisionRadius, char* pathToModel, bool needsRotation
+	GameObject(Vector position, float rotation, float scale, float collisionRadius, Model_3DS* model, bool needsRotation
 	) {
 		this->position = position;
 		this->rotation = rotation;
@@ -120,7 +143,7 @@ public:
 		this->needsRotation = needsRotation;
 
 		this->collisionRadius = collisionRadius;
-		gameObjectModel.Load(pathToModel);
+		gameObjectModel = model;
 	}
 
 	void setPosition(Vector position) {
@@ -163,7 +186,7 @@ public:
 
 
 			}
-			gameObjectModel.Draw();
+			gameObjectModel->Draw();
 			if (needsRotation) {
 				glPopMatrix();
 			}
@@ -314,12 +337,14 @@ void drawTimer() {
 // Variables
 //=======================================================================
 
-GLuint tex;
 int cameraZoom = 0;
 
 float cameraDistanceFromPlayer = 17.0f;
 float cameraHeightAbovePlayer = 10.0f;
 
+// Every model is loaded once and shared by everything drawn with it
+ModelCache models;
+
 // Game Objects
 GameObject aladdin;
 GameObject cave;
@@ -343,20 +368,72 @@ bool tookt = false;
 
 bool flagFinish = false;
 
-// Textures
-GLTexture tex_ground;
+// Textures (handles into TextureManager::Shared(), so loading the next level's lets go of these)
+TextureHandle tex_ground;
+TextureHandle tex_sky;
 
 // State
 bool firstPersonModeOn = false;
 int movementState = 0;
 
-// Obstacles
-
-std::vector<GameObject> enemySnakes;
-std::vector<GameObject> water;
-
-
-std::vector<GameObject> rocks;
+// Threads (loading, the nav grid and the render queue all run their work on it)
+JobSystem jobs;
+
+// Textures are decoded on the jobs and uploaded a little every frame
+TextureStreamer textureStreamer;
+
+// Rendering
+RenderQueue renderQueue;
+OcclusionCuller occlusionCuller;
+bool showStats = false;
+std::vector<RenderItem> renderItems;
+float cavePivot[16];	// The extra turn the cave model needs to stand upright
+double frameMs = 0;	// CPU time of the last myDisplay()
+
+// Lighting
+ClusteredLighting lighting;
+bool clusteredLightingOn = true;	// False: fall back to GL_LIGHT0/GL_LIGHT1
+SceneBatcher sceneBatcher;
+bool batchingOn = true;	// False: every model is drawn with Model_3DS::Draw()
+int testLightCounts[] = { 0, 64, 256, 1024 };
+int testLightMode = 0;	// Which of testLightCounts is scattered around the level
+
+// A short burst of light left behind by a pickup
+struct LightFlash {
+	Vector position;
+	float r, g, b;
+	float life;	// Seconds left
+};
+std::vector<LightFlash> lightFlashes;
+
+// Sparkles, hits and dust
+ParticleSystem particles;
+
+// Obstacles and collectables (the snakes, rocks and water bottles)
+EntityStore entities;
+SpatialGrid entityGrid(MIN_ENEMY_CLOSENESS);	// Where the entities are, by handle slot
+int spawnedCounts[ENTITY_KIND_COUNT];			// How many of each kind have been made (picked up bottles don't come back)
+
+// The snakes chase the player along a flow field
+FlowField navField;
+bool navDirty = true;			// The rocks changed, the blocked cells have to be worked out again
+std::vector<unsigned char> navBlocked;	// What rebuildNavGrid() found, one per cell
+float snakeSpeed = 2.0f;		// Units per second
+std::vector<int> agentRows;		// The snakes' rows in the entity store
+std::vector<float> agentX;		// Their positions and velocities, side by side for FlowField::Steer()
+std::vector<float> agentZ;
+std::vector<float> agentVX;
+std::vector<float> agentVZ;
+std::vector<int> nearby;	// Scratch list for collision queries
+std::vector<int> spawnNearby;	// Scratch list for spawnBlocked(), which runs while nearby is being walked
+
+// The level's walls, pickups and exits (see levels/triggers.txt)
+TriggerSystem triggers;
+
+// Where things spawn, and the game's one random number engine
+SpawnPlacer spawnPlacer;
+unsigned int randomSeed = 0;	// Set from the clock unless "-seed <n>" is given
+float SPAWN_CLEARANCE = 10;		// Nothing spawns closer to the player than this
 
 float playerVerticalVelocity = 0.0;
 bool endOne = false;
@@ -373,6 +450,10 @@ Camera camera;
 // Misc. Functions
 //=======================================================================
 void jump() {
+	// Kick up some sand if the jump starts from the ground
+	if (aladdin.position.y <= 0) {
+		particles.Emit(PARTICLE_DUST, aladdin.position.x, 0.1f, aladdin.position.z);
+	}
 	playerVerticalVelocity = initJumpVel;
 }
 double compareDistances(Vector a, Vector b) {
@@ -382,11 +463,75 @@ double compareDistances(Vector a, Vector b) {
 		std::fabs(a.z - b.z) * std::fabs(a.z - b.z));
 }
 
-int getRandomInt(int min, int max) {
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<int> distribution(min, max);
-	return distribution(gen);
+// Picks a free spot for a new snake, rock or bottle, false if the map is full
+bool placeSpawn(Vector& position) {
+	float x, z;
+	if (!spawnPlacer.Place(x, z)) {
+		return false;
+	}
+
+	position = { x, 0, z };
+	return true;
+}
+
+// What a game object draws as
+RenderItem gameObjectItem(GameObject& object) {
+	RenderItem item;
+	item.model = object.gameObjectModel;
+	item.x = object.position.x;
+	item.y = object.position.y + object.drawLift;
+	item.z = object.position.z;
+	item.yaw = object.rotation;
+	item.scale = object.scale;
+	item.tiltX = object.needsRotation ? 90.0f : 0.0f;
+	item.pivot = object.isCave ? cavePivot : 0;
+	item.occluder = object.isOccluder;
+	return item;
+}
+
+// Queues a game object to be drawn this frame
+void queueGameObject(GameObject& object) {
+	if (!object.displayed) {
+		return;
+	}
+
+	renderItems.push_back(gameObjectItem(object));
+}
+
+// True if the sphere touches the object's mesh, or the ray it moved along (if it moved) crosses it
+bool touchesGameObject(GameObject& object, Vector center, float radius, float movedX, float movedZ) {
+	if (!object.collisionMesh) {
+		return false;
+	}
+
+	float matrix[16], world[16], inverse[16];
+	RenderQueue::ItemMatrix(gameObjectItem(object), matrix, world);
+	Mat4InvertUniform(inverse, world);
+
+	if (object.collisionMesh->OverlapsSphere(inverse, center.x, center.y, center.z, radius)) {
+		return true;
+	}
+
+	// A step is as wide as the player so a thin wall could be stepped over without the sphere ever touching it
+	if (movedX != 0 || movedZ != 0) {
+		float origin[3] = { center.x - movedX, center.y, center.z - movedZ };
+		float dir[3] = { movedX, 0, movedZ };
+		float t;
+		return object.collisionMesh->Raycast(inverse, origin, dir, 1.0f, t);
+	}
+
+	return false;
+}
+
+// Leaves a flash of light behind where something was picked up
+void addLightFlash(Vector position, float r, float g, float b) {
+	LightFlash flash;
+	flash.position = position;
+	flash.r = r;
+	flash.g = g;
+	flash.b = b;
+	flash.life = 1.0f;
+	lightFlashes.push_back(flash);
 }
 
 //=======================================================================
@@ -481,13 +626,50 @@ void myInit(void)
 	InitLightSource();
 	InitMaterial();
 
+	// Read every model at once on the workers, the ones things collide with get their meshes built too
+	const char* solidModels[] = {
+		"models/cave/cave.3ds", "models/snake/snake.3ds", "models/rock1/rock.3ds", "models/bottle/bottle.3ds"
+	};
+	const char* otherModels[] = {
+		"models/aladdin/aladdin.3ds", "models/diamond/diamond.3ds", "models/ghost/ghost.3ds",
+		"models/rock2/rock.3ds", "models/treasure/treasure.3ds"
+	};
+	models.Preload(solidModels, sizeof(solidModels) / sizeof(solidModels[0]), true, jobs);
+	models.Preload(otherModels, sizeof(otherModels) / sizeof(otherModels[0]), false, jobs);
+
 	// {PositionX, PositionY, PositionZ 
 	// 
 	// 
 	// }, Rotation, Scale, Collision Radius, "Path to model file"
-	aladdin = GameObject({ 0,0,0 }, 0, 0.04, 0.5, "models/aladdin/aladdin.3ds", true);
-	cave = GameObject({ 20,0,20 }, 0, 0.02, 0.5, "models/cave/cave.3ds", true);
+	aladdin = GameObject({ 0,0,0 }, 0, 0.04, 0.5, models.Get("models/aladdin/aladdin.3ds"), true);
+	cave = GameObject({ 20,0,20 }, 0, 0.02, 0.5, models.Get("models/cave/cave.3ds"), true);
 	cave.isCave = true;
+	cave.isOccluder = true;
+	cave.collisionMesh = models.GetMesh("models/cave/cave.3ds");
+
+	// The cave level (these never move so they are made once)
+	diamond1 = GameObject({ 20,0,20 }, 0, 0.5, 0.5, models.Get("models/diamond/diamond.3ds"), true);
+	diamond2 = GameObject({ -30, 0, 30 }, 0, 0.5, 0.5, models.Get("models/diamond/diamond.3ds"), true);
+	diamond3 = GameObject({ 5, 0, 30 }, 0, 0.5, 0.5, models.Get("models/diamond/diamond.3ds"), true);
+
+	ghost1 = GameObject({ 10,0,40 }, 0, 4, 0.5, models.Get("models/ghost/ghost.3ds"), true);
+	ghost2 = GameObject({ -20, 0, -20 }, 0, 4, 0.5, models.Get("models/ghost/ghost.3ds"), true);
+	ghost3 = GameObject({ 45, 0, 40 }, 0, 4, 0.5, models.Get("models/ghost/ghost.3ds"), true);
+
+	rock1 = GameObject({ 10,3,20 }, 0, 40, 0.5, models.Get("models/rock2/rock.3ds"), true);
+	rock2 = GameObject({ -10, 3, -40 }, 0, 40, 0.5, models.Get("models/rock2/rock.3ds"), true);
+	rock1.isOccluder = true;
+	rock2.isOccluder = true;
+
+	treasureBox = GameObject({ 20, 0, -50 }, 0, 0.09, 0.5, models.Get("models/treasure/treasure.3ds"), true);
+
+	// Room for every snake, rock and bottle up front so spawning never allocates
+	entities.Reserve(MAX_NUMBER_OF_ENEMIES * ENTITY_KIND_COUNT);
+	particles.Reserve(20000);
+
+	Mat4Identity(cavePivot);
+	Mat4Translate(cavePivot, 1375, 1455, 0);
+	Mat4Rotate(cavePivot, 135, 0, 0, 1);
 	//snake = GameObject({ 7,0,0.9 }, 0, 0.03, 0.5, "models/snake/snake.3ds");
 	//bottle = GameObject({ -7,0,0.9 }, 0, 0.08, 0.5, "models/bottle/bottle.3ds");
 
@@ -495,12 +677,25 @@ void myInit(void)
 	glEnable(GL_NORMALIZE);
 }
 bool checkCaveCollision(Vector pos) {
-	// Implement your rotation collision logic here
-	// Return true if there is a collision, otherwise return false
-	if (pos.x > 28 && pos.x < 57 && pos.z > 28 && pos.z < 41) {
+	// True if nothing may be spawned here
+	return triggers.Overlaps(pos.x, pos.y, pos.z, 1, VOLUME_NOSPAWN);
+}
+// True where nothing may spawn: in the cave, next to the player, or next to a snake. The snakes
+// move, so they are looked up where they are now instead of being kept in the placer
+bool spawnBlocked(float x, float z) {
+	if (checkCaveCollision({ x, 0, z })) {
 		return true;
 	}
-	return false;
+
+	float dx = x - aladdin.position.x;
+	float dz = z - aladdin.position.z;
+	if (dx * dx + dz * dz < SPAWN_CLEARANCE * SPAWN_CLEARANCE) {
+		return true;
+	}
+
+	spawnNearby.clear();
+	entities.FindCollisions(entityGrid, x, 0, z, MIN_ENEMY_CLOSENESS, ENTITY_MASK(ENTITY_SNAKE), spawnNearby);
+	return !spawnNearby.empty();
 }
 //=======================================================================
 // Render Ground Function
@@ -517,7 +712,7 @@ void RenderGround()
 
 	glEnable(GL_TEXTURE_2D);	// Enable 2D texturing
 
-	glBindTexture(GL_TEXTURE_2D, tex_ground.texture[0]);	// Bind the ground texture
+	tex_ground.Use();	// Bind the ground texture
 
 	glPushMatrix();
 	glScalef(3.0, 3.0, 3.0);	// Scale the ground quad	
@@ -540,15 +735,15 @@ void RenderGround()
 }
 void LoadAssets()
 {
-	// Loading texture files
+	// Loading texture files (the cave's sky is its ground texture, so that one is only loaded once)
+	TextureManager &textures = TextureManager::Shared();
 	if (!endOne) {
-		tex_ground.Load("Textures/sand.bmp");
-		loadBMP(&tex, "Textures/blu-sky-3.bmp", true);
+		tex_ground = textures.Load("Textures/sand.bmp");
+		tex_sky = textures.Load("Textures/blu-sky-3.bmp");
 	}
 	else {
-		tex_ground.Load("Textures/caveground.bmp");
-		loadBMP(&tex, "Textures/caveground.bmp", true);
-
+		tex_ground = textures.Load("Textures/caveground.bmp");
+		tex_sky = textures.Load("Textures/caveground.bmp");
 	}
 }
 
@@ -581,10 +776,134 @@ void renderText(const char* text, float x, float y, float scale) {
 	glMatrixMode(GL_MODELVIEW);
 	glPopMatrix();
 }
+// Queues the game objects of the current level to be drawn
+void queueScene() {
+	renderItems.clear();
+
+	if (!endOne) {
+		queueGameObject(cave);
+
+		entities.ExtractRenderItems(renderItems);
+	}
+	else {
+		if (tookd1 == false) {
+			queueGameObject(diamond1);
+		}
+		if (tookd2 == false) {
+			queueGameObject(diamond2);
+		}
+		if (tookd3 == false) {
+			queueGameObject(diamond3);
+		}
+		queueGameObject(ghost1);
+		queueGameObject(ghost2);
+		queueGameObject(ghost3);
+
+		queueGameObject(rock1);
+		queueGameObject(rock2);
+
+		if (tookt == false) {
+			queueGameObject(treasureBox);
+		}
+	}
+}
+
+// Adds every light of the current level for this frame
+void queueLights() {
+	lighting.BeginFrame();
+
+	// The torches flicker a little
+	float t = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
+	float flicker = 0.85f + 0.1f * sinf(t * 13.0f) + 0.05f * sinf(t * 31.0f);
+
+	if (!endOne) {
+		// Torches either side of the cave entrance
+		lighting.AddLight(27, 3, 27, 10, 1.0f, 0.6f, 0.25f, flicker);
+		lighting.AddLight(36, 3, 26, 10, 1.0f, 0.6f, 0.25f, flicker);
+
+		for (int i = 0; i < entities.Size(); i++) {
+			if (entities.kinds[i] == ENTITY_WATER && (entities.flags[i] & ENTITY_VISIBLE)) {
+				const Transform& t = entities.transforms[i];
+				lighting.AddLight(t.x, t.y + 2, t.z, 4, 0.3f, 0.5f, 1.0f);
+			}
+		}
+	}
+	else {
+		// Torches along the cave walls
+		float torches[][3] = { { -35, 4, -50 }, { -35, 4, 0 }, { -35, 4, 48 }, { 58, 4, -50 }, { 58, 4, 0 }, { 58, 4, 48 } };
+		for (int i = 0; i < 6; i++) {
+			lighting.AddLight(torches[i][0], torches[i][1], torches[i][2], 18, 1.0f, 0.55f, 0.2f, flicker);
+		}
+
+		if (!tookd1) {
+			lighting.AddLight(diamond1.position.x, 2, diamond1.position.z, 5, 0.4f, 0.9f, 1.0f);
+		}
+		if (!tookd2) {
+			lighting.AddLight(diamond2.position.x, 2, diamond2.position.z, 5, 0.4f, 0.9f, 1.0f);
+		}
+		if (!tookd3) {
+			lighting.AddLight(diamond3.position.x, 2, diamond3.position.z, 5, 0.4f, 0.9f, 1.0f);
+		}
+		if (!tookt) {
+			lighting.AddLight(treasureBox.position.x, 3, treasureBox.position.z, 8, 1.0f, 0.8f, 0.3f, 1.5f);
+		}
+	}
+
+	for (LightFlash& flash : lightFlashes) {
+		lighting.AddLight(flash.position.x, flash.position.y + 2, flash.position.z, 10 * flash.life, flash.r, flash.g, flash.b, 2 * flash.life);
+	}
+
+	// Extra lights spread over the level to see how the clusters hold up ('l' cycles them)
+	int extra = testLightCounts[testLightMode];
+	for (int i = 0; i < extra; i++) {
+		float x = -30 + (i * 37 % 79);
+		float z = -48 + (i * 53 % 97);
+		lighting.AddLight(x, 1.5f, z, 6, (i % 3) == 0 ? 1.0f : 0.2f, (i % 3) == 1 ? 1.0f : 0.2f, (i % 3) == 2 ? 1.0f : 0.2f);
+	}
+}
+
 void myDisplay(void)
 {
+	std::chrono::high_resolution_clock::time_point frameStart = std::chrono::high_resolution_clock::now();
+
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	// Count this frame's texture binds (printStats() shows the last frame's), and lower the ones not drawn lately if they're over budget
+	TextureManager::Shared().ResetBinds();
+	TextureManager::Shared().NextFrame();
+
+	// GL work the jobs handed back since the last frame, then this frame's share of the texture uploads
+	jobs.RunMainJobs();
+	textureStreamer.Update();
+
+	// Let go of the music streams that have finished (the sound is mixed on the audio thread)
+	audioManager.Update();
+
+	// Start drawing the cave and the big rocks into the occlusion buffer while the ground, sky and HUD are drawn
+	GLfloat view[16];
+	GLfloat projection[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, view);
+	glGetFloatv(GL_PROJECTION_MATRIX, projection);
+	queueScene();
+	occlusionCuller.Begin(renderItems, view, projection);
+
+	// Bin this frame's lights into the clusters
+	bool useClusters = lighting.supported && clusteredLightingOn;
+	if (useClusters) {
+		queueLights();
+		lighting.Update(view, projection, WIDTH, HEIGHT);
+	}
+
+	// The sun: bright over the desert, dim in the cave
+	GLfloat sunDirection[] = { 15.0f, 9.0f, 0.0f };
+	GLfloat sunColor[] = { 0.5f, 0.5f, 0.5f };
+	GLfloat ambientColor[] = { 0.8f, 0.8f, 0.8f };
+	if (endOne) {
+		sunDirection[0] = 0.0f;
+		sunDirection[2] = 15.0f;
+		sunColor[0] = sunColor[1] = sunColor[2] = 0.3f;
+		ambientColor[0] = ambientColor[1] = ambientColor[2] = 0.35f;
+	}
 
 	// Draw Ground
 	RenderGround();
@@ -592,7 +911,11 @@ void myDisplay(void)
 
 	glPushMatrix();
 
+	if (useClusters) {
+		lighting.Bind(sunDirection, sunColor, ambientColor);
+	}
 	aladdin.draw();
+	lighting.Unbind();
 	glPopMatrix();
 	// Drawing the Game Objects
 	//aladdin.draw();
@@ -611,7 +934,7 @@ void myDisplay(void)
 	qobj = gluNewQuadric();
 	glTranslated(50, 0, 0);
 	glRotated(90, 1, 0, 1);
-	glBindTexture(GL_TEXTURE_2D, tex);
+	tex_sky.Use();
 	gluQuadricTexture(qobj, true);
 	gluQuadricNormals(qobj, GL_SMOOTH);
 	gluSphere(qobj, 100, 100, 100);
@@ -633,37 +956,6 @@ void myDisplay(void)
 
 		GLfloat lightIntensity[] = { 0.7, 0.7, 0.7, 1.0f };
 		glLightfv(GL_LIGHT0, GL_AMBIENT, lightIntensity);
-		glPushMatrix();
-
-		cave.draw();
-		glPopMatrix();
-
-		for (GameObject snake : enemySnakes) {
-
-			glPushMatrix();
-
-			snake.draw();
-			glPopMatrix();
-		}
-
-		for (GameObject wateri : water) {
-
-			glPushMatrix();
-
-
-			glTranslatef(0, 1, 0);
-			wateri.draw();
-			glPopMatrix();
-
-		}
-
-		for (GameObject rock : rocks) {
-			glPushMatrix();
-			// Dim the ground texture a bits
-
-			rock.draw();
-			glPopMatrix();
-		}
 	}
 	else {
 		if (!first) {
@@ -680,50 +972,19 @@ void myDisplay(void)
 		glLightfv(GL_LIGHT1, GL_POSITION, lightPosition1);
 		GLfloat lightIntensity1[] = { 0.3, 0.3 ,0.3, 1.0f };
 		glLightfv(GL_LIGHT1, GL_AMBIENT, lightIntensity1);
+	}
 
-		if (tookd1 == false) {
-			glPushMatrix();
-			diamond1.draw();
-			glPopMatrix();
-		}
-		if (tookd2 == false) {
-			glPushMatrix();
-			diamond2.draw();
-			glPopMatrix();
-		}
-		if (tookd3 == false) {
-			glPushMatrix();
-			diamond3.draw();
-			glPopMatrix();
-		}
-		glPushMatrix();
-		ghost1.draw();
-		glPopMatrix();
-
-		glPushMatrix();
-		ghost2.draw();
-		glPopMatrix();
-
-		glPushMatrix();
-		ghost3.draw();
-		glPopMatrix();
-
-		glPushMatrix();
-		rock1.draw();
-		glPopMatrix();
-
-		glPushMatrix();
-		rock2.draw();
-		glPopMatrix();
-
-		if (tookt == false) {
-			glPushMatrix();
-			treasureBox.draw();
-			glPopMatrix();
+	// Transform, cull and sort everything queued above on the workers, then draw it here
+	renderQueue.Build(renderItems, view, projection, HEIGHT, jobs, &occlusionCuller);
+	if (useClusters) {
+		lighting.Bind(sunDirection, sunColor, ambientColor);
+	}
+	renderQueue.Submit(useClusters && batchingOn ? &sceneBatcher : 0);
+	lighting.Unbind();
 
-		}
+	// Last, they blend over everything else
+	particles.Draw();
 
-	}
 	if (flagFinish) {
 		glClearColor(0.0f, 1.0f, 0.0f, 0.0f);
 		glClear(GL_COLOR_BUFFER_BIT);
@@ -741,6 +1002,7 @@ void myDisplay(void)
 		glFlush();
 	}
 
+	frameMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
 	glutSwapBuffers();
 }
 
@@ -789,215 +1051,275 @@ void setCameraFollow() {
 // Timer Function
 //=======================================================================
 
+// Prints the frame counters once a second when they are turned on
+void printStats() {
+	RenderQueue::Stats rq = renderQueue.stats;
+	OcclusionCuller::Stats oc = occlusionCuller.GetStats();
+
+	std::cout << "render: " << rq.items << " items, " << rq.submitted << " drawn, "
+		<< rq.frustumCulled << " frustum / " << rq.detailCulled << " detail / " << rq.occlusionCulled << " occlusion culled, "
+		<< rq.buildMs << " ms on " << rq.threads << " threads" << std::endl;
+
+	SceneBatcher::Stats bs = sceneBatcher.stats;
+	std::cout << "draw calls: " << rq.drawCalls << " (" << rq.batched << " models batched into " << bs.draws << " draws, "
+		<< bs.arrays << " texture arrays of " << bs.layers << " layers, " << bs.vertices << " vertices)" << std::endl;
+
+	float rejectedPct = oc.tested > 0 ? 100.0f * oc.rejected / oc.tested : 0.0f;
+	std::cout << "occlusion: " << oc.occluders << " occluders, " << oc.triangles << " tris, "
+		<< oc.rejected << "/" << oc.tested << " rejected (" << rejectedPct << "%), "
+		<< oc.rasterMs << " ms raster + " << oc.testMs << " ms test" << std::endl;
+
+	ClusteredLighting::Stats ls = lighting.stats;
+	if (lighting.supported && clusteredLightingOn) {
+		std::cout << "lighting: " << ls.lights << " lights, " << ls.visible << " visible, "
+			<< ls.indices << " cluster entries (busiest " << ls.busiest << "), "
+			<< ls.binMs << " ms binning" << std::endl;
+	}
+	else {
+		std::cout << "lighting: fixed function" << std::endl;
+	}
+	std::cout << "particles: " << particles.Count() << std::endl;
+	TextureManager &textures = TextureManager::Shared();
+	std::cout << "textures: " << textures.LiveCount() << " live, " << textures.LiveBytes() / 1024 << " KB, "
+		<< textures.Uploads() << " uploaded, " << textures.PaletteColors() << " palette colors, "
+		<< textures.Binds() << " binds a frame" << std::endl;
+	TextureCache::Stats cs = TextureCache::Shared().stats;
+	std::cout << "texture cache: " << cs.hits << " hits (" << cs.hitMs << " ms), " << cs.misses << " misses ("
+		<< cs.missMs << " ms), " << cs.stored << " stored" << std::endl;
+	std::cout << "texture budget: " << textures.Lowered() << " lowered, " << textures.Evictions() << " evictions, "
+		<< textures.Reloads() << " reloads" << std::endl;
+	TextureStreamer::Stats ts = textureStreamer.stats;
+	std::cout << "streaming: " << ts.decoding << " decoding, " << ts.uploading << " uploading, " << ts.streamed << " done, "
+		<< ts.bytes / 1024 << " KB in " << ts.uploads << " uploads (" << ts.updateMs << " ms) last frame" << std::endl;
+	AudioMixer::Stats mixStats = audioManager.MixerStats();
+	std::cout << "audio: " << audioManager.Sounds() << " sounds, " << audioManager.Streams() << " streams, " << audioManager.Voices() << " voices playing, "
+		<< mixStats.stolen << " cut short, " << mixStats.limited << " blocks limited, "
+		<< mixStats.mixMs << " ms mixing " << mixStats.frames << " frames" << std::endl;
+	std::cout << "frame: " << frameMs << " ms CPU" << std::endl;
+}
+
 void clk(int a) {
-	timer -= 1;
+	if (showStats) {
+		printStats();
+	}
 	glutTimerFunc(1 * 1000, clk, 0);
 	glutPostRedisplay();
 }
 
-bool checkCollitionObstacles() {
-	if (!endOne) {
-		for (int i = 0; i < enemySnakes.size(); i++) {
-			if (compareDistances(aladdin.position, enemySnakes[i].position) < aladdin.collisionRadius + enemySnakes[i].collisionRadius-0.1 ) {
-				audioManager.Play("collision.wav", 0.5f, false);
-				score -= 1;
-				return true;
-			}
+// The player is a sphere standing on the ground, so it doesn't scrape along the floor of everything
+Vector playerCenter() {
+	return { aladdin.position.x, aladdin.position.y + aladdin.collisionRadius, aladdin.position.z };
+}
 
-		}
-		for (int i = 0; i < rocks.size(); i++) {
-			if (compareDistances(aladdin.position, rocks[i].position) < aladdin.collisionRadius + rocks[i].collisionRadius - 0.09) {
-				audioManager.Play("collision.wav", 0.5f, false);
-				score -= 1;
-				return true;
-			}
+// movedX/movedZ: the step the player just took, if any
+bool checkCollitionObstacles(float movedX = 0, float movedZ = 0) {
+	if (!endOne) {
+		Vector center = playerCenter();
+		nearby.clear();
+		entities.FindCollisions(entityGrid, center.x, center.y, center.z, aladdin.collisionRadius,
+			ENTITY_MASK(ENTITY_SNAKE) | ENTITY_MASK(ENTITY_ROCK), nearby);
+		if (!nearby.empty() || touchesGameObject(cave, center, aladdin.collisionRadius, movedX, movedZ)) {
+			audioManager.Play("collision.wav", 0.5f, false);
+			particles.Emit(PARTICLE_HIT, center.x, center.y, center.z);
+			score -= 1;
+			return true;
 		}
 	}
 	return false;
 }
-bool took = false;
 void checkCollitionCollectables() {
-	for (int i = 0; i < water.size(); i++) {
-		if (water[i].effect&&compareDistances(aladdin.position, water[i].position) < aladdin.collisionRadius + water[i].collisionRadius -0.04) {
-			if (!took) {
-				audioManager.Play("whoosh.wav", 0.5f, false);
-
-				water[i].setDisapear();
-				water[i].effect = false;
-
-				score += 1;
-				took = true;
-			}
-		}took = false;
-
+	Vector center = playerCenter();
+	nearby.clear();
+	entities.FindCollisions(entityGrid, center.x, center.y, center.z, aladdin.collisionRadius,
+		ENTITY_MASK(ENTITY_WATER), nearby);
+	for (int i : nearby) {
+		audioManager.Play("whoosh.wav", 0.5f, false);
+
+		const Transform& t = entities.transforms[i];
+		addLightFlash({ t.x, t.y, t.z }, 0.3f, 0.5f, 1.0f);
+		particles.Emit(PARTICLE_PICKUP, t.x, t.y + entities.renders[i].lift, t.z);
+
+		// Gone for good (the row stays put until the next Compact() so the other hits are still right)
+		spawnPlacer.Remove(t.x, t.z);
+		entities.Destroy(entities.HandleOf(i), &entityGrid);
+
+		score += 1;
 	}
 
 }
 float p = 0.0;
-bool first2 = true;
-void checkEndOne() {
-	if (aladdin.position.x > 28 && aladdin.position.x < 35 && aladdin.position.z>28 && aladdin.position.z < 34) {
-		if (first2) {
-			audioManager.Play("target.wav", 0.5f, false);
-			first2 = false;
-		}
-
-
-		endOne = true;
-	}
-
-
+// The level the player is on, as the trigger file numbers them
+int currentLevel() {
+	return endOne ? 2 : 1;
 }
 
-void myTimer(int) {
+// Sends out the enter/stay/exit events for where the player is now
+void updateTriggers() {
+	triggers.Update(aladdin.position.x, aladdin.position.y, aladdin.position.z, currentLevel());
+	triggers.Dispatch();
+}
 
-	setCameraFollow();
-	setupCamera();
-	checkEndOne();
-	
-	std::cout << "x" << aladdin.position.x<<std::endl;
-	std::cout << "z" << aladdin.position.z << std::endl;
+// Tops a kind of entity up to MAX_NUMBER_OF_ENEMIES
+void spawnEntities(EntityKind kind, float scale, float lift, const char* modelPath) {
+	// The sphere only has to hold the whole model, the mesh decides what touches it
+	const CollisionMesh* mesh = models.GetMesh(modelPath);
+	float radius = mesh->Radius() * scale;
 
-	while (enemySnakes.size() < MAX_NUMBER_OF_ENEMIES) {
-		float newSnakeX;
-		float newSnakeZ;
-		Vector newSnakePosition;
+	while (spawnedCounts[kind] < MAX_NUMBER_OF_ENEMIES) {
+		Vector position;
+		if (!placeSpawn(position)) {
+			break;
+		}
 
-		bool tooClose = false;
+		EntityHandle e = entities.Create(kind, position.x, position.y, position.z, 0, scale, radius, models.Get(modelPath));
+		entities.renders[entities.Index(e)].lift = lift;
+		entities.colliders[entities.Index(e)].mesh = mesh;
+		entityGrid.Insert(e.slot, position.x, position.z, radius);
+		spawnedCounts[kind]++;
 
-		while (true) {
-			tooClose = false;
+		// A snake leaves its spot straight away, spawnBlocked() keeps new things off it where it goes
+		if (kind == ENTITY_SNAKE) {
+			spawnPlacer.Remove(position.x, position.z);
+		}
 
-			newSnakeX = getRandomInt(-30, 48);
-			newSnakeZ = getRandomInt(-48, 48);
-			newSnakePosition = { newSnakeX,0,newSnakeZ };
-			if (checkCaveCollision(newSnakePosition)) {
-				tooClose = true;
-			}
-			for (GameObject otherSnake : enemySnakes) {
-				if (compareDistances(otherSnake.position, newSnakePosition) < MIN_ENEMY_CLOSENESS)
-					tooClose = true;
-			}
+		if (kind == ENTITY_ROCK) {
+			navDirty = true;
+		}
+	}
+}
 
-			if (!tooClose) {
-				break;
+// Blocks every nav cell the cave or a rock is in
+void rebuildNavGrid() {
+	int width = navField.Width();
+	int cells = width * navField.Height();
+	navBlocked.assign(cells, 0);
+
+	// Every cell is tested on its own, so the rows are spread over the workers
+	jobs.ParallelFor(navField.Height(), 4, [&](int begin, int end, int thread) {
+		std::vector<int> hits;
+		for (int cz = begin; cz < end; cz++) {
+			for (int cx = 0; cx < width; cx++) {
+				float x, z;
+				navField.CellCenter(cx, cz, x, z);
+
+				// A bit more than half a cell so the snakes keep off the edges
+				hits.clear();
+				entities.FindCollisions(entityGrid, x, 0.5f, z, 1.0f, ENTITY_MASK(ENTITY_ROCK), hits);
+				if (!hits.empty() || touchesGameObject(cave, { x, 0.5f, z }, 1.0f, 0, 0)) {
+					navBlocked[cz * width + cx] = 1;
+				}
 			}
+		}
+	});
 
+	navField.ClearBlocked();
+	for (int cell = 0; cell < cells; cell++) {
+		if (navBlocked[cell]) {
+			navField.SetBlocked(cell % width, cell / width, true);
 		}
+	}
+}
 
-		GameObject newSnake = GameObject(newSnakePosition, 0, 0.03, 0.5, "models/snake/snake.3ds", true);
+// Walks the snakes toward the player, one that reaches them costs a point and starts again somewhere else
+void moveSnakes() {
+	if (navDirty) {
+		rebuildNavGrid();
+		navDirty = false;
+	}
 
-		enemySnakes.push_back(newSnake);
+	// Only does any work when the player has moved into another cell
+	navField.Update(aladdin.position.x, aladdin.position.z);
+
+	agentRows.clear();
+	agentX.clear();
+	agentZ.clear();
+	for (int i = 0; i < entities.Size(); i++) {
+		if (entities.kinds[i] == ENTITY_SNAKE && (entities.flags[i] & ENTITY_ACTIVE)) {
+			agentRows.push_back(i);
+			agentX.push_back(entities.transforms[i].x);
+			agentZ.push_back(entities.transforms[i].z);
+		}
 	}
-	while (rocks.size() < MAX_NUMBER_OF_ENEMIES) {
-		float newRockX;
-		float newRockZ;
-		Vector newRockPosition;
 
-		bool tooClose = false;
+	int count = (int)agentRows.size();
+	agentVX.resize(count);
+	agentVZ.resize(count);
+	navField.Steer(agentX.data(), agentZ.data(), agentVX.data(), agentVZ.data(), count, snakeSpeed);
 
-		while (true) {
-			tooClose = false;
+	for (int k = 0; k < count; k++) {
+		int i = agentRows[k];
+		entities.velocities[i].x = agentVX[k];
+		entities.velocities[i].z = agentVZ[k];
+		entities.flags[i] |= ENTITY_MOVING;
 
-			newRockX = getRandomInt(-30, 48);
-			newRockZ = getRandomInt(-48, 48);
-			newRockPosition = { newRockX,0,newRockZ };
-			if (checkCaveCollision(newRockPosition)) {
-				tooClose = true;
-			}
-			for (GameObject otherSnake : enemySnakes) {
-				if (compareDistances(otherSnake.position, newRockPosition) < MIN_ENEMY_CLOSENESS)
-					tooClose = true;
-			}
-			for (GameObject otherRocks : rocks) {
-				if (compareDistances(otherRocks.position, newRockPosition) < MIN_ENEMY_CLOSENESS)
-					tooClose = true;
-			}
+		// Face the way it is going
+		if (agentVX[k] != 0 || agentVZ[k] != 0) {
+			entities.transforms[i].yaw = atan2f(agentVX[k], agentVZ[k]) * 180.0f / 3.14159265f;
+		}
+	}
 
+	entities.UpdateMovement(1.0f / 60.0f, &entityGrid);
 
-			if (!tooClose) {
-				break;
-			}
+	Vector center = playerCenter();
+	nearby.clear();
+	entities.FindCollisions(entityGrid, center.x, center.y, center.z, aladdin.collisionRadius, ENTITY_MASK(ENTITY_SNAKE), nearby);
+	for (int i : nearby) {
+		audioManager.Play("collision.wav", 0.5f, false);
+		particles.Emit(PARTICLE_HIT, center.x, center.y, center.z);
+		score -= 1;
 
+		Vector position;
+		EntityHandle snake = entities.HandleOf(i);
+		if (placeSpawn(position)) {
+			entities.transforms[i].x = position.x;
+			entities.transforms[i].z = position.z;
+			entityGrid.Move(snake.slot, position.x, position.z);
+			spawnPlacer.Remove(position.x, position.z);
+		}
+		else {
+			entities.Destroy(snake, &entityGrid);
 		}
-
-		GameObject newRock = GameObject(newRockPosition, 0, 0.3, 0.5, "models/rock1/rock.3ds", true);
-
-		rocks.push_back(newRock);
 	}
+}
 
-	while (water.size() < MAX_NUMBER_OF_ENEMIES) {
-		float newWaterX;
-		float newWaterZ;
-		Vector newWaterPosition;
-
-		bool tooClose = false;
+// Moves the game on by one tick (everything here has to come out the same on a replay)
+void updateWorld() {
+	updateTriggers();
 
-		while (true) {
-			tooClose = false;
-
-			newWaterX = getRandomInt(-30, 48);
-			newWaterZ = getRandomInt(-48, 48);
-			newWaterPosition = { newWaterX,0,newWaterZ };
-			if (checkCaveCollision(newWaterPosition)) {
-				tooClose = true;
-			}
-			for (GameObject otherSnake : enemySnakes) {
-				if (compareDistances(otherSnake.position, newWaterPosition) < MIN_ENEMY_CLOSENESS)
-					tooClose = true;
-			}
-			for (GameObject otherRocks : rocks) {
-				if (compareDistances(otherRocks.position, newWaterPosition) < MIN_ENEMY_CLOSENESS)
-					tooClose = true;
-			}
-			for (GameObject otherWater : water) {
-				if (compareDistances(otherWater.position, newWaterPosition) < MIN_ENEMY_CLOSENESS)
-					tooClose = true;
-			}
+	spawnEntities(ENTITY_SNAKE, 0.03f, 0, "models/snake/snake.3ds");
+	spawnEntities(ENTITY_ROCK, 0.3f, 0, "models/rock1/rock.3ds");
+	spawnEntities(ENTITY_WATER, 0.09f, 1, "models/bottle/bottle.3ds");
 
+	if (!endOne) {
+		moveSnakes();
+	}
 
-			if (!tooClose) {
-				break;
-			}
+	particles.Update(1.0f / 60.0f);
 
+	// Fade the pickup flashes out
+	for (size_t i = 0; i < lightFlashes.size();) {
+		lightFlashes[i].life -= 1.0f / 60.0f;
+		if (lightFlashes[i].life <= 0) {
+			lightFlashes.erase(lightFlashes.begin() + i);
+		}
+		else {
+			i++;
 		}
-
-		GameObject newWater = GameObject(newWaterPosition, 0, 0.09, 0.5, "models/bottle/bottle.3ds", true);
-
-		water.push_back(newWater);
 	}
+
 	aladdin.position.y += playerVerticalVelocity;
 	playerVerticalVelocity += gravity;
 	if (aladdin.position.y < 0) {
 		aladdin.position.y = 0;
 		playerVerticalVelocity = 0;
 	}
-
-	diamond1 = GameObject({ 20,0,20 }, 0, 0.5, 0.5, "models/diamond/diamond.3ds", true);
-	diamond2 = GameObject({ -30, 0, 30 }, 0, 0.5, 0.5, "models/diamond/diamond.3ds", true);
-	diamond3 = GameObject({ 5, 0, 30 }, 0, 0.5, 0.5, "models/diamond/diamond.3ds", true);
-
-	ghost1 = GameObject({ 10,0,40 }, 0, 4, 0.5, "models/ghost/ghost.3ds", true);
-	ghost2 = GameObject({ -20, 0, -20 }, 0, 4, 0.5, "models/ghost/ghost.3ds", true);
-	ghost3 = GameObject({ 45, 0, 40 }, 0, 4, 0.5, "models/ghost/ghost.3ds", true);
-
-	rock1 = GameObject({ 10,3,20 }, 0, 40, 0.5, "models/rock2/rock.3ds", true);
-	rock2 = GameObject({ -10, 3, -40 }, 0, 40, 0.5, "models/rock2/rock.3ds", true);
-
-	treasureBox = GameObject({ 20, 0, -50 }, 0, 0.09, 0.5, "models/treasure/treasure.3ds", true);
-
-	glutPostRedisplay();
-	glutTimerFunc(1000 / 60, myTimer, 0);
-
-
-
 }
 float nplayerX = 0.0;
 float nplayerZ = 0.0;
 //=======================================================================
 // Keyboard Function
 //=======================================================================
-void myKeyboard(unsigned char button, int x, int y)
+void handleKeyboard(unsigned char button)
 {
 	switch (button)
 	{
@@ -1014,6 +1336,21 @@ void myKeyboard(unsigned char button, int x, int y)
 	case 'r':
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 		break;
+	case 'o':
+		occlusionCuller.enabled = !occlusionCuller.enabled;
+		break;
+	case 'i':
+		showStats = !showStats;
+		break;
+	case 'l':
+		testLightMode = (testLightMode + 1) % 4;
+		break;
+	case 'k':
+		clusteredLightingOn = !clusteredLightingOn;
+		break;
+	case 'b':
+		batchingOn = !batchingOn;
+		break;
 
 
 
@@ -1036,9 +1373,6 @@ void myKeyboard(unsigned char button, int x, int y)
 			cameraHeightAbovePlayer = 10.0f;
 		}
 		break;
-	case 27:
-		exit(0);
-		break;
 	default:
 		break;
 	}
@@ -1051,88 +1385,61 @@ bool checkRotationCollision() {
 }
 
 bool checkCollisionObstacles() {
-	if ((aladdin.position.x <= 12 && aladdin.position.x >= 8) && aladdin.position.y == 0 && (aladdin.position.z <= 21 && aladdin.position.z >= 18)) {
+	if (triggers.Overlaps(aladdin.position.x, aladdin.position.y, aladdin.position.z, currentLevel(), VOLUME_OBSTACLE)) {
 		score -= 1;
 		audioManager.Play("collision.wav", 0.5f, false);
+		Vector center = playerCenter();
+		particles.Emit(PARTICLE_HIT, center.x, center.y, center.z);
 		return true;
 
 	}
 
-	if ((aladdin.position.x < -8 && aladdin.position.x >=-12) && (aladdin.position.z <= -35 && aladdin.position.z > -44)) {
-		score -= 1;
-		audioManager.Play("collision.wav", 0.5f, false);
-		return true;
+	return false;
+}
 
+// Picks up a diamond the first time the player walks into it
+void takeDiamond(GameObject& diamond, bool& took) {
+	if (!took) {
+		audioManager.Play("whoosh.wav", 0.5f, false);
+		diamond.displayed = false;
+		addLightFlash(diamond.position, 0.4f, 0.9f, 1.0f);
+		particles.Emit(PARTICLE_PICKUP, diamond.position.x, diamond.position.y + 1, diamond.position.z);
+		score += 1;
+		took = true;
 	}
-	if ((aladdin.position.x <= -12 && aladdin.position.x >= -8) && aladdin.position.y == 0 && (aladdin.position.z <= -42 && aladdin.position.z >= -38)) {
-		score -= 1;
-		audioManager.Play("collision.wav", 0.5f, false);
-		return true;
+}
 
+// Trigger handlers, the volumes are matched up with the game objects by name
+void onCollectEvent(const TriggerEvent& event) {
+	if (event.type != TRIGGER_ENTER) {
+		return;
 	}
-	if ((aladdin.position.x <= 12 && aladdin.position.x >= 8) && aladdin.position.y == 0 && (aladdin.position.z <= 42 && aladdin.position.z >= 38)) {
-		score -= 1;
-		audioManager.Play("collision.wav", 0.5f, false);
-		return true;
 
+	const std::string& name = event.volume->name;
+	if (name == "diamond1") {
+		takeDiamond(diamond1, tookd1);
 	}
-	if ((aladdin.position.x <= 47 && aladdin.position.x >= 43) && aladdin.position.y == 0 && (aladdin.position.z <= 42 && aladdin.position.z >= 38)) {
-		score -= 1;
-		audioManager.Play("collision.wav", 0.5f, false);
-		return true;
-
+	else if (name == "diamond2") {
+		takeDiamond(diamond2, tookd2);
 	}
-	if ((aladdin.position.x <= -22 && aladdin.position.x >= -18) && aladdin.position.y == 0 && (aladdin.position.z <= -22 && aladdin.position.z >= -18)) {
-		score -= 1;
-		audioManager.Play("collision.wav", 0.5f, false);
-		return true;
-
+	else if (name == "diamond3") {
+		takeDiamond(diamond3, tookd3);
 	}
-
-	return false;
-}
-
-
-void checkCollisionCollectables() {
-	if ((aladdin.position.x <= 23 && aladdin.position.x >= 16) && aladdin.position.y == 0 && (aladdin.position.z <= 24 && aladdin.position.z >= 16)) {
-		if (!tookd1) {
-			audioManager.Play("whoosh.wav", 0.5f, false);
-			diamond1.displayed = false;
-			score += 1;
-			tookd1 = true;
-		}
-
+	else if (name == "treasure" && !tookt) {
+		audioManager.Play("finish.wav", 0.5f, false);
+		treasureBox.displayed = false;
+		addLightFlash(treasureBox.position, 1.0f, 0.8f, 0.3f);
+		particles.Emit(PARTICLE_PICKUP, treasureBox.position.x, treasureBox.position.y + 1, treasureBox.position.z, 200);
+		tookt = true;
+		flagFinish = true;
 	}
+}
 
-	if ((aladdin.position.x <= -26 && aladdin.position.x >= -34) && aladdin.position.y == 0 && (aladdin.position.z <= 34 && aladdin.position.z >= 26)) {
-		if (!tookd2) {
-			audioManager.Play("whoosh.wav", 0.5f, false);
-			diamond2.displayed = false;
-			score += 1;
-			tookd2 = true;
-		}
-
-	}
-	if ((aladdin.position.x <= 7 && aladdin.position.x >= 3) && aladdin.position.y == 0 && (aladdin.position.z <= 32 && aladdin.position.z >= 28)) {
-		if (!tookd3) {
-			audioManager.Play("whoosh.wav", 0.5f, false);
-			diamond3.displayed = false;
-			score += 1;
-			tookd3 = true;
-		}
-	}
-	if ((aladdin.position.x <= 25 && aladdin.position.x >= 15) && (aladdin.position.z <= -44 && aladdin.position.z >= -52)) {
-		if (!tookt) {
-			audioManager.Play("finish.wav", 0.5f, false);
-			treasureBox.displayed = false;
-			tookt = true;
-			flagFinish = true;
-		}
+void onExitEvent(const TriggerEvent& event) {
+	if (event.type == TRIGGER_ENTER && !endOne) {
+		audioManager.Play("target.wav", 0.5f, false);
+		endOne = true;
 	}
-
-
-	//glutPostRedisplay();
-
 }
 
 //=======================================================================
@@ -1146,7 +1453,7 @@ void updateDirection() {
 	aladdin.direction.x = std::cos(aladdin.rotation * PI / 180.0f);
 	aladdin.direction.z = std::sin(aladdin.rotation * PI / 180.0f);
 }
-void mySpecial(int key, int x, int y) {
+void handleSpecial(int key) {
 	float a = 1.0;
 	float rh = std::sqrtf(1.0 / 2.0);
 	const float xChange[] = { 0.0, -rh, -1.0, -rh, 0.0, rh, 1.0, rh };
@@ -1167,7 +1474,7 @@ void mySpecial(int key, int x, int y) {
 
 
 			// Check collision
-			if (checkCollitionObstacles() == 1 && (!endOne)) {
+			if (checkCollitionObstacles(deltaX, deltaZ) == 1 && (!endOne)) {
 
 				// If collision, revert the position change
 				aladdin.position.x -= deltaX;
@@ -1178,11 +1485,8 @@ void mySpecial(int key, int x, int y) {
 				aladdin.position.x -= (deltaX + 1.5);
 				aladdin.position.z -= (deltaZ + 1.5);
 			}
-			// Check collectables
-			if (endOne) {
-				checkCollisionCollectables();
-			}
-			else {
+			// Check collectables (the cave's are picked up by the triggers)
+			if (!endOne) {
 				checkCollitionCollectables();
 			}
 			audioManager.Play("step.wav", 0.03f, false);
@@ -1246,7 +1550,7 @@ void myMotion(int x, int y)
 //=======================================================================
 // Mouse Function
 //=======================================================================
-void myMouse(int button, int state, int x, int y)
+void handleMouse(int button, int state, int x, int y)
 {
 	y = HEIGHT - y;
 
@@ -1260,6 +1564,174 @@ void myMouse(int button, int state, int x, int y)
 	}
 }
 
+//=======================================================================
+// Simulation Tick Functions
+//=======================================================================
+const int TICK_RATE = 60;	// Ticks per second
+unsigned int simTick = 0;	// Ticks run so far
+int simStartMs = 0;			// When tick 0 was due (GLUT_ELAPSED_TIME)
+std::vector<InputEvent> pendingInput;	// Input that arrived since the last tick
+std::vector<InputEvent> tickInput;		// Input the current tick runs with
+ReplayRecorder recorder;
+
+// Keeps an input event for the next tick
+void queueInput(InputKind kind, int key, int state, int x, int y) {
+	InputEvent event;
+	event.kind = (unsigned char)kind;
+	event.key = key;
+	event.state = state;
+	event.x = x;
+	event.y = y;
+	pendingInput.push_back(event);
+}
+
+// The GLUT input callbacks only queue the input, the tick applies it
+void mySpecial(int key, int x, int y) {
+	queueInput(INPUT_SPECIAL, key, 0, x, y);
+}
+
+void myKeyboard(unsigned char button, int x, int y) {
+	if (button == 27) {
+		exit(0);	// The recording is closed by the atexit handler
+	}
+	queueInput(INPUT_KEYBOARD, button, 0, x, y);
+}
+
+void myMouse(int button, int state, int x, int y) {
+	queueInput(INPUT_MOUSE, button, state, x, y);
+}
+
+// Adds a float to the checksum
+unsigned int hashFloat(unsigned int hash, float value) {
+	return ReplayHash(hash, &value, sizeof(value));
+}
+
+unsigned int hashInt(unsigned int hash, int value) {
+	return ReplayHash(hash, &value, sizeof(value));
+}
+
+// A checksum of everything a tick can change
+unsigned int stateChecksum() {
+	unsigned int hash = REPLAY_HASH_START;
+
+	hash = hashFloat(hash, aladdin.position.x);
+	hash = hashFloat(hash, aladdin.position.y);
+	hash = hashFloat(hash, aladdin.position.z);
+	hash = hashFloat(hash, aladdin.rotation);
+	hash = hashFloat(hash, playerVerticalVelocity);
+	hash = hashInt(hash, movementState);
+	hash = hashInt(hash, score);
+	hash = hashInt(hash, timer);
+	hash = hashInt(hash, (endOne ? 1 : 0) | (tookd1 ? 2 : 0) | (tookd2 ? 4 : 0) | (tookd3 ? 8 : 0) | (tookt ? 16 : 0) | (flagFinish ? 32 : 0));
+
+	hash = ReplayHash(hash, entities.transforms.data(), entities.transforms.size() * sizeof(Transform));
+	hash = ReplayHash(hash, entities.flags.data(), entities.flags.size() * sizeof(unsigned int));
+
+	return hash;
+}
+
+// Runs one tick with the input in tickInput
+void simulateTick() {
+	for (InputEvent& event : tickInput) {
+		if (event.kind == INPUT_SPECIAL) {
+			handleSpecial(event.key);
+		}
+		else if (event.kind == INPUT_KEYBOARD) {
+			handleKeyboard((unsigned char)event.key);
+		}
+		else if (event.kind == INPUT_MOUSE) {
+			handleMouse(event.key, event.state, event.x, event.y);
+		}
+	}
+
+	updateWorld();
+
+	simTick++;
+	if (simTick % TICK_RATE == 0) {
+		timer -= 1;
+
+		// Close the gaps picked up bottles left once a second
+		entities.Compact();
+	}
+}
+
+void myTimer(int) {
+	// Run every tick that is due by now, however long the last frame took
+	int now = glutGet(GLUT_ELAPSED_TIME);
+	unsigned int due = (unsigned int)((long long)(now - simStartMs) * TICK_RATE / 1000);
+
+	// After a long stall (a breakpoint, dragging the window) don't try to catch up on all of it
+	if (due > simTick + TICK_RATE / 4) {
+		simStartMs = now - (int)((long long)simTick * 1000 / TICK_RATE);
+		due = simTick + 1;
+	}
+
+	while (simTick < due) {
+		tickInput.swap(pendingInput);
+		pendingInput.clear();
+
+		simulateTick();
+		recorder.WriteTick(tickInput, stateChecksum());
+	}
+
+	setCameraFollow();
+	setupCamera();
+
+	std::cout << "x" << aladdin.position.x<<std::endl;
+	std::cout << "z" << aladdin.position.z << std::endl;
+
+	glutPostRedisplay();
+	glutTimerFunc(1000 / 60, myTimer, 0);
+}
+
+// Plays a recording back as fast as it will go and checks every tick's checksum
+void runReplay(ReplayReader& reader, bool render) {
+	audioManager.Muted = true;
+
+	unsigned int expected;
+	int mismatches = 0;
+	int firstMismatch = -1;
+	double renderMs = 0;
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	while (reader.ReadTick(tickInput, expected)) {
+		simulateTick();
+
+		if (stateChecksum() != expected) {
+			if (firstMismatch < 0) {
+				firstMismatch = (int)simTick;
+			}
+			mismatches++;
+		}
+
+		// Draw every tick too, for a frame time trace of the session
+		if (render) {
+			std::chrono::high_resolution_clock::time_point frameStart = std::chrono::high_resolution_clock::now();
+			setCameraFollow();
+			setupCamera();
+			myDisplay();
+			glFinish();
+			renderMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
+		}
+	}
+
+	double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	double sessionMs = simTick * 1000.0 / reader.TickRate();
+
+	std::cout << "replay: " << simTick << " ticks (" << sessionMs / 1000.0 << " s of play) in " << totalMs << " ms, "
+		<< (totalMs > 0 ? sessionMs / totalMs : 0) << "x real time" << std::endl;
+	if (render && simTick > 0) {
+		std::cout << "replay: " << renderMs / simTick << " ms per frame" << std::endl;
+	}
+	if (mismatches == 0) {
+		std::cout << "replay: every checksum matched" << std::endl;
+	}
+	else {
+		std::cout << "replay: " << mismatches << " checksums didn't match, the first at tick " << firstMismatch << std::endl;
+	}
+}
+
 
 //=======================================================================
 // Reshape Function
@@ -1306,7 +1778,104 @@ void main(int argc, char** argv)
 	glutInitWindowSize(WIDTH, HEIGHT);
 	glutInitWindowPosition(100, 150);
 	glutCreateWindow(title);
-	audioManager.Play("arabianNights.wav", 0.3f, false);
+	glewInit();
+	jobs.Start(0);
+	MipmapBuilder::SetJobSystem(&jobs);
+
+	// -bench <name>		Run a benchmark instead of the game
+	// -compresstextures	Compress every texture under models/ and textures/ into .dds files and exit
+	// -seed <n>			Play the same level again
+	// -record <file>		Where the session is recorded (session.rpl if not given)
+	// -replay <file>		Play a recorded session back as fast as possible and check it
+	// -render				Draw every tick of the replay too
+	// -uploadbudget <KB>	Most texture data streamed to the card a frame (512 if not given)
+	// -texturebudget <MB>	Most texture memory kept on the card (no limit if not given)
+	// -notexturecache		Decode every texture and build its mipmaps again instead of keeping them in texcache/
+	// -audioout <file>		Write the game's sound to a .wav file instead of playing it
+	const char* benchName = 0;
+	bool compressTextures = false;
+	bool textureCache = true;
+	const char* recordName = "session.rpl";
+	const char* replayName = 0;
+	bool replayRender = false;
+	randomSeed = (unsigned int)time(0);
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc) {
+			benchName = argv[++i];
+		}
+		else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+			randomSeed = (unsigned int)strtoul(argv[++i], 0, 10);
+		}
+		else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+			recordName = argv[++i];
+		}
+		else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc) {
+			replayName = argv[++i];
+		}
+		else if (strcmp(argv[i], "-render") == 0) {
+			replayRender = true;
+		}
+		else if (strcmp(argv[i], "-compresstextures") == 0) {
+			compressTextures = true;
+		}
+		else if (strcmp(argv[i], "-uploadbudget") == 0 && i + 1 < argc) {
+			textureStreamer.budget = (size_t)strtoul(argv[++i], 0, 10) * 1024;
+		}
+		else if (strcmp(argv[i], "-notexturecache") == 0) {
+			textureCache = false;
+		}
+		else if (strcmp(argv[i], "-texturebudget") == 0 && i + 1 < argc) {
+			TextureManager::Shared().SetBudget((size_t)strtoul(argv[++i], 0, 10) * 1024 * 1024);
+		}
+		else if (strcmp(argv[i], "-audioout") == 0 && i + 1 < argc) {
+			audioManager.SetSink(new WavFileSink(argv[++i]));
+		}
+	}
+
+	if (compressTextures) {
+		TextureCompressor compressor;
+		compressor.CompressFolder("models");
+		compressor.CompressFolder("textures");
+		TextureCompressor::Stats &cs = compressor.stats;
+		std::cout << cs.files << " compressed, " << cs.upToDate << " up to date, " << cs.failed << " failed: "
+			<< cs.sourceBytes / 1024 << " KB -> " << cs.compressedBytes / 1024 << " KB" << std::endl;
+		return;
+	}
+
+	if (benchName) {
+		RunBenchmark(benchName);
+		return;
+	}
+
+	// Decoded textures are kept on disk for the next run
+	if (textureCache) {
+		TextureCache::Shared().Open("texcache", &jobs);
+	}
+
+	// The game's textures stream in from here on
+	textureStreamer.Init(&jobs);
+	TextureManager::Shared().SetStreamer(&textureStreamer);
+
+	// A replay runs with the seed it was recorded with
+	ReplayReader replay;
+	if (replayName) {
+		if (!replay.Open(replayName)) {
+			return;
+		}
+		randomSeed = replay.Seed();
+		audioManager.Muted = true;
+	}
+	std::cout << "Seed " << randomSeed << std::endl;
+
+	// Every sound effect the game plays, read once so Play() never touches the disk
+	const char* sounds[] = { "collision.wav", "finish.wav", "step.wav", "target.wav", "whoosh.wav" };
+	for (int i = 0; i < 5; i++) {
+		audioManager.Load(sounds[i]);
+	}
+
+	// The music is read from the file as it plays
+	audioManager.PlayStream("arabianNights.wav", 0.3f, false);
 	glutDisplayFunc(myDisplay);
 	glutTimerFunc(0, myTimer, 0);
 	glutTimerFunc(0, clk, 0);
@@ -1318,6 +1887,29 @@ void main(int argc, char** argv)
 
 	myInit();
 	LoadAssets();
+
+	// The walls, pickups and exits of both levels
+	triggers.Load("levels/triggers.txt");
+	triggers.SetHandler(VOLUME_COLLECT, onCollectEvent);
+	triggers.SetHandler(VOLUME_EXIT, onExitEvent);
+
+	// Snakes, rocks and bottles keep MIN_ENEMY_CLOSENESS apart, out of the cave and away from the player
+	spawnPlacer.Reset(-30, -48, 48, 48, MIN_ENEMY_CLOSENESS, randomSeed);
+	spawnPlacer.SetExclusion(spawnBlocked);
+
+	// One nav cell per unit over the area the player can walk
+	navField.Reset(-37, -53, 59, 50, 1.0f);
+
+	// Use the clustered lights if the card can run the shader
+	if (!lighting.Init()) {
+		std::cout << "Clustered lighting isn't supported, using the fixed function lights" << std::endl;
+	}
+	else if (!sceneBatcher.Init(&lighting)) {
+		std::cout << "Multi draw indirect isn't supported, models are drawn one at a time" << std::endl;
+	}
+	if (!particles.InitGL()) {
+		std::cout << "Point sprites aren't supported, particles are drawn as plain points" << std::endl;
+	}
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_LIGHTING);
 	glEnable(GL_LIGHT0);
@@ -1327,6 +1919,16 @@ void main(int argc, char** argv)
 
 	glShadeModel(GL_SMOOTH);
 
+	if (replayName) {
+		runReplay(replay, replayRender);
+		return;
+	}
+
+	// Record the session so it can be played back later
+	if (recorder.Open(recordName, randomSeed, TICK_RATE)) {
+		atexit([]() { recorder.Close(); });
+	}
+	simStartMs = glutGet(GLUT_ELAPSED_TIME);
 
 	glutMainLoop();
 }
@@ -0,0 +1,154 @@
+//////////////////////////////////////////////////////////////////////
+//
+// 4x4 Matrix Helpers
+//
+// Matrix4.h: a handful of inline functions for building the same
+// matrices that glTranslatef/glRotatef/glScalef build, but on the
+// CPU so they can be worked out away from the GL thread.
+// Matrices are float[16] in OpenGL's column major order so they can
+// go straight into glMultMatrixf/glLoadMatrixf. Every "apply"
+// function multiplies on the right just like the GL calls do, so
+// the calls read in the same order as the glPushMatrix blocks
+// they replace.
+//
+// Usage:
+// float m[16];
+//
+// Mat4Identity(m);
+// Mat4Translate(m, 1.0f, 0.0f, 0.0f);		// glTranslatef(1, 0, 0)
+// Mat4Rotate(m, 90.0f, 0.0f, 1.0f, 0.0f);	// glRotatef(90, 0, 1, 0)
+// Mat4Scale(m, 2.0f, 2.0f, 2.0f);			// glScalef(2, 2, 2)
+// glMultMatrixf(m);
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef MATRIX4_H
+#define MATRIX4_H
+
+#include <math.h>
+#include <string.h>
+
+// Sets m to the identity matrix
+inline void Mat4Identity(float *m)
+{
+	memset(m, 0, sizeof(float) * 16);
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+// out = a * b (out may not be a or b)
+inline void Mat4Multiply(float *out, const float *a, const float *b)
+{
+	for (int c = 0; c < 4; c++)
+	{
+		for (int r = 0; r < 4; r++)
+		{
+			out[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] +
+				a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+		}
+	}
+}
+
+// m = m * b
+inline void Mat4Apply(float *m, const float *b)
+{
+	float t[16];
+	Mat4Multiply(t, m, b);
+	memcpy(m, t, sizeof(t));
+}
+
+// Same as glTranslatef
+inline void Mat4Translate(float *m, float x, float y, float z)
+{
+	m[12] += m[0] * x + m[4] * y + m[8] * z;
+	m[13] += m[1] * x + m[5] * y + m[9] * z;
+	m[14] += m[2] * x + m[6] * y + m[10] * z;
+	m[15] += m[3] * x + m[7] * y + m[11] * z;
+}
+
+// Same as glScalef
+inline void Mat4Scale(float *m, float x, float y, float z)
+{
+	for (int r = 0; r < 4; r++)
+	{
+		m[r] *= x;
+		m[4 + r] *= y;
+		m[8 + r] *= z;
+	}
+}
+
+// Same as glRotatef (the angle is in degrees)
+inline void Mat4Rotate(float *m, float angle, float x, float y, float z)
+{
+	if (angle == 0.0f)
+		return;
+
+	float len = sqrtf(x * x + y * y + z * z);
+	if (len == 0.0f)
+		return;
+
+	x /= len;
+	y /= len;
+	z /= len;
+
+	float rad = angle * 0.0174532925f;
+	float c = cosf(rad);
+	float s = sinf(rad);
+	float t = 1.0f - c;
+
+	float r[16];
+	r[0] = t * x * x + c;		r[4] = t * x * y - s * z;	r[8] = t * x * z + s * y;	r[12] = 0.0f;
+	r[1] = t * x * y + s * z;	r[5] = t * y * y + c;		r[9] = t * y * z - s * x;	r[13] = 0.0f;
+	r[2] = t * x * z - s * y;	r[6] = t * y * z + s * x;	r[10] = t * z * z + c;		r[14] = 0.0f;
+	r[3] = 0.0f;				r[7] = 0.0f;				r[11] = 0.0f;				r[15] = 1.0f;
+
+	Mat4Apply(m, r);
+}
+
+// out = m * (x, y, z, 1), the w is dropped
+inline void Mat4TransformPoint(const float *m, float x, float y, float z, float *out)
+{
+	out[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+	out[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+	out[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+}
+
+// The largest scale along any of the matrix's axes
+inline float Mat4MaxScale(const float *m)
+{
+	float sx = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+	float sy = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+	float sz = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+
+	float s = sx > sy ? sx : sy;
+	if (sz > s)
+		s = sz;
+
+	return sqrtf(s);
+}
+
+// out = m * (x, y, z, 0), a direction (the translation is left out)
+inline void Mat4TransformVector(const float *m, float x, float y, float z, float *out)
+{
+	out[0] = m[0] * x + m[4] * y + m[8] * z;
+	out[1] = m[1] * x + m[5] * y + m[9] * z;
+	out[2] = m[2] * x + m[6] * y + m[10] * z;
+}
+
+// Inverts a matrix built only from translations, rotations and scales that are the same
+// on every axis (everything the game draws with), which is just a transpose and a divide
+inline void Mat4InvertUniform(float *out, const float *m)
+{
+	float s2 = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+	float inv = s2 > 0.0f ? 1.0f / s2 : 0.0f;
+
+	out[0] = m[0] * inv;	out[4] = m[1] * inv;	out[8] = m[2] * inv;
+	out[1] = m[4] * inv;	out[5] = m[5] * inv;	out[9] = m[6] * inv;
+	out[2] = m[8] * inv;	out[6] = m[9] * inv;	out[10] = m[10] * inv;
+	out[3] = 0.0f;			out[7] = 0.0f;			out[11] = 0.0f;			out[15] = 1.0f;
+
+	out[12] = -(out[0] * m[12] + out[4] * m[13] + out[8] * m[14]);
+	out[13] = -(out[1] * m[12] + out[5] * m[13] + out[9] * m[14]);
+	out[14] = -(out[2] * m[12] + out[6] * m[13] + out[10] * m[14]);
+}
+
+#endif // MATRIX4_H
@@ -0,0 +1,318 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Mipmap Builder
+//
+// MipmapBuilder.cpp: implementation of the MipmapBuilder class.
+// See MipmapBuilder.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "MipmapBuilder.h"
+#include "JobSystem.h"
+
+#include <windows.h>
+#include "glew.h"
+#include <gl\glu.h>
+#include <emmintrin.h>	// SSE2
+#include <math.h>
+#include <string.h>
+
+JobSystem *MipmapBuilder::uploadJobs = 0;
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+MipmapBuilder::MipmapBuilder()
+{
+	top = 0;
+	width = 0;
+	height = 0;
+	channels = 0;
+}
+
+MipmapBuilder::~MipmapBuilder()
+{
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Filtering
+//////////////////////////////////////////////////////////////////////
+
+// sRGB bytes to linear light (0..65535) and linear light (in 4096 steps) back
+struct SrgbTables {
+	unsigned short toLinear[256];
+	unsigned char toSrgb[4096];
+
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			double c = i / 255.0;
+			double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+			toLinear[i] = (unsigned short)(linear * 65535.0 + 0.5);
+		}
+		for (int i = 0; i < 4096; i++)
+		{
+			double linear = (i + 0.5) / 4096.0;
+			double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+			toSrgb[i] = (unsigned char)(c * 255.0 + 0.5);
+		}
+	}
+};
+
+// Made before main() so no thread has to wait for them
+static const SrgbTables srgbTables;
+
+// RGBA: four output pixels (32 bytes of each row) at a time, how many pixels were done
+static int BoxRGBA(const unsigned char *row0, const unsigned char *row1, int w, unsigned char *out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+
+	int x = 0;
+	for (; x + 4 <= w; x += 4)
+	{
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + x * 8));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(row0 + x * 8 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(row1 + x * 8));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + x * 8 + 16));
+
+		// The two rows added, two source pixels to a register
+		__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+		// Then the two pixels of each pair, rounded
+		__m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+		__m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+		h0 = _mm_srli_epi16(_mm_add_epi16(h0, two), 2);
+		h1 = _mm_srli_epi16(_mm_add_epi16(h1, two), 2);
+
+		_mm_storeu_si128((__m128i *)(out + x * 4), _mm_packus_epi16(h0, h1));
+	}
+	return x;
+}
+
+// RGB: each byte plus the one a pixel on (both rows) with SSE2, then every other pixel kept
+static int BoxRGB(const unsigned char *row0, const unsigned char *row1, int width, int w, unsigned char *out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	int rowBytes = width * 3;
+
+	int x = 0;
+	for (; x + 4 <= w && x * 6 + 27 <= rowBytes; x += 4)
+	{
+		const unsigned char *a = row0 + x * 6;
+		const unsigned char *b = row1 + x * 6;
+		__m128i a0 = _mm_loadu_si128((const __m128i *)a);
+		__m128i a1 = _mm_loadl_epi64((const __m128i *)(a + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i *)b);
+		__m128i b1 = _mm_loadl_epi64((const __m128i *)(b + 16));
+		__m128i c0 = _mm_loadu_si128((const __m128i *)(a + 3));
+		__m128i c1 = _mm_loadl_epi64((const __m128i *)(a + 19));
+		__m128i d0 = _mm_loadu_si128((const __m128i *)(b + 3));
+		__m128i d1 = _mm_loadl_epi64((const __m128i *)(b + 19));
+
+		// Bytes 0-7, 8-15 and 16-23
+		__m128i s0 = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero)),
+			_mm_add_epi16(_mm_unpacklo_epi8(c0, zero), _mm_unpacklo_epi8(d0, zero)));
+		__m128i s1 = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero)),
+			_mm_add_epi16(_mm_unpackhi_epi8(c0, zero), _mm_unpackhi_epi8(d0, zero)));
+		__m128i s2 = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero)),
+			_mm_add_epi16(_mm_unpacklo_epi8(c1, zero), _mm_unpacklo_epi8(d1, zero)));
+		s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+		s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+		s2 = _mm_srli_epi16(_mm_add_epi16(s2, two), 2);
+
+		// Output pixel j is at byte 6j
+		unsigned char sums[32];
+		_mm_storeu_si128((__m128i *)sums, _mm_packus_epi16(s0, s1));
+		_mm_storeu_si128((__m128i *)(sums + 16), _mm_packus_epi16(s2, s2));
+		unsigned char *o = out + x * 3;
+		memcpy(o, sums, 3);
+		memcpy(o + 3, sums + 6, 3);
+		memcpy(o + 6, sums + 12, 3);
+		memcpy(o + 9, sums + 18, 3);
+	}
+	return x;
+}
+
+void MipmapBuilder::HalveRows(const unsigned char *src, int width, int height, int channels, unsigned char *dst, int begin, int end, bool srgb)
+{
+	int w = width > 1 ? width / 2 : 1;
+	size_t rowBytes = (size_t)width * channels;
+
+	for (int y = begin; y < end; y++)
+	{
+		// A side of 1 stays 1, its pixels are just used twice
+		const unsigned char *row0 = src + (size_t)(height > 1 ? y * 2 : y) * rowBytes;
+		const unsigned char *row1 = height > 1 ? row0 + rowBytes : row0;
+		unsigned char *out = dst + (size_t)y * w * channels;
+
+		int x = 0;
+		if (width > 1 && !srgb)
+			x = channels == 4 ? BoxRGBA(row0, row1, w, out) : BoxRGB(row0, row1, width, w, out);
+
+		// What's left of the row (all of it for sRGB)
+		for (; x < w; x++)
+		{
+			int x0 = (width > 1 ? x * 2 : x) * channels;
+			int x1 = (width > 1 ? x * 2 + 1 : x) * channels;
+			for (int c = 0; c < channels; c++)
+			{
+				if (srgb && c < 3)
+				{
+					const unsigned short *linear = srgbTables.toLinear;
+					int sum = linear[row0[x0 + c]] + linear[row0[x1 + c]] + linear[row1[x0 + c]] + linear[row1[x1 + c]];
+					int index = (sum + 32) >> 6;
+					out[x * channels + c] = srgbTables.toSrgb[index < 4095 ? index : 4095];
+				}
+				else
+				{
+					out[x * channels + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+				}
+			}
+		}
+	}
+}
+
+void MipmapBuilder::Halve(const unsigned char *src, int width, int height, int channels, unsigned char *dst, bool srgb)
+{
+	HalveRows(src, width, height, channels, dst, 0, height > 1 ? height / 2 : 1, srgb);
+}
+
+int MipmapBuilder::LevelCount(int width, int height)
+{
+	int count = 1;
+	while (width > 1 || height > 1)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		count++;
+	}
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Building
+//////////////////////////////////////////////////////////////////////
+
+int MipmapBuilder::Build(const unsigned char *pixels, int width, int height, int channels, bool srgb, JobSystem *jobs)
+{
+	top = pixels;
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+
+	// Room for every level at once, kept for the next texture
+	int count = LevelCount(width, height);
+	offsets.clear();
+	size_t total = 0;
+	int w = width, h = height;
+	for (int level = 1; level < count; level++)
+	{
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+		offsets.push_back(total);
+		total += (size_t)w * h * channels;
+	}
+	if (levels.size() < total)
+		levels.resize(total);
+
+	// Each level from the one above it
+	const unsigned char *src = pixels;
+	w = width;
+	h = height;
+	for (int level = 1; level < count; level++)
+	{
+		unsigned char *dst = &levels[offsets[level - 1]];
+		int rows = h > 1 ? h / 2 : 1;
+
+		// Bands of rows, but only where there is enough work to hand out
+		if (jobs && jobs->NumThreads() > 1 && (size_t)w * h >= 256 * 256)
+		{
+			jobs->ParallelFor(rows, 16, [&](int begin, int end, int thread) {
+				HalveRows(src, w, h, channels, dst, begin, end, srgb);
+			});
+		}
+		else
+		{
+			HalveRows(src, w, h, channels, dst, 0, rows, srgb);
+		}
+
+		src = dst;
+		w = w > 1 ? w / 2 : 1;
+		h = rows;
+	}
+
+	return count;
+}
+
+const unsigned char *MipmapBuilder::Level(int level, int &width, int &height) const
+{
+	width = this->width;
+	height = this->height;
+	for (int i = 0; i < level; i++)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+
+	return level == 0 ? top : &levels[offsets[level - 1]];
+}
+
+//////////////////////////////////////////////////////////////////////
+// Uploading
+//////////////////////////////////////////////////////////////////////
+
+void MipmapBuilder::Upload(const unsigned char *pixels, int width, int height, int channels, bool srgb)
+{
+	GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// A card that can't take these sides gets them scaled up the old way
+	if (!SidesSupported(width, height))
+	{
+		gluBuild2DMipmaps(GL_TEXTURE_2D, format, width, height, format, GL_UNSIGNED_BYTE, pixels);
+		return;
+	}
+
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+
+	// The card makes the rest itself (averaging the bytes as they are, so not for sRGB)
+	if (!srgb && (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object))
+	{
+		glGenerateMipmap(GL_TEXTURE_2D);
+		return;
+	}
+	if (!srgb && GLEW_EXT_framebuffer_object)
+	{
+		glGenerateMipmapEXT(GL_TEXTURE_2D);
+		return;
+	}
+
+	// Textures are only made on the GL thread, so one builder (and its buffer) does for all of them
+	static MipmapBuilder builder;
+	int count = builder.Build(pixels, width, height, channels, srgb, uploadJobs);
+	for (int level = 1; level < count; level++)
+	{
+		int w, h;
+		const unsigned char *data = builder.Level(level, w, h);
+		glTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, format, GL_UNSIGNED_BYTE, data);
+	}
+}
+
+void MipmapBuilder::SetJobSystem(JobSystem *jobs)
+{
+	uploadJobs = jobs;
+}
+
+bool MipmapBuilder::SidesSupported(int width, int height)
+{
+	bool powerOfTwo = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+	return powerOfTwo || GLEW_VERSION_2_0 || GLEW_ARB_texture_non_power_of_two;
+}
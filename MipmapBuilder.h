@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Mipmap Builder
+//
+// MipmapBuilder.h: interface for the MipmapBuilder class.
+// Every texture used to go through gluBuild2DMipmaps, which scales
+// an image whose sides aren't powers of two up to ones that are and
+// then builds each level with a generic loop, even for the 2x2
+// color textures. Upload() replaces it:
+//
+// - With GL 3.0 (or framebuffer objects) the top level is uploaded
+//   as it is and glGenerateMipmap makes the rest on the card.
+// - Otherwise the levels are built here and uploaded one by one.
+//   Sides that aren't powers of two are kept as they are.
+// - Only a card that can't take those sides falls back to
+//   gluBuild2DMipmaps. SidesSupported() is that test, for the other
+//   places that upload levels (the texture cache and streamer).
+//
+// Each level is a 2x2 box filter of the one above it (an odd last
+// row or column is dropped, the way GL sizes its levels). RGBA rows
+// are filtered with SSE2, four output pixels at a time. RGB ones are
+// summed with SSE2 and picked out a pixel at a time. Big levels are
+// split into bands of rows which the job system builds in parallel.
+//
+// sRGB: the colors are turned into linear light, averaged and turned
+// back, so dark and bright texels don't mix to something too dark.
+// Alpha is always averaged as it is. This takes the slower path on
+// the CPU, since glGenerateMipmap averages the bytes as they are.
+//
+// Usage:
+// glBindTexture(GL_TEXTURE_2D, id);
+// MipmapBuilder::Upload(pixels, width, height, 3);	// Instead of gluBuild2DMipmaps
+//
+// MipmapBuilder::SetJobSystem(&jobs);			// Once, so Upload() builds bands in parallel
+//
+// MipmapBuilder builder;
+// int levels = builder.Build(rgba, width, height, 4, false, &jobs);
+// for (int i = 1; i < levels; i++)
+//		pixels = builder.Level(i, w, h);			// Level 0 is the image itself
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef MIPMAPBUILDER_H
+#define MIPMAPBUILDER_H
+
+#include <stddef.h>
+#include <vector>
+
+class JobSystem;
+
+class MipmapBuilder
+{
+public:
+	static int LevelCount(int width, int height);	// Down to 1x1, the image itself included
+
+	// The next level down of an image with 3 or 4 channels (max(1, side / 2) a side)
+	static void Halve(const unsigned char *src, int width, int height, int channels, unsigned char *dst, bool srgb);
+	// Just the rows [begin, end) of the next level, so bands can be built at the same time
+	static void HalveRows(const unsigned char *src, int width, int height, int channels, unsigned char *dst, int begin, int end, bool srgb);
+
+	// Every level below the image, bands of big levels on the jobs (0: this thread), how many levels there are
+	int Build(const unsigned char *pixels, int width, int height, int channels, bool srgb, JobSystem *jobs);
+	const unsigned char *Level(int level, int &width, int &height) const;	// 0 is the image handed to Build()
+
+	// Uploads the image and its mipmaps to the bound GL_TEXTURE_2D (GL thread only)
+	static void Upload(const unsigned char *pixels, int width, int height, int channels, bool srgb = false);
+	static void SetJobSystem(JobSystem *jobs);		// What Upload() builds bands on, 0: none
+	// True if the card takes a texture with these sides as they are (GL thread only), else they're scaled up
+	static bool SidesSupported(int width, int height);
+
+	MipmapBuilder();								// Constructor
+	virtual ~MipmapBuilder();						// Destructor
+
+private:
+	const unsigned char *top;						// Build()'s image, not copied
+	int width;
+	int height;
+	int channels;
+	std::vector<unsigned char> levels;				// Levels 1 and down, one after the other
+	std::vector<size_t> offsets;					// Where each starts in levels (offsets[0] is level 1)
+
+	static JobSystem *uploadJobs;
+};
+
+#endif // MIPMAPBUILDER_H
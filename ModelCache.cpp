@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Model Cache
+//
+// ModelCache.cpp: implementation of the ModelCache class.
+// See ModelCache.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "ModelCache.h"
+
+#include <string.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+ModelCache::ModelCache()
+{
+
+}
+
+ModelCache::~ModelCache()
+{
+	Clear();
+}
+
+Model_3DS *ModelCache::Get(const char *path)
+{
+	std::map<std::string, Model_3DS *>::iterator it = models.find(path);
+	if (it != models.end())
+		return it->second;
+
+	// Model_3DS::Load() writes into the name it is given so hand it a copy
+	char name[260];
+	strncpy(name, path, sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+
+	Model_3DS *model = new Model_3DS();
+	model->Load(name);
+	models[path] = model;
+
+	return model;
+}
+
+const CollisionMesh *ModelCache::GetMesh(const char *path)
+{
+	std::map<std::string, CollisionMesh *>::iterator it = meshes.find(path);
+	if (it != meshes.end())
+		return it->second;
+
+	CollisionMesh *mesh = new CollisionMesh();
+	mesh->Build(*Get(path));
+	meshes[path] = mesh;
+
+	return mesh;
+}
+
+void ModelCache::Preload(const char *const *paths, int count, bool withMeshes, JobSystem &jobs)
+{
+	// Make the entries here so the jobs never touch the maps
+	std::vector<Model_3DS *> loading;
+	std::vector<CollisionMesh *> building;
+	std::vector<const char *> names;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (models.find(paths[i]) != models.end())
+		{
+			// Already loaded, it may still be missing its mesh
+			if (withMeshes)
+				GetMesh(paths[i]);
+			continue;
+		}
+
+		Model_3DS *model = new Model_3DS();
+		model->deferTextures = true;
+		models[paths[i]] = model;
+
+		CollisionMesh *mesh = 0;
+		if (withMeshes && meshes.find(paths[i]) == meshes.end())
+		{
+			mesh = new CollisionMesh();
+			meshes[paths[i]] = mesh;
+		}
+
+		loading.push_back(model);
+		building.push_back(mesh);
+		names.push_back(paths[i]);
+	}
+
+	JobCounter loaded;
+	for (size_t i = 0; i < loading.size(); i++)
+	{
+		Model_3DS *model = loading[i];
+		CollisionMesh *mesh = building[i];
+		const char *path = names[i];
+
+		jobs.Run(loaded, [=, &jobs](int thread) {
+			// Model_3DS::Load() writes into the name it is given so hand it a copy
+			char name[260];
+			strncpy(name, path, sizeof(name) - 1);
+			name[sizeof(name) - 1] = '\0';
+
+			model->Load(name);
+			if (mesh)
+				mesh->Build(*model);
+
+			jobs.RunOnMain([model] { model->LoadTextures(); });
+		});
+	}
+	jobs.Wait(loaded);
+
+	// Every model is read, make their textures
+	jobs.RunMainJobs();
+}
+
+int ModelCache::Count() const
+{
+	return (int)models.size();
+}
+
+void ModelCache::Clear()
+{
+	for (std::map<std::string, Model_3DS *>::iterator it = models.begin(); it != models.end(); ++it)
+		delete it->second;
+
+	models.clear();
+
+	for (std::map<std::string, CollisionMesh *>::iterator it = meshes.begin(); it != meshes.end(); ++it)
+		delete it->second;
+
+	meshes.clear();
+}
@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Model Cache
+//
+// ModelCache.h: interface for the ModelCache class.
+// Every snake in the level looks the same, so there is no reason
+// for each one to load and hold its own copy of snake.3ds. This
+// class loads a model the first time its path is asked for and
+// hands the same Model_3DS out to everyone after that.
+//
+// It does the same for the triangle trees collisions are tested
+// against (see CollisionMesh), built the first time they are asked
+// for from the same loaded model.
+//
+// Preload() loads a list of models at once on the job system: the
+// files are read and the meshes built on the workers, and the GL
+// textures are queued for the main thread, which makes them before
+// Preload() returns. It has to be called from the main thread.
+//
+// The cache owns the models and meshes. The pointers stay good until
+// Clear() or the cache is destroyed.
+//
+// Usage:
+// ModelCache models;
+//
+// Model_3DS *snake = models.Get("models/snake/snake.3ds");
+// const CollisionMesh *shape = models.GetMesh("models/snake/snake.3ds");
+//
+// const char *paths[] = { "models/rock2/rock.3ds", "models/cave/cave.3ds" };
+// models.Preload(paths, 2, true, jobs);	// All at once, with their meshes
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef MODELCACHE_H
+#define MODELCACHE_H
+
+#include "CollisionMesh.h"
+#include "JobSystem.h"
+#include "Model_3DS.h"
+
+#include <map>
+#include <string>
+
+class ModelCache
+{
+public:
+	Model_3DS *Get(const char *path);	// Loads the model if it isn't loaded yet
+	const CollisionMesh *GetMesh(const char *path);	// Builds the model's collision mesh if it isn't built yet
+	// Loads (and if withMeshes is true builds the meshes of) the models that aren't loaded yet, in parallel
+	void Preload(const char *const *paths, int count, bool withMeshes, JobSystem &jobs);
+	int Count() const;					// Models loaded
+	void Clear();						// Deletes every model and mesh
+	ModelCache();						// Constructor
+	virtual ~ModelCache();				// Destructor
+
+private:
+	ModelCache(const ModelCache &);		// Not copyable, it owns the models
+	ModelCache &operator=(const ModelCache &);
+
+	std::map<std::string, Model_3DS *> models;
+	std::map<std::string, CollisionMesh *> meshes;
+};
+
+#endif // MODELCACHE_H
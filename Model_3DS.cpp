@@ -22,7 +22,7 @@
 //    the model
 //
 // Support for non-textured faces is done by reading the color
-// from the material's diffuse color.
+// from the material's diffuse color (a texel of the shared palette).
 //
 // Some models have problems loading even if you follow all of
 // the restrictions I have stated and I don't know why. If you
@@ -81,7 +81,9 @@
 // You need to uncomment this if you are using MFC
 #pragma warn( You need to uncomment this if you are using MFC )
 //#include "stdafx.h"
+#include <map>
 #include <string>
+#include <vector>
 #include "Model_3DS.h"
 
 #include <math.h>			// Header file for the math library
@@ -150,6 +152,12 @@ Model_3DS::Model_3DS()
 	// The model is visible by default
 	visible = true;
 
+	// The textures are made while loading by default
+	deferTextures = false;
+
+	// Not in a SceneBatcher's buffers yet
+	batchIndex = -1;
+
 	// Set up the default position
 	pos.x = 0.0f;
 	pos.y = 0.0f;
@@ -158,6 +166,9 @@ Model_3DS::Model_3DS()
 	rot.x = 0.0f;
 	rot.y = 0.0f;
 	rot.z = 0.0f;
+	// Nothing loaded yet so the bounds are empty
+	boundsMin.x = boundsMin.y = boundsMin.z = 0.0f;
+	boundsMax.x = boundsMax.y = boundsMax.z = 0.0f;
 
 	// Set up the path
 	path = new char[80];
@@ -166,6 +177,8 @@ Model_3DS::Model_3DS()
 	// Zero out our counters for MFC
 	numObjects = 0;
 	numMaterials = 0;
+	Materials = 0;
+	Objects = 0;
 
 	// Set the scale to one
 	scale = 1.0f;
@@ -173,7 +186,23 @@ Model_3DS::Model_3DS()
 
 Model_3DS::~Model_3DS()
 {
+	// Let go of the textures (the last model using one deletes it)
+	delete[] Materials;
+
+	for (int i = 0; i < numObjects; i++)
+	{
+		delete[] Objects[i].Vertexes;
+		delete[] Objects[i].Normals;
+		delete[] Objects[i].TexCoords;
+		delete[] Objects[i].Faces;
+
+		for (int j = 0; j < Objects[i].numMatFaces; j++)
+			delete[] Objects[i].MatFaces[j].subFaces;
+		delete[] Objects[i].MatFaces;
+	}
+	delete[] Objects;
 
+	delete[] path;
 }
 
 void Model_3DS::Load(char* name)
@@ -197,8 +226,9 @@ void Model_3DS::Load(char* name)
 		else
 			temp = strrchr(name, '\\');
 
-		// Allocate space for the path
-		path = new char[strlen(name) - strlen(temp) + 1];
+		// Allocate space for the path and its slash (in place of the empty one)
+		delete[] path;
+		path = new char[strlen(name) - strlen(temp) + 2];
 
 		// Get a pointer to the end of the path and name
 		char* src = name + strlen(name) - 1;
@@ -231,6 +261,9 @@ void Model_3DS::Load(char* name)
 	// Calculate the vertex normals
 	CalculateNormals();
 
+	// Find the box around the model so it can be culled
+	CalculateBounds();
+
 	// For future reference
 	modelname = name;
 
@@ -264,18 +297,178 @@ void Model_3DS::Load(char* name)
 		}
 	}
 
-	// Let's build simple colored textures for the materials w/o a texture
+	// The textures need GL, leave them for later if this isn't the GL thread
+	if (!deferTextures)
+		LoadTextures();
+}
+
+void Model_3DS::LoadTextures()
+{
 	for (int j = 0; j < numMaterials; j++)
 	{
+		// The texture named in the file
+		if (Materials[j].texFile[0])
+		{
+			Materials[j].tex = TextureManager::Shared().Load(Materials[j].texFile);
+
+			// Models whose textures were converted to bitmaps still name the originals,
+			// so if that file isn't there (or can't be read) try the bitmap beside it
+			char *ext = strrchr(Materials[j].texFile, '.');
+			if (!Materials[j].tex.Id() && ext && strlen(ext) == 4 && _stricmp(ext, ".bmp") != 0)
+			{
+				strcpy(ext, ".bmp");
+				Materials[j].tex = TextureManager::Shared().Load(Materials[j].texFile);
+			}
+			continue;
+		}
+
+		// The materials w/o a texture get their color's texel in the palette
 		if (Materials[j].textured == false)
 		{
 			unsigned char r = Materials[j].color.r;
 			unsigned char g = Materials[j].color.g;
 			unsigned char b = Materials[j].color.b;
-			Materials[j].tex.BuildColorTexture(r, g, b);
+			Materials[j].tex = TextureManager::Shared().PaletteColor(r, g, b, Materials[j].paletteU, Materials[j].paletteV);
 			Materials[j].textured = true;
 		}
 	}
+
+	// Every model's colors are in the same texture, so each object can draw them all at once
+	palette = TextureManager::Shared().Palette();
+	for (int i = 0; i < numObjects; i++)
+		MergeFlatFaces(i);
+}
+
+void Model_3DS::MergeFlatFaces(int objindex)
+{
+	Object &object = Objects[objindex];
+	object.paletteFaces = -1;
+
+	// The faces whose color is in the palette (it may have been full)
+	std::vector<bool> paletted(object.numMatFaces, false);
+	int flat = 0;
+	for (int j = 0; j < object.numMatFaces; j++)
+	{
+		Material &material = Materials[object.MatFaces[j].MatIndex];
+		paletted[j] = palette.Valid() && !material.texFile[0] && material.tex.Id() == palette.Id();
+		if (paletted[j])
+			flat++;
+	}
+	if (flat == 0)
+		return;
+
+	// Who each vertex's texture coordinates belong to: -1 nobody yet,
+	// -2 a face that isn't in the palette, otherwise the material of one that is
+	std::vector<int> owner(object.numVerts, -1);
+	for (int j = 0; j < object.numMatFaces; j++)
+	{
+		MaterialFaces &faces = object.MatFaces[j];
+		if (!paletted[j])
+		{
+			for (int f = 0; f < faces.numSubFaces; f++)
+				owner[faces.subFaces[f]] = -2;
+		}
+	}
+
+	std::vector<float> vertexes(object.Vertexes, object.Vertexes + object.numVerts * 3);
+	std::vector<float> normals(object.Normals, object.Normals + object.numVerts * 3);
+	std::vector<float> texCoords(object.numVerts * 2, 0.0f);
+	memcpy(&texCoords[0], object.TexCoords, (object.numTexCoords < object.numVerts ? object.numTexCoords : object.numVerts) * 2 * sizeof(float));
+	std::map<std::pair<int, int>, int> copies;		// (vertex, material) to its copy
+	std::vector<unsigned short> merged;
+
+	for (int j = 0; j < object.numMatFaces; j++)
+	{
+		MaterialFaces &faces = object.MatFaces[j];
+		if (!paletted[j])
+			continue;
+
+		Material &material = Materials[faces.MatIndex];
+		for (int f = 0; f < faces.numSubFaces; f++)
+		{
+			int vertex = faces.subFaces[f];
+			if (owner[vertex] == -1 || owner[vertex] == faces.MatIndex)
+			{
+				owner[vertex] = faces.MatIndex;
+			}
+			else
+			{
+				// Someone else's: a copy of it for this color
+				std::pair<int, int> key(vertex, faces.MatIndex);
+				std::map<std::pair<int, int>, int>::iterator it = copies.find(key);
+				if (it != copies.end())
+				{
+					vertex = it->second;
+				}
+				else
+				{
+					// The indices are 16 bits. If the copies don't fit the colors get solid color
+					// textures instead, which look the same wherever the coordinates point.
+					int copy = (int)vertexes.size() / 3;
+					if (copy > 65535)
+					{
+						for (int k = 0; k < object.numMatFaces; k++)
+						{
+							Material &other = Materials[object.MatFaces[k].MatIndex];
+							if (paletted[k])
+								other.tex = TextureManager::Shared().Color(other.color.r, other.color.g, other.color.b);
+						}
+						return;
+					}
+
+					vertexes.insert(vertexes.end(), vertexes.begin() + vertex * 3, vertexes.begin() + vertex * 3 + 3);
+					normals.insert(normals.end(), normals.begin() + vertex * 3, normals.begin() + vertex * 3 + 3);
+					texCoords.resize(texCoords.size() + 2);
+					copies[key] = copy;
+					vertex = copy;
+				}
+			}
+
+			texCoords[vertex * 2] = material.paletteU;
+			texCoords[vertex * 2 + 1] = material.paletteV;
+			merged.push_back((unsigned short)vertex);
+		}
+	}
+
+	// The new vertex arrays, if anything was copied
+	int numVerts = (int)vertexes.size() / 3;
+	if (numVerts != object.numVerts)
+	{
+		delete[] object.Vertexes;
+		delete[] object.Normals;
+		object.Vertexes = new float[numVerts * 3];
+		object.Normals = new float[numVerts * 3];
+		memcpy(object.Vertexes, &vertexes[0], numVerts * 3 * sizeof(float));
+		memcpy(object.Normals, &normals[0], numVerts * 3 * sizeof(float));
+		totalVerts += numVerts - object.numVerts;
+		object.numVerts = numVerts;
+	}
+	delete[] object.TexCoords;
+	object.TexCoords = new GLfloat[numVerts * 2];
+	memcpy(object.TexCoords, &texCoords[0], numVerts * 2 * sizeof(float));
+	object.numTexCoords = numVerts;
+	object.textured = true;
+
+	// The other faces as they were, then every paletted one together
+	MaterialFaces *matFaces = new MaterialFaces[object.numMatFaces - flat + 1];
+	int count = 0;
+	for (int j = 0; j < object.numMatFaces; j++)
+	{
+		if (!paletted[j])
+			matFaces[count++] = object.MatFaces[j];
+		else
+			delete[] object.MatFaces[j].subFaces;
+	}
+	matFaces[count].subFaces = new unsigned short[merged.size()];
+	memcpy(matFaces[count].subFaces, &merged[0], merged.size() * sizeof(unsigned short));
+	matFaces[count].numSubFaces = (int)merged.size();
+	matFaces[count].MatIndex = -1;
+	object.paletteFaces = count;
+	count++;
+
+	delete[] object.MatFaces;
+	object.MatFaces = matFaces;
+	object.numMatFaces = count;
 }
 
 void Model_3DS::Draw()
@@ -294,69 +487,91 @@ void Model_3DS::Draw()
 
 		glScalef(scale, scale, scale);
 
-		// Loop through the objects
-		for (int i = 0; i < numObjects; i++)
+		// The texture bound last, so faces of the same one don't bind it again
+		unsigned int bound = 0;
+		bool unbound = true;
+
+		// Every object's textured faces first, then every object's solid-colored ones,
+		// so the palette is only bound once
+		for (int pass = 0; pass < 2; pass++)
 		{
-			// Enable texture coordiantes, normals, and vertices arrays
-			if (Objects[i].textured)
-				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-			if (lit)
-				glEnableClientState(GL_NORMAL_ARRAY);
-			glEnableClientState(GL_VERTEX_ARRAY);
-
-			// Point them to the objects arrays
-			if (Objects[i].textured)
-				glTexCoordPointer(2, GL_FLOAT, 0, Objects[i].TexCoords);
-			if (lit)
-				glNormalPointer(GL_FLOAT, 0, Objects[i].Normals);
-			glVertexPointer(3, GL_FLOAT, 0, Objects[i].Vertexes);
-
-			// Loop through the faces as sorted by material and draw them
-			for (int j = 0; j < Objects[i].numMatFaces; j++)
+			// Loop through the objects
+			for (int i = 0; i < numObjects; i++)
 			{
-				// Use the material's texture
-				Materials[Objects[i].MatFaces[j].MatIndex].tex.Use();
+				if (pass == 1 && Objects[i].paletteFaces < 0)
+					continue;
+
+				// Enable texture coordiantes, normals, and vertices arrays
+				if (Objects[i].textured)
+					glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+				if (lit)
+					glEnableClientState(GL_NORMAL_ARRAY);
+				glEnableClientState(GL_VERTEX_ARRAY);
+
+				// Point them to the objects arrays
+				if (Objects[i].textured)
+					glTexCoordPointer(2, GL_FLOAT, 0, Objects[i].TexCoords);
+				if (lit)
+					glNormalPointer(GL_FLOAT, 0, Objects[i].Normals);
+				glVertexPointer(3, GL_FLOAT, 0, Objects[i].Vertexes);
+
+				// Loop through the faces as sorted by material and draw them
+				for (int j = 0; j < Objects[i].numMatFaces; j++)
+				{
+					if ((j == Objects[i].paletteFaces) != (pass == 1))
+						continue;
 
-				glPushMatrix();
+					// Use the material's texture (the palette for the solid-colored faces)
+					const TextureHandle &tex = j == Objects[i].paletteFaces ? palette : Materials[Objects[i].MatFaces[j].MatIndex].tex;
+					if (unbound || tex.Id() != bound)
+					{
+						tex.Use();
+						bound = tex.Id();
+						unbound = false;
+					}
 
-				// Move the model
-				glTranslatef(Objects[i].pos.x, Objects[i].pos.y, Objects[i].pos.z);
+					glPushMatrix();
 
-				glRotatef(Objects[i].rot.z, 0.0f, 0.0f, 1.0f);
-				glRotatef(Objects[i].rot.y, 0.0f, 1.0f, 0.0f);
-				glRotatef(Objects[i].rot.x, 1.0f, 0.0f, 0.0f);
+					// Move the model
+					glTranslatef(Objects[i].pos.x, Objects[i].pos.y, Objects[i].pos.z);
 
-				// Draw the faces using an index to the vertex array
-				glDrawElements(GL_TRIANGLES, Objects[i].MatFaces[j].numSubFaces, GL_UNSIGNED_SHORT, Objects[i].MatFaces[j].subFaces);
+					glRotatef(Objects[i].rot.z, 0.0f, 0.0f, 1.0f);
+					glRotatef(Objects[i].rot.y, 0.0f, 1.0f, 0.0f);
+					glRotatef(Objects[i].rot.x, 1.0f, 0.0f, 0.0f);
 
-				glPopMatrix();
-			}
+					// Draw the faces using an index to the vertex array
+					glDrawElements(GL_TRIANGLES, Objects[i].MatFaces[j].numSubFaces, GL_UNSIGNED_SHORT, Objects[i].MatFaces[j].subFaces);
 
-			// Show the normals?
-			if (shownormals)
-			{
-				// Loop through the vertices and normals and draw the normal
-				for (int k = 0; k < Objects[i].numVerts * 3; k += 3)
+					glPopMatrix();
+				}
+
+				// Show the normals?
+				if (shownormals && pass == 0)
 				{
-					// Disable texturing
-					glDisable(GL_TEXTURE_2D);
-					// Disbale lighting if the model is lit
-					if (lit)
-						glDisable(GL_LIGHTING);
-					// Draw the normals blue
-					glColor3f(0.0f, 0.0f, 1.0f);
-
-					// Draw a line between the vertex and the end of the normal
-					glBegin(GL_LINES);
-					glVertex3f(Objects[i].Vertexes[k], Objects[i].Vertexes[k + 1], Objects[i].Vertexes[k + 2]);
-					glVertex3f(Objects[i].Vertexes[k] + Objects[i].Normals[k], Objects[i].Vertexes[k + 1] + Objects[i].Normals[k + 1], Objects[i].Vertexes[k + 2] + Objects[i].Normals[k + 2]);
-					glEnd();
-
-					// Reset the color to white
-					glColor3f(1.0f, 1.0f, 1.0f);
-					// If the model is lit then renable lighting
-					if (lit)
-						glEnable(GL_LIGHTING);
+					// Loop through the vertices and normals and draw the normal
+					for (int k = 0; k < Objects[i].numVerts * 3; k += 3)
+					{
+						// Disable texturing
+						glDisable(GL_TEXTURE_2D);
+						unbound = true;
+						// Disbale lighting if the model is lit
+						if (lit)
+							glDisable(GL_LIGHTING);
+						// Draw the normals blue
+						glColor3f(0.0f, 0.0f, 1.0f);
+
+						// Draw a line between the vertex and the end of the normal
+						glBegin(GL_LINES);
+						glVertex3f(Objects[i].Vertexes[k], Objects[i].Vertexes[k + 1], Objects[i].Vertexes[k + 2]);
+						glVertex3f(Objects[i].Vertexes[k] + Objects[i].Normals[k], Objects[i].Vertexes[k + 1] + Objects[i].Normals[k + 1], Objects[i].Vertexes[k + 2] + Objects[i].Normals[k + 2]);
+						glEnd();
+
+						// Reset the color to white
+						glColor3f(1.0f, 1.0f, 1.0f);
+						// If the model is lit then renable lighting
+						if (lit)
+							glEnable(GL_LIGHTING);
+					}
 				}
 			}
 		}
@@ -396,6 +611,41 @@ void Model_3DS::CalculateNormals()
 	}
 }
 
+void Model_3DS::CalculateBounds()
+{
+	bool first = true;
+
+	boundsMin.x = boundsMin.y = boundsMin.z = 0.0f;
+	boundsMax.x = boundsMax.y = boundsMax.z = 0.0f;
+
+	// Grow the box around every vertex of every object
+	for (int i = 0; i < numObjects; i++)
+	{
+		for (int k = 0; k < Objects[i].numVerts * 3; k += 3)
+		{
+			float x = Objects[i].Vertexes[k] + Objects[i].pos.x;
+			float y = Objects[i].Vertexes[k + 1] + Objects[i].pos.y;
+			float z = Objects[i].Vertexes[k + 2] + Objects[i].pos.z;
+
+			if (first)
+			{
+				boundsMin.x = boundsMax.x = x;
+				boundsMin.y = boundsMax.y = y;
+				boundsMin.z = boundsMax.z = z;
+				first = false;
+				continue;
+			}
+
+			if (x < boundsMin.x) boundsMin.x = x;
+			if (y < boundsMin.y) boundsMin.y = y;
+			if (z < boundsMin.z) boundsMin.z = z;
+			if (x > boundsMax.x) boundsMax.x = x;
+			if (y > boundsMax.y) boundsMax.y = y;
+			if (z > boundsMax.z) boundsMax.z = z;
+		}
+	}
+}
+
 void Model_3DS::MainChunkProcessor(long length, long findex)
 {
 	ChunkHeader h;
@@ -468,7 +718,10 @@ void Model_3DS::EditChunkProcessor(long length, long findex)
 
 		// Material is set to untextured until we find otherwise
 		for (int d = 0; d < numMaterials; d++)
+		{
 			Materials[d].textured = false;
+			Materials[d].texFile[0] = 0;
+		}
 
 		fseek(bin3ds, findex, SEEK_SET);
 
@@ -500,7 +753,10 @@ void Model_3DS::EditChunkProcessor(long length, long findex)
 
 		// Set the textured variable to false until we find a texture
 		for (int k = 0; k < numObjects; k++)
+		{
 			Objects[k].textured = false;
+			Objects[k].paletteFaces = -1;
+		}
 
 		// Zero the objects position and rotation
 		for (int m = 0; m < numObjects; m++)
@@ -518,6 +774,17 @@ void Model_3DS::EditChunkProcessor(long length, long findex)
 		for (int n = 0; n < numObjects; n++)
 			Objects[n].numTexCoords = 0;
 
+		// Nothing allocated yet (an object without a mesh never gets its arrays)
+		for (int p = 0; p < numObjects; p++)
+		{
+			Objects[p].Vertexes = 0;
+			Objects[p].Normals = 0;
+			Objects[p].TexCoords = 0;
+			Objects[p].Faces = 0;
+			Objects[p].MatFaces = 0;
+			Objects[p].numMatFaces = 0;
+		}
+
 		fseek(bin3ds, findex, SEEK_SET);
 
 		int j = 0;
@@ -760,13 +1027,8 @@ void Model_3DS::MapNameChunkProcessor(long length, long findex, int matindex)
 		}
 	}
 
-	std::string n = name;
-	n.erase(n.end() - 3, n.end());
-	n += "bmp";
-	// Load the name and indicate that the material has a texture
-	char fullname[80];
-	sprintf(fullname, "%s%s", path, n.c_str());
-	Materials[matindex].tex.Load(fullname);
+	// Keep the name (LoadTextures() loads it) and indicate that the material has a texture
+	snprintf(Materials[matindex].texFile, sizeof(Materials[matindex].texFile), "%s%s", path, name);
 	Materials[matindex].textured = true;
 
 	// move the file pointer back to where we got it so
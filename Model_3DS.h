@@ -22,7 +22,12 @@
 //    the model
 //
 // Support for non-textured faces is done by reading the color
-// from the material's diffuse color.
+// from the material's diffuse color. Those colors are texels of
+// one palette texture every model shares (see TextureManager), and
+// LoadTextures() points the faces' texture coordinates at them, so
+// an object draws all of its solid-colored faces in one go. A vertex
+// one of them shares with a textured face (or a face of another
+// color) is copied first, so the two keep their own coordinates.
 //
 // Some models have problems loading even if you follow all of
 // the restrictions I have stated and I don't know why. If you
@@ -38,6 +43,12 @@
 // m.Load("model.3ds"); // Load the model
 // m.Draw();			// Renders the model to the screen
 //
+// // Loading on another thread: only reading the file is safe
+// // there, the textures have to be made on the GL thread
+// m.deferTextures = true;
+// m.Load("model.3ds");	// Any thread
+// m.LoadTextures();		// Later, on the GL thread
+//
 // // If you want to show the model's normals
 // m.shownormals = true;
 //
@@ -74,7 +85,8 @@
 // I decided to use my GLTexture class b/c adding all of its functions
 // Would have greatly bloated the model class's code
 // Just replace this with your favorite texture class
-#include "GLTexture.h"
+// (the textures are shared between models through the TextureManager)
+#include "TextureManager.h"
 
 #include <stdio.h>
 
@@ -108,9 +120,12 @@ public:
 	// TODO: add color support for non textured polys
 	struct Material {
 		char name[80];	// The material's name
-		GLTexture tex;	// The texture (this is the only outside reference in this class)
+		TextureHandle tex;	// The texture, shared with every other material using the same file or color
 		bool textured;	// whether or not it is textured
+		char texFile[80];	// The texture's file, empty if the material is just a color
 		Color4i color;
+		float paletteU;		// Where the color is in the palette (materials w/o a texFile)
+		float paletteV;
 	};
 
 	// Every chunk in the 3ds file starts with this struct
@@ -139,6 +154,7 @@ public:
 		int numTexCoords;			// The number of vertices
 		bool textured;				// True: the object has textures
 		MaterialFaces *MatFaces;	// The faces are divided by materials
+		int paletteFaces;			// The MatFaces with every solid-colored face (its MatIndex is -1), -1 if none
 		Vector pos;					// The position to move the object to
 		Vector rot;					// The angles to rotate the object
 	};
@@ -151,13 +167,19 @@ public:
 	int totalFaces;			// Total number of faces in the model
 	bool shownormals;		// True: show the normals
 	Material *Materials;	// The array of materials
+	TextureHandle palette;	// The colors of the materials w/o a texture, shared by every model
 	Object *Objects;		// The array of objects in the model
 	Vector pos;				// The position to move the model to
 	Vector rot;				// The angles to rotate the model
+	Vector boundsMin;		// The smallest corner of the box around all the vertices
+	Vector boundsMax;		// The largest corner of the box around all the vertices
 	float scale;			// The size you want the model scaled to
 	bool lit;				// True: the model is lit
 	bool visible;			// True: the model gets rendered
+	bool deferTextures;		// True: Load() leaves the textures to LoadTextures() (so it can run off the GL thread)
+	int batchIndex;			// Where SceneBatcher keeps the model, -1 until it's added
 	void Load(char *name);	// Loads a model
+	void LoadTextures();	// Makes the materials' textures (GL thread only)
 	void Draw();			// Draws the model
 	FILE *bin3ds;			// The binary 3ds file
 	Model_3DS();			// Constructor
@@ -198,6 +220,13 @@ private:
 	// Calculates the normals of the vertices by averaging
 	// the normals of the faces that use that vertex
 	void CalculateNormals();
+
+	// Finds the box that holds all of the model's vertices
+	void CalculateBounds();
+
+	// Points an object's solid-colored faces at their palette texels
+	// and draws them as one set of faces
+	void MergeFlatFaces(int objindex);
 };
 
 #endif MODEL_3DS_H
\ No newline at end of file
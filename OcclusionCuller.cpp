@@ -0,0 +1,438 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Software Occlusion Culler
+//
+// OcclusionCuller.cpp: implementation of the OcclusionCuller class.
+// See OcclusionCuller.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "OcclusionCuller.h"
+#include "Matrix4.h"
+
+#include <chrono>
+#include <emmintrin.h>	// SSE2
+#include <string.h>
+
+#define TILES_X		(OCCLUSION_WIDTH / OCCLUSION_TILE)
+#define TILES_Y		(OCCLUSION_HEIGHT / OCCLUSION_TILE)
+
+// Anything closer than this (in clip w) is treated as crossing the near plane
+#define OCCLUSION_NEAR_W	0.1f
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+OcclusionCuller::OcclusionCuller()
+{
+	enabled = true;
+	pending = false;
+	ready = false;
+	quit = false;
+
+	tested = 0;
+	rejected = 0;
+	testNanos = 0;
+	memset(&stats, 0, sizeof(stats));
+	memset(&drawn, 0, sizeof(drawn));
+	Mat4Identity(viewProj);
+
+	// Start empty so nothing is occluded until the first frame is drawn
+	for (int i = 0; i < OCCLUSION_WIDTH * OCCLUSION_HEIGHT; i++)
+		depth[i] = 1.0f;
+	for (int i = 0; i < TILES_X * TILES_Y; i++)
+		tiles[i] = 1.0f;
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+	if (worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+		}
+		wake.notify_one();
+		worker.join();
+	}
+}
+
+void OcclusionCuller::Begin(const std::vector<RenderItem> &items, const float *view, const float *proj)
+{
+	if (!enabled)
+		return;
+
+	// Don't touch the occluder list while the last frame is being drawn
+	Wait();
+
+	// Roll the counters of the last frame over (the raster thread's only now that it's done with them)
+	stats.occluders = drawn.occluders;
+	stats.triangles = drawn.triangles;
+	stats.rasterMs = drawn.rasterMs;
+	stats.tested = tested.exchange(0);
+	stats.rejected = rejected.exchange(0);
+	stats.testMs = testNanos.exchange(0) / 1000000.0;
+
+	Mat4Multiply(viewProj, proj, view);
+
+	// Gather the occluders and their clip matrices
+	occluders.clear();
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		if (!items[i].occluder || !items[i].model || !items[i].model->visible)
+			continue;
+
+		float matrix[16];
+		float world[16];
+		RenderQueue::ItemMatrix(items[i], matrix, world);
+
+		Occluder occ;
+		occ.model = items[i].model;
+		Mat4Multiply(occ.matrix, viewProj, world);
+		occluders.push_back(occ);
+	}
+
+	// Start the raster thread the first time we need it
+	if (!worker.joinable())
+		worker = std::thread(&OcclusionCuller::ThreadLoop, this);
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		ready = false;
+		pending = true;
+	}
+	wake.notify_one();
+}
+
+void OcclusionCuller::Wait()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [this] { return !pending; });
+}
+
+OcclusionCuller::Stats OcclusionCuller::GetStats()
+{
+	return stats;
+}
+
+void OcclusionCuller::ThreadLoop()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return quit || pending; });
+
+			if (quit)
+				return;
+		}
+
+		Rasterize();
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			pending = false;
+			ready = true;
+		}
+		done.notify_all();
+	}
+}
+
+void OcclusionCuller::Rasterize()
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	// Clear to the far plane
+	__m128 far4 = _mm_set1_ps(1.0f);
+	for (int i = 0; i < OCCLUSION_WIDTH * OCCLUSION_HEIGHT; i += 4)
+		_mm_store_ps(&depth[i], far4);
+
+	drawn.occluders = (int)occluders.size();
+	drawn.triangles = 0;
+
+	for (size_t i = 0; i < occluders.size(); i++)
+		DrawModel(occluders[i]);
+
+	BuildTiles();
+
+	drawn.rasterMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void OcclusionCuller::DrawModel(const Occluder &occ)
+{
+	Model_3DS *model = occ.model;
+
+	for (int i = 0; i < model->numObjects; i++)
+	{
+		Model_3DS::Object &obj = model->Objects[i];
+
+		// The same object transform Model_3DS::Draw() uses
+		float matrix[16];
+		memcpy(matrix, occ.matrix, sizeof(matrix));
+		Mat4Translate(matrix, obj.pos.x, obj.pos.y, obj.pos.z);
+		Mat4Rotate(matrix, obj.rot.z, 0.0f, 0.0f, 1.0f);
+		Mat4Rotate(matrix, obj.rot.y, 0.0f, 1.0f, 0.0f);
+		Mat4Rotate(matrix, obj.rot.x, 1.0f, 0.0f, 0.0f);
+
+		// Take every vertex to the screen once (x, y, depth, and 0 when it is behind the near plane)
+		screenVerts.resize(obj.numVerts * 4);
+		for (int v = 0; v < obj.numVerts; v++)
+		{
+			float x = obj.Vertexes[v * 3];
+			float y = obj.Vertexes[v * 3 + 1];
+			float z = obj.Vertexes[v * 3 + 2];
+
+			float cx = matrix[0] * x + matrix[4] * y + matrix[8] * z + matrix[12];
+			float cy = matrix[1] * x + matrix[5] * y + matrix[9] * z + matrix[13];
+			float cz = matrix[2] * x + matrix[6] * y + matrix[10] * z + matrix[14];
+			float cw = matrix[3] * x + matrix[7] * y + matrix[11] * z + matrix[15];
+
+			float *out = &screenVerts[v * 4];
+			if (cw < OCCLUSION_NEAR_W)
+			{
+				out[3] = 0.0f;
+				continue;
+			}
+
+			float inv = 1.0f / cw;
+			out[0] = (cx * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+			out[1] = (cy * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+			out[2] = cz * inv * 0.5f + 0.5f;
+			out[3] = 1.0f;
+		}
+
+		// Draw the faces, skipping the ones that cross the near plane
+		for (int f = 0; f < obj.numFaces; f += 3)
+		{
+			const float *a = &screenVerts[obj.Faces[f] * 4];
+			const float *b = &screenVerts[obj.Faces[f + 1] * 4];
+			const float *c = &screenVerts[obj.Faces[f + 2] * 4];
+
+			if (a[3] == 0.0f || b[3] == 0.0f || c[3] == 0.0f)
+				continue;
+
+			DrawTriangle(a, b, c);
+			drawn.triangles++;
+		}
+	}
+}
+
+void OcclusionCuller::DrawTriangle(const float *a, const float *b, const float *c)
+{
+	// Twice the signed area, skip the ones with no area
+	float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+	if (area > -1e-6f && area < 1e-6f)
+		return;
+
+	// The box of pixels the triangle touches
+	float minX = a[0] < b[0] ? a[0] : b[0];	minX = c[0] < minX ? c[0] : minX;
+	float maxX = a[0] > b[0] ? a[0] : b[0];	maxX = c[0] > maxX ? c[0] : maxX;
+	float minY = a[1] < b[1] ? a[1] : b[1];	minY = c[1] < minY ? c[1] : minY;
+	float maxY = a[1] > b[1] ? a[1] : b[1];	maxY = c[1] > maxY ? c[1] : maxY;
+
+	int x0 = (int)minX;
+	int x1 = (int)maxX + 1;
+	int y0 = (int)minY;
+	int y1 = (int)maxY + 1;
+
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > OCCLUSION_WIDTH) x1 = OCCLUSION_WIDTH;
+	if (y1 > OCCLUSION_HEIGHT) y1 = OCCLUSION_HEIGHT;
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	// Work 4 pixels at a time so start on a multiple of 4
+	x0 &= ~3;
+
+	// Edge functions e = A * x + B * y + C, flipped so the inside is positive for either winding
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+	float A0 = (b[1] - c[1]) * sign, B0 = (c[0] - b[0]) * sign, C0 = (b[0] * c[1] - b[1] * c[0]) * sign;
+	float A1 = (c[1] - a[1]) * sign, B1 = (a[0] - c[0]) * sign, C1 = (c[0] * a[1] - c[1] * a[0]) * sign;
+	float A2 = (a[1] - b[1]) * sign, B2 = (b[0] - a[0]) * sign, C2 = (a[0] * b[1] - a[1] * b[0]) * sign;
+
+	// Depth is linear in screen space: z = a + (e1 * (zb - za) + e2 * (zc - za)) / area
+	float invArea = 1.0f / (area * sign);
+	float dzB = (b[2] - a[2]) * invArea;
+	float dzC = (c[2] - a[2]) * invArea;
+	float zA = a[2];
+
+	// Per pixel steps of the depth
+	float zdx = A1 * dzB + A2 * dzC;
+	float zdy = B1 * dzB + B2 * dzC;
+	float zc = zA + C1 * dzB + C2 * dzC;
+
+	__m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 stepA0 = _mm_set1_ps(A0 * 4.0f);
+	__m128 stepA1 = _mm_set1_ps(A1 * 4.0f);
+	__m128 stepA2 = _mm_set1_ps(A2 * 4.0f);
+	__m128 stepZ = _mm_set1_ps(zdx * 4.0f);
+
+	for (int y = y0; y < y1; y++)
+	{
+		float py = y + 0.5f;
+		__m128 px = _mm_add_ps(_mm_set1_ps((float)x0), offsets);
+
+		// Edge values and depth at the first 4 pixels of the row
+		__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A0), px), _mm_set1_ps(B0 * py + C0));
+		__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A1), px), _mm_set1_ps(B1 * py + C1));
+		__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A2), px), _mm_set1_ps(B2 * py + C2));
+		__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zdx), px), _mm_set1_ps(zdy * py + zc));
+
+		float *row = &depth[y * OCCLUSION_WIDTH];
+
+		for (int x = x0; x < x1; x += 4)
+		{
+			// Inside when all 3 edges are positive
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+
+			if (_mm_movemask_ps(inside))
+			{
+				__m128 old = _mm_load_ps(&row[x]);
+				__m128 nearer = _mm_min_ps(old, z);
+				_mm_store_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+			}
+
+			e0 = _mm_add_ps(e0, stepA0);
+			e1 = _mm_add_ps(e1, stepA1);
+			e2 = _mm_add_ps(e2, stepA2);
+			z = _mm_add_ps(z, stepZ);
+		}
+	}
+}
+
+void OcclusionCuller::BuildTiles()
+{
+	for (int ty = 0; ty < TILES_Y; ty++)
+	{
+		for (int tx = 0; tx < TILES_X; tx++)
+		{
+			__m128 m = _mm_setzero_ps();
+
+			for (int y = 0; y < OCCLUSION_TILE; y++)
+			{
+				const float *row = &depth[(ty * OCCLUSION_TILE + y) * OCCLUSION_WIDTH + tx * OCCLUSION_TILE];
+				m = _mm_max_ps(m, _mm_load_ps(row));
+				m = _mm_max_ps(m, _mm_load_ps(row + 4));
+			}
+
+			// Fold the 4 lanes into one
+			m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+			m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+			_mm_store_ss(&tiles[ty * TILES_X + tx], m);
+		}
+	}
+}
+
+bool OcclusionCuller::IsOccluded(const float *world, const Model_3DS::Vector &bmin, const Model_3DS::Vector &bmax)
+{
+	if (!enabled || !ready)
+		return false;
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	float matrix[16];
+	Mat4Multiply(matrix, viewProj, world);
+
+	// Take the 8 corners of the box to the screen
+	float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1e30f;
+	bool crossesNear = false;
+
+	for (int i = 0; i < 8; i++)
+	{
+		float x = (i & 1) ? bmax.x : bmin.x;
+		float y = (i & 2) ? bmax.y : bmin.y;
+		float z = (i & 4) ? bmax.z : bmin.z;
+
+		float cx = matrix[0] * x + matrix[4] * y + matrix[8] * z + matrix[12];
+		float cy = matrix[1] * x + matrix[5] * y + matrix[9] * z + matrix[13];
+		float cz = matrix[2] * x + matrix[6] * y + matrix[10] * z + matrix[14];
+		float cw = matrix[3] * x + matrix[7] * y + matrix[11] * z + matrix[15];
+
+		if (cw < OCCLUSION_NEAR_W)
+		{
+			crossesNear = true;
+			break;
+		}
+
+		float inv = 1.0f / cw;
+		float sx = (cx * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		float sy = (cy * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		float sz = cz * inv * 0.5f + 0.5f;
+
+		if (sx < minX) minX = sx;
+		if (sx > maxX) maxX = sx;
+		if (sy < minY) minY = sy;
+		if (sy > maxY) maxY = sy;
+		if (sz < minZ) minZ = sz;
+	}
+
+	bool occluded = false;
+
+	// Boxes around the camera are always drawn
+	if (!crossesNear)
+	{
+		int x0 = (int)minX, x1 = (int)maxX + 1;
+		int y0 = (int)minY, y1 = (int)maxY + 1;
+
+		if (x0 < 0) x0 = 0;
+		if (y0 < 0) y0 = 0;
+		if (x1 > OCCLUSION_WIDTH) x1 = OCCLUSION_WIDTH;
+		if (y1 > OCCLUSION_HEIGHT) y1 = OCCLUSION_HEIGHT;
+
+		if (x0 < x1 && y0 < y1)
+		{
+			occluded = true;
+			__m128 nearest = _mm_set1_ps(minZ);
+
+			// Check the coarse tiles first, only go down to the pixels when a tile can't decide
+			for (int ty = y0 / OCCLUSION_TILE; occluded && ty <= (y1 - 1) / OCCLUSION_TILE; ty++)
+			{
+				for (int tx = x0 / OCCLUSION_TILE; occluded && tx <= (x1 - 1) / OCCLUSION_TILE; tx++)
+				{
+					// Everything in the tile is in front of the box
+					if (tiles[ty * TILES_X + tx] < minZ)
+						continue;
+
+					// Find the part of the tile the box covers
+					int px0 = tx * OCCLUSION_TILE;
+					int py0 = ty * OCCLUSION_TILE, py1 = py0 + OCCLUSION_TILE;
+					if (py0 < y0) py0 = y0;
+					if (py1 > y1) py1 = y1;
+
+					// Build a mask of the columns inside the box for each half of the tile
+					__m128 colsLo = _mm_castsi128_ps(_mm_setr_epi32(
+						px0 + 0 >= x0 && px0 + 0 < x1 ? -1 : 0, px0 + 1 >= x0 && px0 + 1 < x1 ? -1 : 0,
+						px0 + 2 >= x0 && px0 + 2 < x1 ? -1 : 0, px0 + 3 >= x0 && px0 + 3 < x1 ? -1 : 0));
+					__m128 colsHi = _mm_castsi128_ps(_mm_setr_epi32(
+						px0 + 4 >= x0 && px0 + 4 < x1 ? -1 : 0, px0 + 5 >= x0 && px0 + 5 < x1 ? -1 : 0,
+						px0 + 6 >= x0 && px0 + 6 < x1 ? -1 : 0, px0 + 7 >= x0 && px0 + 7 < x1 ? -1 : 0));
+
+					for (int py = py0; py < py1; py++)
+					{
+						const float *row = &depth[py * OCCLUSION_WIDTH + px0];
+
+						// Any covered pixel at or behind the box's nearest point means we can see the box
+						__m128 lo = _mm_and_ps(_mm_cmpge_ps(_mm_load_ps(row), nearest), colsLo);
+						__m128 hi = _mm_and_ps(_mm_cmpge_ps(_mm_load_ps(row + 4), nearest), colsHi);
+
+						if (_mm_movemask_ps(_mm_or_ps(lo, hi)))
+						{
+							occluded = false;
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	tested++;
+	if (occluded)
+		rejected++;
+	testNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return occluded;
+}
@@ -0,0 +1,108 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Software Occlusion Culler
+//
+// OcclusionCuller.h: interface for the OcclusionCuller class.
+// This class draws the big models that hide other things (the
+// cave and the large rocks) into a small depth buffer on the CPU
+// and then checks the boxes of everything else against it before
+// it is handed to OpenGL. Anything whose box is completely behind
+// what was drawn doesn't get drawn at all.
+//
+// The depth buffer is only 256x144 so drawing into it is cheap.
+// The rasterizer and the tests work on 4 pixels at a time with
+// SSE. After the occluders are drawn the buffer is reduced into
+// 8x8 tiles that hold the farthest depth in the tile, so most
+// boxes can be rejected (or accepted) by looking at a few tiles
+// and only the tiles on the edge need their pixels checked.
+//
+// The occluders are drawn on a thread of their own: Begin() hands
+// the work over and returns right away so the GL thread can get on
+// with the ground, the sky and the HUD. Wait() blocks until the
+// buffer is ready (RenderQueue::Build() calls it for you).
+//
+// Usage:
+// OcclusionCuller culler;
+//
+// culler.Begin(items, view, proj);	// Draws the items marked occluder
+// ...								// Other GL work
+// culler.Wait();
+// if (culler.IsOccluded(world, model->boundsMin, model->boundsMax))
+//		skip it
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include "RenderQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define OCCLUSION_WIDTH		256		// Width of the depth buffer (a multiple of the tile size)
+#define OCCLUSION_HEIGHT	144		// Height of the depth buffer (a multiple of the tile size)
+#define OCCLUSION_TILE		8		// Size of a tile of the coarse buffer
+
+class OcclusionCuller
+{
+public:
+	// Counters for the last frame
+	struct Stats {
+		int occluders;		// Models drawn into the buffer
+		int triangles;		// Triangles drawn into the buffer
+		int tested;			// Boxes tested
+		int rejected;		// Boxes found to be hidden
+		double rasterMs;	// Time spent drawing the occluders
+		double testMs;		// Time spent testing boxes (summed over the threads)
+	};
+
+	bool enabled;			// False: Begin() does nothing and nothing is occluded
+
+	// Starts drawing the items marked as occluders (returns right away)
+	void Begin(const std::vector<RenderItem> &items, const float *view, const float *proj);
+	void Wait();			// Blocks until the occluders are drawn
+	// True if the box (in model space) is hidden behind the occluders (call after Wait())
+	bool IsOccluded(const float *world, const Model_3DS::Vector &bmin, const Model_3DS::Vector &bmax);
+	Stats GetStats();		// The counters of the last frame
+	OcclusionCuller();		// Constructor
+	virtual ~OcclusionCuller();	// Destructor
+
+private:
+	// A model to draw into the buffer
+	struct Occluder {
+		Model_3DS *model;
+		float matrix[16];	// Model space to clip space
+	};
+
+	void ThreadLoop();		// What the raster thread runs
+	void Rasterize();		// Draws all the occluders and builds the tiles
+	void DrawModel(const Occluder &occ);	// Draws one occluder
+	void DrawTriangle(const float *a, const float *b, const float *c);	// Draws one triangle (screen x, y, depth)
+	void BuildTiles();		// Finds the farthest depth of every tile
+
+	alignas(16) float depth[OCCLUSION_WIDTH * OCCLUSION_HEIGHT];	// The depth buffer (0 near, 1 far)
+	alignas(16) float tiles[(OCCLUSION_WIDTH / OCCLUSION_TILE) * (OCCLUSION_HEIGHT / OCCLUSION_TILE)];	// Farthest depth of every tile
+	std::vector<Occluder> occluders;	// What to draw this frame
+	std::vector<float> screenVerts;		// Scratch space for the transformed vertices
+	float viewProj[16];		// World space to clip space
+
+	std::thread worker;		// The raster thread
+	std::mutex lock;
+	std::condition_variable wake;	// Signaled when there is a frame to draw
+	std::condition_variable done;	// Signaled when the frame is drawn
+	bool pending;			// True: the raster thread has a frame to draw
+	bool ready;				// True: the buffer holds the current frame
+	bool quit;				// True: the raster thread should exit
+
+	Stats stats;			// Only touched on the main thread
+	Stats drawn;			// Only touched on the raster thread (occluders, triangles and rasterMs), read by Begin() after Wait()
+	std::atomic<int> tested;
+	std::atomic<int> rejected;
+	std::atomic<long long> testNanos;
+};
+
+#endif // OCCLUSIONCULLER_H
@@ -0,0 +1,373 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Particle System
+//
+// ParticleSystem.cpp: implementation of the ParticleSystem class.
+// See ParticleSystem.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "ParticleSystem.h"
+
+#include <emmintrin.h>	// SSE2
+#include <math.h>
+#include <string.h>
+
+#define SPRITE_SIZE	32		// Width and height of the dot texture
+
+// How one type of particle moves and looks
+struct ParticleLook {
+	float gravity;		// Units per second per second (negative pulls down)
+	float drag;			// Fraction of the speed lost per second
+	float life;			// Seconds a particle lasts (each gets between half and all of it)
+	float speed;		// How fast they fly out
+	float rise;			// Extra upward speed
+	float size;			// Point size in pixels
+	unsigned char r, g, b;
+	int burst;			// Particles in Emit()'s usual burst
+};
+
+static const ParticleLook looks[PARTICLE_TYPE_COUNT] = {
+	{ -2.0f, 0.8f, 1.2f, 1.5f, 2.5f, 6.0f, 120, 180, 255, 60 },	// PARTICLE_PICKUP
+	{ -9.8f, 1.5f, 0.6f, 4.0f, 1.0f, 5.0f, 255, 60, 30, 40 },	// PARTICLE_HIT
+	{ -6.0f, 3.0f, 0.8f, 1.2f, 1.5f, 8.0f, 200, 170, 110, 24 },	// PARTICLE_DUST
+};
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+ParticleSystem::ParticleSystem()
+{
+	capacity = 0;
+	random = 0x2545F491u;
+	spriteTexture = 0;
+	pointSprites = false;
+
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+		pools[t].count = 0;
+}
+
+ParticleSystem::~ParticleSystem()
+{
+
+}
+
+void ParticleSystem::Reserve(int perType)
+{
+	capacity = perType;
+
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+	{
+		Pool &pool = pools[t];
+		pool.x.resize(perType);
+		pool.y.resize(perType);
+		pool.z.resize(perType);
+		pool.vx.resize(perType);
+		pool.vy.resize(perType);
+		pool.vz.resize(perType);
+		pool.life.resize(perType);
+		pool.vertices.resize(perType * 3);
+		pool.colors.resize(perType * 4);
+		if (pool.count > perType)
+			pool.count = perType;
+	}
+}
+
+bool ParticleSystem::InitGL()
+{
+	// A white dot that fades out toward its edge, the color comes from the vertices
+	unsigned char data[SPRITE_SIZE * SPRITE_SIZE * 2];
+	for (int y = 0; y < SPRITE_SIZE; y++)
+	{
+		for (int x = 0; x < SPRITE_SIZE; x++)
+		{
+			float dx = (x + 0.5f) / SPRITE_SIZE * 2.0f - 1.0f;
+			float dy = (y + 0.5f) / SPRITE_SIZE * 2.0f - 1.0f;
+			float fade = 1.0f - sqrtf(dx * dx + dy * dy);
+			if (fade < 0.0f)
+				fade = 0.0f;
+
+			data[(y * SPRITE_SIZE + x) * 2] = 255;
+			data[(y * SPRITE_SIZE + x) * 2 + 1] = (unsigned char)(fade * fade * 255.0f);
+		}
+	}
+
+	glGenTextures(1, &spriteTexture);
+	glBindTexture(GL_TEXTURE_2D, spriteTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, SPRITE_SIZE, SPRITE_SIZE, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, data);
+
+	pointSprites = GLEW_VERSION_2_0 != 0;
+	return pointSprites;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Simulation
+//////////////////////////////////////////////////////////////////////
+
+float ParticleSystem::Random()
+{
+	random ^= random << 13;
+	random ^= random >> 17;
+	random ^= random << 5;
+	return (random >> 8) * (1.0f / 16777216.0f);
+}
+
+void ParticleSystem::Emit(ParticleType type, float x, float y, float z, int count)
+{
+	const ParticleLook &look = looks[type];
+	Pool &pool = pools[type];
+
+	if (count <= 0)
+		count = look.burst;
+	if (count > capacity - pool.count)
+		count = capacity - pool.count;
+
+	for (int n = 0; n < count; n++)
+	{
+		// A random direction, flattened a little so the bursts spread out more than up
+		float dx = Random() * 2.0f - 1.0f;
+		float dy = Random() * 2.0f - 1.0f;
+		float dz = Random() * 2.0f - 1.0f;
+		float length = sqrtf(dx * dx + dy * dy + dz * dz) + 0.001f;
+		float speed = look.speed * (0.5f + 0.5f * Random()) / length;
+
+		int i = pool.count++;
+		pool.x[i] = x;
+		pool.y[i] = y;
+		pool.z[i] = z;
+		pool.vx[i] = dx * speed;
+		pool.vy[i] = dy * speed * 0.5f + look.rise;
+		pool.vz[i] = dz * speed;
+		pool.life[i] = look.life * (0.5f + 0.5f * Random());
+	}
+}
+
+void ParticleSystem::Update(float dt)
+{
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+		UpdatePool(pools[t], looks[t], dt);
+}
+
+void ParticleSystem::UpdatePool(Pool &pool, const ParticleLook &look, float dt)
+{
+	float keep = 1.0f - look.drag * dt;
+	if (keep < 0.0f)
+		keep = 0.0f;
+
+	float *x = pool.x.data(), *y = pool.y.data(), *z = pool.z.data();
+	float *vx = pool.vx.data(), *vy = pool.vy.data(), *vz = pool.vz.data();
+	float *life = pool.life.data();
+
+	__m128 dt4 = _mm_set1_ps(dt);
+	__m128 fall = _mm_set1_ps(look.gravity * dt);
+	__m128 keep4 = _mm_set1_ps(keep);
+	__m128 zero = _mm_setzero_ps();
+
+	// Survivors are written back at out, which never gets ahead of the block being read
+	int out = 0;
+	int i = 0;
+	for (; i + 4 <= pool.count; i += 4)
+	{
+		__m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+		__m128 sx = _mm_loadu_ps(vx + i), sy = _mm_loadu_ps(vy + i), sz = _mm_loadu_ps(vz + i);
+		__m128 left = _mm_sub_ps(_mm_loadu_ps(life + i), dt4);
+
+		sx = _mm_mul_ps(sx, keep4);
+		sy = _mm_add_ps(_mm_mul_ps(sy, keep4), fall);
+		sz = _mm_mul_ps(sz, keep4);
+		px = _mm_add_ps(px, _mm_mul_ps(sx, dt4));
+		py = _mm_add_ps(py, _mm_mul_ps(sy, dt4));
+		pz = _mm_add_ps(pz, _mm_mul_ps(sz, dt4));
+
+		// Nothing falls through the ground, it lands and stays there
+		__m128 landed = _mm_cmplt_ps(py, zero);
+		py = _mm_max_ps(py, zero);
+		sx = _mm_andnot_ps(landed, sx);
+		sy = _mm_andnot_ps(landed, sy);
+		sz = _mm_andnot_ps(landed, sz);
+
+		int alive = _mm_movemask_ps(_mm_cmpgt_ps(left, zero));
+		if (alive == 0xF)
+		{
+			// The usual case, the whole block lives
+			_mm_storeu_ps(x + out, px); _mm_storeu_ps(y + out, py); _mm_storeu_ps(z + out, pz);
+			_mm_storeu_ps(vx + out, sx); _mm_storeu_ps(vy + out, sy); _mm_storeu_ps(vz + out, sz);
+			_mm_storeu_ps(life + out, left);
+			out += 4;
+		}
+		else if (alive)
+		{
+			float bx[4], by[4], bz[4], bvx[4], bvy[4], bvz[4], bl[4];
+			_mm_storeu_ps(bx, px); _mm_storeu_ps(by, py); _mm_storeu_ps(bz, pz);
+			_mm_storeu_ps(bvx, sx); _mm_storeu_ps(bvy, sy); _mm_storeu_ps(bvz, sz);
+			_mm_storeu_ps(bl, left);
+
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (!(alive & (1 << lane)))
+					continue;
+
+				x[out] = bx[lane]; y[out] = by[lane]; z[out] = bz[lane];
+				vx[out] = bvx[lane]; vy[out] = bvy[lane]; vz[out] = bvz[lane];
+				life[out] = bl[lane];
+				out++;
+			}
+		}
+	}
+
+	// The ones left over
+	for (; i < pool.count; i++)
+	{
+		float left = life[i] - dt;
+		if (left <= 0.0f)
+			continue;
+
+		float sx = vx[i] * keep, sy = vy[i] * keep + look.gravity * dt, sz = vz[i] * keep;
+		float px = x[i] + sx * dt, py = y[i] + sy * dt, pz = z[i] + sz * dt;
+		if (py < 0.0f)
+		{
+			py = 0.0f;
+			sx = sy = sz = 0.0f;
+		}
+
+		x[out] = px; y[out] = py; z[out] = pz;
+		vx[out] = sx; vy[out] = sy; vz[out] = sz;
+		life[out] = left;
+		out++;
+	}
+
+	pool.count = out;
+}
+
+void ParticleSystem::Clear()
+{
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+		pools[t].count = 0;
+}
+
+int ParticleSystem::Count(ParticleType type) const
+{
+	return pools[type].count;
+}
+
+int ParticleSystem::Count() const
+{
+	int count = 0;
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+		count += pools[t].count;
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Drawing
+//////////////////////////////////////////////////////////////////////
+
+int ParticleSystem::PackVertices(ParticleType type)
+{
+	const ParticleLook &look = looks[type];
+	Pool &pool = pools[type];
+
+	// Fade out over the last third of the longest life
+	float fade = 255.0f * 3.0f / look.life;
+
+	float *vertices = pool.vertices.data();
+	unsigned char *colors = pool.colors.data();
+
+	__m128 fade4 = _mm_set1_ps(fade);
+	__m128 opaque = _mm_set1_ps(255.0f);
+	__m128i rgb = _mm_set1_epi32(look.r | (look.g << 8) | (look.b << 16));
+
+	int i = 0;
+	for (; i + 4 <= pool.count; i += 4)
+	{
+		// Four particles' x, y and z turned into x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+		__m128 px = _mm_loadu_ps(&pool.x[i]);
+		__m128 py = _mm_loadu_ps(&pool.y[i]);
+		__m128 pz = _mm_loadu_ps(&pool.z[i]);
+		__m128 xyLow = _mm_unpacklo_ps(px, py);		// x0 y0 x1 y1
+		__m128 xyHigh = _mm_unpackhi_ps(px, py);	// x2 y2 x3 y3
+		__m128 t0 = _mm_shuffle_ps(pz, xyLow, _MM_SHUFFLE(2, 2, 0, 0));		// z0 z0 x1 x1
+		__m128 t1 = _mm_shuffle_ps(xyLow, pz, _MM_SHUFFLE(1, 1, 3, 3));		// y1 y1 z1 z1
+		__m128 t2 = _mm_shuffle_ps(pz, xyHigh, _MM_SHUFFLE(3, 2, 3, 2));	// z2 z3 x3 y3
+		_mm_storeu_ps(vertices + i * 3, _mm_shuffle_ps(xyLow, t0, _MM_SHUFFLE(2, 0, 1, 0)));
+		_mm_storeu_ps(vertices + i * 3 + 4, _mm_shuffle_ps(t1, xyHigh, _MM_SHUFFLE(1, 0, 2, 0)));
+		_mm_storeu_ps(vertices + i * 3 + 8, _mm_shuffle_ps(t2, t2, _MM_SHUFFLE(1, 3, 2, 0)));
+
+		// The type's color with the alpha in the top byte
+		__m128 alpha = _mm_min_ps(_mm_mul_ps(_mm_loadu_ps(&pool.life[i]), fade4), opaque);
+		__m128i rgba = _mm_or_si128(rgb, _mm_slli_epi32(_mm_cvttps_epi32(alpha), 24));
+		_mm_storeu_si128((__m128i *)(colors + i * 4), rgba);
+	}
+
+	// The ones left over
+	for (; i < pool.count; i++)
+	{
+		vertices[i * 3] = pool.x[i];
+		vertices[i * 3 + 1] = pool.y[i];
+		vertices[i * 3 + 2] = pool.z[i];
+
+		float alpha = pool.life[i] * fade;
+		colors[i * 4] = look.r;
+		colors[i * 4 + 1] = look.g;
+		colors[i * 4 + 2] = look.b;
+		colors[i * 4 + 3] = (unsigned char)(alpha < 255.0f ? alpha : 255.0f);
+	}
+
+	return pool.count;
+}
+
+void ParticleSystem::Draw()
+{
+	if (Count() == 0)
+		return;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_POINT_BIT | GL_TEXTURE_BIT);
+
+	// Glowing, so they add up instead of covering each other, and never hide what is behind them
+	glDisable(GL_LIGHTING);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	glDepthMask(GL_FALSE);
+
+	if (pointSprites)
+	{
+		// Smaller further away: 1 / sqrt(1 + 0.01 d^2), so about 0.7 of its size 10 units off and 0.3 at 30
+		GLfloat attenuation[] = { 1.0f, 0.0f, 0.01f };
+		glPointParameterfv(GL_POINT_DISTANCE_ATTENUATION, attenuation);
+
+		glEnable(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, spriteTexture);
+		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+		glEnable(GL_POINT_SPRITE);
+		glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+	}
+	else
+	{
+		glDisable(GL_TEXTURE_2D);
+		glEnable(GL_POINT_SMOOTH);
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++)
+	{
+		int count = PackVertices((ParticleType)t);
+		if (count == 0)
+			continue;
+
+		glPointSize(looks[t].size);
+		glVertexPointer(3, GL_FLOAT, 0, pools[t].vertices.data());
+		glColorPointer(4, GL_UNSIGNED_BYTE, 0, pools[t].colors.data());
+		glDrawArrays(GL_POINTS, 0, count);
+	}
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	glPopAttrib();
+	glColor3f(1.0f, 1.0f, 1.0f);
+}
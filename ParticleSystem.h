@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Particle System
+//
+// ParticleSystem.h: interface for the ParticleSystem class.
+// Picking something up or running into a snake used to just play
+// a sound. This class throws out bursts of small glowing points
+// instead: sparkles over a pickup, a red puff when something hits
+// the player and a bit of sand when the player jumps.
+//
+// Every type of particle has its own pool, and a pool keeps each
+// value (x, y, z, the velocity and the time left) in its own array
+// so Update() can move four particles at a time with SSE. The same
+// pass drops the particles that ran out of time by sliding the live
+// ones down over them, so the live ones are always the first Count()
+// of every array and nothing is ever allocated after Reserve().
+//
+// Draw() packs a pool's positions and fading colors into one vertex
+// array and draws the whole pool with a single glDrawArrays of
+// point sprites (GL 2.0), or plain round points on cards without
+// them. Particles are only drawn, the game never reads them back,
+// so they have their own random numbers and don't disturb the
+// seeded ones a replay depends on.
+//
+// Usage:
+// ParticleSystem particles;
+//
+// particles.Reserve(20000);					// Room per type
+// particles.InitGL();							// Once, after glewInit()
+//
+// particles.Emit(PARTICLE_PICKUP, x, y, z);	// The type's usual burst
+// particles.Update(1.0f / 60.0f);				// Every tick
+// particles.Draw();							// After the scene, GL thread only
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef PARTICLESYSTEM_H
+#define PARTICLESYSTEM_H
+
+#include "glew.h"
+
+#include <vector>
+
+// The kinds of effect, each drawn with one call
+enum ParticleType {
+	PARTICLE_PICKUP,	// Blue sparkles rising off a collected bottle or diamond
+	PARTICLE_HIT,		// A red burst when a snake or rock hits the player
+	PARTICLE_DUST,		// Sand kicked up by a jump
+	PARTICLE_TYPE_COUNT
+};
+
+struct ParticleLook;	// How a type moves and looks (see ParticleSystem.cpp)
+
+class ParticleSystem
+{
+public:
+	void Reserve(int perType);			// Most live particles of each type (more are dropped)
+	bool InitGL();						// Makes the sprite texture (needs a GL context), false without point sprites
+
+	// Throws out count particles (0: the type's usual burst) from a point
+	void Emit(ParticleType type, float x, float y, float z, int count = 0);
+	void Update(float dt);				// Moves every particle and drops the ones that ran out of time
+	void Draw();						// One draw call per type that has any particles
+	// Fills a type's vertex array (Draw() does this), how many vertices it holds
+	int PackVertices(ParticleType type);
+	void Clear();						// Drops every particle
+
+	int Count(ParticleType type) const;	// Live particles of a type
+	int Count() const;					// Live particles of every type
+
+	ParticleSystem();					// Constructor
+	virtual ~ParticleSystem();			// Destructor
+
+private:
+	// One type's particles, side by side
+	struct Pool {
+		std::vector<float> x, y, z;
+		std::vector<float> vx, vy, vz;
+		std::vector<float> life;		// Seconds left
+		int count;						// The live ones are [0, count)
+		std::vector<float> vertices;	// xyz of every live particle, for glVertexPointer
+		std::vector<unsigned char> colors;	// rgba of every live particle
+	};
+
+	void UpdatePool(Pool &pool, const ParticleLook &look, float dt);
+	float Random();						// 0..1
+
+	Pool pools[PARTICLE_TYPE_COUNT];
+	int capacity;
+	unsigned int random;				// The particles' own random numbers (xorshift)
+	GLuint spriteTexture;				// A soft round dot
+	bool pointSprites;					// True: the card has GL 2.0 point sprites
+};
+
+#endif // PARTICLESYSTEM_H
@@ -0,0 +1,311 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Render Queue
+//
+// RenderQueue.cpp: implementation of the RenderQueue class.
+// See RenderQueue.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "RenderQueue.h"
+#include "Matrix4.h"
+#include "OcclusionCuller.h"
+#include "SceneBatcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+RenderQueue::RenderQueue()
+{
+	lodPixels = 48.0f;
+	minPixels = 1.5f;
+	grain = 64;
+	pixelScale = 1.0f;
+	occluder = 0;
+
+	memset(&stats, 0, sizeof(stats));
+	memset(planes, 0, sizeof(planes));
+	Mat4Identity(viewMatrix);
+}
+
+RenderQueue::~RenderQueue()
+{
+
+}
+
+const std::vector<RenderCommand> &RenderQueue::Commands() const
+{
+	return merged;
+}
+
+void RenderQueue::ExtractFrustum(const float *view, const float *proj)
+{
+	float clip[16];
+	Mat4Multiply(clip, proj, view);
+
+	// The planes are the sums and differences of the 4th row and the other rows
+	for (int i = 0; i < 3; i++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			planes[i * 2][k] = clip[k * 4 + 3] + clip[k * 4 + i];
+			planes[i * 2 + 1][k] = clip[k * 4 + 3] - clip[k * 4 + i];
+		}
+	}
+
+	// Normalize them so the distance to a plane comes out in world units
+	for (int i = 0; i < 6; i++)
+	{
+		float len = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		if (len == 0.0f)
+			continue;
+
+		for (int k = 0; k < 4; k++)
+			planes[i][k] /= len;
+	}
+}
+
+void RenderQueue::ItemMatrix(const RenderItem &item, float *matrix, float *world)
+{
+	Model_3DS *model = item.model;
+
+	// Same order as the glTranslatef/glRotatef/glScalef calls in GameObject::draw()
+	Mat4Identity(matrix);
+	Mat4Translate(matrix, item.x, item.y, item.z);
+	Mat4Rotate(matrix, item.yaw, 0.0f, 1.0f, 0.0f);
+	Mat4Scale(matrix, item.scale, item.scale, item.scale);
+	Mat4Rotate(matrix, item.tiltX, 1.0f, 0.0f, 0.0f);
+	if (item.pivot)
+		Mat4Apply(matrix, item.pivot);
+
+	// Model_3DS::Draw() moves, rotates and scales the model on its own as well
+	memcpy(world, matrix, sizeof(float) * 16);
+	Mat4Translate(world, model->pos.x, model->pos.y, model->pos.z);
+	Mat4Rotate(world, model->rot.x, 1.0f, 0.0f, 0.0f);
+	Mat4Rotate(world, model->rot.y, 0.0f, 1.0f, 0.0f);
+	Mat4Rotate(world, model->rot.z, 0.0f, 0.0f, 1.0f);
+	Mat4Scale(world, model->scale, model->scale, model->scale);
+}
+
+bool RenderQueue::BuildCommand(const RenderItem &item, RenderCommand &cmd, int &culledBy)
+{
+	Model_3DS *model = item.model;
+
+	float world[16];
+	ItemMatrix(item, cmd.matrix, world);
+
+	// Put a sphere around the model's box
+	float cx = (model->boundsMin.x + model->boundsMax.x) * 0.5f;
+	float cy = (model->boundsMin.y + model->boundsMax.y) * 0.5f;
+	float cz = (model->boundsMin.z + model->boundsMax.z) * 0.5f;
+	float ex = (model->boundsMax.x - model->boundsMin.x) * 0.5f;
+	float ey = (model->boundsMax.y - model->boundsMin.y) * 0.5f;
+	float ez = (model->boundsMax.z - model->boundsMin.z) * 0.5f;
+
+	float center[3];
+	Mat4TransformPoint(world, cx, cy, cz, center);
+	float radius = Mat4MaxScale(world) * sqrtf(ex * ex + ey * ey + ez * ez);
+
+	// Frustum cull
+	for (int i = 0; i < 6; i++)
+	{
+		float d = planes[i][0] * center[0] + planes[i][1] * center[1] + planes[i][2] * center[2] + planes[i][3];
+		if (d < -radius)
+		{
+			culledBy = 1;
+			return false;
+		}
+	}
+
+	// Distance from the camera (the camera looks down -z)
+	float eye[3];
+	Mat4TransformPoint(viewMatrix, center[0], center[1], center[2], eye);
+	float depth = -eye[2];
+
+	// Pick the level of detail from the size on screen
+	cmd.lod = 0;
+	if (depth > radius)
+	{
+		float pixels = radius / depth * pixelScale;
+
+		if (pixels < minPixels)
+		{
+			culledBy = 2;
+			return false;
+		}
+
+		if (pixels < lodPixels)
+			cmd.lod = 1;
+	}
+
+	// Hidden behind the cave or the rocks (they can't hide themselves)
+	if (occluder && !item.occluder && occluder->IsOccluded(world, model->boundsMin, model->boundsMax))
+	{
+		culledBy = 3;
+		return false;
+	}
+
+	// Sort by texture first then front to back (a positive float's bits sort like the float)
+	unsigned long long state = 0;
+	if (model->numMaterials > 0)
+		state = model->Materials[0].tex.Id() & 0x7FFFFFFF;
+
+	if (depth < 0.0f)
+		depth = 0.0f;
+
+	unsigned int depthBits;
+	memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	cmd.key = (state << 32) | depthBits;
+	cmd.model = model;
+
+	return true;
+}
+
+void RenderQueue::Build(const std::vector<RenderItem> &items, const float *view, const float *proj, int viewportHeight, JobSystem &jobs, OcclusionCuller *occlusion)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	int numThreads = jobs.NumThreads();
+
+	// Keep the old lists around so their memory gets reused
+	if ((int)threadLists.size() < numThreads)
+	{
+		threadLists.resize(numThreads);
+		threadFrustumCulled.resize(numThreads);
+		threadDetailCulled.resize(numThreads);
+		threadOcclusionCulled.resize(numThreads);
+	}
+
+	for (size_t t = 0; t < threadLists.size(); t++)
+	{
+		threadLists[t].clear();
+		threadFrustumCulled[t] = 0;
+		threadDetailCulled[t] = 0;
+		threadOcclusionCulled[t] = 0;
+	}
+
+	ExtractFrustum(view, proj);
+	memcpy(viewMatrix, view, sizeof(viewMatrix));
+
+	// proj[5] is cot(fovy / 2), half the viewport is that many pixels at a distance of 1
+	pixelScale = proj[5] * viewportHeight * 0.5f;
+
+	// The occluders have to be drawn before anything can be tested against them
+	occluder = occlusion;
+	if (occluder)
+		occluder->Wait();
+
+	// Transform, cull, pick the detail and make the key for every item
+	jobs.ParallelFor((int)items.size(), grain, [&](int begin, int end, int thread) {
+		std::vector<RenderCommand> &list = threadLists[thread];
+		RenderCommand cmd;
+
+		for (int i = begin; i < end; i++)
+		{
+			if (!items[i].model || !items[i].model->visible)
+				continue;
+
+			int culledBy = 0;
+			if (BuildCommand(items[i], cmd, culledBy))
+				list.push_back(cmd);
+			else if (culledBy == 1)
+				threadFrustumCulled[thread]++;
+			else if (culledBy == 2)
+				threadDetailCulled[thread]++;
+			else
+				threadOcclusionCulled[thread]++;
+		}
+	});
+
+	// Sort every thread's list on its own
+	jobs.ParallelFor(numThreads, 1, [&](int begin, int end, int thread) {
+		for (int t = begin; t < end; t++)
+		{
+			std::sort(threadLists[t].begin(), threadLists[t].end(),
+				[](const RenderCommand &a, const RenderCommand &b) { return a.key < b.key; });
+		}
+	});
+
+	Merge();
+
+	stats.items = (int)items.size();
+	stats.frustumCulled = 0;
+	stats.detailCulled = 0;
+	stats.occlusionCulled = 0;
+	for (int t = 0; t < numThreads; t++)
+	{
+		stats.frustumCulled += threadFrustumCulled[t];
+		stats.detailCulled += threadDetailCulled[t];
+		stats.occlusionCulled += threadOcclusionCulled[t];
+	}
+	stats.submitted = (int)merged.size();
+	stats.threads = numThreads;
+	stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void RenderQueue::Merge()
+{
+	size_t total = 0;
+	for (size_t t = 0; t < threadLists.size(); t++)
+		total += threadLists[t].size();
+
+	merged.clear();
+	merged.reserve(total);
+
+	heads.assign(threadLists.size(), 0);
+
+	// There are only a handful of lists so just pick the smallest head every time
+	for (size_t n = 0; n < total; n++)
+	{
+		int best = -1;
+
+		for (size_t t = 0; t < threadLists.size(); t++)
+		{
+			if (heads[t] == threadLists[t].size())
+				continue;
+
+			if (best < 0 || threadLists[t][heads[t]].key < threadLists[best][heads[best]].key)
+				best = (int)t;
+		}
+
+		merged.push_back(threadLists[best][heads[best]]);
+		heads[best]++;
+	}
+}
+
+void RenderQueue::Submit(SceneBatcher *batcher)
+{
+	stats.batched = 0;
+	stats.drawCalls = 0;
+
+	// The batcher takes what it can, the rest is drawn one model at a time
+	if (batcher)
+	{
+		batcher->Submit(merged, batched);
+		stats.batched = batcher->stats.commands;
+		stats.drawCalls = batcher->stats.drawCalls;
+	}
+
+	for (size_t i = 0; i < merged.size(); i++)
+	{
+		if (batcher && batched[i])
+			continue;
+
+		// Draw() makes a call per material of every object
+		Model_3DS *model = merged[i].model;
+		for (int j = 0; model->visible && j < model->numObjects; j++)
+			stats.drawCalls += model->Objects[j].numMatFaces;
+
+		glPushMatrix();
+		glMultMatrixf(merged[i].matrix);
+		merged[i].model->Draw();
+		glPopMatrix();
+	}
+}
@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Render Queue
+//
+// RenderQueue.h: interface for the RenderQueue class.
+// This class turns the list of things the game wants drawn
+// this frame into a sorted list of draw commands. All of the
+// per object CPU work (building the transform, frustum culling,
+// picking the level of detail and making the sort key) is split
+// across the JobSystem. Every thread writes into its own command
+// list so nothing is shared while the jobs run. The lists are then
+// sorted (also in parallel) and merged on the GL thread, which is
+// the only thread that ever touches OpenGL.
+//
+// The game describes an object with a RenderItem: the model and
+// the same position/rotation/scale that GameObject::draw() used
+// to feed to glTranslatef/glRotatef/glScalef.
+//
+// Commands are sorted by texture first so objects sharing a model
+// are drawn back to back, and front to back inside that so the
+// depth test throws away as many hidden pixels as it can.
+//
+// Usage:
+// RenderQueue queue;
+// std::vector<RenderItem> items;
+//
+// items.push_back(item);					// Fill in what to draw
+// queue.Build(items, view, proj, HEIGHT, jobs, 0);	// Transform, cull and sort
+// queue.Submit();							// Draw it (GL thread only)
+// queue.Submit(&batcher);					// Or most of it in a few calls (see SceneBatcher)
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include "Model_3DS.h"
+#include "JobSystem.h"
+
+#include <vector>
+
+class OcclusionCuller;
+class SceneBatcher;
+
+// One object the game wants drawn
+struct RenderItem {
+	Model_3DS *model;	// The model to draw
+	float x;			// Where to move the model to
+	float y;
+	float z;
+	float yaw;			// Rotation about the y axis in degrees
+	float scale;		// The size to scale the model to
+	float tiltX;		// Rotation about the x axis applied after the scale (90 for the upright models)
+	const float *pivot;	// An extra matrix applied last, can be 0
+	bool occluder;		// True: the model is big enough to hide other things (see OcclusionCuller)
+};
+
+// One draw the GL thread has to make
+struct RenderCommand {
+	unsigned long long key;	// What the commands are sorted by
+	Model_3DS *model;		// The model to draw
+	float matrix[16];		// The model's world matrix
+	int lod;				// The level of detail picked for the model
+};
+
+class RenderQueue
+{
+public:
+	// Counters for the last Build()
+	struct Stats {
+		int items;			// Items handed to Build()
+		int frustumCulled;	// Items outside of the view
+		int detailCulled;	// Items too small on screen to bother with
+		int occlusionCulled;	// Items hidden behind the occluders
+		int submitted;		// Commands left to draw
+		int threads;		// Threads the work was split across
+		double buildMs;		// CPU time of Build() in milliseconds
+		int batched;		// Commands the SceneBatcher drew (counted by Submit())
+		int drawCalls;		// GL draw calls Submit() made
+	};
+
+	float lodPixels;		// Objects smaller than this on screen (in pixels) use the low detail level
+	float minPixels;		// Objects smaller than this on screen (in pixels) are not drawn at all
+	int grain;				// Items per job
+	Stats stats;			// Counters for the last frame
+
+	// Transforms, culls and sorts the items (view and proj are column major like glGetFloatv returns)
+	// If occlusion isn't 0 the items are also tested against it
+	void Build(const std::vector<RenderItem> &items, const float *view, const float *proj, int viewportHeight, JobSystem &jobs, OcclusionCuller *occlusion);
+	// Works out the item's matrix (what gets drawn with) and world matrix (that plus the model's own transform)
+	static void ItemMatrix(const RenderItem &item, float *matrix, float *world);
+	// Draws the sorted commands, as many as it can through the batcher if it isn't 0
+	void Submit(SceneBatcher *batcher = 0);
+	const std::vector<RenderCommand> &Commands() const;	// The sorted commands of the last Build()
+	RenderQueue();			// Constructor
+	virtual ~RenderQueue();	// Destructor
+
+private:
+	// Works out the command for one item, returns false if it was culled
+	bool BuildCommand(const RenderItem &item, RenderCommand &cmd, int &culledBy);
+	void ExtractFrustum(const float *view, const float *proj);	// Finds the 6 planes of the view
+	void Merge();			// Merges the sorted per thread lists into one
+
+	std::vector<std::vector<RenderCommand> > threadLists;	// Commands made by every thread
+	std::vector<int> threadFrustumCulled;	// Culled counts per thread
+	std::vector<int> threadDetailCulled;
+	std::vector<int> threadOcclusionCulled;
+	std::vector<RenderCommand> merged;		// The final sorted commands
+	std::vector<size_t> heads;				// Merge cursors into threadLists
+	std::vector<bool> batched;				// Which commands the batcher drew
+
+	float planes[6][4];		// The frustum planes (a, b, c, d) with the normals pointing in
+	float viewMatrix[16];	// The camera's matrix
+	float pixelScale;		// Turns radius / distance into pixels on screen
+	OcclusionCuller *occluder;	// What the items are tested against this frame (can be 0)
+};
+
+#endif // RENDERQUEUE_H
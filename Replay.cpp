@@ -0,0 +1,261 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Session Record/Replay
+//
+// Replay.cpp: implementation of the ReplayRecorder and ReplayReader
+// classes. See Replay.h for the file format.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "Replay.h"
+
+#include <string.h>
+
+#define REPLAY_FLUSH_SIZE	4096	// Bytes buffered before they go to the file
+
+unsigned int ReplayHash(unsigned int hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Writes a 32 bit value low byte first, whatever the machine is
+static void PutU32(unsigned char *out, unsigned int value)
+{
+	out[0] = (unsigned char)value;
+	out[1] = (unsigned char)(value >> 8);
+	out[2] = (unsigned char)(value >> 16);
+	out[3] = (unsigned char)(value >> 24);
+}
+
+static unsigned int GetU32(const unsigned char *in)
+{
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((unsigned int)in[3] << 24);
+}
+
+//////////////////////////////////////////////////////////////////////
+// ReplayRecorder
+//////////////////////////////////////////////////////////////////////
+
+ReplayRecorder::ReplayRecorder()
+{
+	file = 0;
+	ticks = 0;
+}
+
+ReplayRecorder::~ReplayRecorder()
+{
+	Close();
+}
+
+bool ReplayRecorder::Open(const char *name, unsigned int seed, int tickRate)
+{
+	Close();
+
+	file = fopen(name, "wb");
+	if (!file)
+	{
+		printf("ReplayRecorder: can't create %s\n", name);
+		return false;
+	}
+
+	unsigned char header[16];
+	memcpy(header, "ARPL", 4);
+	PutU32(header + 4, REPLAY_VERSION);
+	PutU32(header + 8, seed);
+	PutU32(header + 12, (unsigned int)tickRate);
+	fwrite(header, 1, sizeof(header), file);
+
+	buffer.clear();
+	buffer.reserve(REPLAY_FLUSH_SIZE * 2);
+	ticks = 0;
+
+	return true;
+}
+
+bool ReplayRecorder::IsOpen() const
+{
+	return file != 0;
+}
+
+int ReplayRecorder::Ticks() const
+{
+	return ticks;
+}
+
+void ReplayRecorder::WriteVarint(unsigned int value)
+{
+	// 7 bits at a time, the top bit says another byte follows
+	while (value >= 0x80)
+	{
+		buffer.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	buffer.push_back((unsigned char)value);
+}
+
+void ReplayRecorder::WriteInt(int value)
+{
+	WriteVarint(((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+}
+
+void ReplayRecorder::WriteTick(const std::vector<InputEvent> &events, unsigned int checksum)
+{
+	if (!file)
+		return;
+
+	WriteVarint((unsigned int)events.size());
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		buffer.push_back(events[i].kind);
+		WriteInt(events[i].key);
+		WriteInt(events[i].state);
+		WriteInt(events[i].x);
+		WriteInt(events[i].y);
+	}
+
+	unsigned char sum[4];
+	PutU32(sum, checksum);
+	buffer.insert(buffer.end(), sum, sum + 4);
+
+	ticks++;
+
+	if (buffer.size() >= REPLAY_FLUSH_SIZE)
+	{
+		fwrite(&buffer[0], 1, buffer.size(), file);
+		buffer.clear();
+	}
+}
+
+void ReplayRecorder::Close()
+{
+	if (!file)
+		return;
+
+	if (!buffer.empty())
+		fwrite(&buffer[0], 1, buffer.size(), file);
+	buffer.clear();
+
+	fclose(file);
+	file = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ReplayReader
+//////////////////////////////////////////////////////////////////////
+
+ReplayReader::ReplayReader()
+{
+	cursor = 0;
+	seed = 0;
+	tickRate = 60;
+}
+
+ReplayReader::~ReplayReader()
+{
+
+}
+
+bool ReplayReader::Open(const char *name)
+{
+	FILE *file = fopen(name, "rb");
+	if (!file)
+	{
+		printf("ReplayReader: can't open %s\n", name);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data.resize(size > 0 ? size : 0);
+	if (size > 0 && fread(&data[0], 1, size, file) != (size_t)size)
+		data.clear();
+	fclose(file);
+
+	if (data.size() < 16 || memcmp(&data[0], "ARPL", 4) != 0 || GetU32(&data[4]) != REPLAY_VERSION)
+	{
+		printf("ReplayReader: %s isn't a recording this version can play\n", name);
+		data.clear();
+		return false;
+	}
+
+	seed = GetU32(&data[8]);
+	tickRate = (int)GetU32(&data[12]);
+	cursor = 16;
+
+	return true;
+}
+
+unsigned int ReplayReader::Seed() const
+{
+	return seed;
+}
+
+int ReplayReader::TickRate() const
+{
+	return tickRate;
+}
+
+bool ReplayReader::ReadVarint(unsigned int &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (cursor >= data.size())
+			return false;
+
+		unsigned char byte = data[cursor++];
+		value |= (unsigned int)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool ReplayReader::ReadInt(int &value)
+{
+	unsigned int zigzag;
+	if (!ReadVarint(zigzag))
+		return false;
+
+	value = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+	return true;
+}
+
+bool ReplayReader::ReadTick(std::vector<InputEvent> &events, unsigned int &checksum)
+{
+	events.clear();
+
+	unsigned int count;
+	if (!ReadVarint(count))
+		return false;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (cursor >= data.size())
+			return false;
+
+		InputEvent event;
+		event.kind = data[cursor++];
+		if (!ReadInt(event.key) || !ReadInt(event.state) || !ReadInt(event.x) || !ReadInt(event.y))
+			return false;
+
+		events.push_back(event);
+	}
+
+	// A tick cut off half way (the game was killed) doesn't count
+	if (cursor + 4 > data.size())
+		return false;
+
+	checksum = GetU32(&data[cursor]);
+	cursor += 4;
+
+	return true;
+}
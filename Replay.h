@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Session Record/Replay
+//
+// Replay.h: interface for the ReplayRecorder and ReplayReader
+// classes. The game runs its simulation in fixed ticks (60 a
+// second) and only ever changes state from inside a tick, with
+// the input that arrived since the last one. So a session can be
+// played again exactly from just the random seed and the input
+// of every tick.
+//
+// A recording is a small binary file:
+//
+// header:	"ARPL", version, seed, ticks per second	(4 x 4 bytes)
+// per tick:	event count (varint), the events, state checksum (4 bytes)
+// event:	kind (1 byte), key, state, x, y (varints, zigzagged)
+//
+// An idle tick is 5 bytes. The checksum is of the game state after
+// the tick, so a replay can tell the exact tick it went wrong on.
+//
+// Usage:
+// ReplayRecorder recorder;
+// recorder.Open("session.rpl", seed, 60);
+// recorder.WriteTick(events, checksum);		// After every tick
+// recorder.Close();
+//
+// ReplayReader reader;
+// reader.Open("session.rpl");
+// while (reader.ReadTick(events, checksum)) ...	// Run the tick, compare checksums
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <vector>
+
+#define REPLAY_VERSION	1
+
+// Where an input event came from
+enum InputKind {
+	INPUT_SPECIAL,		// glutSpecialFunc (the arrow keys)
+	INPUT_KEYBOARD,		// glutKeyboardFunc
+	INPUT_MOUSE			// glutMouseFunc
+};
+
+// One input event, applied at the start of the next tick
+struct InputEvent {
+	unsigned char kind;	// InputKind
+	int key;			// The key or mouse button
+	int state;			// GLUT_DOWN/GLUT_UP for the mouse
+	int x;				// Where the mouse was
+	int y;
+};
+
+// Adds size bytes to a running FNV-1a hash (start with REPLAY_HASH_START)
+#define REPLAY_HASH_START	2166136261u
+unsigned int ReplayHash(unsigned int hash, const void *data, size_t size);
+
+class ReplayRecorder
+{
+public:
+	bool Open(const char *name, unsigned int seed, int tickRate);	// Starts a new file
+	void WriteTick(const std::vector<InputEvent> &events, unsigned int checksum);
+	void Close();					// Flushes and closes the file
+	bool IsOpen() const;
+	int Ticks() const;				// Ticks written so far
+	ReplayRecorder();				// Constructor
+	virtual ~ReplayRecorder();		// Destructor (closes the file)
+
+private:
+	void WriteVarint(unsigned int value);
+	void WriteInt(int value);		// Zigzags it first so small negatives stay small
+
+	FILE *file;
+	std::vector<unsigned char> buffer;	// Written out in big chunks
+	int ticks;
+};
+
+class ReplayReader
+{
+public:
+	bool Open(const char *name);	// Reads the whole file in, false if it isn't a recording
+	// Reads the next tick's events and checksum, false at the end of the file
+	bool ReadTick(std::vector<InputEvent> &events, unsigned int &checksum);
+	unsigned int Seed() const;
+	int TickRate() const;
+	ReplayReader();					// Constructor
+	virtual ~ReplayReader();		// Destructor
+
+private:
+	bool ReadVarint(unsigned int &value);
+	bool ReadInt(int &value);
+
+	std::vector<unsigned char> data;
+	size_t cursor;
+	unsigned int seed;
+	int tickRate;
+};
+
+#endif // REPLAY_H
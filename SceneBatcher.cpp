@@ -0,0 +1,605 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Scene Batcher
+//
+// SceneBatcher.cpp: implementation of the SceneBatcher class.
+// See SceneBatcher.h for how it works.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "SceneBatcher.h"
+#include "ClusteredLighting.h"
+#include "Matrix4.h"
+#include "MipmapBuilder.h"
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+
+#define VERTEX_FLOATS	8		// Position, normal, texture coordinates
+#define INSTANCE_FLOATS	20		// World matrix, then the layer padded to a vec4
+#define DRAW_UINTS		5		// count, instanceCount, firstIndex, baseVertex, baseInstance
+
+// OpenGL 4.3 calls this version of GLEW doesn't know about
+typedef void (GLAPIENTRY *MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+typedef void (GLAPIENTRY *VertexAttribDivisorProc)(GLuint index, GLuint divisor);
+typedef void (GLAPIENTRY *CopyImageSubDataProc)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ,
+	GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei width, GLsizei height, GLsizei depth);
+
+static MultiDrawElementsIndirectProc multiDrawElementsIndirect = 0;
+static VertexAttribDivisorProc vertexAttribDivisor = 0;
+static CopyImageSubDataProc copyImageSubData = 0;
+
+// The clustered lighting vertex shader, with the model's matrix and
+// texture layer coming from the draw's instance
+static const char *vertexSource =
+	"#version 430 compatibility\n"
+	"layout(location = 0) in vec3 position;\n"
+	"layout(location = 1) in vec3 normal;\n"
+	"layout(location = 2) in vec2 texCoord;\n"
+	"layout(location = 3) in mat4 world;\n"		// Locations 3 to 6
+	"layout(location = 7) in vec4 layerData;\n"
+	"out vec3 viewPos;\n"
+	"out vec3 viewNormal;\n"
+	"out vec2 uv;\n"
+	"out vec4 color;\n"
+	"flat out float layer;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 p = gl_ModelViewMatrix * (world * vec4(position, 1.0));\n"
+	"	viewPos = p.xyz;\n"
+	"	viewNormal = mat3(gl_ModelViewMatrix) * (mat3(world) * normal);\n"
+	"	uv = texCoord;\n"
+	"	color = gl_Color;\n"
+	"	layer = layerData.x;\n"
+	"	gl_Position = gl_ProjectionMatrix * p;\n"
+	"}\n";
+
+// The layer's texel and the color, lit (a layer below 0: no texture)
+static const char *fragmentSource =
+	"uniform sampler2DArray diffuseMaps;\n"
+	"in vec3 viewPos;\n"
+	"in vec3 viewNormal;\n"
+	"in vec2 uv;\n"
+	"in vec4 color;\n"
+	"flat in float layer;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 base = color;\n"
+	"	if (layer >= 0.0)\n"
+	"		base *= texture(diffuseMaps, vec3(uv, layer));\n"
+	"	vec3 light = clusterLight(viewPos, normalize(viewNormal));\n"
+	"	gl_FragColor = vec4(base.rgb * light, base.a);\n"
+	"}\n";
+
+// Compiles one stage of the shader from its pieces, returns 0 if it didn't compile
+static GLuint CompileShader(GLenum type, const char **sources, int count)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, count, sources, 0);
+	glCompileShader(shader);
+
+	GLint ok = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), 0, log);
+		printf("SceneBatcher: shader didn't compile:\n%s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+SceneBatcher::SceneBatcher()
+{
+	supported = false;
+	memset(&stats, 0, sizeof(stats));
+
+	lighting = 0;
+	program = 0;
+	vertexArray = 0;
+	vertexBuffer = 0;
+	indexBuffer = 0;
+	instanceBuffer = 0;
+	indirectBuffer = 0;
+	geometryDirty = false;
+	paletteColors = 0;
+	arrayBytes = 0;
+}
+
+SceneBatcher::~SceneBatcher()
+{
+
+}
+
+bool SceneBatcher::Init(ClusteredLighting *lighting)
+{
+	// The shader lights like ClusteredLighting's, so it has to be there
+	if (!lighting || !lighting->supported)
+		return false;
+	this->lighting = lighting;
+
+	// Multi draw indirect with a base instance and glCopyImageSubData are OpenGL 4.3
+	int major = 0, minor = 0;
+	const char *version = (const char *)glGetString(GL_VERSION);
+	if (!version || sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 43)
+		return false;
+
+	multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)wglGetProcAddress("glMultiDrawElementsIndirect");
+	vertexAttribDivisor = (VertexAttribDivisorProc)wglGetProcAddress("glVertexAttribDivisor");
+	copyImageSubData = (CopyImageSubDataProc)wglGetProcAddress("glCopyImageSubData");
+	if (!multiDrawElementsIndirect || !vertexAttribDivisor || !copyImageSubData)
+		return false;
+
+	const char *vertexSources[] = { vertexSource };
+	const char *fragmentSources[] = { "#version 430 compatibility\n", ClusteredLighting::ShadingSource(), fragmentSource };
+	GLuint vs = CompileShader(GL_VERTEX_SHADER, vertexSources, 1);
+	GLuint fs = CompileShader(GL_FRAGMENT_SHADER, fragmentSources, 3);
+	if (!vs || !fs)
+		return false;
+
+	program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	glLinkProgram(program);
+
+	GLint ok = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok)
+	{
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), 0, log);
+		printf("SceneBatcher: shader didn't link:\n%s\n", log);
+		return false;
+	}
+
+	// The arrays are always on unit 0, the lights on 1 to 3 (see ClusteredLighting::SetUniforms())
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "diffuseMaps"), 0);
+	glUseProgram(0);
+
+	glGenBuffers(1, &vertexBuffer);
+	glGenBuffers(1, &indexBuffer);
+	glGenBuffers(1, &instanceBuffer);
+	glGenBuffers(1, &indirectBuffer);
+
+	// Everything the shader reads, set up once
+	glGenVertexArrays(1, &vertexArray);
+	glBindVertexArray(vertexArray);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(float), (const void *)0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(float), (const void *)(3 * sizeof(float)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(float), (const void *)(6 * sizeof(float)));
+
+	// One per draw: the draw's base instance picks it
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (int i = 0; i < 5; i++)
+	{
+		glEnableVertexAttribArray(3 + i);
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS * sizeof(float), (const void *)(i * 4 * sizeof(float)));
+		vertexAttribDivisor(3 + i, 1);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	supported = true;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Building the buffers
+//////////////////////////////////////////////////////////////////////
+
+bool SceneBatcher::Add(Model_3DS *model)
+{
+	if (!supported)
+		return false;
+
+	// Already in
+	int index = model->batchIndex;
+	if (index >= 0 && index < (int)batches.size() && batches[index].model == model)
+		return true;
+
+	// Its textures are still to be made (LoadTextures() hasn't run yet) or streamed in. One already
+	// copied is drawn from its layer, whatever has become of the original since
+	for (int i = 0; i < model->numMaterials; i++)
+	{
+		const TextureHandle &tex = model->Materials[i].tex;
+		if (model->Materials[i].texFile[0] && (!tex.Valid() || (!tex.Resident() && layers.find(tex.Id()) == layers.end())))
+			return false;
+	}
+
+	Batch batch;
+	batch.model = model;
+	batch.firstPiece = (int)pieces.size();
+	batch.numPieces = 0;
+
+	for (int i = 0; i < model->numObjects; i++)
+	{
+		Model_3DS::Object &object = model->Objects[i];
+		GLint baseVertex = (GLint)(vertices.size() / VERTEX_FLOATS);
+
+		for (int v = 0; v < object.numVerts; v++)
+		{
+			vertices.insert(vertices.end(), object.Vertexes + v * 3, object.Vertexes + v * 3 + 3);
+			vertices.insert(vertices.end(), object.Normals + v * 3, object.Normals + v * 3 + 3);
+
+			// Objects w/o texture coordinates are drawn with whatever the
+			// texture has at the corner, so do the same
+			bool hasTexCoord = object.textured && object.TexCoords && v < object.numTexCoords;
+			vertices.push_back(hasTexCoord ? object.TexCoords[v * 2] : 0.0f);
+			vertices.push_back(hasTexCoord ? object.TexCoords[v * 2 + 1] : 0.0f);
+		}
+
+		for (int j = 0; j < object.numMatFaces; j++)
+		{
+			Model_3DS::MaterialFaces &faces = object.MatFaces[j];
+			const TextureHandle &tex = j == object.paletteFaces ? model->palette : model->Materials[faces.MatIndex].tex;
+
+			Piece piece;
+			piece.object = i;
+			piece.firstIndex = (GLuint)indices.size();
+			piece.count = faces.numSubFaces;
+			piece.baseVertex = baseVertex;
+
+			// A texture that didn't load draws untextured, like texture 0 does
+			Layer layer;
+			piece.array = -1;
+			piece.layer = 0;
+			if (LayerOf(tex, layer))
+			{
+				piece.array = layer.array;
+				piece.layer = layer.layer;
+			}
+
+			indices.insert(indices.end(), faces.subFaces, faces.subFaces + faces.numSubFaces);
+			pieces.push_back(piece);
+			batch.numPieces++;
+		}
+	}
+
+	model->batchIndex = (int)batches.size();
+	batches.push_back(batch);
+	geometryDirty = true;
+	return true;
+}
+
+bool SceneBatcher::LayerOf(const TextureHandle &tex, Layer &layer)
+{
+	GLuint id = tex.Id();
+	if (!id)
+		return false;
+
+	std::map<GLuint, Layer>::iterator it = layers.find(id);
+	if (it != layers.end())
+	{
+		layer = it->second;
+		return true;
+	}
+
+	// What the texture looks like
+	GLint width = 0, height = 0, format = 0, compressed = 0, minFilter = 0, magFilter = 0;
+	glBindTexture(GL_TEXTURE_2D, id);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &magFilter);
+	if (width <= 0 || height <= 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return false;
+	}
+
+	// The old style component counts, as the sized formats the arrays are made with
+	if (format == 3)
+		format = GL_RGB8;
+	else if (format == 4)
+		format = GL_RGBA8;
+
+	// Only the levels it has (the palette and the like have just the one)
+	int levels = 1;
+	if (minFilter != GL_NEAREST && minFilter != GL_LINEAR)
+	{
+		int most = MipmapBuilder::LevelCount(width, height);
+		while (levels < most)
+		{
+			GLint levelWidth = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, levels, GL_TEXTURE_WIDTH, &levelWidth);
+			if (levelWidth <= 0)
+				break;
+			levels++;
+		}
+	}
+
+	// An array of its kind, or a new one
+	int found = -1;
+	for (size_t i = 0; i < arrays.size(); i++)
+	{
+		TextureArray &array = arrays[i];
+		if (array.width == width && array.height == height && array.format == format &&
+			array.minFilter == minFilter && array.magFilter == magFilter && array.levels == levels)
+		{
+			found = (int)i;
+			break;
+		}
+	}
+
+	if (found < 0)
+	{
+		TextureArray array;
+		array.texture = 0;
+		array.width = width;
+		array.height = height;
+		array.format = format;
+		array.compressed = compressed != 0;
+		array.minFilter = minFilter;
+		array.magFilter = magFilter;
+		array.levels = levels;
+		array.layers = 0;
+		array.capacity = 0;
+		array.layerBytes = 0;
+
+		// Compressed levels are made with their size in bytes
+		for (int level = 0; level < levels && array.compressed; level++)
+		{
+			GLint bytes = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &bytes);
+			array.levelBytes.push_back(bytes);
+		}
+
+		// What a layer takes, for the budget
+		int texelBytes = format == GL_RGB8 || format == GL_RGB ? 3 : 4;
+		for (int level = 0; level < levels; level++)
+		{
+			GLint levelWidth = width >> level > 0 ? width >> level : 1;
+			GLint levelHeight = height >> level > 0 ? height >> level : 1;
+			array.layerBytes += array.compressed ? array.levelBytes[level] : (size_t)levelWidth * levelHeight * texelBytes;
+		}
+
+		found = (int)arrays.size();
+		arrays.push_back(array);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	TextureArray &array = arrays[found];
+	if (array.layers == array.capacity)
+		Grow(array, array.capacity > 0 ? array.capacity * 2 : 4);
+
+	layer.array = found;
+	layer.layer = array.layers++;
+	CopyLayer(id, layer);
+
+	layers[id] = layer;
+	held.push_back(tex);
+
+	// The layer is what's drawn now, the original can go down to its last level
+	TextureManager::Shared().Copied(tex);
+	return true;
+}
+
+void SceneBatcher::Grow(TextureArray &array, int capacity)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.minFilter);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, array.magFilter);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, array.levels - 1);
+
+	GLenum external = array.format == GL_RGB8 || array.format == GL_RGB ? GL_RGB : GL_RGBA;
+	for (int level = 0; level < array.levels; level++)
+	{
+		GLsizei width = array.width >> level > 0 ? array.width >> level : 1;
+		GLsizei height = array.height >> level > 0 ? array.height >> level : 1;
+
+		if (array.compressed)
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.format, width, height, capacity, 0, array.levelBytes[level] * capacity, 0);
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.format, width, height, capacity, 0, external, GL_UNSIGNED_BYTE, 0);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// The layers already in, card to card (once every level is there, GL won't copy into an incomplete texture)
+	for (int level = 0; level < array.levels && array.layers > 0; level++)
+	{
+		GLsizei width = array.width >> level > 0 ? array.width >> level : 1;
+		GLsizei height = array.height >> level > 0 ? array.height >> level : 1;
+		copyImageSubData(array.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.layers);
+	}
+
+	if (array.texture)
+		glDeleteTextures(1, &array.texture);
+	array.texture = texture;
+
+	arrayBytes += (capacity - array.capacity) * array.layerBytes;
+	array.capacity = capacity;
+	TextureManager::Shared().SetCopyBytes(arrayBytes);
+}
+
+void SceneBatcher::CopyLayer(GLuint source, const Layer &layer)
+{
+	const TextureArray &array = arrays[layer.array];
+	for (int level = 0; level < array.levels; level++)
+	{
+		GLsizei width = array.width >> level > 0 ? array.width >> level : 1;
+		GLsizei height = array.height >> level > 0 ? array.height >> level : 1;
+		copyImageSubData(source, GL_TEXTURE_2D, level, 0, 0, 0, array.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer.layer, width, height, 1);
+	}
+}
+
+void SceneBatcher::UploadGeometry()
+{
+	// The vertex array object remembers the index buffer, so this has to happen with it bound
+	glBindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.empty() ? 0 : &vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.empty() ? 0 : &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	geometryDirty = false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Drawing
+//////////////////////////////////////////////////////////////////////
+
+void SceneBatcher::Submit(const std::vector<RenderCommand> &commands, std::vector<bool> &drawn)
+{
+	drawn.assign(commands.size(), false);
+	memset(&stats, 0, sizeof(stats));
+	if (!supported)
+		return;
+
+	// Models loaded since the palette was copied may have put colors in it
+	TextureManager &textures = TextureManager::Shared();
+	if (textures.PaletteColors() != paletteColors)
+	{
+		TextureHandle palette = textures.Palette();
+		std::map<GLuint, Layer>::iterator it = layers.find(palette.Id());
+		if (it != layers.end())
+			CopyLayer(it->first, it->second);
+		paletteColors = textures.PaletteColors();
+	}
+
+	for (size_t i = 0; i < draws.size(); i++)
+		draws[i].clear();
+	instanceData.clear();
+
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		Model_3DS *model = commands[i].model;
+
+		// Draw() wouldn't have drawn it either
+		if (!model->visible)
+		{
+			drawn[i] = true;
+			continue;
+		}
+
+		// Unlit models and the normals are left to Draw()
+		if (!model->lit || model->shownormals || !Add(model))
+			continue;
+
+		// Draw()'s move, rotate and scale of the whole model
+		float modelMatrix[16];
+		memcpy(modelMatrix, commands[i].matrix, sizeof(modelMatrix));
+		Mat4Translate(modelMatrix, model->pos.x, model->pos.y, model->pos.z);
+		Mat4Rotate(modelMatrix, model->rot.x, 1.0f, 0.0f, 0.0f);
+		Mat4Rotate(modelMatrix, model->rot.y, 0.0f, 1.0f, 0.0f);
+		Mat4Rotate(modelMatrix, model->rot.z, 0.0f, 0.0f, 1.0f);
+		Mat4Scale(modelMatrix, model->scale, model->scale, model->scale);
+
+		// The first bucket is the untextured pieces, then one per array (Add() may have made one)
+		if (draws.size() < arrays.size() + 1)
+			draws.resize(arrays.size() + 1);
+
+		const Batch &batch = batches[model->batchIndex];
+		int object = -1;
+		float world[16];
+		for (int p = batch.firstPiece; p < batch.firstPiece + batch.numPieces; p++)
+		{
+			const Piece &piece = pieces[p];
+
+			// And each object's own
+			if (piece.object != object)
+			{
+				object = piece.object;
+				const Model_3DS::Object &o = model->Objects[object];
+				memcpy(world, modelMatrix, sizeof(world));
+				Mat4Translate(world, o.pos.x, o.pos.y, o.pos.z);
+				Mat4Rotate(world, o.rot.z, 0.0f, 0.0f, 1.0f);
+				Mat4Rotate(world, o.rot.y, 0.0f, 1.0f, 0.0f);
+				Mat4Rotate(world, o.rot.x, 1.0f, 0.0f, 0.0f);
+			}
+
+			GLuint instance = (GLuint)(instanceData.size() / INSTANCE_FLOATS);
+			instanceData.insert(instanceData.end(), world, world + 16);
+			instanceData.push_back(piece.array < 0 ? -1.0f : (float)piece.layer);
+			instanceData.push_back(0.0f);
+			instanceData.push_back(0.0f);
+			instanceData.push_back(0.0f);
+
+			std::vector<GLuint> &bucket = draws[piece.array + 1];
+			bucket.push_back(piece.count);
+			bucket.push_back(1);
+			bucket.push_back(piece.firstIndex);
+			bucket.push_back((GLuint)piece.baseVertex);
+			bucket.push_back(instance);
+			stats.draws++;
+		}
+
+		drawn[i] = true;
+		stats.commands++;
+	}
+
+	stats.models = (int)batches.size();
+	stats.vertices = (int)(vertices.size() / VERTEX_FLOATS);
+	stats.arrays = (int)arrays.size();
+	stats.layers = (int)layers.size();
+	if (stats.draws == 0)
+		return;
+
+	if (geometryDirty)
+		UploadGeometry();
+
+	// This frame's draws, each array's back to back
+	drawData.clear();
+	for (size_t i = 0; i < draws.size(); i++)
+		drawData.insert(drawData.end(), draws[i].begin(), draws[i].end());
+
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(float), &instanceData[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, drawData.size() * sizeof(GLuint), &drawData[0], GL_STREAM_DRAW);
+
+	// Swap the lighting shader for this one, with the same lights
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	glUseProgram(program);
+	lighting->SetUniforms(program);
+
+	glBindVertexArray(vertexArray);
+	glActiveTexture(GL_TEXTURE0);
+
+	size_t offset = 0;
+	for (size_t i = 0; i < draws.size(); i++)
+	{
+		GLsizei count = (GLsizei)(draws[i].size() / DRAW_UINTS);
+		if (count == 0)
+			continue;
+
+		// The untextured ones don't sample, whatever is bound
+		if (i > 0)
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[i - 1].texture);
+
+		multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void *)(offset * sizeof(GLuint)), count, 0);
+		offset += draws[i].size();
+		stats.drawCalls++;
+	}
+
+	// Leave things how Draw() expects them
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glUseProgram(previousProgram);
+}
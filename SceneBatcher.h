@@ -0,0 +1,156 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Scene Batcher
+//
+// SceneBatcher.h: interface for the SceneBatcher class.
+// Model_3DS::Draw() makes a glDrawElements call (and often a texture
+// bind) for every material of every object, from arrays in client
+// memory, so the scene costs a few hundred calls a frame. This class
+// draws the same models from one place on the card:
+//
+// - Every model it is handed has its vertices (position, normal and
+//   texture coordinates) copied into one shared vertex buffer, and
+//   its faces into one shared index buffer. Each material of each
+//   object becomes a piece: where its indices start, how many there
+//   are and which vertex they count from.
+// - The textures are copied (every mipmap level, with
+//   glCopyImageSubData, so compressed ones stay compressed) into
+//   texture arrays, one per size, format and filter. Every texture
+//   is a layer, and a piece says which array and layer it samples.
+// - Every frame each command's pieces are written out as indirect
+//   draws plus a world matrix and layer per draw (read as instanced
+//   attributes through the draw's base instance), and every array is
+//   drawn with one glMultiDrawElementsIndirect call.
+//
+// So the whole opaque scene is one call per texture array, usually
+// a handful. The shader is the clustered lighting one with the
+// world matrix and the array layer added, so this is only used
+// while ClusteredLighting is bound.
+//
+// It needs OpenGL 4.3 (multi draw indirect and glCopyImageSubData).
+// If the card doesn't have it Init() returns false, and the render
+// queue keeps drawing everything with Model_3DS::Draw(). Models that
+// aren't lit, or whose textures aren't loaded (or streamed in, or
+// back to full size after being lowered to fit the texture budget)
+// yet, are left to it too. Once copied, the originals aren't bound,
+// so each is lowered to its last level straight away (see
+// TextureManager::Copied()), and the arrays' memory is counted
+// against the texture budget instead.
+//
+// Usage:
+// SceneBatcher batcher;
+//
+// batcher.Init(&lighting);					// Once, after lighting.Init()
+//
+// lighting.Bind(sunDir, sunColor, ambient);
+// batcher.Submit(commands, drawn);			// drawn[i]: the batcher drew command i
+// for (...) if (!drawn[i]) commands[i].model->Draw();
+// lighting.Unbind();
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef SCENEBATCHER_H
+#define SCENEBATCHER_H
+
+#include "glew.h"
+#include "RenderQueue.h"
+
+#include <map>
+#include <vector>
+
+class ClusteredLighting;
+
+class SceneBatcher
+{
+public:
+	// Counters for the last Submit()
+	struct Stats {
+		int commands;		// Commands drawn by the batcher
+		int draws;			// Indirect draws (one per material of each object)
+		int drawCalls;		// glMultiDrawElementsIndirect calls
+		int models;			// Models in the buffers
+		int vertices;		// Vertices in the shared vertex buffer
+		int arrays;			// Texture arrays
+		int layers;			// Textures in them
+	};
+
+	bool supported;			// True: Init() worked and Submit() draws
+	Stats stats;
+
+	bool Init(ClusteredLighting *lighting);	// Compiles the shader and makes the buffers (needs a GL context)
+	bool Add(Model_3DS *model);	// Copies the model into the buffers (if it wasn't already), false if it can't be batched
+	// Draws the commands it can in a few calls (GL thread, lighting bound), the rest are left false in drawn
+	void Submit(const std::vector<RenderCommand> &commands, std::vector<bool> &drawn);
+	SceneBatcher();			// Constructor
+	virtual ~SceneBatcher();	// Destructor
+
+private:
+	// The faces of one material of one object
+	struct Piece {
+		int object;			// The object in the model it belongs to
+		GLuint firstIndex;	// Where the indices start in the index buffer
+		GLuint count;		// How many there are
+		GLint baseVertex;	// Where the object's vertices start in the vertex buffer
+		int array;			// The texture array (-1: untextured)
+		int layer;			// The layer in it
+	};
+
+	// What's known about a model
+	struct Batch {
+		Model_3DS *model;
+		int firstPiece;
+		int numPieces;
+	};
+
+	// Textures of the same size, format and filtering
+	struct TextureArray {
+		GLuint texture;
+		GLint width;
+		GLint height;
+		GLint format;		// The internal format of the textures copied in
+		bool compressed;	// True: format is a compressed one (from a .dds or .ktx)
+		std::vector<GLint> levelBytes;	// The size of a layer of each level, if it's compressed
+		GLint minFilter;
+		GLint magFilter;
+		int levels;			// Mipmap levels of every layer
+		int layers;			// Layers used
+		int capacity;		// Layers made
+		size_t layerBytes;	// The memory of a layer, every level
+	};
+
+	// Where a texture was copied to
+	struct Layer {
+		int array;
+		int layer;
+	};
+
+	bool LayerOf(const TextureHandle &tex, Layer &layer);	// Finds or copies a texture, false if it has nothing in it
+	void Grow(TextureArray &array, int capacity);			// Remakes the array with more layers, keeping the ones in it
+	void CopyLayer(GLuint source, const Layer &layer);		// Copies every level of a texture into its layer
+	void UploadGeometry();									// Uploads the vertices and indices after Add()
+
+	ClusteredLighting *lighting;
+	GLuint program;			// The clustered lighting shader, drawn from the buffers
+	GLuint vertexArray;		// The vertex array object with all of the attributes
+	GLuint vertexBuffer;	// Position, normal and texture coordinates of every vertex, interleaved
+	GLuint indexBuffer;		// 32 bit indices, counted from each piece's base vertex
+	GLuint instanceBuffer;	// World matrix and layer per draw
+	GLuint indirectBuffer;	// The draws, grouped by texture array
+
+	std::vector<float> vertices;			// What's in the vertex buffer
+	std::vector<GLuint> indices;			// What's in the index buffer
+	bool geometryDirty;						// True: Add() put something in that isn't uploaded
+	std::vector<Batch> batches;				// Models, by Model_3DS::batchIndex
+	std::vector<Piece> pieces;				// Pieces of every model, by Batch::firstPiece
+	std::vector<TextureArray> arrays;
+	std::map<GLuint, Layer> layers;			// By the texture's GL name
+	std::vector<TextureHandle> held;		// The textures copied, so their names can't be reused
+	size_t arrayBytes;						// The memory of every layer made, told to the TextureManager
+	int paletteColors;						// TextureManager::PaletteColors() when the palette was last copied
+
+	std::vector<std::vector<GLuint> > draws;	// This frame's indirect draws, the untextured ones then per array
+	std::vector<GLuint> drawData;			// All of them, back to back
+	std::vector<float> instanceData;		// World matrix and layer per draw
+};
+
+#endif // SCENEBATCHER_H
@@ -0,0 +1,235 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Spatial Hash Grid
+//
+// SpatialGrid.cpp: implementation of the SpatialGrid class.
+// See SpatialGrid.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "SpatialGrid.h"
+
+#include <math.h>
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+SpatialGrid::SpatialGrid(float cellSize)
+{
+	if (cellSize <= 0.0f)
+		cellSize = 1.0f;
+
+	this->cellSize = cellSize;
+	invCellSize = 1.0f / cellSize;
+	maxRadius = 0.0f;
+	count = 0;
+}
+
+SpatialGrid::~SpatialGrid()
+{
+
+}
+
+float SpatialGrid::CellSize() const
+{
+	return cellSize;
+}
+
+int SpatialGrid::Count() const
+{
+	return count;
+}
+
+long long SpatialGrid::CellKey(int cx, int cz) const
+{
+	return ((long long)cx << 32) | (unsigned int)cz;
+}
+
+int SpatialGrid::CellCoord(float v) const
+{
+	return (int)floorf(v * invCellSize);
+}
+
+bool SpatialGrid::Contains(int id) const
+{
+	return id >= 0 && id < (int)entries.size() && entries[id].slot >= 0;
+}
+
+void SpatialGrid::Link(int id)
+{
+	Entry &entry = entries[id];
+	entry.cell = CellKey(CellCoord(entry.x), CellCoord(entry.z));
+
+	std::vector<int> &cell = cells[entry.cell];
+	entry.slot = (int)cell.size();
+	cell.push_back(id);
+}
+
+void SpatialGrid::Unlink(int id)
+{
+	Entry &entry = entries[id];
+	std::vector<int> &cell = cells[entry.cell];
+
+	// Move the last id into the hole so the list stays packed
+	int last = cell.back();
+	cell[entry.slot] = last;
+	entries[last].slot = entry.slot;
+	cell.pop_back();
+
+	entry.slot = -1;
+}
+
+void SpatialGrid::Insert(int id, float x, float z, float radius)
+{
+	if (id < 0)
+		return;
+
+	if (Contains(id))
+	{
+		entries[id].radius = radius;
+		if (radius > maxRadius)
+			maxRadius = radius;
+		Move(id, x, z);
+		return;
+	}
+
+	if (id >= (int)entries.size())
+	{
+		Entry empty = { 0.0f, 0.0f, 0.0f, 0, -1 };
+		entries.resize(id + 1, empty);
+	}
+
+	Entry &entry = entries[id];
+	entry.x = x;
+	entry.z = z;
+	entry.radius = radius;
+
+	if (radius > maxRadius)
+		maxRadius = radius;
+
+	Link(id);
+	count++;
+}
+
+void SpatialGrid::Move(int id, float x, float z)
+{
+	if (!Contains(id))
+		return;
+
+	Entry &entry = entries[id];
+	entry.x = x;
+	entry.z = z;
+
+	// Only touch the cells if it crossed into a new one
+	if (CellKey(CellCoord(x), CellCoord(z)) != entry.cell)
+	{
+		Unlink(id);
+		Link(id);
+	}
+}
+
+void SpatialGrid::Remove(int id)
+{
+	if (!Contains(id))
+		return;
+
+	Unlink(id);
+	count--;
+}
+
+void SpatialGrid::Clear()
+{
+	for (std::unordered_map<long long, std::vector<int> >::iterator it = cells.begin(); it != cells.end(); ++it)
+		it->second.clear();
+
+	for (size_t i = 0; i < entries.size(); i++)
+		entries[i].slot = -1;
+
+	maxRadius = 0.0f;
+	count = 0;
+}
+
+void SpatialGrid::QueryRadius(float x, float z, float radius, std::vector<int> &found) const
+{
+	// An entity can stick out of its cell by its own radius
+	float reach = radius + maxRadius;
+	int cx0 = CellCoord(x - reach), cx1 = CellCoord(x + reach);
+	int cz0 = CellCoord(z - reach), cz1 = CellCoord(z + reach);
+
+	for (int cx = cx0; cx <= cx1; cx++)
+	{
+		for (int cz = cz0; cz <= cz1; cz++)
+		{
+			std::unordered_map<long long, std::vector<int> >::const_iterator it = cells.find(CellKey(cx, cz));
+			if (it == cells.end())
+				continue;
+
+			const std::vector<int> &cell = it->second;
+			for (size_t i = 0; i < cell.size(); i++)
+			{
+				const Entry &entry = entries[cell[i]];
+				float dx = entry.x - x;
+				float dz = entry.z - z;
+				float r = radius + entry.radius;
+				if (dx * dx + dz * dz <= r * r)
+					found.push_back(cell[i]);
+			}
+		}
+	}
+}
+
+void SpatialGrid::QueryBox(float minX, float minZ, float maxX, float maxZ, std::vector<int> &found) const
+{
+	int cx0 = CellCoord(minX - maxRadius), cx1 = CellCoord(maxX + maxRadius);
+	int cz0 = CellCoord(minZ - maxRadius), cz1 = CellCoord(maxZ + maxRadius);
+
+	for (int cx = cx0; cx <= cx1; cx++)
+	{
+		for (int cz = cz0; cz <= cz1; cz++)
+		{
+			std::unordered_map<long long, std::vector<int> >::const_iterator it = cells.find(CellKey(cx, cz));
+			if (it == cells.end())
+				continue;
+
+			const std::vector<int> &cell = it->second;
+			for (size_t i = 0; i < cell.size(); i++)
+			{
+				// Distance from the circle's center to the box
+				const Entry &entry = entries[cell[i]];
+				float dx = entry.x < minX ? minX - entry.x : (entry.x > maxX ? entry.x - maxX : 0.0f);
+				float dz = entry.z < minZ ? minZ - entry.z : (entry.z > maxZ ? entry.z - maxZ : 0.0f);
+				if (dx * dx + dz * dz <= entry.radius * entry.radius)
+					found.push_back(cell[i]);
+			}
+		}
+	}
+}
+
+bool SpatialGrid::AnyWithin(float x, float z, float distance) const
+{
+	int cx0 = CellCoord(x - distance), cx1 = CellCoord(x + distance);
+	int cz0 = CellCoord(z - distance), cz1 = CellCoord(z + distance);
+
+	for (int cx = cx0; cx <= cx1; cx++)
+	{
+		for (int cz = cz0; cz <= cz1; cz++)
+		{
+			std::unordered_map<long long, std::vector<int> >::const_iterator it = cells.find(CellKey(cx, cz));
+			if (it == cells.end())
+				continue;
+
+			const std::vector<int> &cell = it->second;
+			for (size_t i = 0; i < cell.size(); i++)
+			{
+				const Entry &entry = entries[cell[i]];
+				float dx = entry.x - x;
+				float dz = entry.z - z;
+				if (dx * dx + dz * dz < distance * distance)
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Spatial Hash Grid
+//
+// SpatialGrid.h: interface for the SpatialGrid class.
+// This class answers "what is near this point?" without looking
+// at every entity in the level. The ground (x, z) is cut into
+// square cells and every entity is filed under the cell its
+// center is in. A query only looks at the cells its circle or
+// box touches, so the cost depends on how crowded that spot is,
+// not on how many entities there are in total.
+//
+// Only the cells that have something in them exist (they live in
+// a hash map keyed by the cell coordinates), so the level can be
+// any size. Entities are circles on the ground; the height is left
+// to the caller since everything in the game stands on y = 0.
+//
+// Entities are known by an id the caller picks (the index into
+// its own vector is the natural choice). Insert, Move and Remove
+// are all O(1) so the grid can be kept up to date as things
+// spawn, walk around and get picked up.
+//
+// A query returns every entity whose circle might overlap the
+// query shape (it never misses one), the caller then does its
+// exact test on just those.
+//
+// Usage:
+// SpatialGrid grid(5.0f);				// 5 units per cell
+//
+// grid.Insert(id, x, z, radius);		// When it spawns
+// grid.Move(id, x, z);				// When it moves
+// grid.Remove(id);					// When it despawns
+//
+// std::vector<int> found;
+// grid.QueryRadius(x, z, r, found);	// Everything overlapping the circle
+// grid.QueryBox(minX, minZ, maxX, maxZ, found);
+// if (grid.AnyWithin(x, z, r)) ...	// Stops at the first hit
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <unordered_map>
+#include <vector>
+
+class SpatialGrid
+{
+public:
+	// Inserts an entity, if the id is already in the grid it is moved instead
+	void Insert(int id, float x, float z, float radius);
+	void Move(int id, float x, float z);	// Moves an entity to a new spot
+	void Remove(int id);					// Takes an entity out of the grid
+	void Clear();							// Takes everything out (keeps the memory)
+	bool Contains(int id) const;			// True if the id is in the grid
+	int Count() const;						// Entities in the grid
+
+	// Adds the ids of every entity whose circle touches the circle (x, z, radius) to found
+	void QueryRadius(float x, float z, float radius, std::vector<int> &found) const;
+	// Adds the ids of every entity whose circle touches the box to found
+	void QueryBox(float minX, float minZ, float maxX, float maxZ, std::vector<int> &found) const;
+	// True if any entity's center is closer than distance to (x, z)
+	bool AnyWithin(float x, float z, float distance) const;
+
+	float CellSize() const;
+	SpatialGrid(float cellSize = 5.0f);		// Constructor
+	virtual ~SpatialGrid();					// Destructor
+
+private:
+	// Where an entity is
+	struct Entry {
+		float x;
+		float z;
+		float radius;
+		long long cell;		// The key of the cell it is filed under
+		int slot;			// Its place in that cell's list (-1 if it isn't in the grid)
+	};
+
+	long long CellKey(int cx, int cz) const;	// Packs the cell coordinates into one key
+	int CellCoord(float v) const;				// The cell a coordinate falls in
+	void Link(int id);							// Files the entity under its cell
+	void Unlink(int id);						// Takes the entity out of its cell
+
+	std::vector<Entry> entries;						// Indexed by id
+	std::unordered_map<long long, std::vector<int> > cells;	// The ids in every cell
+	float cellSize;
+	float invCellSize;
+	float maxRadius;		// The biggest entity, queries are grown by this much
+	int count;
+};
+
+#endif // SPATIALGRID_H
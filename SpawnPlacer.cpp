@@ -0,0 +1,313 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Spawn Placement
+//
+// SpawnPlacer.cpp: implementation of the SpawnPlacer class.
+// See SpawnPlacer.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "SpawnPlacer.h"
+
+#include <math.h>
+
+#define PLACER_PI	3.14159265358979323846f
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+SpawnPlacer::SpawnPlacer()
+{
+	triesPerPoint = 30;
+	dartTries = 8;
+	maxTries = 30 * 16;
+	lastTries = 0;
+
+	Reset(0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0);
+}
+
+SpawnPlacer::~SpawnPlacer()
+{
+
+}
+
+void SpawnPlacer::Reset(float minX, float minZ, float maxX, float maxZ, float minDistance, unsigned int seed)
+{
+	if (minDistance <= 0.0f)
+		minDistance = 1.0f;
+
+	this->minX = minX;
+	this->minZ = minZ;
+	this->maxX = maxX;
+	this->maxZ = maxZ;
+	this->minDistance = minDistance;
+
+	engine.seed(seed);
+
+	cellSize = minDistance / sqrtf(2.0f);
+	cellsX = (int)ceilf((maxX - minX) / cellSize) + 1;
+	cellsZ = (int)ceilf((maxZ - minZ) / cellSize) + 1;
+
+	grid.assign(cellsX * cellsZ, -1);
+	points.clear();
+	active.clear();
+	lastTries = 0;
+}
+
+void SpawnPlacer::SetExclusion(Exclusion exclusion)
+{
+	this->exclusion = exclusion;
+}
+
+int SpawnPlacer::CellIndex(float x, float z) const
+{
+	if (x < minX || x > maxX || z < minZ || z > maxZ)
+		return -1;
+
+	int cx = (int)((x - minX) / cellSize);
+	int cz = (int)((z - minZ) / cellSize);
+	return cz * cellsX + cx;
+}
+
+bool SpawnPlacer::IsFree(float x, float z) const
+{
+	int cell = CellIndex(x, z);
+	if (cell < 0)
+		return false;
+
+	if (exclusion && exclusion(x, z))
+		return false;
+
+	// A point closer than minDistance can only be within 2 cells
+	int cx = cell % cellsX;
+	int cz = cell / cellsX;
+	for (int j = cz - 2; j <= cz + 2; j++)
+	{
+		if (j < 0 || j >= cellsZ)
+			continue;
+
+		for (int i = cx - 2; i <= cx + 2; i++)
+		{
+			if (i < 0 || i >= cellsX)
+				continue;
+
+			int p = grid[j * cellsX + i];
+			if (p < 0)
+				continue;
+
+			float dx = points[p * 2] - x;
+			float dz = points[p * 2 + 1] - z;
+			if (dx * dx + dz * dz < minDistance * minDistance)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void SpawnPlacer::Add(float x, float z)
+{
+	int index = (int)points.size() / 2;
+	points.push_back(x);
+	points.push_back(z);
+	grid[CellIndex(x, z)] = index;
+	active.push_back(index);
+}
+
+bool SpawnPlacer::Insert(float x, float z)
+{
+	if (!IsFree(x, z))
+		return false;
+
+	Add(x, z);
+	return true;
+}
+
+bool SpawnPlacer::Remove(float x, float z)
+{
+	int cell = CellIndex(x, z);
+	if (cell < 0)
+		return false;
+
+	// The nearest point, it can only be within 2 cells
+	int cx = cell % cellsX;
+	int cz = cell / cellsX;
+	int found = -1;
+	float best = minDistance * minDistance;
+	for (int j = cz - 2; j <= cz + 2; j++)
+	{
+		if (j < 0 || j >= cellsZ)
+			continue;
+
+		for (int i = cx - 2; i <= cx + 2; i++)
+		{
+			if (i < 0 || i >= cellsX)
+				continue;
+
+			int p = grid[j * cellsX + i];
+			if (p < 0)
+				continue;
+
+			float dx = points[p * 2] - x;
+			float dz = points[p * 2 + 1] - z;
+			if (dx * dx + dz * dz < best)
+			{
+				best = dx * dx + dz * dz;
+				found = p;
+			}
+		}
+	}
+
+	if (found < 0)
+		return false;
+
+	float fx = points[found * 2];
+	float fz = points[found * 2 + 1];
+	grid[CellIndex(fx, fz)] = -1;
+	for (size_t i = 0; i < active.size(); i++)
+	{
+		if (active[i] == found)
+		{
+			active[i] = active.back();
+			active.pop_back();
+			break;
+		}
+	}
+
+	// The last point takes over its index so the points stay packed
+	int last = NumPoints() - 1;
+	if (found != last)
+	{
+		points[found * 2] = points[last * 2];
+		points[found * 2 + 1] = points[last * 2 + 1];
+		grid[CellIndex(points[found * 2], points[found * 2 + 1])] = found;
+		for (size_t i = 0; i < active.size(); i++)
+		{
+			if (active[i] == last)
+				active[i] = found;
+		}
+	}
+	points.resize(last * 2);
+
+	// Points that were retired next to it (up to 2 minDistance away, 3 cells) may have room now
+	cell = CellIndex(fx, fz);
+	cx = cell % cellsX;
+	cz = cell / cellsX;
+	for (int j = cz - 3; j <= cz + 3; j++)
+	{
+		if (j < 0 || j >= cellsZ)
+			continue;
+
+		for (int i = cx - 3; i <= cx + 3; i++)
+		{
+			if (i < 0 || i >= cellsX)
+				continue;
+
+			int p = grid[j * cellsX + i];
+			if (p < 0)
+				continue;
+
+			float dx = points[p * 2] - fx;
+			float dz = points[p * 2 + 1] - fz;
+			if (dx * dx + dz * dz >= 4.0f * minDistance * minDistance)
+				continue;
+
+			bool isActive = false;
+			for (size_t k = 0; k < active.size() && !isActive; k++)
+				isActive = active[k] == p;
+			if (!isActive)
+				active.push_back(p);
+		}
+	}
+
+	return true;
+}
+
+bool SpawnPlacer::Place(float &x, float &z)
+{
+	lastTries = 0;
+
+	// A few darts anywhere first so a sparse level is spread out instead of growing from one spot
+	for (int i = 0; i < dartTries || (active.empty() && lastTries < maxTries); i++)
+	{
+		lastTries++;
+		float cx = RandomFloat(minX, maxX);
+		float cz = RandomFloat(minZ, maxZ);
+		if (IsFree(cx, cz))
+		{
+			Add(cx, cz);
+			x = cx;
+			z = cz;
+			return true;
+		}
+	}
+
+	while (lastTries < maxTries && !active.empty())
+	{
+		// Try around a random active point, in the ring 1 to 2 minDistance out
+		int slot = RandomInt(0, (int)active.size() - 1);
+		int p = active[slot];
+		float px = points[p * 2];
+		float pz = points[p * 2 + 1];
+
+		for (int k = 0; k < triesPerPoint && lastTries < maxTries; k++)
+		{
+			lastTries++;
+			float angle = RandomFloat(0.0f, 2.0f * PLACER_PI);
+			float radius = minDistance * sqrtf(RandomFloat(1.0f, 4.0f));	// Even over the ring's area
+			float cx = px + cosf(angle) * radius;
+			float cz = pz + sinf(angle) * radius;
+
+			if (IsFree(cx, cz))
+			{
+				Add(cx, cz);
+				x = cx;
+				z = cz;
+				return true;
+			}
+
+			// Retire the point once all of its tries have failed
+			if (k == triesPerPoint - 1)
+			{
+				active[slot] = active.back();
+				active.pop_back();
+			}
+		}
+	}
+
+	// Out of tries, or nothing is active any more and the area is full
+	return false;
+}
+
+int SpawnPlacer::RandomInt(int min, int max)
+{
+	std::uniform_int_distribution<int> distribution(min, max);
+	return distribution(engine);
+}
+
+float SpawnPlacer::RandomFloat(float min, float max)
+{
+	std::uniform_real_distribution<float> distribution(min, max);
+	return distribution(engine);
+}
+
+std::mt19937 &SpawnPlacer::Engine()
+{
+	return engine;
+}
+
+bool SpawnPlacer::Full() const
+{
+	return !points.empty() && active.empty();
+}
+
+int SpawnPlacer::NumPoints() const
+{
+	return (int)points.size() / 2;
+}
+
+int SpawnPlacer::LastTries() const
+{
+	return lastTries;
+}
@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Spawn Placement
+//
+// SpawnPlacer.h: interface for the SpawnPlacer class.
+// This class picks where new things spawn so that no two of them
+// are closer than a minimum distance and nothing lands in an
+// excluded area (like inside the cave).
+//
+// It uses Bridson's Poisson disk sampling: every placed point
+// stays "active" until 30 tries around it (between 1 and 2 times
+// the minimum distance away) have all failed. A placement first
+// throws a few darts anywhere in the area (so a sparse level is
+// spread out), then grows new points out of the active ones, so
+// a crowded area fills up evenly and the placer knows when it is
+// full instead of trying forever. Checking a candidate only looks
+// at the few cells of a background grid around it (the cells are
+// small enough to hold one point each).
+//
+// Every placement makes at most a fixed number of tries, so it
+// takes bounded time even on a crowded map. Place() returns false
+// when no spot was found in that many tries, the next call carries
+// on where it left off. Full() says when there is no room at all.
+//
+// Remove() gives a spot back when whatever was there is gone (or
+// has moved off it). The points around it become active again, so
+// the room it leaves is found by the next placements.
+//
+// All of the randomness comes from one engine seeded once, so the
+// same seed always gives the same level.
+//
+// Usage:
+// SpawnPlacer placer;
+//
+// placer.Reset(minX, minZ, maxX, maxZ, minDistance, seed);
+// placer.SetExclusion(isBlocked);		// bool isBlocked(float x, float z)
+//
+// float x, z;
+// if (placer.Place(x, z)) ...			// Somewhere free
+// placer.Remove(x, z);					// It's free again
+//
+// int n = placer.RandomInt(1, 6);		// The same engine for anything else
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef SPAWNPLACER_H
+#define SPAWNPLACER_H
+
+#include <functional>
+#include <random>
+#include <vector>
+
+class SpawnPlacer
+{
+public:
+	typedef std::function<bool(float, float)> Exclusion;
+
+	int triesPerPoint;		// Tries around an active point before it is retired (Bridson's k)
+	int dartTries;			// Tries anywhere in the area before growing from the active points
+	int maxTries;			// Most candidates Place() looks at before it gives up
+
+	// Forgets every point and starts over on the area [minX, maxX] x [minZ, maxZ]
+	void Reset(float minX, float minZ, float maxX, float maxZ, float minDistance, unsigned int seed);
+	void SetExclusion(Exclusion exclusion);		// Spots it returns true for are never used
+	bool Place(float &x, float &z);				// Finds a free spot and takes it, false if there is none
+	bool Insert(float x, float z);				// Takes a spot picked by someone else, false if it is too close
+	bool Remove(float x, float z);				// Gives back the point nearest (x, z) (closer than the minimum distance), false if there isn't one
+	bool IsFree(float x, float z) const;		// True if a point could go here
+
+	int RandomInt(int min, int max);			// Uniform in [min, max]
+	float RandomFloat(float min, float max);	// Uniform in [min, max)
+	std::mt19937 &Engine();						// The engine itself
+
+	bool Full() const;							// True once every point has been retired (nothing fits anywhere)
+	int NumPoints() const;						// Points placed so far
+	int LastTries() const;						// Candidates the last Place() looked at
+	SpawnPlacer();								// Constructor
+	virtual ~SpawnPlacer();						// Destructor
+
+private:
+	int CellIndex(float x, float z) const;		// The grid cell of a point, -1 if it's outside
+	void Add(float x, float z);					// Stores a point and makes it active
+
+	std::mt19937 engine;
+	Exclusion exclusion;
+
+	float minX, minZ, maxX, maxZ;
+	float minDistance;
+	float cellSize;				// minDistance / sqrt(2), so a cell can only hold one point
+	int cellsX, cellsZ;
+	std::vector<int> grid;		// Point index per cell, -1 if empty
+	std::vector<float> points;	// x, z of every point
+	std::vector<int> active;	// Points that may still have room around them
+	int lastTries;
+};
+
+#endif // SPAWNPLACER_H
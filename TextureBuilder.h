@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include "glew.h"
-#include "glaux.h"
+#include "ImageDecoder.h"
+#include "MipmapBuilder.h"
+#include <windows.h>
+#include <GL/glu.h>
 
 #pragma comment(lib, "glew32.lib")
-#pragma comment(lib, "glaux.lib")
 
 void loadPPM(GLuint *textureID, char *strFileName, int width, int height, int wrap) {
 	BYTE *data;
@@ -21,7 +23,7 @@ void loadPPM(GLuint *textureID, char *strFileName, int width, int height, int wr
 
 	glGenTextures(1, textureID);
 	glBindTexture(GL_TEXTURE_2D, *textureID);
-	gluBuild2DMipmaps(GL_TEXTURE_2D, 3, width, height, GL_RGB, GL_UNSIGNED_BYTE, data);
+	MipmapBuilder::Upload(data, width, height, 3);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap ? GL_REPEAT : GL_CLAMP);
@@ -32,30 +34,19 @@ void loadPPM(GLuint *textureID, char *strFileName, int width, int height, int wr
 }
 
 void loadBMP(GLuint *textureID, char *strFileName, int wrap) {
-	AUX_RGBImageRec *pBitmap = NULL;
-	FILE *pFile = NULL;
-
-	fopen_s(&pFile, strFileName, "r");
-	if (pFile) {
-		pBitmap = auxDIBImageLoadA(strFileName);
-	}
-	else {
+	ImageDecoder decoder;
+	ImageInfo info;
+	unsigned char *pixels = decoder.DecodeFile(strFileName, info);
+	if (!pixels) {
 		MessageBoxA(NULL, "Texture file not found!", "Error!", MB_OK);
 		exit(EXIT_FAILURE);
 	}
 
 	glGenTextures(1, textureID);
 	glBindTexture(GL_TEXTURE_2D, *textureID);
-	gluBuild2DMipmaps(GL_TEXTURE_2D, 3, pBitmap->sizeX, pBitmap->sizeY, GL_RGB, GL_UNSIGNED_BYTE, pBitmap->data);
+	MipmapBuilder::Upload(pixels, info.width, info.height, info.channels);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap ? GL_REPEAT : GL_CLAMP);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap ? GL_REPEAT : GL_CLAMP);
-
-	if (pBitmap) {
-		if (pBitmap->data) {
-			free(pBitmap->data);
-		}
-		free(pBitmap);
-	}
 }
\ No newline at end of file
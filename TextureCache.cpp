@@ -0,0 +1,523 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Cache
+//
+// TextureCache.cpp: implementation of the TextureCache class.
+// See TextureCache.h for what it keeps and how.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "TextureCache.h"
+#include "ImageDecoder.h"
+#include "MipmapBuilder.h"
+#include "TextureManager.h"
+
+#include <windows.h>
+#include "glew.h"
+#include <gl\glu.h>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Bump when the layout of a chain changes, the old ones are built again
+#define CACHE_VERSION 1
+
+// What a cache file starts with, the levels follow
+struct CacheHeader {
+	char magic[4];					// "MIPC"
+	unsigned int version;			// CACHE_VERSION
+	unsigned long long source;		// Hash of the file it was built from
+	int width;
+	int height;
+	int channels;
+	int levels;
+};
+
+// The whole chain's size: each level is max(1, side / 2) a side of the one above
+static size_t ChainBytes(int width, int height, int channels, int levels)
+{
+	size_t bytes = 0;
+	for (int level = 0; level < levels; level++)
+	{
+		bytes += (size_t)width * height * channels;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+
+	return bytes;
+}
+
+// The whole file, empty if it can't be read
+static std::vector<unsigned char> ReadWholeFile(const char *name)
+{
+	std::vector<unsigned char> data;
+	FILE *file = fopen(name, "rb");
+	if (!file)
+		return data;
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (length > 0)
+	{
+		data.resize(length);
+		data.resize(fread(&data[0], 1, length, file));
+	}
+	fclose(file);
+	return data;
+}
+
+static double ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Chain
+//////////////////////////////////////////////////////////////////////
+
+TextureCache::Chain::Chain()
+{
+	width = 0;
+	height = 0;
+	channels = 0;
+	levels = 0;
+	pixels = 0;
+	file = 0;
+	mapping = 0;
+	view = 0;
+}
+
+TextureCache::Chain::~Chain()
+{
+	Reset();
+}
+
+void TextureCache::Chain::Reset()
+{
+	if (view)
+		UnmapViewOfFile(view);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+
+	std::vector<unsigned char>().swap(built);
+	width = 0;
+	height = 0;
+	channels = 0;
+	levels = 0;
+	pixels = 0;
+	file = 0;
+	mapping = 0;
+	view = 0;
+}
+
+const unsigned char *TextureCache::Chain::Level(int level, int &width, int &height) const
+{
+	width = this->width;
+	height = this->height;
+
+	size_t offset = 0;
+	for (int i = 0; i < level; i++)
+	{
+		offset += (size_t)width * height * channels;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+
+	return pixels + offset;
+}
+
+size_t TextureCache::Chain::Bytes() const
+{
+	return ChainBytes(width, height, channels, levels);
+}
+
+void TextureCache::Chain::Upload() const
+{
+	GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// A card that can't take these sides gets the image scaled up the old way, as MipmapBuilder::Upload() does
+	if (!MipmapBuilder::SidesSupported(width, height))
+	{
+		gluBuild2DMipmaps(GL_TEXTURE_2D, format, width, height, format, GL_UNSIGNED_BYTE, pixels);
+		return;
+	}
+
+	for (int level = 0; level < levels; level++)
+	{
+		int w, h;
+		const unsigned char *data = Level(level, w, h);
+		glTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, format, GL_UNSIGNED_BYTE, data);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+TextureCache::TextureCache()
+{
+	memset(&stats, 0, sizeof(stats));
+	jobs = 0;
+}
+
+TextureCache::~TextureCache()
+{
+
+}
+
+TextureCache &TextureCache::Shared()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Hashing
+//////////////////////////////////////////////////////////////////////
+
+static const unsigned long long PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const unsigned long long PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const unsigned long long PRIME64_3 = 0x165667B19E3779F9ULL;
+static const unsigned long long PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const unsigned long long PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static unsigned long long Rotate(unsigned long long x, int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+static unsigned long long Read64(const unsigned char *p)
+{
+	unsigned long long x;
+	memcpy(&x, p, 8);
+	return x;
+}
+
+static unsigned long long Read32(const unsigned char *p)
+{
+	unsigned int x;
+	memcpy(&x, p, 4);
+	return x;
+}
+
+// One lane's step: mix 8 more bytes in
+static unsigned long long Round(unsigned long long acc, unsigned long long input)
+{
+	acc += input * PRIME64_2;
+	acc = Rotate(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static unsigned long long MergeRound(unsigned long long acc, unsigned long long lane)
+{
+	acc ^= Round(0, lane);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+unsigned long long TextureCache::Hash(const void *data, size_t size, unsigned long long seed)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + size;
+	unsigned long long hash;
+
+	// Four lanes of 8 bytes, 32 bytes a step
+	if (size >= 32)
+	{
+		unsigned long long v1 = seed + PRIME64_1 + PRIME64_2;
+		unsigned long long v2 = seed + PRIME64_2;
+		unsigned long long v3 = seed;
+		unsigned long long v4 = seed - PRIME64_1;
+
+		const unsigned char *limit = end - 32;
+		do
+		{
+			v1 = Round(v1, Read64(p));
+			v2 = Round(v2, Read64(p + 8));
+			v3 = Round(v3, Read64(p + 16));
+			v4 = Round(v4, Read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		hash = Rotate(v1, 1) + Rotate(v2, 7) + Rotate(v3, 12) + Rotate(v4, 18);
+		hash = MergeRound(hash, v1);
+		hash = MergeRound(hash, v2);
+		hash = MergeRound(hash, v3);
+		hash = MergeRound(hash, v4);
+	}
+	else
+	{
+		hash = seed + PRIME64_5;
+	}
+
+	hash += size;
+
+	// The tail: 8, then 4, then 1 byte at a time
+	for (; p + 8 <= end; p += 8)
+	{
+		hash ^= Round(0, Read64(p));
+		hash = Rotate(hash, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (p + 4 <= end)
+	{
+		hash ^= Read32(p) * PRIME64_1;
+		hash = Rotate(hash, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++)
+	{
+		hash ^= *p * PRIME64_5;
+		hash = Rotate(hash, 11) * PRIME64_1;
+	}
+
+	// Every bit of the input reaches every bit of the hash
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+//////////////////////////////////////////////////////////////////////
+// The cache
+//////////////////////////////////////////////////////////////////////
+
+bool TextureCache::Open(const char *folder, JobSystem *jobs)
+{
+	this->jobs = jobs;
+
+	// Made if it isn't there (failing because it is is fine)
+	CreateDirectoryA(folder, 0);
+
+	struct stat info;
+	if (stat(folder, &info) != 0 || !(info.st_mode & S_IFDIR))
+	{
+		printf("TextureCache: can't make %s, textures won't be cached\n", folder);
+		return false;
+	}
+
+	this->folder = folder;
+	return true;
+}
+
+bool TextureCache::IsOpen() const
+{
+	return !folder.empty();
+}
+
+bool TextureCache::Get(const char *path, Chain &chain)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	chain.Reset();
+
+	// The hash needs all of the file, and so does the decoder if it isn't cached
+	std::vector<unsigned char> data = ReadWholeFile(path);
+	if (data.empty())
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stats.failed++;
+		return false;
+	}
+
+	unsigned long long hash = Hash(&data[0], data.size());
+	std::string key = TextureManager::NormalizePath(path);
+	std::string name;
+	if (IsOpen())
+	{
+		name = EntryName(key, hash);
+		if (Map(name, hash, chain))
+		{
+			double ms = ElapsedMs(start);
+			std::lock_guard<std::mutex> guard(lock);
+			stats.hits++;
+			stats.hitMs += ms;
+			return true;
+		}
+	}
+
+	// Decoded straight into the chain, then the levels below it built and put after it
+	ImageDecoder decoder;
+	ImageInfo info;
+	if (!decoder.ReadInfo(&data[0], data.size(), info))
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stats.failed++;
+		return false;
+	}
+
+	int levels = MipmapBuilder::LevelCount(info.width, info.height);
+	size_t top = (size_t)info.width * info.height * info.channels;
+	chain.built.resize(ChainBytes(info.width, info.height, info.channels, levels));
+	if (!decoder.DecodeInto(&data[0], data.size(), &chain.built[0], top, info))
+	{
+		chain.Reset();
+		std::lock_guard<std::mutex> guard(lock);
+		stats.failed++;
+		return false;
+	}
+
+	MipmapBuilder mipmaps;
+	mipmaps.Build(&chain.built[0], info.width, info.height, info.channels, false, jobs);
+	size_t offset = top;
+	for (int level = 1; level < levels; level++)
+	{
+		int w, h;
+		const unsigned char *pixels = mipmaps.Level(level, w, h);
+		size_t bytes = (size_t)w * h * info.channels;
+		memcpy(&chain.built[offset], pixels, bytes);
+		offset += bytes;
+	}
+
+	chain.width = info.width;
+	chain.height = info.height;
+	chain.channels = info.channels;
+	chain.levels = levels;
+	chain.pixels = &chain.built[0];
+
+	if (IsOpen())
+		Store(key, name, hash, chain);
+
+	double ms = ElapsedMs(start);
+	std::lock_guard<std::mutex> guard(lock);
+	stats.misses++;
+	stats.missMs += ms;
+	return true;
+}
+
+int TextureCache::Clear()
+{
+	if (!IsOpen())
+		return 0;
+
+	char pattern[MAX_PATH];
+	sprintf_s(pattern, sizeof(pattern), "%s/*", folder.c_str());
+
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA(pattern, &found);
+	if (find == INVALID_HANDLE_VALUE)
+		return 0;
+
+	int deleted = 0;
+	do
+	{
+		const char *ext = strrchr(found.cFileName, '.');
+		if (!ext || _stricmp(ext, ".mip") != 0)
+			continue;
+
+		std::string name = folder + "/" + found.cFileName;
+		if (remove(name.c_str()) == 0)
+			deleted++;
+	} while (FindNextFileA(find, &found));
+
+	FindClose(find);
+	return deleted;
+}
+
+std::string TextureCache::EntryName(const std::string &key, unsigned long long hash) const
+{
+	// The path's hash, then the contents' (the first part finds the file's old chains)
+	char name[40];
+	sprintf_s(name, sizeof(name), "%08x-%016llx.mip", (unsigned int)Hash(key.data(), key.size()), hash);
+	return folder + "/" + name;
+}
+
+bool TextureCache::Map(const std::string &name, unsigned long long hash, Chain &chain)
+{
+	HANDLE file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = 0;
+	const void *view = 0;
+	if (GetFileSizeEx(file, &size) && size.QuadPart >= (LONGLONG)sizeof(CacheHeader))
+		mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (mapping)
+		view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	// Built from this very file, by this version, and all there
+	const CacheHeader *header = (const CacheHeader *)view;
+	bool good = header && memcmp(header->magic, "MIPC", 4) == 0 && header->version == CACHE_VERSION && header->source == hash &&
+		header->width > 0 && header->height > 0 && (header->channels == 3 || header->channels == 4) &&
+		header->levels == MipmapBuilder::LevelCount(header->width, header->height) &&
+		(size_t)size.QuadPart == sizeof(CacheHeader) + ChainBytes(header->width, header->height, header->channels, header->levels);
+
+	chain.file = file;
+	chain.mapping = mapping;
+	chain.view = view;
+	if (!good)
+	{
+		chain.Reset();
+		return false;
+	}
+
+	chain.width = header->width;
+	chain.height = header->height;
+	chain.channels = header->channels;
+	chain.levels = header->levels;
+	chain.pixels = (const unsigned char *)view + sizeof(CacheHeader);
+	return true;
+}
+
+void TextureCache::Store(const std::string &key, const std::string &name, unsigned long long hash, const Chain &chain)
+{
+	CacheHeader header;
+	memcpy(header.magic, "MIPC", 4);
+	header.version = CACHE_VERSION;
+	header.source = hash;
+	header.width = chain.width;
+	header.height = chain.height;
+	header.channels = chain.channels;
+	header.levels = chain.levels;
+
+	// Written under a name of its own first, so a chain that's half written is never mapped
+	char temp[MAX_PATH];
+	sprintf_s(temp, sizeof(temp), "%s.%lu.tmp", name.c_str(), (unsigned long)GetCurrentThreadId());
+	FILE *file = fopen(temp, "wb");
+	if (!file)
+		return;
+
+	size_t bytes = chain.Bytes();
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(chain.pixels, 1, bytes, file) == bytes;
+	if (fclose(file) != 0)
+		written = false;
+	if (!written)
+	{
+		remove(temp);
+		return;
+	}
+
+	// The file's old chains (it's changed since they were built) make way for it
+	char pattern[MAX_PATH];
+	sprintf_s(pattern, sizeof(pattern), "%s/*", folder.c_str());
+	std::string prefix = name.substr(folder.size() + 1, 9);
+
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA(pattern, &found);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			const char *ext = strrchr(found.cFileName, '.');
+			if (ext && _stricmp(ext, ".mip") == 0 && strncmp(found.cFileName, prefix.c_str(), prefix.size()) == 0)
+				remove((folder + "/" + found.cFileName).c_str());
+		} while (FindNextFileA(find, &found));
+
+		FindClose(find);
+	}
+
+	if (rename(temp, name.c_str()) != 0)
+	{
+		remove(temp);
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	stats.stored++;
+}
@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Cache
+//
+// TextureCache.h: interface for the TextureCache class.
+// Every launch decoded every bitmap, targa and png again and built
+// every mipmap level again, though the files hardly ever change. This
+// class keeps the result on disk: the whole mip chain of each file,
+// decoded and laid out the way glTexImage2D takes it (RGB or RGBA,
+// bottom row first, the levels one after the other), in a folder of
+// its own.
+//
+// A chain is found by the file's path and a hash of what's in it
+// (XXH64, which reads 32 bytes a step and costs far less than even
+// reading the file). A file that's been changed hashes differently,
+// so its old chain isn't found; it is built again and the old one
+// deleted when the new one is written. Getting a cached chain maps
+// the file into memory (nothing is copied) and hands out pointers
+// into it, so uploading it is the only work left.
+//
+// Without Open() nothing is cached: Get() decodes the file and
+// builds the chain every time, the way it was done before.
+//
+// The cache file is a small header (the size, the channels, the
+// levels and the source's hash) and then the levels.
+//
+// Usage:
+// TextureCache &cache = TextureCache::Shared();
+//
+// cache.Open("texcache", &jobs);				// Once, the folder is made if it isn't there
+//
+// TextureCache::Chain chain;
+// if (cache.Get("models/snake/skin.bmp", chain))	// Any thread
+// {
+//		glBindTexture(GL_TEXTURE_2D, id);
+//		chain.Upload();							// GL thread
+// }
+// printf("%d from the cache in %.1f ms\n", cache.stats.hits, cache.stats.hitMs);
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+class TextureCache
+{
+public:
+	// What Get() did since the cache was made
+	struct Stats {
+		int hits;				// Chains mapped from the cache
+		int misses;				// Chains built from the file
+		int stored;				// Chains written to the cache
+		int failed;				// Files that couldn't be read or decoded
+		double hitMs;			// Time the hits took (reading and hashing the file, mapping the chain)
+		double missMs;			// Time the misses took (decoding, building and writing the chain)
+	};
+
+	// A file's mip chain, mapped from the cache or built in memory
+	class Chain
+	{
+	public:
+		int width;
+		int height;
+		int channels;			// 3: RGB, 4: RGBA
+		int levels;				// Down to 1x1, the image itself included
+
+		const unsigned char *Level(int level, int &width, int &height) const;	// Level 0 is the image
+		size_t Bytes() const;	// Every level
+		void Upload() const;	// Every level to the bound GL_TEXTURE_2D (GL thread only), scaled up if the card needs it
+		void Reset();			// Unmaps it or frees it
+
+		Chain();				// Constructor (empty)
+		virtual ~Chain();		// Destructor
+
+	private:
+		friend class TextureCache;
+
+		const unsigned char *pixels;	// Level 0, the others after it
+		std::vector<unsigned char> built;	// What pixels points into if it was built here
+		void *file;				// The cache file, mapping and view if it was mapped
+		void *mapping;
+		const void *view;
+
+		Chain(const Chain &);	// Not copyable, it may hold a mapping
+		Chain &operator=(const Chain &);
+	};
+
+	Stats stats;
+
+	static TextureCache &Shared();	// The one GLTexture and the TextureStreamer use
+	// A hash of the data (XXH64), the same on every machine
+	static unsigned long long Hash(const void *data, size_t size, unsigned long long seed = 0);
+
+	bool Open(const char *folder, JobSystem *jobs = 0);	// Caches chains in the folder (made if needed), jobs build them, false if it can't be made
+	bool IsOpen() const;			// True: Open() worked
+	// The file's chain (any thread), from the cache or built (and stored, if open), false if the file can't be read or decoded
+	bool Get(const char *path, Chain &chain);
+	int Clear();					// Deletes every chain in the folder, how many were deleted
+
+	TextureCache();					// Constructor
+	virtual ~TextureCache();		// Destructor
+
+private:
+	std::string EntryName(const std::string &key, unsigned long long hash) const;	// The file a chain is stored in
+	bool Map(const std::string &name, unsigned long long hash, Chain &chain);	// Maps a stored chain, false if there's none (or it's bad)
+	void Store(const std::string &key, const std::string &name, unsigned long long hash, const Chain &chain);	// Writes it, deleting the file's old chains
+
+	std::string folder;				// Empty until Open()
+	JobSystem *jobs;
+	std::mutex lock;				// Guards stats, Get() is called from the workers
+};
+
+#endif // TEXTURECACHE_H
@@ -0,0 +1,442 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Compressor
+//
+// TextureCompressor.cpp: implementation of the TextureCompressor class.
+// See TextureCompressor.h for how to use it.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "TextureCompressor.h"
+#include "MipmapBuilder.h"
+
+#include <windows.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+TextureCompressor::TextureCompressor()
+{
+	verbose = true;
+	memset(&stats, 0, sizeof(stats));
+}
+
+TextureCompressor::~TextureCompressor()
+{
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Blocks
+//////////////////////////////////////////////////////////////////////
+
+// A float RGB color to 5:6:5, rounded
+static unsigned short To565(const float *c)
+{
+	int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+	r = r < 0 ? 0 : r > 31 ? 31 : r;
+	g = g < 0 ? 0 : g > 63 ? 63 : g;
+	b = b < 0 ? 0 : b > 31 ? 31 : b;
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+// And back the way the card expands it
+static void From565(unsigned short c, int *out)
+{
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+// The four colors two end points make, and the nearest of them to every pixel (2 bits each)
+static unsigned int PickColorIndices(const unsigned char *block, unsigned short c0, unsigned short c1)
+{
+	int palette[4][3];
+	From565(c0, palette[0]);
+	From565(c1, palette[1]);
+	for (int k = 0; k < 3; k++)
+	{
+		palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+		palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+	}
+
+	unsigned int indices = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		const unsigned char *p = block + i * 4;
+		int best = 0, bestDistance = 0x7FFFFFFF;
+		for (int j = 0; j < 4; j++)
+		{
+			int dr = p[0] - palette[j][0], dg = p[1] - palette[j][1], db = p[2] - palette[j][2];
+			int distance = dr * dr + dg * dg + db * db;
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				best = j;
+			}
+		}
+		indices |= best << (i * 2);
+	}
+	return indices;
+}
+
+// Where each index falls between the first end point (0) and the second (1)
+static const float INDEX_WEIGHT[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+void TextureCompressor::EncodeBC1(const unsigned char *block, unsigned char *out)
+{
+	// The mean color and how the colors spread around it
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int k = 0; k < 3; k++)
+			mean[k] += block[i * 4 + k];
+	for (int k = 0; k < 3; k++)
+		mean[k] /= 16.0f;
+
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };	// rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++)
+	{
+		float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	// The principal axis by a few rounds of power iteration
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iter = 0; iter < 4; iter++)
+	{
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float length = sqrtf(x * x + y * y + z * z);
+		if (length < 1e-6f)
+			break;
+		axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+	}
+
+	// The end points are the colors furthest out along it
+	float lo = 1e30f, hi = -1e30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+		if (t < lo) lo = t;
+		if (t > hi) hi = t;
+	}
+
+	float end0[3], end1[3];
+	for (int k = 0; k < 3; k++)
+	{
+		end0[k] = mean[k] + axis[k] * hi;
+		end1[k] = mean[k] + axis[k] * lo;
+	}
+
+	unsigned short c0 = To565(end0), c1 = To565(end1);
+	unsigned int indices = PickColorIndices(block, c0, c1);
+
+	// Then the end points that best fit the indices they got (least squares), if that's solvable
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+	{
+		float t = INDEX_WEIGHT[(indices >> (i * 2)) & 3];
+		float s = 1.0f - t;
+		aa += s * s; ab += s * t; bb += t * t;
+		for (int k = 0; k < 3; k++)
+		{
+			ax[k] += s * block[i * 4 + k];
+			bx[k] += t * block[i * 4 + k];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) > 1e-4f)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			end0[k] = (ax[k] * bb - bx[k] * ab) / det;
+			end1[k] = (bx[k] * aa - ax[k] * ab) / det;
+		}
+
+		unsigned short r0 = To565(end0), r1 = To565(end1);
+		if (r0 != c0 || r1 != c1)
+		{
+			c0 = r0;
+			c1 = r1;
+			indices = PickColorIndices(block, c0, c1);
+		}
+	}
+
+	// The four color mode needs c0 > c1: swapping the ends swaps indices 0<->1 and 2<->3
+	if (c0 < c1)
+	{
+		unsigned short t = c0; c0 = c1; c1 = t;
+		indices ^= 0x55555555;
+	}
+	else if (c0 == c1)
+		indices = 0;
+
+	out[0] = (unsigned char)c0; out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)c1; out[3] = (unsigned char)(c1 >> 8);
+	out[4] = (unsigned char)indices; out[5] = (unsigned char)(indices >> 8);
+	out[6] = (unsigned char)(indices >> 16); out[7] = (unsigned char)(indices >> 24);
+}
+
+void TextureCompressor::EncodeBC3(const unsigned char *block, unsigned char *out)
+{
+	// Eight alpha levels from the highest to the lowest in the block
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		int a = block[i * 4 + 3];
+		if (a > a0) a0 = a;
+		if (a < a1) a1 = a;
+	}
+
+	unsigned long long indices = 0;
+	if (a0 > a1)
+	{
+		int levels[8] = { a0, a1 };
+		for (int j = 1; j < 7; j++)
+			levels[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int a = block[i * 4 + 3];
+			int best = 0, bestDistance = 256;
+			for (int j = 0; j < 8; j++)
+			{
+				int distance = a > levels[j] ? a - levels[j] : levels[j] - a;
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = j;
+				}
+			}
+			indices |= (unsigned long long)best << (i * 3);
+		}
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(indices >> (b * 8));
+
+	EncodeBC1(block, out + 8);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Images
+//////////////////////////////////////////////////////////////////////
+
+// The DDS header fields and flags the loader reads
+static const unsigned int DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000;
+static const unsigned int DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+static const unsigned int DDPF_FOURCC = 0x4;
+static const unsigned int DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+
+static void Put32(std::vector<unsigned char> &out, unsigned int v)
+{
+	out.push_back((unsigned char)v);
+	out.push_back((unsigned char)(v >> 8));
+	out.push_back((unsigned char)(v >> 16));
+	out.push_back((unsigned char)(v >> 24));
+}
+
+bool TextureCompressor::Compress(const unsigned char *rgba, int width, int height, std::vector<unsigned char> &dds)
+{
+	if (width <= 0 || height <= 0)
+		return false;
+
+	bool alpha = false;
+	for (size_t i = 0; i < (size_t)width * height && !alpha; i++)
+		alpha = rgba[i * 4 + 3] != 255;
+
+	int levels = 1;
+	while ((width >> (levels - 1)) > 1 || (height >> (levels - 1)) > 1)
+		levels++;
+
+	int blockBytes = alpha ? 16 : 8;
+	size_t topSize = (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+
+	// The header
+	dds.clear();
+	dds.push_back('D'); dds.push_back('D'); dds.push_back('S'); dds.push_back(' ');
+	Put32(dds, 124);
+	Put32(dds, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE);
+	Put32(dds, height);
+	Put32(dds, width);
+	Put32(dds, (unsigned int)topSize);
+	Put32(dds, 0);								// Depth
+	Put32(dds, levels);
+	for (int i = 0; i < 11; i++)
+		Put32(dds, 0);
+	Put32(dds, 32);								// The pixel format's size
+	Put32(dds, DDPF_FOURCC);
+	dds.push_back('D'); dds.push_back('X'); dds.push_back('T'); dds.push_back(alpha ? '5' : '1');
+	for (int i = 0; i < 5; i++)
+		Put32(dds, 0);
+	Put32(dds, DDSCAPS_COMPLEX | DDSCAPS_TEXTURE | DDSCAPS_MIPMAP);
+	for (int i = 0; i < 4; i++)
+		Put32(dds, 0);
+
+	// Every level, halving as it goes
+	std::vector<unsigned char> level(rgba, rgba + (size_t)width * height * 4), next;
+	int w = width, h = height;
+	for (int l = 0; l < levels; l++)
+	{
+		for (int by = 0; by < h; by += 4)
+		{
+			for (int bx = 0; bx < w; bx += 4)
+			{
+				// Blocks off the edge repeat the last row and column
+				unsigned char block[64];
+				for (int y = 0; y < 4; y++)
+				{
+					int sy = by + y < h ? by + y : h - 1;
+					for (int x = 0; x < 4; x++)
+					{
+						int sx = bx + x < w ? bx + x : w - 1;
+						memcpy(block + (y * 4 + x) * 4, &level[((size_t)sy * w + sx) * 4], 4);
+					}
+				}
+
+				unsigned char out[16];
+				if (alpha)
+					EncodeBC3(block, out);
+				else
+					EncodeBC1(block, out);
+				dds.insert(dds.end(), out, out + blockBytes);
+			}
+		}
+
+		if (l + 1 < levels)
+		{
+			next.resize((size_t)(w > 1 ? w / 2 : 1) * (h > 1 ? h / 2 : 1) * 4);
+			MipmapBuilder::Halve(&level[0], w, h, 4, &next[0], false);
+			level.swap(next);
+			w = w > 1 ? w / 2 : 1;
+			h = h > 1 ? h / 2 : 1;
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Files
+//////////////////////////////////////////////////////////////////////
+
+bool TextureCompressor::CompressFile(const char *path)
+{
+	// The .dds goes beside the original, named the same
+	char out[MAX_PATH];
+	strncpy(out, path, sizeof(out) - 5);
+	out[sizeof(out) - 5] = '\0';
+	char *ext = strrchr(out, '.');
+	if (ext)
+		*ext = '\0';
+	strcat(out, ".dds");
+
+	struct stat source, compressed;
+	if (stat(path, &source) == 0 && stat(out, &compressed) == 0 && compressed.st_mtime >= source.st_mtime)
+	{
+		stats.upToDate++;
+		return true;
+	}
+
+	ImageInfo info;
+	unsigned char *pixels = decoder.DecodeFile(path, info);
+	if (!pixels)
+	{
+		if (verbose)
+			printf("%s: %s\n", path, decoder.Error());
+		stats.failed++;
+		return false;
+	}
+
+	// The blocks are made from RGBA
+	size_t count = (size_t)info.width * info.height;
+	rgba.resize(count * 4);
+	if (info.channels == 4)
+		memcpy(&rgba[0], pixels, count * 4);
+	else
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			rgba[i * 4] = pixels[i * 3];
+			rgba[i * 4 + 1] = pixels[i * 3 + 1];
+			rgba[i * 4 + 2] = pixels[i * 3 + 2];
+			rgba[i * 4 + 3] = 255;
+		}
+	}
+
+	Compress(&rgba[0], info.width, info.height, dds);
+
+	FILE *f = fopen(out, "wb");
+	if (!f || fwrite(&dds[0], 1, dds.size(), f) != dds.size())
+	{
+		if (f)
+			fclose(f);
+		if (verbose)
+			printf("%s: can't write %s\n", path, out);
+		stats.failed++;
+		return false;
+	}
+	fclose(f);
+
+	// Uncompressed it would have been RGBA plus a third for the mipmaps
+	size_t sourceBytes = count * 4 * 4 / 3;
+	size_t compressedBytes = dds.size() - 128;
+	stats.files++;
+	stats.sourceBytes += sourceBytes;
+	stats.compressedBytes += compressedBytes;
+
+	if (verbose)
+	{
+		printf("%s: %dx%d %s, %d KB -> %d KB\n", out, info.width, info.height, dds[87] == '5' ? "BC3" : "BC1",
+			(int)(sourceBytes / 1024), (int)(compressedBytes / 1024));
+	}
+	return true;
+}
+
+int TextureCompressor::CompressFolder(const char *folder)
+{
+	int before = stats.files;
+
+	char pattern[MAX_PATH];
+	sprintf_s(pattern, sizeof(pattern), "%s\\*", folder);
+
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA(pattern, &found);
+	if (find == INVALID_HANDLE_VALUE)
+		return 0;
+
+	do
+	{
+		if (strcmp(found.cFileName, ".") == 0 || strcmp(found.cFileName, "..") == 0)
+			continue;
+
+		char path[MAX_PATH];
+		sprintf_s(path, sizeof(path), "%s\\%s", folder, found.cFileName);
+
+		if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			CompressFolder(path);
+			continue;
+		}
+
+		const char *ext = strrchr(found.cFileName, '.');
+		if (ext && (_stricmp(ext, ".bmp") == 0 || _stricmp(ext, ".tga") == 0 || _stricmp(ext, ".png") == 0))
+			CompressFile(path);
+	} while (FindNextFileA(find, &found));
+
+	FindClose(find);
+	return stats.files - before;
+}
@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Compressor
+//
+// TextureCompressor.h: interface for the TextureCompressor class.
+// Every texture used to be uploaded as plain RGB with its mipmaps
+// built by gluBuild2DMipmaps while the level loaded. This class
+// does that work once, offline: it reads a bitmap, targa or png,
+// builds the whole mip chain and compresses every level into 4x4
+// blocks, BC1 (DXT1, 8 bytes a block) for opaque images and BC3
+// (DXT5, 16 bytes a block) for ones with alpha, then writes them
+// to a .dds file beside the original. GLTexture::Load() picks the
+// .dds up instead of the original when there is one, and uploads
+// the blocks as they are with glCompressedTexImage2D. The card
+// keeps them compressed, a quarter to an eighth of the memory.
+//
+// Each block's two end colors come from the line through its
+// pixels' colors (the principal axis), refined once by least
+// squares, and every pixel takes the nearest of the four colors
+// in between. Alpha gets its own 8 levels between the block's
+// lowest and highest.
+//
+// The rows are stored bottom first like every other texture the
+// game loads, so other DDS viewers show them upside down.
+//
+// Run it with "-compresstextures" (or CompressFolder() on a folder
+// of your own). Files whose .dds is newer than they are skipped.
+//
+// Usage:
+// TextureCompressor compressor;
+//
+// compressor.CompressFolder("models");			// Every texture under models/
+// compressor.CompressFile("textures/sand.bmp");	// Writes textures/sand.dds
+// printf("%d files, %d KB\n", compressor.stats.files, (int)(compressor.stats.compressedBytes / 1024));
+//
+// std::vector<unsigned char> dds;
+// TextureCompressor::Compress(pixels, width, height, dds);	// RGBA pixels, in memory
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTURECOMPRESSOR_H
+#define TEXTURECOMPRESSOR_H
+
+#include "ImageDecoder.h"
+
+#include <stddef.h>
+#include <vector>
+
+class TextureCompressor
+{
+public:
+	// What CompressFolder() and CompressFile() did
+	struct Stats {
+		int files;					// Compressed
+		int upToDate;				// Skipped, the .dds was newer
+		int failed;					// Couldn't be read or written
+		size_t sourceBytes;			// What they'd take uncompressed (RGBA, with mipmaps)
+		size_t compressedBytes;		// The blocks written
+	};
+
+	int CompressFolder(const char *folder);				// Every .bmp, .tga and .png under the folder, how many were compressed
+	bool CompressFile(const char *path);				// One file into a .dds beside it
+	bool verbose;										// True: prints a line per file
+
+	// RGBA pixels (bottom row first) into a whole DDS file, BC1 if every alpha is 255 and BC3 if not, false: bad size
+	static bool Compress(const unsigned char *rgba, int width, int height, std::vector<unsigned char> &dds);
+	// One 4x4 block of RGBA pixels (row by row) into its 8 or 16 bytes
+	static void EncodeBC1(const unsigned char *block, unsigned char *out);
+	static void EncodeBC3(const unsigned char *block, unsigned char *out);
+
+	Stats stats;										// Since construction
+
+	TextureCompressor();								// Constructor
+	virtual ~TextureCompressor();						// Destructor
+
+private:
+	ImageDecoder decoder;
+	std::vector<unsigned char> rgba;					// The decoded file, made RGBA
+	std::vector<unsigned char> dds;						// The file being written
+};
+
+#endif // TEXTURECOMPRESSOR_H
@@ -0,0 +1,705 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Manager
+//
+// TextureManager.cpp: implementation of the TextureManager and
+// TextureHandle classes.
+// See TextureManager.h for how to use them.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "TextureManager.h"
+#include "TextureStreamer.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////
+// TextureHandle
+//////////////////////////////////////////////////////////////////////
+
+TextureHandle::TextureHandle()
+{
+	manager = 0;
+	entry = -1;
+}
+
+TextureHandle::TextureHandle(TextureManager *manager, int entry)
+{
+	this->manager = manager;
+	this->entry = entry;
+	manager->AddRef(entry);
+}
+
+TextureHandle::TextureHandle(const TextureHandle &other)
+{
+	manager = other.manager;
+	entry = other.entry;
+	if (manager)
+		manager->AddRef(entry);
+}
+
+TextureHandle &TextureHandle::operator=(const TextureHandle &other)
+{
+	// Take the new reference first so assigning a handle to itself doesn't delete the texture
+	// (and copy it out, other may be this)
+	TextureManager *otherManager = other.manager;
+	int otherEntry = other.entry;
+	if (otherManager)
+		otherManager->AddRef(otherEntry);
+
+	Reset();
+	manager = otherManager;
+	entry = otherEntry;
+
+	return *this;
+}
+
+TextureHandle::~TextureHandle()
+{
+	Reset();
+}
+
+void TextureHandle::Reset()
+{
+	if (manager)
+		manager->Release(entry);
+
+	manager = 0;
+	entry = -1;
+}
+
+void TextureHandle::Use() const
+{
+	if (manager)
+	{
+		TextureManager::Entry &e = manager->entries[entry];
+		manager->binds++;
+		e.lastUsed = manager->frame;
+
+		// Lowered to fit the budget, it's wanted again
+		if (e.dropped > 0 && !e.streaming)
+			manager->Reload(entry);
+	}
+
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, Id());
+}
+
+unsigned int TextureHandle::Id() const
+{
+	return manager ? manager->entries[entry].texture.texture[0] : 0;
+}
+
+int TextureHandle::Width() const
+{
+	return manager ? manager->entries[entry].texture.width : 0;
+}
+
+int TextureHandle::Height() const
+{
+	return manager ? manager->entries[entry].texture.height : 0;
+}
+
+bool TextureHandle::Valid() const
+{
+	return manager != 0;
+}
+
+bool TextureHandle::Resident() const
+{
+	return !manager || (!manager->entries[entry].streaming && manager->entries[entry].dropped == 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+TextureManager::TextureManager()
+{
+	paletteEntry = -1;
+	streamer = 0;
+	binds = 0;
+	liveCount = 0;
+	liveBytes = 0;
+	copyBytes = 0;
+	uploads = 0;
+	budget = 0;
+	frame = 0;
+	evictions = 0;
+	reloads = 0;
+}
+
+TextureManager::~TextureManager()
+{
+	// Handles still out there point at this, so only the GL textures go
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].refs > 0 && entries[i].texture.texture[0])
+			glDeleteTextures(1, &entries[i].texture.texture[0]);
+	}
+}
+
+TextureManager &TextureManager::Shared()
+{
+	// Never deleted: the models in global caches let go of their textures after main() returns,
+	// and the manager has to still be there when they do
+	static TextureManager *shared = new TextureManager();
+	return *shared;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loading
+//////////////////////////////////////////////////////////////////////
+
+std::string TextureManager::NormalizePath(const char *path)
+{
+	std::string key;
+	key.reserve(strlen(path));
+
+	for (const char *c = path; *c; c++)
+	{
+		char ch = *c;
+		if (ch == '"')
+			continue;
+		if (ch == '\\')
+			ch = '/';
+
+		if (ch == '/')
+		{
+			// Doubled slashes
+			if (!key.empty() && key[key.size() - 1] == '/')
+				continue;
+
+			// "./" in the middle or at the start
+			if (key == "." || (key.size() >= 2 && key.compare(key.size() - 2, 2, "/.") == 0))
+			{
+				key.erase(key.size() - 1);
+				continue;
+			}
+		}
+
+		key += (char)tolower((unsigned char)ch);
+	}
+
+	return key;
+}
+
+TextureHandle TextureManager::Load(const char *path)
+{
+	std::string key = NormalizePath(path);
+
+	TextureHandle found = Find(key);
+	if (found.Valid())
+		return found;
+
+	int entry = Add(key);
+	entries[entry].path = path;
+
+	// Streamed: a grey texel for now, the streamer fills the texture in over the next frames
+	if (streamer && streamer->Accepts(path))
+	{
+		GLTexture &texture = entries[entry].texture;
+		unsigned char grey[3] = { 128, 128, 128 };
+		glGenTextures(1, &texture.texture[0]);
+		glBindTexture(GL_TEXTURE_2D, texture.texture[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+		Finish(entry);
+		entries[entry].streaming = true;
+
+		TextureHandle handle(this, entry);
+		streamer->Stream(handle, path);
+		return handle;
+	}
+
+	// GLTexture::Load() writes into the name it is given so hand it a copy
+	char name[260];
+	strncpy(name, path, sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+	entries[entry].texture.Load(name);
+
+	Finish(entry);
+	return TextureHandle(this, entry);
+}
+
+TextureHandle TextureManager::Color(unsigned char r, unsigned char g, unsigned char b)
+{
+	// Keyed like a color in HTML, no file name can look like that
+	char key[8];
+	sprintf(key, "#%02x%02x%02x", r, g, b);
+
+	TextureHandle found = Find(key);
+	if (found.Valid())
+		return found;
+
+	int entry = Add(key);
+	entries[entry].texture.BuildColorTexture(r, g, b);
+
+	Finish(entry);
+	return TextureHandle(this, entry);
+}
+
+TextureHandle TextureManager::PaletteColor(unsigned char r, unsigned char g, unsigned char b, float &u, float &v)
+{
+	unsigned int color = (r << 16) | (g << 8) | b;
+	std::map<unsigned int, int>::iterator it = paletteSlots.find(color);
+
+	int slot;
+	if (it != paletteSlots.end())
+	{
+		slot = it->second;
+	}
+	else
+	{
+		// Full: a texture of its own, which is the same color wherever it's sampled
+		if ((int)paletteSlots.size() >= PALETTE_SIDE * PALETTE_SIDE)
+		{
+			u = 0.5f;
+			v = 0.5f;
+			return Color(r, g, b);
+		}
+
+		// The palette itself the first time, white until the colors are written in
+		if (paletteEntry < 0)
+		{
+			paletteEntry = Add("#palette");
+			GLTexture &texture = entries[paletteEntry].texture;
+
+			std::vector<unsigned char> white(PALETTE_SIDE * PALETTE_SIDE * 3, 255);
+			glGenTextures(1, &texture.texture[0]);
+			glBindTexture(GL_TEXTURE_2D, texture.texture[0]);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, PALETTE_SIDE, PALETTE_SIDE, 0, GL_RGB, GL_UNSIGNED_BYTE, &white[0]);
+			Finish(paletteEntry);
+
+			// No mipmaps, so don't count a third more for them
+			entries[paletteEntry].bytes = PALETTE_SIDE * PALETTE_SIDE * 3;
+		}
+
+		slot = (int)paletteSlots.size();
+		paletteSlots[color] = slot;
+
+		unsigned char texel[3] = { r, g, b };
+		glBindTexture(GL_TEXTURE_2D, entries[paletteEntry].texture.texture[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, slot % PALETTE_SIDE, slot / PALETTE_SIDE, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, texel);
+	}
+
+	// The middle of the texel
+	u = (slot % PALETTE_SIDE + 0.5f) / PALETTE_SIDE;
+	v = (slot / PALETTE_SIDE + 0.5f) / PALETTE_SIDE;
+	return TextureHandle(this, paletteEntry);
+}
+
+TextureHandle TextureManager::Palette()
+{
+	if (paletteEntry < 0)
+		return TextureHandle();
+
+	return TextureHandle(this, paletteEntry);
+}
+
+void TextureManager::SetStreamer(TextureStreamer *streamer)
+{
+	this->streamer = streamer;
+}
+
+void TextureManager::Streamed(const TextureHandle &texture, bool resident)
+{
+	if (texture.manager != this)
+		return;
+
+	// Its memory counted again at its new size (the handle is a reference, so it's live)
+	Entry &e = entries[texture.entry];
+	liveBytes -= e.bytes;
+	Measure(texture.entry);
+	liveBytes += e.bytes;
+	e.streaming = !resident;
+	if (resident)
+		e.dropped = 0;
+}
+
+void TextureManager::SetBudget(size_t bytes)
+{
+	budget = bytes;
+}
+
+void TextureManager::Copied(const TextureHandle &texture)
+{
+	if (texture.manager != this)
+		return;
+
+	// Only file textures can be loaded again, and a half streamed one isn't worth copying anyway
+	const Entry &e = entries[texture.entry];
+	if (e.path.empty() || e.streaming)
+		return;
+
+	Lower(texture.entry, 32);
+}
+
+void TextureManager::SetCopyBytes(size_t bytes)
+{
+	copyBytes = bytes;
+}
+
+void TextureManager::NextFrame()
+{
+	frame++;
+	if (budget == 0)
+		return;
+
+	// Least recently used first, until they fit
+	std::vector<bool> lowest(entries.size(), false);
+	while (liveBytes + copyBytes > budget)
+	{
+		int oldest = -1;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			// Live file textures not used last frame, that can still go lower
+			const Entry &e = entries[i];
+			if (e.refs == 0 || e.path.empty() || e.streaming || lowest[i] || e.lastUsed >= frame - 1)
+				continue;
+			if (e.texture.width <= 1 && e.texture.height <= 1)
+				continue;
+
+			if (oldest < 0 || e.lastUsed < entries[oldest].lastUsed)
+				oldest = (int)i;
+		}
+
+		// Everything left is in use or as small as it goes
+		if (oldest < 0)
+			break;
+
+		// As many levels as it takes to fit, each a quarter of the one above
+		const Entry &e = entries[oldest];
+		int levels = 1;
+		size_t bytes = e.bytes / 4;
+		int side = (e.texture.width > e.texture.height ? e.texture.width : e.texture.height) / 2;
+		while (liveBytes + copyBytes - e.bytes + bytes > budget && side > 1)
+		{
+			levels++;
+			bytes /= 4;
+			side /= 2;
+		}
+
+		if (!Lower(oldest, levels))
+			lowest[oldest] = true;
+	}
+}
+
+TextureHandle TextureManager::Find(const std::string &key)
+{
+	std::map<std::string, int>::iterator it = lookup.find(key);
+	if (it == lookup.end())
+		return TextureHandle();
+
+	return TextureHandle(this, it->second);
+}
+
+int TextureManager::Add(const std::string &key)
+{
+	int entry;
+	if (!freeEntries.empty())
+	{
+		entry = freeEntries.back();
+		freeEntries.pop_back();
+	}
+	else
+	{
+		entry = (int)entries.size();
+		entries.push_back(Entry());
+	}
+
+	// A file that doesn't load keeps texture 0 (and is still shared, so it isn't tried again)
+	Entry &e = entries[entry];
+	e.key = key;
+	e.texture.texture[0] = 0;
+	e.texture.width = 0;
+	e.texture.height = 0;
+	e.refs = 0;
+	e.bytes = 0;
+	e.streaming = false;
+	e.path.clear();
+	e.lastUsed = frame;
+	e.dropped = 0;
+	lookup[key] = entry;
+
+	return entry;
+}
+
+void TextureManager::Finish(int entry)
+{
+	if (!entries[entry].texture.texture[0])
+		return;
+
+	Measure(entry);
+	uploads++;
+}
+
+void TextureManager::Measure(int entry)
+{
+	Entry &e = entries[entry];
+
+	// Ask GL what it made, the loaders don't all say
+	GLint width = 0, height = 0, format = 0;
+	glBindTexture(GL_TEXTURE_2D, e.texture.texture[0]);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+
+	size_t bytes = (size_t)width * height * 4;
+	if (format == 3 || format == GL_RGB || format == GL_RGB8)
+		bytes = (size_t)width * height * 3;
+
+	// Compressed ones (from a .dds) say how big they are
+	GLint compressed = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	if (compressed)
+	{
+		GLint size = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+		bytes = size;
+	}
+
+	// The mipmaps add a third
+	e.texture.width = width;
+	e.texture.height = height;
+	e.bytes = bytes * 4 / 3;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Residency
+//////////////////////////////////////////////////////////////////////
+
+// How many mipmap levels the texture has
+static int LevelCount(GLuint texture)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	int count = 0;
+	while (count < 16)
+	{
+		GLint width = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, count, GL_TEXTURE_WIDTH, &width);
+		if (width == 0)
+			break;
+		count++;
+	}
+
+	return count;
+}
+
+bool TextureManager::Lower(int entry, int levels)
+{
+	Entry &e = entries[entry];
+	GLuint id = e.texture.texture[0];
+
+	// Keep the last level at least (no mipmaps: nothing to go down to)
+	int count = LevelCount(id);
+	if (levels > count - 1)
+		levels = count - 1;
+	if (levels <= 0)
+		return false;
+
+	CopyLevels(id, levels, id);
+
+	liveBytes -= e.bytes;
+	Measure(entry);
+	liveBytes += e.bytes;
+	e.dropped += levels;
+	evictions++;
+	return true;
+}
+
+void TextureManager::Reload(int entry)
+{
+	Entry &e = entries[entry];
+	e.dropped = 0;
+	reloads++;
+
+	// The streamer fills the same texture in again, its average color shows until then
+	if (streamer && streamer->Accepts(e.path.c_str()))
+	{
+		e.streaming = true;
+		streamer->Stream(TextureHandle(this, entry), e.path.c_str());
+		return;
+	}
+
+	// Loaded the usual way into a texture of its own, then copied over (a file that's gone keeps what it has)
+	char name[260];
+	strncpy(name, e.path.c_str(), sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+
+	GLTexture loaded;
+	loaded.Load(name);
+	if (!loaded.texture[0])
+		return;
+
+	CopyLevels(loaded.texture[0], 0, e.texture.texture[0]);
+	glDeleteTextures(1, &loaded.texture[0]);
+
+	liveBytes -= e.bytes;
+	Measure(entry);
+	liveBytes += e.bytes;
+}
+
+void TextureManager::CopyLevels(GLuint source, int first, GLuint target)
+{
+	// A level of the texture, as it is on the card
+	struct Level {
+		GLint width;
+		GLint height;
+		std::vector<unsigned char> data;
+	};
+
+	glBindTexture(GL_TEXTURE_2D, source);
+	GLint internal = 0, compressed = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internal);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	GLenum format = (internal == GL_RGB || internal == GL_RGB8 || internal == 3) ? GL_RGB : GL_RGBA;
+	int channels = format == GL_RGB ? 3 : 4;
+
+	// Read back the ones kept (compressed ones as their blocks)
+	std::vector<Level> levels;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (int level = first; level < 16; level++)
+	{
+		Level l;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &l.width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &l.height);
+		if (l.width == 0 || l.height == 0)
+			break;
+
+		if (compressed)
+		{
+			GLint size = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			l.data.resize(size);
+			glGetCompressedTexImage(GL_TEXTURE_2D, level, &l.data[0]);
+		}
+		else
+		{
+			l.data.resize((size_t)l.width * l.height * channels);
+			glGetTexImage(GL_TEXTURE_2D, level, format, GL_UNSIGNED_BYTE, &l.data[0]);
+		}
+		levels.push_back(l);
+	}
+
+	if (levels.empty())
+		return;
+
+	// They become levels 0.. of the target, and the levels it had past those are emptied
+	int old = LevelCount(target);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < (int)levels.size(); i++)
+	{
+		const Level &l = levels[i];
+		if (compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, internal, l.width, l.height, 0, (GLsizei)l.data.size(), &l.data[0]);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, internal, l.width, l.height, 0, format, GL_UNSIGNED_BYTE, &l.data[0]);
+	}
+	for (int i = (int)levels.size(); i < old; i++)
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+}
+
+void TextureManager::AddRef(int entry)
+{
+	Entry &e = entries[entry];
+	if (e.refs++ == 0)
+	{
+		liveCount++;
+		liveBytes += e.bytes;
+	}
+}
+
+void TextureManager::Release(int entry)
+{
+	Entry &e = entries[entry];
+	if (--e.refs > 0)
+		return;
+
+	if (e.texture.texture[0])
+		glDeleteTextures(1, &e.texture.texture[0]);
+
+	liveCount--;
+	liveBytes -= e.bytes;
+
+	// The palette's colors went with it
+	if (entry == paletteEntry)
+	{
+		paletteEntry = -1;
+		paletteSlots.clear();
+	}
+
+	lookup.erase(e.key);
+	e.key.clear();
+	e.path.clear();
+	e.texture.texture[0] = 0;
+	freeEntries.push_back(entry);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Statistics
+//////////////////////////////////////////////////////////////////////
+
+int TextureManager::LiveCount() const
+{
+	return liveCount;
+}
+
+size_t TextureManager::LiveBytes() const
+{
+	return liveBytes + copyBytes;
+}
+
+int TextureManager::Uploads() const
+{
+	return uploads;
+}
+
+int TextureManager::PaletteColors() const
+{
+	return (int)paletteSlots.size();
+}
+
+int TextureManager::Binds() const
+{
+	return binds;
+}
+
+void TextureManager::ResetBinds()
+{
+	binds = 0;
+}
+
+int TextureManager::Lowered() const
+{
+	int count = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].refs > 0 && entries[i].dropped > 0)
+			count++;
+	}
+
+	return count;
+}
+
+int TextureManager::Evictions() const
+{
+	return evictions;
+}
+
+int TextureManager::Reloads() const
+{
+	return reloads;
+}
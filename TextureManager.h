@@ -0,0 +1,199 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Manager
+//
+// TextureManager.h: interface for the TextureManager and
+// TextureHandle classes.
+// Every material of every model used to load its own copy of its
+// texture, so two models painted with the same bitmap uploaded it
+// twice, and nothing was ever deleted (the ground texture was even
+// loaded again on top of the old one when the level changed). This
+// class loads a texture file once and hands out handles to it. A
+// handle counts as a reference: copying it adds one, destroying or
+// resetting it takes one away, and when the last one goes the GL
+// texture is deleted.
+//
+// Files are looked up by their path made lower case with forward
+// slashes and no "./" or doubled slashes, so "Models\\Snake\\skin.bmp"
+// and "models/snake/./skin.bmp" are the same texture. The solid
+// color textures materials without a bitmap get are shared the same
+// way, by their color.
+//
+// Better still, a flat color can be a single texel of the palette: a
+// 64x64 texture every model's flat colors share (4096 of them). A
+// model whose solid-colored faces point their texture coordinates at
+// their texels draws all of them with one texture, so it binds once
+// instead of once per color. The palette is sampled with GL_NEAREST
+// and has no mipmaps, so a texel never bleeds into its neighbours.
+// Once it is full, PaletteColor() hands out a solid color texture
+// instead (any coordinates will do for those).
+//
+// Use() counts the binds, so the game can show how many a frame took.
+//
+// With a TextureStreamer set, Load() hands back a grey placeholder at
+// once and the streamer fills it in over the next frames (see
+// TextureStreamer.h). Resident() says when it's all there.
+//
+// Card memory can be given a budget. Once a frame NextFrame() checks
+// the live textures against it, and while they're over it the file
+// texture used least recently (Use() stamps the frame) loses its
+// biggest mipmap levels: the rest are read back and made the whole
+// texture, a quarter of the memory a level. At the bottom it is just
+// its 1x1 level, its average color, which is as good as unloaded.
+// Only textures not used last frame are lowered, so what's on screen
+// keeps its detail. The next Use() of a lowered texture loads the
+// file again (through the streamer if there is one), into the same
+// GL texture, so the handles and whatever kept its number don't
+// notice. Solid colors and the palette are too small to bother with.
+//
+// The SceneBatcher draws copies of the textures from arrays of its
+// own. Copied() tells the manager a texture has one: the original is
+// lowered to its last level at once, since only a model the batcher
+// leaves to Draw() binds it now (and that Use() loads it again). The
+// batcher reports the memory of its arrays with SetCopyBytes(), and
+// it is counted in LiveBytes() and against the budget like the rest.
+// The arrays hold what is drawn every frame, so like the textures
+// used last frame they are never lowered: a budget smaller than them
+// lowers everything else and stays over.
+//
+// Textures are GL objects, so handles may only be made, copied and
+// dropped on the GL thread.
+//
+// Usage:
+// TextureManager &textures = TextureManager::Shared();
+//
+// TextureHandle skin = textures.Load("models/snake/skin.bmp");
+// TextureHandle red = textures.Color(255, 0, 0);
+// float u, v;
+// TextureHandle palette = textures.PaletteColor(255, 0, 0, u, v);	// Red is at (u, v)
+// skin.Use();									// Binds it
+//
+// textures.SetBudget(64 * 1024 * 1024);		// Bytes on the card, 0: no limit
+// textures.NextFrame();						// Once a frame, before drawing
+// textures.Copied(skin);						// Drawn from a copy now, lowers the original
+//
+// skin.Reset();								// Done with it (the destructor does this too)
+// printf("%d textures, %d bytes\n", textures.LiveCount(), (int)textures.LiveBytes());
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTUREMANAGER_H
+#define TEXTUREMANAGER_H
+
+#include "GLTexture.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class TextureManager;
+class TextureStreamer;
+
+// A counted reference to a texture in a TextureManager
+class TextureHandle
+{
+public:
+	void Use() const;								// Binds the texture (unbinds if the handle is empty), loading it again if it was lowered
+	unsigned int Id() const;						// OpenGL's number for the texture, 0 if empty
+	int Width() const;
+	int Height() const;
+	bool Valid() const;								// True: it points at a texture
+	bool Resident() const;							// True: it's all there, not being streamed in or lowered (or is empty)
+	void Reset();									// Lets go of the texture
+
+	TextureHandle();								// Constructor (empty)
+	TextureHandle(const TextureHandle &other);		// Another reference to the same texture
+	TextureHandle &operator=(const TextureHandle &other);
+	virtual ~TextureHandle();						// Destructor
+
+private:
+	friend class TextureManager;
+	TextureHandle(TextureManager *manager, int entry);
+
+	TextureManager *manager;
+	int entry;										// -1 if empty
+};
+
+class TextureManager
+{
+public:
+	enum {
+		PALETTE_SIDE = 64							// Texels across and down the palette
+	};
+
+	static TextureManager &Shared();				// The one the models and the game share
+
+	TextureHandle Load(const char *path);			// The file's texture, loaded the first time it is asked for
+	TextureHandle Color(unsigned char r, unsigned char g, unsigned char b);	// A shared solid color texture
+	// The palette, with the color added if it wasn't in it, and where its texel is
+	TextureHandle PaletteColor(unsigned char r, unsigned char g, unsigned char b, float &u, float &v);
+	TextureHandle Palette();						// The palette, empty if no color has been put in it
+	void SetStreamer(TextureStreamer *streamer);	// What Load() streams files through, 0: none (loads them at once)
+	// The streamer remade the texture or finished it: measures it again, resident says it's all there
+	void Streamed(const TextureHandle &texture, bool resident);
+	void SetBudget(size_t bytes);					// Most texture memory kept on the card, 0: no limit
+	void NextFrame();								// Once a frame (GL thread): lowers textures until they fit the budget
+	void Copied(const TextureHandle &texture);		// Something draws a copy of it instead: lowers it as far as it goes
+	void SetCopyBytes(size_t bytes);				// The memory of those copies, counted against the budget
+
+	int LiveCount() const;							// Textures with at least one handle
+	size_t LiveBytes() const;						// Their texture memory, mipmaps included, and the copies'
+	int Uploads() const;							// Textures made since the start (the rest were shared)
+	int PaletteColors() const;						// Colors in the palette
+	int Binds() const;								// TextureHandle::Use() calls since ResetBinds()
+	void ResetBinds();
+	int Lowered() const;							// Live textures below their full size
+	int Evictions() const;							// Times a texture was lowered since the start
+	int Reloads() const;							// Times one was loaded again since the start
+	// The key a path is stored under
+	static std::string NormalizePath(const char *path);
+
+	TextureManager();								// Constructor
+	virtual ~TextureManager();						// Destructor
+
+private:
+	friend class TextureHandle;
+
+	// A loaded texture
+	struct Entry {
+		std::string key;
+		GLTexture texture;
+		int refs;
+		size_t bytes;
+		bool streaming;								// True: the streamer is still filling it in
+		std::string path;							// The file it was loaded from, empty for colors and the palette
+		int lastUsed;								// The frame of the last Use()
+		int dropped;								// Mipmap levels taken off the top, 0: full size
+	};
+
+	TextureHandle Find(const std::string &key);	// A handle to a loaded texture, empty if it isn't loaded
+	int Add(const std::string &key);				// An entry for a new texture (reuses free ones)
+	void Finish(int entry);							// Counts the memory of a freshly made texture
+	void Measure(int entry);						// Reads its size back from GL
+	bool Lower(int entry, int levels);				// Takes levels off the top of it, false if it has none to spare
+	void Reload(int entry);							// Loads its file into it again
+	void CopyLevels(GLuint source, int first, GLuint target);	// Makes levels first.. of source all of target's
+	void AddRef(int entry);
+	void Release(int entry);						// Deletes the texture with its last reference
+
+	TextureManager(const TextureManager &);		// Not copyable, the handles point at it
+	TextureManager &operator=(const TextureManager &);
+
+	std::vector<Entry> entries;
+	std::vector<int> freeEntries;					// Entries whose texture was deleted
+	std::map<std::string, int> lookup;				// Key to entry
+	int paletteEntry;								// The palette's entry, -1 until a color is asked for
+	TextureStreamer *streamer;
+	std::map<unsigned int, int> paletteSlots;		// 0xRRGGBB to its texel (row * PALETTE_SIDE + column)
+	int binds;
+	int liveCount;
+	size_t liveBytes;
+	size_t copyBytes;
+	int uploads;
+	size_t budget;
+	int frame;
+	int evictions;
+	int reloads;
+};
+
+#endif // TEXTUREMANAGER_H
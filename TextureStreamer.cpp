@@ -0,0 +1,297 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Streamer
+//
+// TextureStreamer.cpp: implementation of the TextureStreamer class.
+// See TextureStreamer.h for how it works.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "TextureStreamer.h"
+#include "MipmapBuilder.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+TextureStreamer::TextureStreamer()
+{
+	budget = 512 * 1024;
+	memset(&stats, 0, sizeof(stats));
+
+	jobs = 0;
+	decodeCount = 0;
+	next = 0;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	// The jobs write into the requests, so they have to be done first
+	if (jobs)
+		jobs->Wait(decoding);
+
+	for (size_t i = 0; i < pending.size(); i++)
+		delete pending[i];
+	for (size_t i = 0; i < uploads.size(); i++)
+		delete uploads[i];
+}
+
+bool TextureStreamer::Init(JobSystem *jobs, int ringSize)
+{
+	this->jobs = jobs;
+
+	// Pixel buffer objects are OpenGL 2.1
+	if (!GLEW_VERSION_2_1 && !GLEW_ARB_pixel_buffer_object)
+		return false;
+
+	ring.resize(ringSize);
+	glGenBuffers(ringSize, &ring[0]);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Requests
+//////////////////////////////////////////////////////////////////////
+
+bool TextureStreamer::Accepts(const char *path) const
+{
+	if (!jobs)
+		return false;
+
+	// What ImageDecoder reads
+	const char *ext = strrchr(path, '.');
+	if (!ext || (_stricmp(ext, ".bmp") != 0 && _stricmp(ext, ".tga") != 0 && _stricmp(ext, ".png") != 0))
+		return false;
+
+	// GLTexture::Load() would take the .dds beside it instead
+	std::string compressed(path, ext - path);
+	compressed += ".dds";
+	FILE *file = fopen(compressed.c_str(), "rb");
+	if (file)
+	{
+		fclose(file);
+		return false;
+	}
+
+	// A file that isn't there gets no texture at all, like GLTexture::Load() gives it
+	file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fclose(file);
+
+	return true;
+}
+
+void TextureStreamer::Stream(const TextureHandle &texture, const char *path)
+{
+	Request *request = new Request();
+	request->texture = texture;
+	request->path = path;
+	request->level = 0;
+	request->row = 0;
+	decodeCount++;
+
+	// With no workers to take it, Update() decodes it a frame at a time
+	if (jobs->NumThreads() < 2)
+	{
+		pending.push_back(request);
+		return;
+	}
+
+	// Get the mip chain on the workers, then hand it back to the GL thread
+	JobSystem *jobs = this->jobs;
+	jobs->Run(decoding, [this, jobs, request](int thread) {
+		Decode(request);
+		jobs->RunOnMain([this, request] { Decoded(request); });
+	});
+}
+
+void TextureStreamer::Decode(Request *request)
+{
+	if (!TextureCache::Shared().Get(request->path.c_str(), request->chain))
+		printf("TextureStreamer: %s: can't be read or decoded\n", request->path.c_str());
+}
+
+void TextureStreamer::Decoded(Request *request)
+{
+	decodeCount--;
+
+	// It stays grey
+	if (request->chain.levels == 0)
+	{
+		Done(request);
+		return;
+	}
+
+	const TextureCache::Chain &chain = request->chain;
+	GLenum format = chain.channels == 4 ? GL_RGBA : GL_RGB;
+	int last = chain.levels - 1;
+
+	// A card that can't take its sides can't have the levels as they are, it all goes up at once scaled up
+	if (!MipmapBuilder::SidesSupported(chain.width, chain.height))
+	{
+		glBindTexture(GL_TEXTURE_2D, request->texture.Id());
+		chain.Upload();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+		Done(request);
+		return;
+	}
+
+	// Every level its size, only the 1x1 one filled in and sampled
+	glBindTexture(GL_TEXTURE_2D, request->texture.Id());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int level = 0; level <= last; level++)
+	{
+		int width, height;
+		const unsigned char *pixels = chain.Level(level, width, height);
+		glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, format, GL_UNSIGNED_BYTE, level == last ? pixels : 0);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, last);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, last);
+
+	// It's the size it will be now
+	TextureManager::Shared().Streamed(request->texture, false);
+
+	if (last == 0)
+	{
+		Done(request);
+		return;
+	}
+
+	request->level = last - 1;
+	request->row = 0;
+	uploads.push_back(request);
+}
+
+void TextureStreamer::Done(Request *request)
+{
+	TextureManager::Shared().Streamed(request->texture, true);
+	stats.streamed++;
+	delete request;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Uploading
+//////////////////////////////////////////////////////////////////////
+
+void TextureStreamer::UploadRows(Request *request, int level, int row, int rows)
+{
+	int width, height;
+	const unsigned char *pixels = request->chain.Level(level, width, height);
+	size_t rowBytes = (size_t)width * request->chain.channels;
+	size_t bytes = rowBytes * rows;
+	const unsigned char *src = pixels + rowBytes * row;
+	GLenum format = request->chain.channels == 4 ? GL_RGBA : GL_RGB;
+
+	glBindTexture(GL_TEXTURE_2D, request->texture.Id());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if (!ring.empty())
+	{
+		// Fresh storage for the buffer (the card may still be reading what was in it), then the rows into it
+		GLuint buffer = ring[next];
+		next = (next + 1) % (int)ring.size();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, 0, GL_STREAM_DRAW);
+		void *dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		if (dst)
+		{
+			memcpy(dst, src, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			// The card copies it into the texture when it gets to it, this doesn't wait
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, row, width, rows, format, GL_UNSIGNED_BYTE, 0);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	glTexSubImage2D(GL_TEXTURE_2D, level, 0, row, width, rows, format, GL_UNSIGNED_BYTE, src);
+}
+
+void TextureStreamer::Update()
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	stats.bytes = 0;
+	stats.uploads = 0;
+
+	// No workers: one file a frame is decoded here
+	if (!pending.empty())
+	{
+		Request *request = pending.front();
+		pending.pop_front();
+		Decode(request);
+		Decoded(request);
+	}
+
+	while (!uploads.empty())
+	{
+		Request *request = uploads.front();
+		int width, height;
+		request->chain.Level(request->level, width, height);
+		size_t rowBytes = (size_t)width * request->chain.channels;
+
+		// As many of the level's rows as fit, at least one a frame
+		size_t fit = stats.bytes < budget ? (budget - stats.bytes) / rowBytes : 0;
+		int rows = height - request->row;
+		if ((size_t)rows > fit)
+			rows = fit > 0 ? (int)fit : (stats.bytes == 0 ? 1 : 0);
+		if (rows == 0)
+			break;
+
+		UploadRows(request, request->level, request->row, rows);
+		stats.bytes += rowBytes * rows;
+		stats.uploads++;
+		request->row += rows;
+		if (request->row < height)
+			continue;
+
+		// The whole level is in, sample it
+		glBindTexture(GL_TEXTURE_2D, request->texture.Id());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, request->level);
+
+		request->level--;
+		request->row = 0;
+		if (request->level < 0)
+		{
+			uploads.pop_front();
+			Done(request);
+		}
+	}
+
+	stats.decoding = decodeCount;
+	stats.uploading = (int)uploads.size();
+	stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void TextureStreamer::Finish()
+{
+	if (!jobs)
+		return;
+
+	// Every file decoded and handed back
+	jobs->Wait(decoding);
+	jobs->RunMainJobs();
+	while (!pending.empty())
+	{
+		Request *request = pending.front();
+		pending.pop_front();
+		Decode(request);
+		Decoded(request);
+	}
+
+	size_t frameBudget = budget;
+	budget = (size_t)-1;
+	Update();
+	budget = frameBudget;
+}
@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Texture Streamer
+//
+// TextureStreamer.h: interface for the TextureStreamer class.
+// Loading a texture used to read, decode and upload it right there,
+// so whatever frame asked for it (the cave's textures are loaded in
+// the middle of one) stalled until it was on the card. With a
+// streamer handed to the TextureManager, a texture it loads is
+// streamed instead:
+//
+// - TextureManager::Load() only checks the file is there and hands
+//   back a 1x1 grey texture straight away.
+// - A job gets the file's mip chain from the TextureCache (decoding
+//   it and building its mipmaps if it isn't cached) on the workers.
+// - Back on the GL thread the texture is made its full size, but
+//   only the 1x1 level (the image's average color) is filled in, and
+//   it is the only level sampled (GL_TEXTURE_BASE_LEVEL).
+// - Every frame Update() uploads the next levels, smallest first,
+//   through a ring of pixel buffer objects. Once a level is all in,
+//   the base level moves down to it, so the texture sharpens a level
+//   at a time until it is resident.
+//
+// No more than budget bytes are uploaded a frame (big levels go up
+// a band of rows at a time), but at least one row is, so a small
+// budget is slow but still finishes. Cards without pixel buffer
+// objects upload from memory in the same steps. Cards that can't
+// take sides that aren't powers of two get such a file all at once,
+// scaled up (see MipmapBuilder::SidesSupported()). With no worker
+// threads (one core) Update() decodes a file a frame itself.
+//
+// Files that are blocks compressed ahead of time (a .dds or .ktx,
+// or a .dds beside the file, see TextureCompressor) are left to
+// GLTexture::Load(): they're small and their mipmaps come with them.
+// A file that's there but can't be decoded stays grey.
+//
+// Usage:
+// TextureStreamer streamer;
+//
+// streamer.Init(&jobs);							// After glewInit() and jobs.Start()
+// streamer.budget = 512 * 1024;					// Bytes a frame
+// TextureManager::Shared().SetStreamer(&streamer);	// Load() streams from now on
+//
+// jobs.RunMainJobs();								// Every frame (takes the decoded files)
+// streamer.Update();								// Then uploads this frame's share
+//
+// streamer.Finish();								// Everything in now, e.g. behind a loading screen
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include "JobSystem.h"
+#include "TextureCache.h"
+#include "TextureManager.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+class TextureStreamer
+{
+public:
+	// Counters, the per frame ones for the last Update()
+	struct Stats {
+		int decoding;		// Files still being read and decoded
+		int uploading;		// Textures with levels still to upload
+		int streamed;		// Textures made resident since Init()
+		size_t bytes;		// Bytes uploaded last frame
+		int uploads;		// glTexSubImage2D calls last frame
+		double updateMs;	// CPU time of the last Update()
+	};
+
+	size_t budget;			// Most bytes uploaded a frame
+	Stats stats;
+
+	bool Init(JobSystem *jobs, int ringSize = 3);	// Makes the pixel buffers (GL thread), false if there are none (uploads still work)
+	// True: the file is there and is one it streams (otherwise load it the usual way)
+	bool Accepts(const char *path) const;
+	void Stream(const TextureHandle &texture, const char *path);	// Starts streaming the file into the texture (GL thread)
+	void Update();			// Uploads up to budget bytes of the next levels (GL thread, once a frame)
+	void Finish();			// Waits for every file and uploads all that's left
+	TextureStreamer();		// Constructor
+	virtual ~TextureStreamer();	// Destructor
+
+private:
+	// A texture on its way in
+	struct Request {
+		TextureHandle texture;	// Keeps the texture alive until it's resident
+		std::string path;
+		TextureCache::Chain chain;	// Every level (none if the file couldn't be decoded)
+		int level;				// The level being uploaded
+		int row;				// Rows of it uploaded
+	};
+
+	void Decode(Request *request);	// Gets the file's mip chain (any thread)
+	void Decoded(Request *request);	// The job's done: makes the texture its size with the 1x1 level in it
+	// Uploads rows [row, row + rows) of a level of the request's texture
+	void UploadRows(Request *request, int level, int row, int rows);
+	void Done(Request *request);	// Resident (or given up on): lets go of it
+
+	JobSystem *jobs;
+	JobCounter decoding;			// The decode jobs
+	int decodeCount;				// Requests whose job hasn't handed them back yet
+	std::deque<Request *> pending;	// Waiting for Update() to decode them, when there are no workers
+	std::deque<Request *> uploads;	// Decoded, with levels still to upload, oldest first
+	std::vector<GLuint> ring;		// The pixel buffers, used in turn
+	int next;						// The next one to use
+};
+
+#endif // TEXTURESTREAMER_H
@@ -0,0 +1,318 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Trigger Volumes
+//
+// TriggerSystem.cpp: implementation of the TriggerSystem class.
+// See TriggerSystem.h for how to use it and the file format.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "TriggerSystem.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#define LEAF_SIZE	4	// Most volumes in a leaf
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+TriggerSystem::TriggerSystem()
+{
+
+}
+
+TriggerSystem::~TriggerSystem()
+{
+
+}
+
+VolumeKind TriggerSystem::KindFromName(const char *name, bool &ok)
+{
+	ok = true;
+
+	if (strcmp(name, "obstacle") == 0)
+		return VOLUME_OBSTACLE;
+	if (strcmp(name, "collect") == 0)
+		return VOLUME_COLLECT;
+	if (strcmp(name, "exit") == 0)
+		return VOLUME_EXIT;
+	if (strcmp(name, "nospawn") == 0)
+		return VOLUME_NOSPAWN;
+
+	ok = false;
+	return VOLUME_OBSTACLE;
+}
+
+bool TriggerSystem::Load(const char *name)
+{
+	FILE *file = fopen(name, "r");
+	if (!file)
+	{
+		printf("TriggerSystem: can't open %s\n", name);
+		return false;
+	}
+
+	Clear();
+
+	char line[512];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		lineNumber++;
+
+		// Skip blank lines and comments
+		char *start = line;
+		while (*start == ' ' || *start == '\t')
+			start++;
+		if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0')
+			continue;
+
+		char kindName[32];
+		char volumeName[128];
+		TriggerVolume volume;
+		int read = sscanf(start, "%31s %d %127s %f %f %f %f %f %f", kindName, &volume.level, volumeName,
+			&volume.min[0], &volume.min[1], &volume.min[2], &volume.max[0], &volume.max[1], &volume.max[2]);
+
+		bool ok = false;
+		if (read == 9)
+			volume.kind = KindFromName(kindName, ok);
+
+		if (!ok)
+		{
+			printf("TriggerSystem: %s line %d isn't a volume, skipping it\n", name, lineNumber);
+			continue;
+		}
+
+		volume.name = volumeName;
+		volumes.push_back(volume);
+	}
+
+	fclose(file);
+
+	Build();
+	return true;
+}
+
+void TriggerSystem::Add(const TriggerVolume &volume)
+{
+	volumes.push_back(volume);
+}
+
+void TriggerSystem::Clear()
+{
+	volumes.clear();
+	nodes.clear();
+	order.clear();
+	inside.clear();
+	events.clear();
+}
+
+int TriggerSystem::NumVolumes() const
+{
+	return (int)volumes.size();
+}
+
+const TriggerVolume &TriggerSystem::Volume(int index) const
+{
+	return volumes[index];
+}
+
+void TriggerSystem::Build()
+{
+	nodes.clear();
+	order.resize(volumes.size());
+	for (size_t i = 0; i < volumes.size(); i++)
+		order[i] = (int)i;
+
+	// A tree over n volumes has at most 2n nodes
+	nodes.reserve(volumes.size() * 2 + 1);
+
+	if (!volumes.empty())
+		BuildNode(0, (int)volumes.size());
+
+	inside.clear();
+}
+
+int TriggerSystem::BuildNode(int first, int count)
+{
+	int index = (int)nodes.size();
+	nodes.push_back(Node());
+
+	// The box around every volume in the range
+	Node node;
+	for (int k = 0; k < 3; k++)
+	{
+		node.min[k] = volumes[order[first]].min[k];
+		node.max[k] = volumes[order[first]].max[k];
+	}
+	for (int i = first + 1; i < first + count; i++)
+	{
+		const TriggerVolume &v = volumes[order[i]];
+		for (int k = 0; k < 3; k++)
+		{
+			if (v.min[k] < node.min[k]) node.min[k] = v.min[k];
+			if (v.max[k] > node.max[k]) node.max[k] = v.max[k];
+		}
+	}
+
+	node.left = -1;
+	node.right = -1;
+	node.first = first;
+	node.count = count;
+
+	if (count > LEAF_SIZE)
+	{
+		// Split at the median center along the longest side
+		int axis = 0;
+		for (int k = 1; k < 3; k++)
+		{
+			if (node.max[k] - node.min[k] > node.max[axis] - node.min[axis])
+				axis = k;
+		}
+
+		int half = count / 2;
+		std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+			[&](int a, int b) {
+				return volumes[a].min[axis] + volumes[a].max[axis] < volumes[b].min[axis] + volumes[b].max[axis];
+			});
+
+		node.left = BuildNode(first, half);
+		node.right = BuildNode(first + half, count - half);
+	}
+
+	nodes[index] = node;
+	return index;
+}
+
+bool TriggerSystem::Walk(const float *min, const float *max, int level, VolumeKind kind, std::vector<int> *found) const
+{
+	if (nodes.empty())
+		return false;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node &node = nodes[stack[--top]];
+
+		if (min[0] > node.max[0] || max[0] < node.min[0] ||
+			min[1] > node.max[1] || max[1] < node.min[1] ||
+			min[2] > node.max[2] || max[2] < node.min[2])
+			continue;
+
+		if (node.left >= 0)
+		{
+			stack[top++] = node.right;
+			stack[top++] = node.left;
+			continue;
+		}
+
+		for (int i = node.first; i < node.first + node.count; i++)
+		{
+			const TriggerVolume &v = volumes[order[i]];
+			if (v.level != level)
+				continue;
+			if (kind != VOLUME_KIND_COUNT && v.kind != kind)
+				continue;
+
+			if (min[0] > v.max[0] || max[0] < v.min[0] ||
+				min[1] > v.max[1] || max[1] < v.min[1] ||
+				min[2] > v.max[2] || max[2] < v.min[2])
+				continue;
+
+			// Without a list to fill the first one is the answer
+			if (!found)
+				return true;
+			found->push_back(order[i]);
+		}
+	}
+
+	return found && !found->empty();
+}
+
+void TriggerSystem::QueryBox(const float *min, const float *max, int level, std::vector<int> &found) const
+{
+	Walk(min, max, level, VOLUME_KIND_COUNT, &found);
+}
+
+void TriggerSystem::Query(float x, float y, float z, int level, std::vector<int> &found) const
+{
+	float point[3] = { x, y, z };
+	QueryBox(point, point, level, found);
+}
+
+bool TriggerSystem::Overlaps(float x, float y, float z, int level, VolumeKind kind) const
+{
+	// Called for every spawn candidate, so it stops at the first hit and allocates nothing
+	float point[3] = { x, y, z };
+	return Walk(point, point, level, kind, 0);
+}
+
+void TriggerSystem::Update(float x, float y, float z, int level)
+{
+	current.clear();
+	Query(x, y, z, level, current);
+	std::sort(current.begin(), current.end());
+
+	// Walk both sorted lists together: only in current is an enter, only in inside is an exit
+	size_t a = 0, b = 0;
+	while (a < current.size() || b < inside.size())
+	{
+		TriggerEvent event;
+
+		if (b == inside.size() || (a < current.size() && current[a] < inside[b]))
+		{
+			event.type = TRIGGER_ENTER;
+			event.index = current[a++];
+		}
+		else if (a == current.size() || inside[b] < current[a])
+		{
+			event.type = TRIGGER_EXIT;
+			event.index = inside[b++];
+		}
+		else
+		{
+			event.type = TRIGGER_STAY;
+			event.index = current[a++];
+			b++;
+		}
+
+		event.volume = &volumes[event.index];
+		events.push_back(event);
+	}
+
+	inside.swap(current);
+}
+
+void TriggerSystem::Dispatch()
+{
+	// Hand them out a kind at a time, in the order they happened within a kind
+	std::stable_sort(events.begin(), events.end(), [](const TriggerEvent &a, const TriggerEvent &b) {
+		return a.volume->kind < b.volume->kind;
+	});
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const Handler &handler = handlers[events[i].volume->kind];
+		if (handler)
+			handler(events[i]);
+	}
+
+	events.clear();
+}
+
+void TriggerSystem::Reset()
+{
+	inside.clear();
+	events.clear();
+}
+
+void TriggerSystem::SetHandler(VolumeKind kind, Handler handler)
+{
+	handlers[kind] = handler;
+}
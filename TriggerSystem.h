@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Trigger Volumes
+//
+// TriggerSystem.h: interface for the TriggerSystem class.
+// This class holds every box in the level that does something
+// when the player is inside it: walls the player bumps into,
+// collectables, the cave entrance, places nothing may spawn.
+// The boxes come from a text file so new ones can be added
+// without recompiling.
+//
+// Every line of the file is one volume:
+//
+// kind level name minX minY minZ maxX maxY maxZ
+//
+// kind is obstacle, collect, exit or nospawn, level is 1 (the
+// desert) or 2 (the cave) and name is whatever the game wants to
+// know the volume by. Lines starting with # are comments. Bounds
+// are inclusive, so minY = maxY = 0 means "only on the ground".
+//
+// The volumes are put in a bounding volume hierarchy once they
+// are loaded, so a query only opens the boxes around the point.
+//
+// Update() works out which volumes the player is in and compares
+// that with last time to make enter, stay and exit events. The
+// events are kept until Dispatch(), which hands them out grouped
+// by kind to the handler registered for that kind.
+//
+// Usage:
+// TriggerSystem triggers;
+//
+// triggers.Load("levels/triggers.txt");
+// triggers.SetHandler(VOLUME_COLLECT, onCollect);	// void onCollect(const TriggerEvent&)
+//
+// triggers.Update(x, y, z, level);			// Every tick
+// triggers.Dispatch();						// Calls the handlers
+//
+// if (triggers.Overlaps(x, y, z, level, VOLUME_OBSTACLE)) ...	// Straight query
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TRIGGERSYSTEM_H
+#define TRIGGERSYSTEM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// What a volume is for
+enum VolumeKind {
+	VOLUME_OBSTACLE,	// The player can't walk into it
+	VOLUME_COLLECT,		// Something to pick up
+	VOLUME_EXIT,		// Takes the player to the next level
+	VOLUME_NOSPAWN,		// Nothing may be spawned in it
+	VOLUME_KIND_COUNT
+};
+
+// What happened to a volume
+enum TriggerEventType {
+	TRIGGER_ENTER,		// The player just walked in
+	TRIGGER_STAY,		// The player was already inside
+	TRIGGER_EXIT		// The player just left
+};
+
+// One box in the level
+struct TriggerVolume {
+	VolumeKind kind;
+	int level;			// The level it belongs to
+	std::string name;	// What the game knows it by
+	float min[3];		// The box
+	float max[3];
+};
+
+// One event handed to a handler
+struct TriggerEvent {
+	TriggerEventType type;
+	const TriggerVolume *volume;
+	int index;			// The volume's index in the system
+};
+
+class TriggerSystem
+{
+public:
+	typedef std::function<void(const TriggerEvent &)> Handler;
+
+	bool Load(const char *name);		// Reads the volumes from a file and builds the tree
+	void Add(const TriggerVolume &volume);	// Adds a volume (call Build() once they are all in)
+	void Build();						// Builds the tree over the volumes
+	void Clear();						// Forgets every volume
+	int NumVolumes() const;
+	const TriggerVolume &Volume(int index) const;
+
+	void SetHandler(VolumeKind kind, Handler handler);	// Who gets the events of a kind
+	// Works out the enter, stay and exit events for the player at (x, y, z)
+	void Update(float x, float y, float z, int level);
+	void Dispatch();					// Hands the queued events out and clears them
+	void Reset();						// Forgets which volumes the player was in
+
+	// True if the point is in any volume of that kind on that level
+	bool Overlaps(float x, float y, float z, int level, VolumeKind kind) const;
+	// Adds the index of every volume on that level holding the point to found
+	void Query(float x, float y, float z, int level, std::vector<int> &found) const;
+	// Adds the index of every volume on that level touching the box to found
+	void QueryBox(const float *min, const float *max, int level, std::vector<int> &found) const;
+
+	TriggerSystem();					// Constructor
+	virtual ~TriggerSystem();			// Destructor
+
+private:
+	// A node of the tree: either two children or a run of volumes
+	struct Node {
+		float min[3];
+		float max[3];
+		int left;		// The children, -1 for a leaf
+		int right;
+		int first;		// First entry in order (leaves only)
+		int count;		// Volumes in the leaf
+	};
+
+	int BuildNode(int first, int count);	// Builds the subtree over order[first..first+count)
+	// Visits the volumes of a kind (VOLUME_KIND_COUNT: any) on that level touching the box, adding them
+	// to found, or without found stops at the first one. True if there was one
+	bool Walk(const float *min, const float *max, int level, VolumeKind kind, std::vector<int> *found) const;
+	static VolumeKind KindFromName(const char *name, bool &ok);
+
+	std::vector<TriggerVolume> volumes;
+	std::vector<Node> nodes;
+	std::vector<int> order;				// Volume indices as the leaves reference them
+	std::vector<int> inside;			// Volumes the player was in last Update() (sorted)
+	std::vector<int> current;			// Scratch for Update()
+	std::vector<TriggerEvent> events;	// Waiting for Dispatch()
+	Handler handlers[VOLUME_KIND_COUNT];
+};
+
+#endif // TRIGGERSYSTEM_H
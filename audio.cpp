@@ -1,137 +1,236 @@
 #include "audio.h"
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
 Audio::Audio()
 {
     BasePath = "";
-    hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-    if (FAILED(hr))
-        cout << hr;
-    pXAudio2 = nullptr;
-    if (FAILED(hr = XAudio2Create(&pXAudio2, 0, XAUDIO2_DEFAULT_PROCESSOR)))
-        cout << hr;
-
-    pMasterVoice = nullptr;
-    if (FAILED(hr = pXAudio2->CreateMasteringVoice(&pMasterVoice)))
-        cout << hr;
+    Muted = false;
+    sink = AudioSink::OpenDefault(mixer.Rate());
+    block.resize(AudioMixer::BLOCK_FRAMES * 2);
+    stop = false;
+    thread = std::thread(&Audio::MixLoop, this);
 }
-int Audio::Play(string path, float volume, bool ShouldLoop) {
-    path = BasePath + "\\" + path;
-    WAVEFORMATEXTENSIBLE wfx = { 0 };
-    XAUDIO2_BUFFER buffer = { 0 };
-#ifdef _XBOX
-    char* strFileName = path;
-#else
-    TCHAR* strFileName = new TCHAR[path.size() + 1];
-    strFileName[path.size()] = 0;
-    std::copy(path.begin(), path.end(), strFileName);
-#endif
-    // Open the file
-    HANDLE hFile = CreateFile(
-        strFileName,
-        GENERIC_READ,
-        FILE_SHARE_READ,
-        NULL,
-        OPEN_EXISTING,
-        0,
-        NULL);
-
-    if (INVALID_HANDLE_VALUE == hFile)
-        return HRESULT_FROM_WIN32(GetLastError());
-
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, 0, NULL, FILE_BEGIN))
-        return HRESULT_FROM_WIN32(GetLastError());
-    DWORD dwChunkSize;
-    DWORD dwChunkPosition;
-    //check the file type, should be fourccWAVE or 'XWMA'
-    FindChunk(hFile, fourccRIFF, dwChunkSize, dwChunkPosition);
-    DWORD filetype;
-    ReadChunkData(hFile, &filetype, sizeof(DWORD), dwChunkPosition);
+Audio::~Audio()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    wake.notify_one();
+    thread.join();
+
+    // The sink may still be reading from what was written to it, and the voices from the sounds
+    mixer.StopAll();
+    delete sink;
+    for (size_t i = 0; i < sounds.size(); i++)
+        delete sounds[i];
+    for (size_t i = 0; i < streams.size(); i++)
+        delete streams[i];
+}
+bool Audio::SetSink(AudioSink* sink) {
+    if (!sink->Open(mixer.Rate())) {
+        delete sink;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    delete this->sink;
+    this->sink = sink;
+    return true;
+}
+bool Audio::Load(const char* name) {
+    if (Find(name))
+        return true;
+
+    // The whole file in one read, the chunks are found in memory
+    string path = BasePath.empty() ? string(name) : BasePath + "/" + name;
+    FILE* hFile = fopen(path.c_str(), "rb");
+    if (!hFile)
+        return false;
+
+    vector<unsigned char> file;
+    fseek(hFile, 0, SEEK_END);
+    long size = ftell(hFile);
+    fseek(hFile, 0, SEEK_SET);
+    if (size > 12) {
+        file.resize(size);
+        file.resize(fread(&file[0], 1, file.size(), hFile));
+    }
+    fclose(hFile);
+
+    //check the file type, should be fourccWAVE
+    unsigned int dwChunkSize;
+    unsigned int dwChunkPosition;
+    unsigned int filetype = 0;
+    if (!FindChunk(file, fourccRIFF, dwChunkSize, dwChunkPosition))
+        return false;
+    memcpy(&filetype, &file[dwChunkPosition], 4);
     if (filetype != fourccWAVE)
-        return S_FALSE;
-
-    FindChunk(hFile, fourccFMT, dwChunkSize, dwChunkPosition);
-    ReadChunkData(hFile, &wfx, dwChunkSize, dwChunkPosition);
-    FindChunk(hFile, fourccDATA, dwChunkSize, dwChunkPosition);
-    BYTE* pDataBuffer = new BYTE[dwChunkSize];
-    ReadChunkData(hFile, pDataBuffer, dwChunkSize, dwChunkPosition);
-
-    buffer.AudioBytes = dwChunkSize;  // size of the audio buffer in bytes
-    buffer.pAudioData = pDataBuffer;  // buffer containing audio data
-    buffer.Flags = XAUDIO2_END_OF_STREAM; // tell the source voice not to expect any data after this buffer
-    if (ShouldLoop) buffer.LoopCount = XAUDIO2_LOOP_INFINITE;
-    IXAudio2SourceVoice* pSourceVoice;
-    if (FAILED(hr = pXAudio2->CreateSourceVoice(&pSourceVoice, (WAVEFORMATEX*)&wfx))) cout << hr;
-    //if (FAILED(hr = pSourceVoice->SetSourceSampleRate(20000))) cout << hr;
-    if (FAILED(hr = pSourceVoice->SubmitSourceBuffer(&buffer))) cout << hr;
-    //if (FAILED(hr = pSourceVoice->SetFrequencyRatio(1.2))) cout << hr;
-    pSourceVoice->SetVolume(volume);
-    if (FAILED(hr = pSourceVoice->Start(0)))
-        cout << hr;
+        return false;
+
+    // The format: PCM (8, 16, 24 or 32 bit) or float, mono or stereo
+    AudioStream::Format format;
+    if (!FindChunk(file, fourccFMT, dwChunkSize, dwChunkPosition) || !AudioStream::ParseFormat(&file[dwChunkPosition], dwChunkSize, format))
+        return false;
+
+    if (!FindChunk(file, fourccDATA, dwChunkSize, dwChunkPosition))
+        return false;
+    int count = dwChunkSize / (format.bits / 8 * format.channels) * format.channels;
+    if (count == 0)
+        return false;
+
+    // Every sample to a float from -1 to 1
+    Sound* sound = new Sound();
+    sound->name = name;
+    sound->clip.rate = format.rate;
+    sound->clip.channels = format.channels;
+    sound->clip.frames = count / format.channels;
+    sound->clip.samples.resize(count);
+    AudioStream::Decode(&file[dwChunkPosition], count, format, &sound->clip.samples[0]);
+
+    sounds.push_back(sound);
+    return true;
+}
+int Audio::Play(const char* name, float volume, bool ShouldLoop) {
+    if (Muted)
+        return 0;
+
+    // Sounds that weren't loaded ahead of time are loaded now, once
+    const Sound* sound = Find(name);
+    if (!sound) {
+        if (!Load(name))
+            return 1;
+        sound = Find(name);
+    }
 
+    std::lock_guard<std::mutex> guard(lock);
+    if (mixer.Play(&sound->clip, volume, ShouldLoop) < 0)
+        return 1;
     return 0;
 }
+int Audio::PlayStream(const char* name, float volume, bool ShouldLoop) {
+    if (Muted)
+        return 0;
+
+    // Only the header is read here, the stream's thread reads the rest as it's played
+    string path = BasePath.empty() ? string(name) : BasePath + "/" + name;
+    AudioStream* stream = new AudioStream();
+    if (!stream->Open(path.c_str(), ShouldLoop)) {
+        delete stream;
+        return 1;
+    }
 
+    int voice;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        voice = mixer.Play(stream, volume);
+    }
+    if (voice < 0) {
+        delete stream;
+        return 1;
+    }
+    streams.push_back(stream);
+    return 0;
+}
+void Audio::Update() {
+    // Streams that have played to the end (or were cut short), deleted without the lock since that joins their threads
+    vector<AudioStream*> done;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < streams.size(); ) {
+            if (mixer.IsPlaying(streams[i])) {
+                i++;
+                continue;
+            }
+            done.push_back(streams[i]);
+            streams.erase(streams.begin() + i);
+        }
+    }
+    for (size_t i = 0; i < done.size(); i++)
+        delete done[i];
+}
+void Audio::MixLoop() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stop) {
+        int frames = sink ? sink->Writable() : 0;
+        while (frames > 0) {
+            int n = frames < AudioMixer::BLOCK_FRAMES ? frames : AudioMixer::BLOCK_FRAMES;
+            mixer.Mix(&block[0], n);
+            sink->Write(&block[0], n);
+            frames -= n;
+        }
 
-HRESULT Audio::FindChunk(HANDLE hFile, DWORD fourcc, DWORD& dwChunkSize, DWORD& dwChunkDataPosition)
+        // A sink buffer is 10 ms, so looking twice as often keeps it full
+        wake.wait_for(guard, std::chrono::milliseconds(5));
+    }
+}
+int Audio::Sounds() const {
+    return (int)sounds.size();
+}
+int Audio::Voices() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return mixer.Playing();
+}
+int Audio::Streams() const {
+    return (int)streams.size();
+}
+AudioMixer::Stats Audio::MixerStats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return mixer.stats;
+}
+
+
+// Names are compared ignoring case, the way Windows finds the files
+static bool SameName(const char* a, const char* b)
 {
-    HRESULT hr = S_OK;
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, 0, NULL, FILE_BEGIN))
-        return HRESULT_FROM_WIN32(GetLastError());
-
-    DWORD dwChunkType;
-    DWORD dwChunkDataSize;
-    DWORD dwRIFFDataSize = 0;
-    DWORD dwFileType;
-    DWORD bytesRead = 0;
-    DWORD dwOffset = 0;
-
-    while (hr == S_OK)
-    {
-        DWORD dwRead;
-        if (0 == ReadFile(hFile, &dwChunkType, sizeof(DWORD), &dwRead, NULL))
-            hr = HRESULT_FROM_WIN32(GetLastError());
+    for (; *a && *b; a++, b++) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b))
+            return false;
+    }
+    return *a == *b;
+}
+const Audio::Sound* Audio::Find(const char* name) const
+{
+    for (size_t i = 0; i < sounds.size(); i++) {
+        if (SameName(sounds[i]->name.c_str(), name))
+            return sounds[i];
+    }
+    return NULL;
+}
 
-        if (0 == ReadFile(hFile, &dwChunkDataSize, sizeof(DWORD), &dwRead, NULL))
-            hr = HRESULT_FROM_WIN32(GetLastError());
 
-        switch (dwChunkType)
-        {
-        case fourccRIFF:
-            dwRIFFDataSize = dwChunkDataSize;
-            dwChunkDataSize = 4;
-            if (0 == ReadFile(hFile, &dwFileType, sizeof(DWORD), &dwRead, NULL))
-                hr = HRESULT_FROM_WIN32(GetLastError());
-            break;
+bool Audio::FindChunk(const vector<unsigned char>& file, unsigned int fourcc, unsigned int& dwChunkSize, unsigned int& dwChunkDataPosition)
+{
+    unsigned int dwOffset = 0;
 
-        default:
-            if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, dwChunkDataSize, NULL, FILE_CURRENT))
-                return HRESULT_FROM_WIN32(GetLastError());
-        }
+    while ((size_t)dwOffset + 8 <= file.size())
+    {
+        unsigned int dwChunkType;
+        unsigned int dwChunkDataSize;
+        memcpy(&dwChunkType, &file[dwOffset], 4);
+        memcpy(&dwChunkDataSize, &file[dwOffset + 4], 4);
 
-        dwOffset += sizeof(DWORD) * 2;
+        // The RIFF chunk holds the others, only its file type is stepped over
+        if (dwChunkType == fourccRIFF)
+            dwChunkDataSize = 4;
+
+        dwOffset += 8;
 
         if (dwChunkType == fourcc)
         {
+            if ((size_t)dwOffset + dwChunkDataSize > file.size())
+                return false;
             dwChunkSize = dwChunkDataSize;
             dwChunkDataPosition = dwOffset;
-            return S_OK;
+            return true;
         }
 
-        dwOffset += dwChunkDataSize;
-
-        if (bytesRead >= dwRIFFDataSize) return S_FALSE;
-
+        // Chunks start on even bytes
+        dwOffset += dwChunkDataSize + (dwChunkDataSize & 1);
     }
 
-    return S_OK;
+    return false;
 
 }
-HRESULT Audio::ReadChunkData(HANDLE hFile, void* buffer, DWORD buffersize, DWORD bufferoffset)
-{
-    HRESULT hr = S_OK;
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, bufferoffset, NULL, FILE_BEGIN))
-        return HRESULT_FROM_WIN32(GetLastError());
-    DWORD dwRead;
-    if (0 == ReadFile(hFile, buffer, buffersize, &dwRead, NULL))
-        hr = HRESULT_FROM_WIN32(GetLastError());
-    return hr;
-}
\ No newline at end of file
@@ -1,10 +1,16 @@
 #pragma once
 #pragma once
-#include <xaudio2.h>
+#include "AudioMixer.h"
+#include "AudioSink.h"
+#include "AudioStream.h"
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 using namespace std;
-#ifdef _XBOX 
+#ifdef _XBOX
 #define fourccRIFF 'RIFF'
 #define fourccDATA 'data'
 #define fourccFMT 'fmt '
@@ -21,16 +27,53 @@ using namespace std;
 #define fourccXWMA 'AMWX'
 #define fourccDPDS 'sdpd'
 #endif
+// Every sound is loaded into memory once (Load(), or the first Play()
+// of one that wasn't), as floats, and played by an AudioMixer: Play()
+// starts one of its voices on the sound, so it reads no file and
+// allocates nothing. Long sounds (the music) are better streamed:
+// PlayStream() reads only the header and the stream's own thread
+// reads the rest a block at a time as it's played, looping without
+// a gap if asked to. A thread of the Audio's own mixes as much as
+// the sink has room for every few milliseconds and hands it over,
+// so a long frame (loading the cave, a model) doesn't starve the
+// sink the way mixing once a frame did. The mixer and the sink are
+// only touched with the lock held. Update() (once a frame) lets go
+// of the streams that have finished. The sink is XAudio2 on Windows
+// and a NullSink anywhere else, unless SetSink() gives it another
+// one (a WavFileSink to record what's played).
 class Audio
 {
 private:
-    HRESULT hr;
-    IXAudio2* pXAudio2;
-    IXAudio2MasteringVoice* pMasterVoice;
-    HRESULT FindChunk(HANDLE hFile, DWORD fourcc, DWORD& dwChunkSize, DWORD& dwChunkDataPosition);
-    HRESULT ReadChunkData(HANDLE hFile, void* buffer, DWORD buffersize, DWORD bufferoffset);
+    // A sound in memory
+    struct Sound {
+        string name;
+        AudioMixer::Clip clip;  // What the mixer's voices play from
+    };
+
+    AudioMixer mixer;
+    AudioSink* sink;
+    vector<Sound*> sounds;      // Pointers, so loading more doesn't move the clips the voices are playing
+    vector<AudioStream*> streams;   // Playing, deleted by Update() when they're done
+    vector<short> block;        // Mixed samples on their way to the sink
+    std::thread thread;         // Mixes into the sink
+    mutable std::mutex lock;    // Held around everything the thread touches (the mixer and the sink)
+    std::condition_variable wake;
+    bool stop;
+    void MixLoop();             // The thread: mixes what the sink has room for until stopped
+    static bool FindChunk(const vector<unsigned char>& file, unsigned int fourcc, unsigned int& dwChunkSize, unsigned int& dwChunkDataPosition);
+    const Sound* Find(const char* name) const;  // The loaded sound, 0 if it isn't loaded
 public:
     Audio();
-    int Play(string path, float volume = 1, bool ShouldLoop = false); // plays the audio file with specified volume and can be looped
+    ~Audio();
+    bool SetSink(AudioSink* sink); // opens it and sends the sound there from now on (it's deleted with the Audio), false if it can't be opened (and it's deleted now)
+    bool Load(const char* name); // loads a .wav file (from BasePath) into memory so Play() doesn't have to, false if it can't be read
+    int Play(const char* name, float volume = 1, bool ShouldLoop = false); // plays the audio file with specified volume and can be looped, 0 if it's playing
+    int PlayStream(const char* name, float volume = 1, bool ShouldLoop = false); // the same, but read from the file as it plays (for music), 0 if it's playing
+    void Update(); // deletes the streams that have finished, call it once a frame
+    int Sounds() const; // Sounds loaded
+    int Voices() const; // Voices playing
+    int Streams() const; // Streams playing
+    AudioMixer::Stats MixerStats() const; // a copy, the thread keeps changing them
+    bool Muted; // When true Play() does nothing (used while replaying a recorded session)
     string BasePath; // Directory where all audio files (relevant to project) are stored i.e if all audio files are stored in "D:\game" than set BasePath to "D:\game", this will be automatically added in path of every audio file
-};
\ No newline at end of file
+};